@@ -0,0 +1,725 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* loopback benchmark - starts a server in-process, and then hammers it from
+   a set of epoll driven client threads, one scenario at a time.
+   a human readable table goes to stderr, and the results as JSON to stdout
+   (or the file given with -o) so that runs can be compared between commits */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <httpd.h>
+
+#define MAX_PIPELINE 64
+#define RX_CHUNK     65536
+#define HDR_MAX      8192
+
+#define LARGE_SIZE   (256 * 1024)
+#define UPLOAD_SIZE  (64 * 1024)
+
+struct scenario {
+	const char *name;
+	const char *method;
+	const char *uri;
+	size_t bodyLen;
+	int keepalive;
+	int pipeline;
+};
+
+struct scenario scenarioList[] = {
+	{ "get_small_close",     "GET",  "/small",  0,           0, 1 },
+	{ "get_small_keepalive", "GET",  "/small",  0,           1, 1 },
+	{ "get_large",           "GET",  "/large",  0,           0, 1 },
+	{ "post_upload",         "POST", "/upload", UPLOAD_SIZE, 0, 1 },
+	{ "get_small_pipelined", "GET",  "/small",  0,           1, 8 },
+};
+
+/* ########################################################################## */
+
+struct conn {
+	int fd;
+
+	/* the request blob - 'pipeline' copies of the request */
+	size_t txPos;
+
+	/* requests that have been sent, but not yet answered */
+	int outstanding;
+	uint64_t sentAt[MAX_PIPELINE];
+
+	/* response parsing */
+	int inHeaders;
+	char hdr[HDR_MAX];
+	size_t hdrLen;
+	size_t bodyRemaining;
+	int bodyUntilClose;
+	int status;
+};
+
+struct latencies {
+	uint32_t *us;
+	size_t count;
+	size_t size;
+};
+
+struct worker {
+	pthread_t tid;
+	int epfd;
+	int nconns;
+	struct conn *conns;
+
+	struct latencies lat;
+	uint64_t completed;
+	uint64_t errors;
+	uint64_t retries;
+	uint64_t connects;
+	uint64_t rxBytes;
+};
+
+struct run {
+	struct scenario *sc;
+	char *tx;
+	size_t txLen;
+
+	int port;
+	int nthreads;
+	int nconns;
+
+	volatile int stop;
+};
+
+static struct run run;
+
+/* ########################################################################## */
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void lat_add(struct latencies *lat, uint64_t ns) {
+	if (lat->count == lat->size) {
+		void *p;
+		size_t n = lat->size ? lat->size * 2 : 65536;
+		if ((p = realloc(lat->us, n * sizeof(*lat->us))) == NULL) return;
+		lat->us = p;
+		lat->size = n;
+	}
+	ns /= 1000;
+	lat->us[lat->count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(struct latencies *lat, double p) {
+	size_t i;
+	if (lat->count == 0) return 0;
+	i = (size_t)(p * (lat->count - 1) + 0.5);
+	return lat->us[i];
+}
+
+/* VmRSS and VmHWM from /proc, in kB - the server is in-process, so this covers both ends */
+static void get_rss(long *rss, long *hwm) {
+	char line[256];
+	FILE *f;
+	*rss = *hwm = -1;
+	if ((f = fopen("/proc/self/status", "r")) == NULL) return;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "VmRSS:", 6)) *rss = atol(&line[6]);
+		if (!strncmp(line, "VmHWM:", 6)) *hwm = atol(&line[6]);
+	}
+	fclose(f);
+}
+
+/* ########################################################################## */
+
+static char content_large[LARGE_SIZE];
+
+int page_small(int rxid, struct session_info *session, char *content, int contentLength) {
+	httpd_addHeader(session, "Content-Type", "text/plain");
+	httpd_respond(session, "Hello, world!\n");
+	return 0;
+}
+int page_large(int rxid, struct session_info *session, char *content, int contentLength) {
+	httpd_addHeader(session, "Content-Type", "application/octet-stream");
+	httpd_nrespond(session, content_large, sizeof(content_large));
+	return 0;
+}
+int page_upload(int rxid, struct session_info *session, char *content, int contentLength) {
+	httpd_addHeader(session, "Content-Type", "text/plain");
+	httpd_respond(session, "%d\n", contentLength);
+	return 0;
+}
+
+int server_callback(int rxid, struct session_info *session, char *content, int contentLength) {
+	char *uri;
+
+	if ((uri = httpd_getURI(session)) == NULL) return 1;
+
+	if (!strcmp(uri, "/small"))  return page_small(rxid, session, content, contentLength);
+	if (!strcmp(uri, "/large"))  return page_large(rxid, session, content, contentLength);
+	if (!strcmp(uri, "/upload")) return page_upload(rxid, session, content, contentLength);
+
+	httpd_setHttpCode(session, 404, NULL);
+	return 0;
+}
+
+/* ########################################################################## */
+
+static void conn_watch(struct worker *w, struct conn *c, int op, uint32_t events) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(w->epfd, op, c->fd, &ev);
+}
+
+static void conn_reset_rx(struct conn *c) {
+	c->inHeaders = 1;
+	c->hdrLen = 0;
+	c->bodyRemaining = 0;
+	c->bodyUntilClose = 0;
+	c->status = 0;
+}
+
+/* opens a new connection, and queues the whole request blob.
+   'keep' requests that went unanswered on a previous connection keep their original timestamps */
+static int conn_open(struct worker *w, struct conn *c, int keep) {
+	struct sockaddr_in addr;
+	uint64_t now;
+	int i;
+
+	if ((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP)) == -1) return -1;
+	i = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(run.port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+		close(c->fd);
+		c->fd = -1;
+		return -1;
+	}
+	w->connects++;
+
+	now = now_ns();
+	for (i = keep; i < run.sc->pipeline; i++) c->sentAt[i] = now;
+	c->outstanding = run.sc->pipeline;
+	c->txPos = 0;
+	conn_reset_rx(c);
+
+	conn_watch(w, c, EPOLL_CTL_ADD, EPOLLOUT);
+	return 0;
+}
+
+static void conn_close(struct worker *w, struct conn *c) {
+	if (c->fd == -1) return;
+	epoll_ctl(w->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/* the connection went away - anything unanswered is sent again on a fresh one */
+static void conn_restart(struct worker *w, struct conn *c) {
+	int keep;
+
+	keep = c->outstanding;
+	conn_close(w, c);
+	if (run.stop) return;
+
+	if (keep > 0) {
+		int done = run.sc->pipeline - keep;
+		w->retries += keep;
+		memmove(&c->sentAt[0], &c->sentAt[done], keep * sizeof(c->sentAt[0]));
+	}
+
+	if (conn_open(w, c, keep) != 0) w->errors++;
+}
+
+static void conn_response_done(struct worker *w, struct conn *c) {
+	int done;
+	uint64_t now = now_ns();
+
+	done = run.sc->pipeline - c->outstanding;
+	lat_add(&w->lat, now - c->sentAt[done]);
+	if (c->status < 200 || c->status > 299) w->errors++;
+	w->completed++;
+	c->outstanding--;
+	conn_reset_rx(c);
+
+	if (c->outstanding > 0) return;
+
+	/* the whole batch was answered */
+	if (run.stop) {
+		conn_close(w, c);
+	} else if (run.sc->keepalive) {
+		int i;
+		for (i = 0; i < run.sc->pipeline; i++) c->sentAt[i] = now;
+		c->outstanding = run.sc->pipeline;
+		c->txPos = 0;
+		conn_watch(w, c, EPOLL_CTL_MOD, EPOLLOUT);
+	} else {
+		conn_close(w, c);
+		if (conn_open(w, c, 0) != 0) w->errors++;
+	}
+}
+
+static int conn_parse_headers(struct conn *c) {
+	char *p, *eoh;
+
+	c->hdr[c->hdrLen] = '\0';
+	if ((eoh = strstr(c->hdr, "\r\n\r\n")) == NULL) return 0;
+
+	if (sscanf(c->hdr, "HTTP/%*d.%*d %d", &c->status) != 1) c->status = 0;
+
+	c->bodyUntilClose = 1;
+	for (p = strstr(c->hdr, "\r\n"); p && p < eoh; p = strstr(p + 2, "\r\n")) {
+		if (strncasecmp(p + 2, "Content-Length:", 15)) continue;
+		c->bodyRemaining = strtoul(p + 17, NULL, 10);
+		c->bodyUntilClose = 0;
+		break;
+	}
+
+	c->inHeaders = 0;
+	return (eoh + 4) - c->hdr;
+}
+
+/* returns non-zero if the connection should be dropped */
+static int conn_consume(struct worker *w, struct conn *c, char *data, size_t len) {
+	while (len > 0 && c->outstanding > 0) {
+		if (c->inHeaders) {
+			size_t n, used, prev;
+
+			prev = c->hdrLen;
+			n = len;
+			if (n > HDR_MAX - 1 - prev) n = HDR_MAX - 1 - prev;
+			memcpy(&c->hdr[prev], data, n);
+			c->hdrLen += n;
+
+			if ((used = conn_parse_headers(c)) == 0) {
+				if (c->hdrLen >= HDR_MAX - 1) { w->errors++; return -1; }
+				return 0;
+			}
+			used -= prev;
+			data += used;
+			len -= used;
+
+			if (!c->bodyUntilClose && c->bodyRemaining == 0) {
+				conn_response_done(w, c);
+				if (c->txPos < run.txLen) return 0;
+			}
+			continue;
+		}
+
+		if (c->bodyUntilClose) return 0;
+
+		if (len >= c->bodyRemaining) {
+			data += c->bodyRemaining;
+			len -= c->bodyRemaining;
+			c->bodyRemaining = 0;
+			conn_response_done(w, c);
+			if (c->txPos < run.txLen) return 0;
+		} else {
+			c->bodyRemaining -= len;
+			len = 0;
+		}
+	}
+	return 0;
+}
+
+static void conn_event(struct worker *w, struct conn *c, uint32_t events, char *rxbuf) {
+	ssize_t l;
+
+	if (c->txPos < run.txLen) {
+		if (events & (EPOLLERR | EPOLLHUP)) goto restart;
+
+		while (c->txPos < run.txLen) {
+			if ((l = send(c->fd, &run.tx[c->txPos], run.txLen - c->txPos, MSG_NOSIGNAL)) > 0) {
+				c->txPos += l;
+				continue;
+			}
+			if (l == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+			goto restart;
+		}
+		conn_watch(w, c, EPOLL_CTL_MOD, EPOLLIN);
+		return;
+	}
+
+	for (;;) {
+		if ((l = recv(c->fd, rxbuf, RX_CHUNK, 0)) > 0) {
+			w->rxBytes += l;
+			if (conn_consume(w, c, rxbuf, l) != 0) goto restart;
+			if (c->fd == -1 || c->txPos < run.txLen) return;
+			continue;
+		}
+		if (l == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+		break;
+	}
+
+	/* EOF or error - a response without a length finishes here */
+	if (c->outstanding > 0 && !c->inHeaders && c->bodyUntilClose) {
+		conn_response_done(w, c);
+		if (c->fd == -1) return;
+	}
+
+restart:
+	conn_restart(w, c);
+}
+
+void *worker_thread(void *arg) {
+	struct worker *w = arg;
+	struct epoll_event evs[256];
+	char *rxbuf;
+	int i, n;
+
+	if ((rxbuf = malloc(RX_CHUNK)) == NULL) return NULL;
+
+	for (i = 0; i < w->nconns; i++) {
+		w->conns[i].fd = -1;
+		if (conn_open(w, &w->conns[i], 0) != 0) w->errors++;
+	}
+
+	while (!run.stop) {
+		if ((n = epoll_wait(w->epfd, evs, sizeof(evs) / sizeof(*evs), 100)) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			struct conn *c = evs[i].data.ptr;
+			if (c->fd == -1) continue;
+			conn_event(w, c, evs[i].events, rxbuf);
+		}
+	}
+
+	for (i = 0; i < w->nconns; i++) conn_close(w, &w->conns[i]);
+	free(rxbuf);
+
+	return NULL;
+}
+
+/* ########################################################################## */
+
+static int build_request(struct scenario *sc) {
+	char head[512];
+	size_t headLen, oneLen;
+	int i;
+
+	headLen = snprintf(head, sizeof(head),
+	                   "%s %s HTTP/1.1\r\n"
+	                   "Host: 127.0.0.1:%d\r\n"
+	                   "Connection: %s\r\n",
+	                   sc->method, sc->uri, run.port, sc->keepalive ? "keep-alive" : "close");
+	if (sc->bodyLen > 0) {
+		headLen += snprintf(&head[headLen], sizeof(head) - headLen, "Content-Length: %zu\r\n", sc->bodyLen);
+	}
+	headLen += snprintf(&head[headLen], sizeof(head) - headLen, "\r\n");
+
+	oneLen = headLen + sc->bodyLen;
+	run.txLen = oneLen * sc->pipeline;
+	if ((run.tx = malloc(run.txLen)) == NULL) return -1;
+
+	for (i = 0; i < sc->pipeline; i++) {
+		memcpy(&run.tx[i * oneLen], head, headLen);
+		memset(&run.tx[i * oneLen + headLen], 'x', sc->bodyLen);
+	}
+
+	return 0;
+}
+
+struct result {
+	const char *name;
+	double seconds;
+	uint64_t completed;
+	uint64_t errors;
+	uint64_t retries;
+	uint64_t connects;
+	uint64_t rxBytes;
+	double rps;
+	uint32_t p50, p99, p999, max;
+	double mean;
+	long rss, hwm;
+	
+	/* the library's own allocations, from httpd_getMemStats() */
+	double allocsPerReq;
+	double bytesPerReq;
+	long long memPeak;
+};
+
+static int run_scenario(struct scenario *sc, int seconds, struct result *res) {
+	struct httpd_memStats memBefore, memAfter;
+	struct worker *workers;
+	struct latencies all;
+	uint64_t start;
+	int i, j, per, extra;
+
+	memset(res, 0, sizeof(*res));
+	res->name = sc->name;
+
+	run.sc = sc;
+	run.stop = 0;
+	if (build_request(sc) != 0) return -1;
+
+	if ((workers = calloc(run.nthreads, sizeof(*workers))) == NULL) return -1;
+
+	per = run.nconns / run.nthreads;
+	extra = run.nconns % run.nthreads;
+
+	httpd_getMemStats(HTTPD_MEM_COUNT, &memBefore);
+	start = now_ns();
+	for (i = 0; i < run.nthreads; i++) {
+		struct worker *w = &workers[i];
+		w->nconns = per + (i < extra ? 1 : 0);
+		if (w->nconns == 0) continue;
+		w->conns = calloc(w->nconns, sizeof(*w->conns));
+		w->epfd = epoll_create1(0);
+		pthread_create(&w->tid, NULL, worker_thread, w);
+	}
+
+	sleep(seconds);
+	run.stop = 1;
+
+	memset(&all, 0, sizeof(all));
+	for (i = 0; i < run.nthreads; i++) {
+		struct worker *w = &workers[i];
+		if (w->nconns == 0) continue;
+		pthread_join(w->tid, NULL);
+		close(w->epfd);
+
+		res->completed += w->completed;
+		res->errors += w->errors;
+		res->retries += w->retries;
+		res->connects += w->connects;
+		res->rxBytes += w->rxBytes;
+
+		for (j = 0; j < (int)w->lat.count; j++) lat_add(&all, (uint64_t)w->lat.us[j] * 1000);
+		free(w->lat.us);
+		free(w->conns);
+	}
+	res->seconds = (now_ns() - start) / 1e9;
+	free(workers);
+	free(run.tx);
+	run.tx = NULL;
+
+	if (all.count > 0) {
+		double sum = 0;
+		qsort(all.us, all.count, sizeof(*all.us), cmp_u32);
+		for (j = 0; j < (int)all.count; j++) sum += all.us[j];
+		res->mean = sum / all.count;
+		res->p50 = percentile(&all, 0.50);
+		res->p99 = percentile(&all, 0.99);
+		res->p999 = percentile(&all, 0.999);
+		res->max = all.us[all.count - 1];
+	}
+	free(all.us);
+
+	res->rps = res->completed / res->seconds;
+	get_rss(&res->rss, &res->hwm);
+
+	httpd_getMemStats(HTTPD_MEM_COUNT, &memAfter);
+	if (res->completed > 0) {
+		res->allocsPerReq = (double)(memAfter.mallocs + memAfter.reallocs - memBefore.mallocs - memBefore.reallocs) / res->completed;
+		res->bytesPerReq = (double)(memAfter.bytes - memBefore.bytes) / res->completed;
+	}
+	res->memPeak = memAfter.peak;
+
+	return 0;
+}
+
+/* ########################################################################## */
+
+/* ########################################################################## */
+
+static struct {
+	void *(*malloc)(size_t);
+	void *(*realloc)(void *, size_t);
+	void (*free)(void *);
+} dlalloc;
+
+static void *dl_malloc(void *ctx, size_t size)             { return dlalloc.malloc(size); }
+static void *dl_realloc(void *ctx, void *ptr, size_t size) { return dlalloc.realloc(ptr, size); }
+static void  dl_free(void *ctx, void *ptr)                 { dlalloc.free(ptr); }
+
+/* loads an allocator library without interposing it, so only the library's allocations move */
+static int use_allocator(const char *path) {
+	void *dl;
+	hte ret;
+
+	if ((dl = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		return -1;
+	}
+	dlalloc.malloc = dlsym(dl, "malloc");
+	dlalloc.realloc = dlsym(dl, "realloc");
+	dlalloc.free = dlsym(dl, "free");
+	if (!dlalloc.malloc || !dlalloc.realloc || !dlalloc.free) {
+		fprintf(stderr, "%s: doesn't provide malloc/realloc/free\n", path);
+		return -1;
+	}
+
+	if ((ret = httpd_setAllocator(dl_malloc, dl_realloc, dl_free, NULL)) != HTE_NONE) {
+		fprintf(stderr, "httpd_setAllocator() returned %d\n", ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* ########################################################################## */
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-p port] [-t threads] [-c connections] [-d seconds] [-s scenario[,scenario...]] [-a allocator.so] [-l label] [-o results.json]\n", argv0);
+	fprintf(stderr, "  -a    route the library's allocations to malloc/realloc/free from this library (e.g. libjemalloc.so.2)\n");
+	fprintf(stderr, "scenarios:");
+	{
+		int i;
+		for (i = 0; i < (int)(sizeof(scenarioList) / sizeof(*scenarioList)); i++) fprintf(stderr, " %s", scenarioList[i].name);
+	}
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[]) {
+	struct httpd_info *httpd;
+	struct result *results;
+	char *filter = NULL;
+	char *label = "";
+	char *outfile = NULL;
+	char *allocator = NULL;
+	FILE *out;
+	int seconds = 3;
+	int i, n, opt;
+	hte ret;
+
+	run.port = 8089;
+	run.nthreads = 2;
+	run.nconns = 32;
+
+	while ((opt = getopt(argc, argv, "p:t:c:d:s:a:l:o:h")) != -1) {
+		switch (opt) {
+			case 'p': run.port = atoi(optarg);     break;
+			case 't': run.nthreads = atoi(optarg); break;
+			case 'c': run.nconns = atoi(optarg);   break;
+			case 'd': seconds = atoi(optarg);      break;
+			case 's': filter = optarg;             break;
+			case 'l': label = optarg;              break;
+			case 'o': outfile = optarg;            break;
+			case 'a': allocator = optarg;          break;
+			default:  usage(argv[0]);              return 1;
+		}
+	}
+	if (run.nthreads < 1 || run.nconns < 1 || seconds < 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (allocator && use_allocator(allocator) != 0) return 1;
+	memset(content_large, 'L', sizeof(content_large));
+
+	if ((ret = httpd_startServer(&httpd, run.port, server_callback)) != HTE_NONE) {
+		fprintf(stderr, "httpd_startServer() returned %d\n", ret);
+		return 1;
+	}
+
+	n = sizeof(scenarioList) / sizeof(*scenarioList);
+	if ((results = calloc(n, sizeof(*results))) == NULL) return 1;
+
+	fprintf(stderr, "%-22s %10s %8s %8s %10s %10s %10s %10s %9s %10s %10s\n",
+	        "scenario", "req/s", "errors", "retries", "p50(us)", "p99(us)", "p999(us)", "max(us)", "rss(kB)", "allocs/req", "bytes/req");
+
+	for (i = 0; i < n; i++) {
+		struct result *r = &results[i];
+
+		if (filter) {
+			char *p = strstr(filter, scenarioList[i].name);
+			size_t l = strlen(scenarioList[i].name);
+			if (!p || (p != filter && p[-1] != ',') || (p[l] != '\0' && p[l] != ',')) continue;
+		}
+
+		if (run_scenario(&scenarioList[i], seconds, r) != 0) {
+			fprintf(stderr, "%s: failed to run\n", scenarioList[i].name);
+			continue;
+		}
+
+		fprintf(stderr, "%-22s %10.0f %8llu %8llu %10u %10u %10u %10u %9ld %10.1f %10.0f\n",
+		        r->name, r->rps, (unsigned long long)r->errors, (unsigned long long)r->retries,
+		        r->p50, r->p99, r->p999, r->max, r->rss, r->allocsPerReq, r->bytesPerReq);
+	}
+
+	if (outfile) {
+		if ((out = fopen(outfile, "w")) == NULL) {
+			perror(outfile);
+			return 1;
+		}
+	} else {
+		out = stdout;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"label\": \"%s\",\n", label);
+	fprintf(out, "  \"threads\": %d,\n", run.nthreads);
+	fprintf(out, "  \"connections\": %d,\n", run.nconns);
+	fprintf(out, "  \"seconds\": %d,\n", seconds);
+	fprintf(out, "  \"allocator\": \"%s\",\n", allocator ? allocator : "libc");
+	fprintf(out, "  \"scenarios\": [");
+	for (i = 0, opt = 0; i < n; i++) {
+		struct result *r = &results[i];
+		if (!r->name) continue;
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"requests\": %llu, \"errors\": %llu, \"retries\": %llu, \"connects\": %llu, "
+		             "\"rx_bytes\": %llu, \"seconds\": %.3f, \"rps\": %.1f, "
+		             "\"latency_us\": {\"mean\": %.1f, \"p50\": %u, \"p99\": %u, \"p999\": %u, \"max\": %u}, "
+		             "\"rss_kb\": %ld, \"rss_peak_kb\": %ld, "
+		             "\"memory\": {\"allocs_per_req\": %.2f, \"bytes_per_req\": %.0f, \"peak_bytes\": %lld}}",
+		        opt++ ? "," : "", r->name,
+		        (unsigned long long)r->completed, (unsigned long long)r->errors, (unsigned long long)r->retries,
+		        (unsigned long long)r->connects, (unsigned long long)r->rxBytes, r->seconds, r->rps,
+		        r->mean, r->p50, r->p99, r->p999, r->max, r->rss, r->hwm,
+		        r->allocsPerReq, r->bytesPerReq, r->memPeak);
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if (out != stdout) fclose(out);
+	free(results);
+
+	return 0;
+}
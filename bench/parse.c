@@ -0,0 +1,393 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* http_parse() harness - for every request in the corpus:
+     - parses it in one go to get the reference result
+     - re-parses it split at every possible point, a byte at a time, and in
+       HTTP_BLOCK_SIZE slices (as http_read() does), and checks that the
+       result always matches the reference
+     - times repeated parses to give bytes/ns and requests/s
+   this links against the static library, as it pokes at internal structures */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "httpd.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "mem.h"
+
+#define BLOCK_SIZE 128 /* keep in step with HTTP_BLOCK_SIZE in http.c */
+#define MAX_CORPUS 256
+
+struct sample {
+	char *name;
+	unsigned char *data;
+	size_t len;
+};
+
+struct snapshot {
+	enum http_state state;
+	char *method;
+	char *uri;
+	char *httpVersion;
+	int headerc;
+	char **names;
+	char **values;
+	size_t contentLength;
+	size_t contentReceived;
+	char *content;
+};
+
+static struct sample corpus[MAX_CORPUS];
+static int ncorpus;
+
+/* ########################################################################## */
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int load_file(const char *path, const char *name) {
+	struct sample *s;
+	FILE *f;
+	long l;
+
+	if (ncorpus >= MAX_CORPUS) return -1;
+	if ((f = fopen(path, "rb")) == NULL) return -1;
+	fseek(f, 0, SEEK_END);
+	l = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	s = &corpus[ncorpus];
+	if (l <= 0 || (s->data = malloc(l)) == NULL || fread(s->data, 1, l, f) != (size_t)l) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	s->len = l;
+	s->name = strdup(name);
+	ncorpus++;
+
+	return 0;
+}
+
+static int load_corpus(const char *dir) {
+	struct dirent *d;
+	DIR *dh;
+	char path[1024];
+
+	if ((dh = opendir(dir)) == NULL) return load_file(dir, dir);
+	while ((d = readdir(dh)) != NULL) {
+		if (d->d_name[0] == '.') continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+		load_file(path, d->d_name);
+	}
+	closedir(dh);
+
+	return 0;
+}
+
+/* ########################################################################## */
+
+static void session_init(struct session_info *session, struct http_request *req, size_t len) {
+	memset(session, 0, sizeof(*session));
+	memset(req, 0, sizeof(*req));
+	session->xfer.request = req;
+	req->buf = buf_alloc(NULL, len);
+}
+
+static void session_cleanup(struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	if (req->buf) buf_free(req->buf);
+	if (req->data.headers) mem_free(req->data.headers);
+}
+
+/* feeds 'data' to the parser, revealing another slice at each cut, as http_read() does
+   cuts must be ascending, and the final slice always runs to 'len' */
+static void parse_cuts(struct session_info *session, const unsigned char *data, size_t len, size_t *cuts, int ncuts) {
+	struct http_request *req = session->xfer.request;
+	int i;
+
+	memcpy(req->buf->data, data, len);
+	req->state = STATE_START;
+
+	for (i = 0; i <= ncuts; i++) {
+		req->buf->next = (i < ncuts) ? cuts[i] : len;
+		if (req->buf->next == 0) continue;
+		if (http_parse(session) != HTE_NONE) break;
+		if (req->state == STATE_ERROR || req->state == STATE_COMPLETE) break;
+	}
+
+	if (req->state == STATE_COMPLETE) http_parse_fixup(session);
+}
+
+static char *dupstr(unsigned char *s) {
+	return s ? strdup((char *)s) : NULL;
+}
+
+static void snapshot_take(struct snapshot *snap, struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	int i;
+
+	memset(snap, 0, sizeof(*snap));
+	snap->state = req->state;
+	if (req->state != STATE_COMPLETE) return;
+
+	snap->method = dupstr(req->method);
+	snap->uri = dupstr(req->uri);
+	snap->httpVersion = dupstr(req->httpVersion);
+	snap->headerc = req->data.headerc;
+	snap->names = calloc(snap->headerc + 1, sizeof(char *));
+	snap->values = calloc(snap->headerc + 1, sizeof(char *));
+	for (i = 0; i < snap->headerc; i++) {
+		snap->names[i] = dupstr(req->data.headers[i].name);
+		snap->values[i] = dupstr(req->data.headers[i].value);
+	}
+	snap->contentLength = req->data.contentLength;
+	snap->contentReceived = req->data.contentReceived;
+	if (req->data.content) {
+		snap->content = malloc(req->data.contentReceived + 1);
+		memcpy(snap->content, req->data.content, req->data.contentReceived);
+	}
+}
+
+static void snapshot_free(struct snapshot *snap) {
+	int i;
+	free(snap->method);
+	free(snap->uri);
+	free(snap->httpVersion);
+	for (i = 0; i < snap->headerc; i++) {
+		free(snap->names[i]);
+		free(snap->values[i]);
+	}
+	free(snap->names);
+	free(snap->values);
+	free(snap->content);
+}
+
+static int strdiff(const char *a, const char *b) {
+	if (!a || !b) return a != b;
+	return strcmp(a, b);
+}
+
+/* returns the name of the first field that differs, or NULL if they match */
+static const char *snapshot_diff(struct snapshot *a, struct snapshot *b) {
+	int i;
+
+	if (a->state != b->state) return "state";
+	if (a->state != STATE_COMPLETE) return NULL;
+	if (strdiff(a->method, b->method)) return "method";
+	if (strdiff(a->uri, b->uri)) return "uri";
+	if (strdiff(a->httpVersion, b->httpVersion)) return "httpVersion";
+	if (a->headerc != b->headerc) return "headerc";
+	for (i = 0; i < a->headerc; i++) {
+		if (strdiff(a->names[i], b->names[i])) return "header name";
+		if (strdiff(a->values[i], b->values[i])) return "header value";
+	}
+	if (a->contentLength != b->contentLength) return "contentLength";
+	if (a->contentReceived != b->contentReceived) return "contentReceived";
+	if (!a->content != !b->content) return "content";
+	if (a->content && memcmp(a->content, b->content, a->contentReceived)) return "content";
+
+	return NULL;
+}
+
+/* ########################################################################## */
+
+static int check_cuts(struct sample *s, struct snapshot *ref, const char *mode, size_t *cuts, int ncuts, int verbose) {
+	struct session_info session;
+	struct http_request req;
+	struct snapshot snap;
+	const char *field;
+
+	session_init(&session, &req, s->len);
+	parse_cuts(&session, s->data, s->len, cuts, ncuts);
+	snapshot_take(&snap, &session);
+	session_cleanup(&session);
+
+	field = snapshot_diff(ref, &snap);
+	if (field && verbose) {
+		int i;
+		fprintf(stderr, "  MISMATCH %s: %s, %s, cuts:", s->name, mode, field);
+		for (i = 0; i < ncuts && i < 8; i++) fprintf(stderr, " %zu", cuts[i]);
+		fprintf(stderr, "%s\n", ncuts > 8 ? " ..." : "");
+	}
+	snapshot_free(&snap);
+
+	return field != NULL;
+}
+
+static int check_sample(struct sample *s, int verbose) {
+	struct session_info session;
+	struct http_request req;
+	struct snapshot ref;
+	size_t *cuts;
+	size_t i;
+	int fail = 0;
+
+	session_init(&session, &req, s->len);
+	parse_cuts(&session, s->data, s->len, NULL, 0);
+	snapshot_take(&ref, &session);
+	session_cleanup(&session);
+
+	if (ref.state != STATE_COMPLETE) {
+		fprintf(stderr, "  %s: doesn't parse to completion in one go (state %d)\n", s->name, ref.state);
+	}
+
+	if ((cuts = malloc(sizeof(*cuts) * s->len)) == NULL) return 1;
+
+	/* every single split point */
+	for (i = 1; i < s->len; i++) {
+		cuts[0] = i;
+		fail += check_cuts(s, &ref, "split", cuts, 1, verbose);
+	}
+
+	/* a byte at a time */
+	for (i = 1; i < s->len; i++) cuts[i - 1] = i;
+	fail += check_cuts(s, &ref, "bytewise", cuts, s->len - 1, verbose);
+
+	/* the same slicing as http_read() */
+	for (i = 0; (i + 1) * BLOCK_SIZE < s->len; i++) cuts[i] = (i + 1) * BLOCK_SIZE;
+	fail += check_cuts(s, &ref, "blocks", cuts, i, verbose);
+
+	free(cuts);
+	snapshot_free(&ref);
+
+	return fail;
+}
+
+/* ########################################################################## */
+
+static double time_sample(struct sample *s, long iterations, int copyOnly) {
+	struct session_info session;
+	struct http_request req;
+	uint64_t start;
+	long i;
+
+	session_init(&session, &req, s->len);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		memcpy(req.buf->data, s->data, s->len);
+		if (copyOnly) continue;
+
+		req.parsePos = 0;
+		req.state = STATE_START;
+		req.data.headerc = 0;
+		req.data.contentLength = 0;
+		req.data.contentReceived = 0;
+		req.data.content = NULL;
+		req.buf->next = s->len;
+
+		http_parse(&session);
+		http_parse_fixup(&session);
+	}
+	start = now_ns() - start;
+
+	session_cleanup(&session);
+
+	return (double)start;
+}
+
+/* ########################################################################## */
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-n iterations] [-q] [-o results.json] <corpus dir or file>...\n", argv0);
+}
+
+int main(int argc, char *argv[]) {
+	char *outfile = NULL;
+	FILE *out;
+	long iterations = 200000;
+	int verbose = 1;
+	int i, opt, failures;
+	double totBytes, totNs;
+
+	while ((opt = getopt(argc, argv, "n:qo:h")) != -1) {
+		switch (opt) {
+			case 'n': iterations = atol(optarg); break;
+			case 'q': verbose = 0;               break;
+			case 'o': outfile = optarg;          break;
+			default:  usage(argv[0]);            return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	for (i = optind; i < argc; i++) load_corpus(argv[i]);
+	if (ncorpus == 0) {
+		fprintf(stderr, "empty corpus\n");
+		return 1;
+	}
+
+	if (outfile) {
+		if ((out = fopen(outfile, "w")) == NULL) {
+			perror(outfile);
+			return 1;
+		}
+	} else {
+		out = stdout;
+	}
+
+	fprintf(stderr, "%-28s %6s %8s %10s %12s\n", "sample", "bytes", "splits", "bytes/ns", "req/s");
+	fprintf(out, "{\n  \"iterations\": %ld,\n  \"samples\": [", iterations);
+
+	failures = 0;
+	totBytes = totNs = 0;
+	for (i = 0; i < ncorpus; i++) {
+		struct sample *s = &corpus[i];
+		double ns, copyNs;
+		int fail;
+
+		fail = check_sample(s, verbose);
+		failures += fail;
+
+		copyNs = time_sample(s, iterations, 1);
+		ns = time_sample(s, iterations, 0) - copyNs;
+		if (ns <= 0) ns = 1;
+
+		totBytes += (double)s->len * iterations;
+		totNs += ns;
+
+		fprintf(stderr, "%-28s %6zu %8s %10.3f %12.0f\n", s->name, s->len, fail ? "FAIL" : "ok",
+		        (s->len * iterations) / ns, iterations / (ns / 1e9));
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"bytes\": %zu, \"split_failures\": %d, \"bytes_per_ns\": %.4f, \"rps\": %.0f}",
+		        i ? "," : "", s->name, s->len, fail, (s->len * iterations) / ns, iterations / (ns / 1e9));
+	}
+
+	fprintf(stderr, "%-28s %6s %8d %10.3f %12.0f\n", "total", "", failures, totBytes / totNs, (ncorpus * iterations) / (totNs / 1e9));
+	fprintf(out, "\n  ],\n  \"split_failures\": %d,\n  \"bytes_per_ns\": %.4f,\n  \"rps\": %.0f\n}\n",
+	        failures, totBytes / totNs, (ncorpus * iterations) / (totNs / 1e9));
+
+	if (out != stdout) fclose(out);
+
+	return failures ? 2 : 0;
+}
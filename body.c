@@ -0,0 +1,137 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "body.h"
+#include "mem.h"
+
+EXPORT struct httpd_body *httpd_bodyCreate(void *data, size_t len, httpd_bodyFree release, void *ctx) {
+	struct httpd_body *body;
+	
+	if (!data && len > 0) return NULL;
+	
+	if ((body = mem_malloc(HTTPD_MEM_OTHER, sizeof(*body))) == NULL) return NULL;
+	memset(body, 0, sizeof(*body));
+	body->refs = 1;
+	body->data = data;
+	body->len = len;
+	body->release = release;
+	body->ctx = ctx;
+	
+	return body;
+}
+
+EXPORT struct httpd_body *httpd_bodyHold(struct httpd_body *body) {
+	if (!body) return NULL;
+	__sync_fetch_and_add(&body->refs, 1);
+	return body;
+}
+
+EXPORT void httpd_bodyRelease(struct httpd_body *body) {
+	if (!body) return;
+	if (__sync_sub_and_fetch(&body->refs, 1) != 0) return;
+	
+	if (body->release) body->release(body->ctx, body->data, body->len);
+	mem_free(body);
+}
+
+EXPORT hte httpd_respondBody(struct session_info *session, struct httpd_body *body) {
+	struct http_response *rsp;
+	
+	if (!session || !body) return HTE_INVALPARAM;
+	rsp = session->xfer.response;
+	if (body->len == 0) return HTE_NONE;
+	
+	/* HTTP/2 frames the buffer, a compressed stream has to go through the compressor, and the
+	   response only has room for so many - they get a copy, as httpd_nrespond() would */
+	if (session->h2 || rsp->gzip || rsp->bodyc >= HTTP_BODIES) {
+		if (nbufcatf(&rsp->buf, (char *)body->data, body->len) != body->len) return HTE_RESPOND;
+		return HTE_NONE;
+	}
+	
+	/* once the head's gone, whatever's buffered goes first and then the body */
+	if (rsp->flushed) {
+		if (http_respond(session, 0) != HTE_NONE) return HTE_RESPOND;
+		return session_send(session, body->data, body->len) == HTE_NONE ? HTE_NONE : HTE_RESPOND;
+	}
+	
+	rsp->bodies[rsp->bodyc] = httpd_bodyHold(body);
+	rsp->bodyAt[rsp->bodyc] = rsp->buf ? rsp->buf->next : 0;
+	rsp->bodyc++;
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+int body_iov(struct http_response *rsp, struct iovec *iov, int head) {
+	size_t at, len;
+	int c, i;
+	
+#define PIECE(p, l) \
+	if ((l) > 0) { \
+		iov[c].iov_base = (p); \
+		iov[c].iov_len = (l); \
+		c++; \
+	}
+	
+	c = 0;
+	if (head && rsp->headBuf) PIECE(rsp->headBuf->data, rsp->headBuf->len);
+	
+	at = 0;
+	len = rsp->buf ? rsp->buf->len : 0;
+	for (i = 0; i < rsp->bodyc; i++) {
+		PIECE(&rsp->buf->data[at], rsp->bodyAt[i] - at);
+		at = rsp->bodyAt[i];
+		PIECE(rsp->bodies[i]->data, rsp->bodies[i]->len);
+	}
+	PIECE(&rsp->buf->data[at], len - at);
+	
+#undef PIECE
+	
+	return c;
+}
+
+size_t body_length(struct http_response *rsp) {
+	size_t len;
+	int i;
+	
+	len = rsp->buf ? rsp->buf->len : 0;
+	for (i = 0; i < rsp->bodyc; i++) {
+		len += rsp->bodies[i]->len;
+	}
+	
+	return len;
+}
+
+void body_drop(struct http_response *rsp) {
+	while (rsp->bodyc > 0) {
+		rsp->bodyc--;
+		httpd_bodyRelease(rsp->bodies[rsp->bodyc]);
+		rsp->bodies[rsp->bodyc] = NULL;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef BODY_H
+#define BODY_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/uio.h>
+
+/* shared bodies - immutable data with a count of the responses (and the owner) holding it
+   a response keeps up to HTTP_BODIES of them, each at the point in its buffer it was added, and
+   the pieces go out together in one sendmsg() */
+
+struct http_response;
+
+struct httpd_body {
+	int refs;
+	unsigned char *data;
+	size_t len;
+	
+	httpd_bodyFree release;
+	void *ctx;
+	
+	/* XXH64 of the data, for etag.c */
+	unsigned long long hash;
+	int hashed;
+};
+
+#define HTTP_BODIES 8
+#define HTTP_IOV (2 + HTTP_BODIES * 2) /* the head, and the buffer either side of each body */
+
+/* fills 'iov' with the head (if 'head') and then the body, returns how many there are */
+int body_iov(struct http_response *rsp, struct iovec *iov, int head);
+size_t body_length(struct http_response *rsp);
+/* lets go of the response's bodies, once they're sent or no longer wanted */
+void body_drop(struct http_response *rsp);
+
+#endif /* BODY_H */
@@ -27,6 +27,7 @@
 
 #include "internal.h"
 #include "buf.h"
+#include "mem.h"
 
 EXPORT struct buf *buf_alloc(struct buf *_buf, size_t size) {
 	size_t tot_size;
@@ -40,7 +41,7 @@ EXPORT struct buf *buf_alloc(struct buf *_buf, size_t size) {
 		return NULL;
 	}
 	
-	if ((buf = realloc(_buf, tot_size)) == NULL) return NULL;
+	if ((buf = mem_realloc(HTTPD_MEM_BUF, _buf, tot_size)) == NULL) return NULL;
 	
 	if (!_buf) {
 		/* wipe everything in preparation */
@@ -57,7 +58,7 @@ EXPORT struct buf *buf_alloc(struct buf *_buf, size_t size) {
 }
 
 EXPORT void buf_free(struct buf *buf) {
-	free(buf);
+	mem_free(buf);
 }
 
 
@@ -0,0 +1,623 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "cache.h"
+#include "timeout.h"
+#include "co.h"
+#include "mem.h"
+#include "mono.h"
+
+static pthread_mutex_t cache_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+static unsigned long long cache_hash(unsigned char *key, size_t len) {
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	size_t i;
+	
+	for (i = 0; i < len; i++) {
+		h ^= key[i];
+		h *= 0x100000001b3ULL;
+	}
+	
+	return h;
+}
+
+/* the entries are HTTP/1.x as it goes on the wire, and nobody's credentials may be shared */
+static int cache_eligible(struct session_info *session) {
+	char *method = (char *)session->xfer.request->method;
+	
+	if (session->h2) return 0;
+	if (!method || (strcmp(method, "GET") && strcmp(method, "HEAD"))) return 0;
+	if (httpd_getHeader(session, "Authorization")) return 0;
+	
+	return 1;
+}
+
+/* the method, URI, version and the headers it varies on, each ended with a nul */
+static unsigned char *cache_key(struct cache_info *cache, struct session_info *session, size_t *len) {
+	struct http_request *req = session->xfer.request;
+	char *part[3 + CACHE_VARY];
+	unsigned char *key, *p;
+	int i, n;
+	
+	part[0] = (char *)req->method;
+	part[1] = (char *)req->uri;
+	part[2] = (char *)req->httpVersion;
+	n = 3;
+	for (i = 0; i < cache->varyc; i++) {
+		part[n++] = httpd_getHeader(session, cache->vary[i]);
+	}
+	
+	*len = 0;
+	for (i = 0; i < n; i++) *len += (part[i] ? strlen(part[i]) : 0) + 1;
+	
+	if ((key = mem_malloc(HTTPD_MEM_OTHER, *len)) == NULL) return NULL;
+	
+	for (p = key, i = 0; i < n; i++) {
+		size_t l = part[i] ? strlen(part[i]) : 0;
+		memcpy(p, part[i] ? part[i] : "", l);
+		p += l;
+		*(p++) = '\0';
+	}
+	
+	return key;
+}
+
+/* ########################################################################## */
+
+static int cache_is(char *p, size_t n, char *directive) {
+	return strlen(directive) == n && !strncasecmp(p, directive, n);
+}
+
+/* the value of 'directive=N', or -1 if it's another */
+static long cache_arg(char *p, size_t n, char *directive) {
+	size_t l = strlen(directive);
+	
+	if (n <= l + 1 || strncasecmp(p, directive, l) || p[l] != '=') return -1;
+	p += l + 1;
+	if (*p == '"') p++;
+	
+	return strtol(p, NULL, 10);
+}
+
+/* calls 'fn' for each of the comma separated items in 'value', until it returns non-zero */
+static int cache_items(char *value, int (*fn)(void *ctx, char *p, size_t n), void *ctx) {
+	char *p, *e;
+	size_t n;
+	int ret;
+	
+	for (p = value; *p; p = e) {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+		if (!*p) break;
+		for (e = p; *e && *e != ','; e++);
+		for (n = e - p; n > 0 && (p[n - 1] == ' ' || p[n - 1] == '\t'); n--);
+		if ((ret = fn(ctx, p, n)) != 0) return ret;
+	}
+	
+	return 0;
+}
+
+struct cache_control {
+	long maxAge;
+	long sMaxAge;
+	long swr;
+};
+
+static int cache_controlItem(void *ctx, char *p, size_t n) {
+	struct cache_control *cc = ctx;
+	long v;
+	
+	if (cache_is(p, n, "no-store") || cache_is(p, n, "no-cache") || cache_is(p, n, "private")) return -1;
+	if ((v = cache_arg(p, n, "max-age")) >= 0) cc->maxAge = v;
+	if ((v = cache_arg(p, n, "s-maxage")) >= 0) cc->sMaxAge = v;
+	if ((v = cache_arg(p, n, "stale-while-revalidate")) >= 0) cc->swr = v;
+	
+	return 0;
+}
+
+/* a Vary the handler set is only honoured if the key already varies on it */
+static int cache_varyItem(void *ctx, char *p, size_t n) {
+	struct cache_info *cache = ctx;
+	int i;
+	
+	for (i = 0; i < cache->varyc; i++) {
+		if (cache_is(p, n, cache->vary[i])) return 0;
+	}
+	
+	return -1;
+}
+
+/* 0 if the response may be shared between clients, along with how many seconds it may be kept
+   fresh (-1 for not at all) and then served stale while it's revalidated - only what the handler
+   has asked for is cached */
+static int cache_policy(struct cache_info *cache, struct http_response *rsp, long *maxAge, long *swr) {
+	struct cache_control cc = { -1, -1, 0 };
+	struct http_header *h;
+	int i;
+	
+	/* it only answers the request's If-None-Match */
+	if (rsp->httpCode == 304) return -1;
+	
+	for (i = 0; i < rsp->data.headerc; i++) {
+		h = &rsp->data.headers[i];
+		if (!h->name || !h->value) continue;
+		
+		if (!strcasecmp((char *)h->name, "Set-Cookie")) return -1;
+		if (!strcasecmp((char *)h->name, "Vary")) {
+			if (cache_items((char *)h->value, cache_varyItem, cache)) return -1;
+		} else if (!strcasecmp((char *)h->name, "Cache-Control")) {
+			if (cache_items((char *)h->value, cache_controlItem, &cc)) return -1;
+		}
+	}
+	
+	if (cc.sMaxAge >= 0) cc.maxAge = cc.sMaxAge;
+	if (cc.maxAge == 0 && cc.swr == 0) cc.maxAge = -1;
+	*maxAge = cc.maxAge;
+	*swr = cc.swr;
+	
+	return 0;
+}
+
+/* ########################################################################## */
+
+static void cache_release(struct cache_entry *e) {
+	if (__sync_sub_and_fetch(&e->refs, 1) == 0) mem_free(e);
+}
+
+/* the shard's mutex must be held - returns the link that points at the entry, or at NULL */
+static struct cache_entry **cache_find(struct cache_shard *shard, unsigned long long hash, unsigned char *key, size_t keyLen) {
+	struct cache_entry **link;
+	
+	for (link = &shard->buckets[(hash / CACHE_SHARDS) & (CACHE_BUCKETS - 1)]; *link; link = &(*link)->next) {
+		struct cache_entry *e = *link;
+		if (e->hash == hash && e->keyLen == keyLen && !memcmp(e->data, key, keyLen)) break;
+	}
+	
+	return link;
+}
+
+/* the shard's mutex must be held */
+static void cache_remove(struct cache_shard *shard, struct cache_entry *e) {
+	struct cache_entry **link;
+	
+	for (link = &shard->buckets[(e->hash / CACHE_SHARDS) & (CACHE_BUCKETS - 1)]; *link != e; link = &(*link)->next);
+	*link = e->next;
+	
+	if (e->ringNext == e) {
+		shard->hand = NULL;
+	} else {
+		e->ringPrev->ringNext = e->ringNext;
+		e->ringNext->ringPrev = e->ringPrev;
+		if (shard->hand == e) shard->hand = e->ringNext;
+	}
+	
+	shard->bytes -= sizeof(*e) + e->keyLen + e->len;
+	shard->entries--;
+	cache_release(e);
+}
+
+/* the shard's mutex must be held - it goes in just behind the hand, the last it'll come to */
+static void cache_insert(struct cache_shard *shard, struct cache_entry **link, struct cache_entry *e) {
+	e->next = *link;
+	*link = e;
+	
+	if (!shard->hand) {
+		e->ringPrev = e->ringNext = e;
+		shard->hand = e;
+	} else {
+		e->ringNext = shard->hand;
+		e->ringPrev = shard->hand->ringPrev;
+		e->ringPrev->ringNext = e;
+		shard->hand->ringPrev = e;
+	}
+	
+	shard->bytes += sizeof(*e) + e->keyLen + e->len;
+	shard->entries++;
+}
+
+/* the shard's mutex must be held - the hand sweeps past (and clears) anything used since it last
+   came round, and takes the first that wasn't */
+static void cache_evict(struct cache_info *cache, struct cache_shard *shard) {
+	struct cache_entry *e;
+	
+	while ((e = shard->hand)->referenced) {
+		e->referenced = 0;
+		shard->hand = e->ringNext;
+	}
+	
+	cache_remove(shard, e);
+	__sync_fetch_and_add(&cache->evictions, 1);
+}
+
+static void cache_flush(struct cache_info *cache) {
+	int i;
+	
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		struct cache_shard *shard = &cache->shards[i];
+		pthread_mutex_lock(&shard->mutex);
+		while (shard->hand) cache_remove(shard, shard->hand);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+}
+
+/* ########################################################################## */
+
+static void cache_flightRelease(struct cache_flight *f) {
+	if (__sync_sub_and_fetch(&f->refs, 1) != 0) return;
+	
+	if (f->entry) cache_release(f->entry);
+	if (f->fd != -1) close(f->fd);
+	mem_free(f);
+}
+
+/* the shard's mutex must be held - returns the flight to wait on, or NULL if the session is to
+   run the callback itself (leading a new flight if it could) */
+static struct cache_flight *cache_fly(struct cache_shard *shard, struct session_info *session, unsigned long long hash, unsigned char *key, size_t keyLen) {
+	struct cache_flight *f;
+	
+	for (f = shard->flights; f; f = f->next) {
+		if (f->hash == hash && f->keyLen == keyLen && !memcmp(f->key, key, keyLen)) break;
+	}
+	
+	if (f) {
+		if (f->fd == -1 && (f->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) return NULL;
+		__sync_fetch_and_add(&f->refs, 1);
+		return f;
+	}
+	
+	if ((f = mem_malloc(HTTPD_MEM_OTHER, sizeof(*f) + keyLen)) == NULL) return NULL;
+	memset(f, 0, sizeof(*f));
+	f->hash = hash;
+	f->refs = 1;
+	f->fd = -1;
+	f->keyLen = keyLen;
+	memcpy(f->key, key, keyLen);
+	
+	f->next = shard->flights;
+	shard->flights = f;
+	session->flight = f;
+	
+	return NULL;
+}
+
+/* 'e' is NULL if there's nothing to share, the waiters run the callback themselves */
+static void cache_landWith(struct session_info *session, struct cache_entry *e) {
+	struct cache_info *cache = session->httpd->cache;
+	struct cache_flight *f = session->flight, **link;
+	struct cache_shard *shard = &cache->shards[f->hash & (CACHE_SHARDS - 1)];
+	uint64_t one = 1;
+	
+	pthread_mutex_lock(&shard->mutex);
+	
+	for (link = &shard->flights; *link != f; link = &(*link)->next);
+	*link = f->next;
+	
+	if (e) {
+		__sync_fetch_and_add(&e->refs, 1);
+		f->entry = e;
+	}
+	__sync_synchronize();
+	f->landed = 1;
+	
+	/* it's never read, so it stays readable for everyone */
+	if (f->fd != -1 && write(f->fd, &one, sizeof(one)) != sizeof(one)) {
+		fprintf(stderr, "%s:%d %s(): couldn't wake the waiters\n", __FILE__, __LINE__, __FUNCTION__);
+	}
+	
+	pthread_mutex_unlock(&shard->mutex);
+	
+	session->flight = NULL;
+	cache_flightRelease(f);
+}
+
+void cache_land(struct session_info *session) {
+	cache_landWith(session, NULL);
+}
+
+static int cache_send(struct session_info *session, struct cache_entry *e);
+
+/* returns as cache_serve() does, with 0 if it timed out or landed with nothing to share */
+static int cache_await(struct session_info *session, struct cache_flight *f) {
+	struct cache_info *cache = session->httpd->cache;
+	unsigned long long deadline, now;
+	int fd = f->fd, ret = 0;
+	
+	/* a loop can't watch the same fd for two of its coroutines */
+	if (co_active() && (fd = dup(f->fd)) == -1) goto done;
+	
+	deadline = mono_ms() + cache->coalesceMs;
+	while (!f->landed && (now = mono_ms()) < deadline) {
+		if (co_wait(fd, EPOLLIN, deadline - now) != 0) break;
+		__sync_synchronize();
+	}
+	if (fd != f->fd) close(fd);
+	
+	/* the entry is set before it lands, and held by the flight */
+	if (f->landed && f->entry) {
+		__sync_fetch_and_add(&cache->coalesced, 1);
+		ret = cache_send(session, f->entry);
+	} else {
+		__sync_fetch_and_add(&cache->fallbacks, 1);
+	}
+	
+done:
+	cache_flightRelease(f);
+	return ret;
+}
+
+static int cache_send(struct session_info *session, struct cache_entry *e) {
+	struct buf *b;
+	
+	/* the pool's I/O loop sends it later, so it needs a copy of its own */
+	if (session->pool) {
+		if ((b = buf_alloc(NULL, e->len)) == NULL) return -1;
+		memcpy(b->data, &e->data[e->keyLen], e->len);
+		session->xfer.response->headBuf = b;
+		return 1;
+	}
+	
+	timeout_phase(session, TIMEOUT_WRITE);
+	if (session_send(session, &e->data[e->keyLen], e->len) != HTE_NONE) return -1;
+	
+	return 1;
+}
+
+int cache_serve(struct session_info *session) {
+	struct cache_info *cache = session->httpd->cache;
+	struct cache_shard *shard;
+	struct cache_flight *f;
+	struct cache_entry *e;
+	unsigned long long hash, now;
+	unsigned char *key;
+	size_t keyLen;
+	int fresh, ret;
+	
+	if (!cache || (!cache->limit && !cache->coalesceMs) || !cache_eligible(session)) return 0;
+	if ((key = cache_key(cache, session, &keyLen)) == NULL) return 0;
+	hash = cache_hash(key, keyLen);
+	shard = &cache->shards[hash & (CACHE_SHARDS - 1)];
+	now = mono_ms();
+	
+	pthread_mutex_lock(&shard->mutex);
+	
+	fresh = 1;
+	f = NULL;
+	e = cache->limit ? *cache_find(shard, hash, key, keyLen) : NULL;
+	if (e && now >= e->freshUntil) {
+		/* one request goes to the callback for a fresh copy, the rest have this one meanwhile */
+		fresh = 0;
+		if (now >= e->staleUntil || !e->revalidating) {
+			e->revalidating = 1;
+			e = NULL;
+		}
+	}
+	if (e) {
+		e->referenced = 1;
+		__sync_fetch_and_add(&e->refs, 1);
+	} else if (cache->coalesceMs) {
+		f = cache_fly(shard, session, hash, key, keyLen);
+	}
+	
+	pthread_mutex_unlock(&shard->mutex);
+	mem_free(key);
+	
+	if (!e) {
+		__sync_fetch_and_add(&cache->misses, 1);
+		return f ? cache_await(session, f) : 0;
+	}
+	__sync_fetch_and_add(fresh ? &cache->hits : &cache->staleHits, 1);
+	
+	ret = cache_send(session, e);
+	cache_release(e);
+	
+	return ret;
+}
+
+void cache_store(struct session_info *session) {
+	struct cache_info *cache = session->httpd->cache;
+	struct http_response *rsp = session->xfer.response;
+	struct cache_shard *shard;
+	struct cache_entry *e, **link;
+	unsigned long long hash, now;
+	unsigned char *key;
+	size_t keyLen, len;
+	long maxAge = -1, swr = 0;
+	int shareable, keep;
+	
+	if (!cache || (!cache->limit && !session->flight) || !cache_eligible(session)) return;
+	if ((key = cache_key(cache, session, &keyLen)) == NULL) {
+		if (session->flight) cache_land(session);
+		return;
+	}
+	hash = cache_hash(key, keyLen);
+	shard = &cache->shards[hash & (CACHE_SHARDS - 1)];
+	
+	/* a response streamed out with httpd_flush() was never whole */
+	shareable = !rsp->flushed && rsp->headBuf && cache_policy(cache, rsp, &maxAge, &swr) == 0;
+	len = shareable ? rsp->headBuf->len + body_length(rsp) : 0;
+	keep = shareable && maxAge >= 0 && sizeof(*e) + keyLen + len <= cache->limit;
+	
+	e = NULL;
+	if (keep || (shareable && session->flight)) e = mem_malloc(HTTPD_MEM_OTHER, sizeof(*e) + keyLen + len);
+	if (!e) keep = 0;
+	
+	if (e) {
+		memset(e, 0, sizeof(*e));
+		e->hash = hash;
+		e->refs = 1;
+		now = mono_ms();
+		e->freshUntil = now + maxAge * 1000;
+		e->staleUntil = e->freshUntil + swr * 1000;
+		e->keyLen = keyLen;
+		e->len = len;
+		memcpy(e->data, key, keyLen);
+		{
+			struct iovec iov[HTTP_IOV];
+			size_t at = keyLen;
+			int i, c;
+			
+			c = body_iov(rsp, iov, 1);
+			for (i = 0; i < c; i++) {
+				memcpy(&e->data[at], iov[i].iov_base, iov[i].iov_len);
+				at += iov[i].iov_len;
+			}
+		}
+	}
+	
+	if (cache->limit) {
+		pthread_mutex_lock(&shard->mutex);
+		
+		/* whatever was kept for the request before is out of date now, even if this can't replace it */
+		if (*(link = cache_find(shard, hash, key, keyLen)) != NULL) cache_remove(shard, *link);
+		
+		if (keep) {
+			while (shard->hand && shard->bytes + sizeof(*e) + keyLen + len > cache->limit) cache_evict(cache, shard);
+			__sync_fetch_and_add(&e->refs, 1);
+			cache_insert(shard, cache_find(shard, hash, key, keyLen), e);
+			__sync_fetch_and_add(&cache->stores, 1);
+		}
+		
+		pthread_mutex_unlock(&shard->mutex);
+	}
+	
+	if (session->flight) cache_landWith(session, e);
+	if (e) cache_release(e);
+	mem_free(key);
+}
+
+/* ########################################################################## */
+
+/* cache_startMutex must be held */
+static struct cache_info *cache_create(struct httpd_info *httpd) {
+	struct cache_info *cache;
+	int i;
+	
+	if (httpd->cache) return httpd->cache;
+	
+	if ((cache = mem_malloc(HTTPD_MEM_SERVER, sizeof(*cache))) == NULL) return NULL;
+	memset(cache, 0, sizeof(*cache));
+	for (i = 0; i < CACHE_SHARDS; i++) pthread_mutex_init(&cache->shards[i].mutex, NULL);
+	
+	__sync_synchronize();
+	httpd->cache = cache;
+	
+	return cache;
+}
+
+EXPORT hte httpd_setCache(struct httpd_info *httpd, size_t bytes) {
+	struct cache_info *cache;
+	hte ret = HTE_NONE;
+	
+	if (!httpd) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&cache_startMutex);
+	
+	if (!httpd->cache && bytes == 0) goto done;
+	if ((cache = cache_create(httpd)) == NULL) { ret = HTE_NOMEM; goto done; }
+	
+	/* a smaller budget is caught up with as responses are stored, and none at all empties it */
+	cache->limit = bytes / CACHE_SHARDS;
+	if (bytes == 0) cache_flush(cache);
+	
+done:
+	pthread_mutex_unlock(&cache_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_addCacheVary(struct httpd_info *httpd, char *header) {
+	struct cache_info *cache;
+	hte ret = HTE_NONE;
+	char *p;
+	
+	if (!httpd || !header || !*header) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&cache_startMutex);
+	
+	if ((cache = cache_create(httpd)) == NULL) { ret = HTE_NOMEM; goto done; }
+	if (cache->varyc >= CACHE_VARY) { ret = HTE_INVALPARAM; goto done; }
+	if ((p = mem_malloc(HTTPD_MEM_SERVER, strlen(header) + 1)) == NULL) { ret = HTE_NOMEM; goto done; }
+	strcpy(p, header);
+	
+	cache->vary[cache->varyc] = p;
+	__sync_synchronize();
+	cache->varyc++;
+	
+done:
+	pthread_mutex_unlock(&cache_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_setCoalescing(struct httpd_info *httpd, int timeoutMs) {
+	struct cache_info *cache;
+	hte ret = HTE_NONE;
+	
+	if (!httpd || timeoutMs < 0) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&cache_startMutex);
+	
+	if (!httpd->cache && timeoutMs == 0) goto done;
+	if ((cache = cache_create(httpd)) == NULL) { ret = HTE_NOMEM; goto done; }
+	
+	/* flights already in the air still land, there's just nobody new waiting on them */
+	cache->coalesceMs = timeoutMs;
+	
+done:
+	pthread_mutex_unlock(&cache_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_getCacheStats(struct httpd_info *httpd, struct httpd_cacheStats *stats) {
+	struct cache_info *cache;
+	int i;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((cache = httpd->cache) == NULL) return HTE_NONE;
+	
+	stats->hits = cache->hits;
+	stats->staleHits = cache->staleHits;
+	stats->misses = cache->misses;
+	stats->stores = cache->stores;
+	stats->evictions = cache->evictions;
+	stats->coalesced = cache->coalesced;
+	stats->fallbacks = cache->fallbacks;
+	for (i = 0; i < CACHE_SHARDS; i++) {
+		pthread_mutex_lock(&cache->shards[i].mutex);
+		stats->entries += cache->shards[i].entries;
+		stats->bytes += cache->shards[i].bytes;
+		pthread_mutex_unlock(&cache->shards[i].mutex);
+	}
+	
+	return HTE_NONE;
+}
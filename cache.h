@@ -0,0 +1,101 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* response cache - whole serialized responses, head and body, keyed on the request's method, URI,
+   version and the values of any headers it varies on
+   the entries are spread over shards by their key's hash, each shard a chained hash table behind
+   its own mutex with its share of the byte budget, and a CLOCK ring to pick what to evict
+   an entry is reference counted so it can be sent from without the shard's mutex held
+   with coalescing on, a request that misses becomes a flight that others with the same key wait
+   on (each with an eventfd that's left readable as it lands, dup()ed for a coroutine as a loop
+   can't watch the same fd twice), and they're sent the response it lands with if it can be shared */
+
+#include <pthread.h>
+
+struct session_info;
+
+#define CACHE_SHARDS  16   /* must be a power of two */
+#define CACHE_BUCKETS 1024 /* in each shard, must be a power of two */
+#define CACHE_VARY    8    /* headers the key may vary on */
+
+struct cache_entry {
+	struct cache_entry *next;                /* in its bucket */
+	struct cache_entry *ringPrev, *ringNext; /* round the clock */
+	unsigned long long hash;
+	int refs;         /* the shard's, and one for each response being sent from it */
+	int referenced;   /* hit since the hand last came round */
+	int revalidating; /* a request has gone to the callback for a fresh copy */
+	unsigned long long freshUntil; /* CLOCK_MONOTONIC in ms */
+	unsigned long long staleUntil; /* it can stand in while it's being revalidated until then */
+	size_t keyLen;
+	size_t len;
+	unsigned char data[1]; /* the key, then the response */
+};
+
+/* a request others are waiting on */
+struct cache_flight {
+	struct cache_flight *next; /* in its shard, until it lands */
+	unsigned long long hash;
+	int refs;   /* the leader's, and each waiter's */
+	int fd;     /* -1 until someone waits */
+	int landed;
+	struct cache_entry *entry; /* what it landed with, NULL if that can't be shared */
+	size_t keyLen;
+	unsigned char key[1];
+};
+
+struct cache_shard {
+	pthread_mutex_t mutex;
+	struct cache_flight *flights;
+	struct cache_entry *buckets[CACHE_BUCKETS];
+	struct cache_entry *hand; /* NULL while it's empty */
+	size_t bytes;
+	unsigned int entries;
+};
+
+struct cache_info {
+	size_t limit; /* for each shard, 0 while it's off */
+	int coalesceMs; /* how long a request waits on another's flight, 0 while that's off */
+	char *vary[CACHE_VARY];
+	int varyc;
+	
+	unsigned long long hits;
+	unsigned long long staleHits;
+	unsigned long long misses;
+	unsigned long long stores;
+	unsigned long long evictions;
+	unsigned long long coalesced;
+	unsigned long long fallbacks;
+	
+	struct cache_shard shards[CACHE_SHARDS];
+};
+
+/* answers the request from the cache in place of the callback if it can
+   returns 1 if it did, 0 if the callback is needed, and -1 if the answer couldn't be sent */
+int cache_serve(struct session_info *session);
+/* once the response is prepared - it's kept if it says it may be, and dropped if it says not,
+   and the session's flight lands with it */
+void cache_store(struct session_info *session);
+/* for a session leading a flight that's never going to get as far as cache_store() */
+void cache_land(struct session_info *session);
+
+#endif /* CACHE_H */
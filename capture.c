@@ -0,0 +1,154 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "capture.h"
+#include "mem.h"
+#include "mono.h"
+
+static pthread_mutex_t capture_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void put_varint(FILE *f, uint64_t v) {
+	unsigned char b[10];
+	int i = 0;
+	
+	do {
+		b[i] = v & 0x7F;
+		v >>= 7;
+		if (v) b[i] |= 0x80;
+		i++;
+	} while (v);
+	
+	fwrite(b, 1, i, f);
+}
+
+/* the capture mutex must be held */
+static void put_record(struct capture_info *cap, enum capture_record type, unsigned int id) {
+	unsigned long long now, us;
+	
+	now = mono_ns();
+	us = now > cap->last ? (now - cap->last) / 1000 : 0;
+	
+	/* only move 'last' on by whole microseconds, so that rounding doesn't drift */
+	cap->last += us * 1000;
+	
+	fputc(type, cap->f);
+	put_varint(cap->f, id);
+	put_varint(cap->f, us);
+}
+
+EXPORT hte httpd_startCapture(struct httpd_info *httpd, char *path) {
+	struct capture_info *cap;
+	struct timeval tv;
+	uint64_t us;
+	int i;
+	
+	if (!httpd || !path) return HTE_INVALPARAM;
+	
+	/* the capture_info is never freed, so that sessions never have to worry about it going away
+	   and it's whole before they can see it */
+	pthread_mutex_lock(&capture_startMutex);
+	if ((cap = httpd->capture) == NULL) {
+		if ((cap = mem_malloc(HTTPD_MEM_OTHER, sizeof(*cap))) == NULL) {
+			pthread_mutex_unlock(&capture_startMutex);
+			return HTE_NOMEM;
+		}
+		memset(cap, 0, sizeof(*cap));
+		pthread_mutex_init(&cap->mutex, NULL);
+		__sync_synchronize();
+		httpd->capture = cap;
+	}
+	pthread_mutex_unlock(&capture_startMutex);
+	
+	pthread_mutex_lock(&cap->mutex);
+	
+	if (cap->f) fclose(cap->f);
+	if ((cap->f = fopen(path, "wb")) == NULL) {
+		pthread_mutex_unlock(&cap->mutex);
+		return HTE_WRITE;
+	}
+	
+	/* each file numbers its connections from 1, one that's still open starts again in this one */
+	cap->file++;
+	cap->nextId = 0;
+	
+	gettimeofday(&tv, NULL);
+	us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+	
+	fwrite(CAP_MAGIC, 1, 8, cap->f);
+	for (i = 0; i < 8; i++) fputc((us >> (i * 8)) & 0xFF, cap->f);
+	cap->last = mono_ns();
+	
+	pthread_mutex_unlock(&cap->mutex);
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_stopCapture(struct httpd_info *httpd) {
+	struct capture_info *cap;
+	
+	if (!httpd) return HTE_INVALPARAM;
+	if ((cap = httpd->capture) == NULL) return HTE_NONE;
+	
+	pthread_mutex_lock(&cap->mutex);
+	if (cap->f) fclose(cap->f);
+	cap->f = NULL;
+	pthread_mutex_unlock(&cap->mutex);
+	
+	return HTE_NONE;
+}
+
+void capture_data(struct session_info *session, unsigned char *data, size_t len) {
+	struct capture_info *cap;
+	
+	if ((cap = session->httpd->capture) == NULL) return;
+	
+	pthread_mutex_lock(&cap->mutex);
+	if (cap->f) {
+		if (session->captureId == 0 || session->captureFile != cap->file) {
+			session->captureId = ++cap->nextId;
+			session->captureFile = cap->file;
+			put_record(cap, CAP_OPEN, session->captureId);
+		}
+		put_record(cap, CAP_DATA, session->captureId);
+		put_varint(cap->f, len);
+		fwrite(data, 1, len, cap->f);
+	}
+	pthread_mutex_unlock(&cap->mutex);
+}
+
+void capture_close(struct session_info *session) {
+	struct capture_info *cap;
+	
+	if (session->captureId == 0) return;
+	if ((cap = session->httpd->capture) == NULL) return;
+	
+	pthread_mutex_lock(&cap->mutex);
+	if (cap->f && session->captureFile == cap->file) put_record(cap, CAP_CLOSE, session->captureId);
+	pthread_mutex_unlock(&cap->mutex);
+}
@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* capture file format (read by tools/replay.c)
+     header: "HTTPCAP1", then the wall clock start time as 8 bytes of little endian microseconds
+     records: type (1 byte), connection id (varint), microseconds since the previous record (varint)
+              CAP_DATA records are followed by a length (varint) and that many bytes
+   varints are LEB128 - 7 bits at a time, least significant first, top bit set if more follow */
+
+struct session_info;
+
+#define CAP_MAGIC "HTTPCAP1"
+
+enum capture_record {
+	CAP_OPEN  = 1,
+	CAP_DATA  = 2,
+	CAP_CLOSE = 3,
+};
+
+struct capture_info {
+	pthread_mutex_t mutex;
+	FILE *f;
+	unsigned long long last; /* mono_ns() */
+	unsigned int file; /* counts the files, a session's id is only good in the one it was given in */
+	unsigned int nextId;
+};
+
+void capture_data(struct session_info *session, unsigned char *data, size_t len);
+void capture_close(struct session_info *session);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,364 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#include "internal.h"
+#include "loop.h"
+#include "co.h"
+#include "mem.h"
+#include "mono.h"
+
+static __thread struct co_info *co_current;
+
+static unsigned long long co_deadline(int timeoutMs) {
+	if (timeoutMs <= 0) return 0;
+	return mono_ns() + (unsigned long long)timeoutMs * 1000000ULL;
+}
+
+/* ########################################################################## */
+
+/* an idle coroutine goes back on the cache's list, without its stack if there are plenty */
+static void co_putBack(struct co_info *co) {
+	struct co_cache *cache = co->cache;
+	
+	if (co->stack && cache->idleStacks >= CO_KEEP) {
+		munmap(co->stack, cache->stackSize + sysconf(_SC_PAGESIZE));
+		co->stack = NULL;
+		cache->stacks--;
+		if (co->timer.watch.fd != -1) {
+			close(co->timer.watch.fd);
+			co->timer.watch.fd = -1;
+		}
+	}
+	
+	if (co->stack) {
+		co->next = cache->free;
+		cache->free = co;
+		cache->idleStacks++;
+	} else {
+		co->next = cache->spare;
+		cache->spare = co;
+	}
+}
+
+static void co_resume(struct co_info *co) {
+	/* woken for something it's no longer waiting for */
+	if (!co->waiting) return;
+	co->waiting = 0;
+	
+	co_current = co;
+	swapcontext(&co->caller, &co->ctx);
+	co_current = NULL;
+	
+	if (co->done) {
+		co->cache->live--;
+		co_putBack(co);
+	}
+}
+
+static void co_event(struct loop_watch *watch, uint32_t events) {
+	co_resume((struct co_info *)watch);
+}
+
+static void co_timerEvent(struct loop_watch *watch, uint32_t events) {
+	co_resume(((struct co_timer *)watch)->co);
+}
+
+static void co_entry(void) {
+	struct co_info *co = co_current;
+	
+	co->fn(co->arg);
+	
+	/* never comes back here, the stack is reset by the next co_start() */
+	co->done = 1;
+	swapcontext(&co->ctx, &co->caller);
+}
+
+/* ########################################################################## */
+
+void co_cacheInit(struct co_cache *cache, struct loop_info *loop, size_t stackSize) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	
+	memset(cache, 0, sizeof(*cache));
+	cache->loop = loop;
+	cache->stackSize = (stackSize + page - 1) & ~(page - 1);
+}
+
+hte co_start(struct co_cache *cache, void (*fn)(void *arg), void *arg) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct co_info *co;
+	
+	if ((co = cache->free) != NULL) {
+		cache->free = co->next;
+		cache->idleStacks--;
+	} else if ((co = cache->spare) != NULL) {
+		cache->spare = co->next;
+	} else {
+		if ((co = mem_malloc(HTTPD_MEM_SERVER, sizeof(*co))) == NULL) return HTE_NOMEM;
+		memset(co, 0, sizeof(*co));
+		co->cache = cache;
+		co->watch.fd = -1;
+		co->watch.handler = co_event;
+		co->timer.watch.fd = -1;
+		co->timer.watch.handler = co_timerEvent;
+		co->timer.co = co;
+	}
+	
+	if (!co->stack) {
+		/* not from mem_malloc(), the guard page needs a mapping of its own */
+		if ((co->stack = mmap(NULL, cache->stackSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0)) == MAP_FAILED) {
+			co->stack = NULL;
+			co_putBack(co);
+			return HTE_NOMEM;
+		}
+		mprotect(co->stack, page, PROT_NONE);
+		cache->stacks++;
+	}
+	
+	if (getcontext(&co->ctx) != 0) {
+		co_putBack(co);
+		return HTE_THREAD;
+	}
+	co->ctx.uc_stack.ss_sp = (unsigned char *)co->stack + page;
+	co->ctx.uc_stack.ss_size = cache->stackSize;
+	co->ctx.uc_link = NULL;
+	makecontext(&co->ctx, co_entry, 0);
+	
+	co->fn = fn;
+	co->arg = arg;
+	co->done = 0;
+	cache->live++;
+	
+	co->waiting = 1;
+	co_resume(co);
+	
+	return HTE_NONE;
+}
+
+int co_active(void) {
+	return co_current != NULL;
+}
+
+/* ########################################################################## */
+
+/* returns 0 when the fd may be ready - or for no reason at all, so always try again
+   an fd of -1 waits for the deadline alone, and a deadline of 0 never comes */
+static int co_waitUntil(int fd, uint32_t events, unsigned long long deadline) {
+	struct co_info *co = co_current;
+	
+	if (!co) {
+		struct pollfd pfd;
+		unsigned long long now;
+		int ms = -1;
+		
+		if (deadline) {
+			if ((now = mono_ns()) >= deadline) goto timedOut;
+			ms = (deadline - now + 999999) / 1000000;
+		}
+		
+		pfd.fd = fd;
+		pfd.events = ((events & EPOLLIN) ? POLLIN : 0) | ((events & EPOLLOUT) ? POLLOUT : 0);
+		pfd.revents = 0;
+		if (poll(fd == -1 ? NULL : &pfd, fd == -1 ? 0 : 1, ms) == -1 && errno != EINTR) return -1;
+	} else {
+		struct loop_info *loop = co->cache->loop;
+		uint64_t n;
+		int e;
+		
+		if (fd == -1 && !deadline) return 0;
+		
+		if (fd != -1) {
+			co->watch.fd = fd;
+			if (loop_add(loop, &co->watch, events) != HTE_NONE) return -1;
+		}
+		if (deadline) {
+			struct itimerspec its;
+			
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = deadline / 1000000000ULL;
+			its.it_value.tv_nsec = deadline % 1000000000ULL;
+			
+			if (co->timer.watch.fd == -1 && (co->timer.watch.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) goto fail;
+			if (timerfd_settime(co->timer.watch.fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) goto fail;
+			if (loop_add(loop, &co->timer.watch, EPOLLIN) != HTE_NONE) goto fail;
+		}
+		
+		co->waiting = 1;
+		swapcontext(&co->ctx, &co->caller);
+		
+		if (fd != -1) loop_del(loop, &co->watch);
+		if (deadline) {
+			loop_del(loop, &co->timer.watch);
+			if (read(co->timer.watch.fd, &n, sizeof(n)) == -1) {
+				/* it hadn't fired */
+			}
+		}
+		goto check;
+fail:
+		e = errno;
+		if (fd != -1) loop_del(loop, &co->watch);
+		errno = e;
+		return -1;
+	}
+	
+check:
+	if (deadline && mono_ns() >= deadline) goto timedOut;
+	return 0;
+timedOut:
+	errno = ETIMEDOUT;
+	return -1;
+}
+
+int co_wait(int fd, uint32_t events, int timeoutMs) {
+	return co_waitUntil(fd, events, co_deadline(timeoutMs));
+}
+
+ssize_t co_recv(int fd, void *buf, size_t len, int flags, int timeoutMs) {
+	unsigned long long deadline = co_deadline(timeoutMs);
+	ssize_t l;
+	
+	/* with nothing else to do while waiting, the kernel may as well do it */
+	if (!co_current && !deadline) return recv(fd, buf, len, flags);
+	
+	for (;;) {
+		if ((l = recv(fd, buf, len, flags | MSG_DONTWAIT)) != -1) return l;
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+		if (co_waitUntil(fd, EPOLLIN, deadline) != 0) return -1;
+	}
+}
+
+ssize_t co_sendmsg(int fd, struct msghdr *msg, int flags, int timeoutMs) {
+	unsigned long long deadline = co_deadline(timeoutMs);
+	ssize_t l;
+	
+	if (!co_current && !deadline) return sendmsg(fd, msg, flags);
+	
+	for (;;) {
+		if ((l = sendmsg(fd, msg, flags | MSG_DONTWAIT)) != -1) return l;
+		if (errno == EINTR) continue;
+		if (errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+		if (co_waitUntil(fd, EPOLLOUT, deadline) != 0) return -1;
+	}
+}
+
+ssize_t co_send(int fd, const void *buf, size_t len, int flags, int timeoutMs) {
+	struct iovec iov;
+	struct msghdr msg;
+	
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	
+	return co_sendmsg(fd, &msg, flags, timeoutMs);
+}
+
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, int timeoutMs) {
+	unsigned long long deadline = co_deadline(timeoutMs);
+	socklen_t errlen;
+	int flags, r, err;
+	
+	if (!co_current && !deadline) return connect(fd, addr, addrlen);
+	
+	if ((flags = fcntl(fd, F_GETFL)) == -1) return -1;
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+	
+	if ((r = connect(fd, addr, addrlen)) != 0 && errno == EINPROGRESS) {
+		/* it's finished when the socket can be written to, and SO_ERROR says how it went */
+		for (;;) {
+			struct pollfd pfd;
+			
+			if ((r = co_waitUntil(fd, EPOLLOUT, deadline)) != 0) break;
+			
+			pfd.fd = fd;
+			pfd.events = POLLOUT;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, 0) != 1) continue;
+			
+			errlen = sizeof(err);
+			if ((r = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen)) == 0 && err != 0) {
+				errno = err;
+				r = -1;
+			}
+			break;
+		}
+	}
+	
+	err = errno;
+	fcntl(fd, F_SETFL, flags);
+	errno = err;
+	
+	return r;
+}
+
+void co_sleep(int ms) {
+	unsigned long long deadline;
+	int e = errno;
+	
+	if ((deadline = co_deadline(ms)) == 0) return;
+	
+	/* there's only the deadline to wait for, so it always ends in a timeout */
+	while (co_waitUntil(-1, 0, deadline) == 0);
+	
+	errno = e;
+}
+
+/* ########################################################################## */
+
+EXPORT ssize_t httpd_recv(int fd, void *buf, size_t len, int timeoutMs) {
+	return co_recv(fd, buf, len, 0, timeoutMs);
+}
+
+EXPORT ssize_t httpd_send(int fd, const void *buf, size_t len, int timeoutMs) {
+	const unsigned char *p = buf;
+	size_t done = 0;
+	ssize_t l;
+	
+	while (done < len) {
+		if ((l = co_send(fd, &p[done], len - done, MSG_NOSIGNAL, timeoutMs)) == -1) return -1;
+		done += l;
+	}
+	
+	return done;
+}
+
+EXPORT int httpd_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, int timeoutMs) {
+	return co_connect(fd, addr, addrlen, timeoutMs);
+}
+
+EXPORT void httpd_sleep(int ms) {
+	co_sleep(ms);
+}
@@ -0,0 +1,89 @@
+#ifndef CO_H
+#define CO_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* coroutines - with httpd_setCoroutines() each callback runs on a stack of its own on the I/O
+   loop that read its request, and the co_*() calls below hand the loop back while they wait
+   (on any other thread they block as usual, or poll() when given a timeout)
+   stacks are kept on a list per loop and reused, only the loop's thread ever touches it */
+
+#include <stdint.h>
+#include <ucontext.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "loop.h"
+
+#define CO_STACK 65536 /* unless httpd_setCoroutines() is told otherwise */
+#define CO_KEEP  64    /* most idle stacks a loop keeps */
+
+struct co_info;
+
+/* the timerfd for a wait's deadline, which needs a watch of its own */
+struct co_timer {
+	struct loop_watch watch; /* must be first */
+	struct co_info *co;
+};
+
+struct co_info {
+	struct loop_watch watch; /* must be first, the fd being waited for */
+	struct co_timer timer;
+	struct co_cache *cache;
+	struct co_info *next; /* on one of the cache's lists */
+	
+	ucontext_t ctx;
+	ucontext_t caller;
+	void *stack; /* mmap()ed, with a guard page at the bottom */
+	
+	void (*fn)(void *arg);
+	void *arg;
+	int waiting; /* suspended, for the loop to resume */
+	int done;
+};
+
+/* one per loop, a coroutine's struct is never freed so that an event for it that's still
+   on its way from epoll_wait() can't land on freed memory - at worst it wakes the next user
+   early, and every wait goes round again if it was woken for nothing */
+struct co_cache {
+	struct loop_info *loop;
+	size_t stackSize;
+	struct co_info *free;  /* finished, with their stacks */
+	struct co_info *spare; /* finished, and their stacks given back */
+	int idleStacks;
+	int live;   /* started and not yet finished */
+	int stacks; /* allocated, in use or idle */
+};
+
+void co_cacheInit(struct co_cache *cache, struct loop_info *loop, size_t stackSize);
+/* must be called on the cache's loop thread, and runs 'fn' until it first waits */
+hte co_start(struct co_cache *cache, void (*fn)(void *arg), void *arg);
+/* non-zero on a coroutine */
+int co_active(void);
+
+/* 'timeoutMs' of 0 waits for ever, a timeout fails with errno set to ETIMEDOUT */
+int co_wait(int fd, uint32_t events, int timeoutMs);
+ssize_t co_recv(int fd, void *buf, size_t len, int flags, int timeoutMs);
+ssize_t co_sendmsg(int fd, struct msghdr *msg, int flags, int timeoutMs);
+ssize_t co_send(int fd, const void *buf, size_t len, int flags, int timeoutMs);
+int co_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, int timeoutMs);
+void co_sleep(int ms);
+
+#endif /* CO_H */
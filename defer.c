@@ -0,0 +1,307 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "loop.h"
+#include "defer.h"
+#include "mem.h"
+#include "mono.h"
+
+#define DEFER_BATCH 64 /* expired sessions closed per trip round the lock */
+
+static pthread_mutex_t defer_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char defer_504[] =
+	"HTTP/1.1 504 Gateway Timeout\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+/* the defer mutex must be held for all of these */
+static void defer_arm(struct defer_info *defer) {
+	struct itimerspec its;
+	
+	memset(&its, 0, sizeof(its));
+	if (defer->head) {
+		its.it_value.tv_sec = defer->head->deadline / 1000000000ULL;
+		its.it_value.tv_nsec = defer->head->deadline % 1000000000ULL;
+	}
+	timerfd_settime(defer->timer.fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void defer_link(struct defer_info *defer, struct httpd_deferred *d) {
+	struct httpd_deferred *p;
+	
+	/* handlers tend to use the same timeout every time, so this is nearly always the tail */
+	for (p = defer->tail; p && p->deadline > d->deadline; p = p->prev);
+	
+	d->prev = p;
+	d->next = p ? p->next : defer->head;
+	if (d->next) {
+		d->next->prev = d;
+	} else {
+		defer->tail = d;
+	}
+	if (p) {
+		p->next = d;
+	} else {
+		defer->head = d;
+		defer_arm(defer);
+	}
+	d->linked = 1;
+}
+
+/* the timer is left as it is, if it goes off for nothing it's just set again */
+static void defer_unlink(struct defer_info *defer, struct httpd_deferred *d) {
+	if (!d->linked) return;
+	
+	if (d->prev) {
+		d->prev->next = d->next;
+	} else {
+		defer->head = d->next;
+	}
+	if (d->next) {
+		d->next->prev = d->prev;
+	} else {
+		defer->tail = d->prev;
+	}
+	d->prev = d->next = NULL;
+	d->linked = 0;
+}
+
+/* ########################################################################## */
+
+static void defer_timer(struct loop_watch *watch, uint32_t events) {
+	struct defer_info *defer = (struct defer_info *)watch;
+	struct session_info *expired[DEFER_BATCH];
+	struct httpd_deferred *d;
+	unsigned long long now, n;
+	int i, c;
+	
+	if (read(watch->fd, &n, sizeof(n)) != sizeof(n)) return;
+	now = mono_ns();
+	
+	do {
+		pthread_mutex_lock(&defer->mutex);
+		for (c = 0; c < DEFER_BATCH && (d = defer->head) != NULL && d->deadline <= now; c++) {
+			defer_unlink(defer, d);
+			/* the handle stays for httpd_resume() to find, but the session goes */
+			d->state = DEFER_EXPIRED;
+			expired[c] = d->session;
+			d->session = NULL;
+			expired[c]->deferred = NULL;
+		}
+		if (c < DEFER_BATCH) defer_arm(defer);
+		pthread_mutex_unlock(&defer->mutex);
+		
+		for (i = 0; i < c; i++) {
+			/* whatever the callback put in the response before it deferred is no use to a 504 */
+			session_answer(expired[i], defer_504, sizeof(defer_504) - 1);
+			session_close(expired[i]);
+		}
+	} while (c == DEFER_BATCH);
+}
+
+static struct defer_info *defer_get(struct httpd_info *httpd) {
+	struct defer_info *defer;
+	
+	pthread_mutex_lock(&defer_startMutex);
+	
+	if ((defer = httpd->defer) != NULL) goto done;
+	
+	if ((defer = mem_malloc(HTTPD_MEM_SERVER, sizeof(*defer))) == NULL) goto done;
+	memset(defer, 0, sizeof(*defer));
+	defer->timer.fd = -1;
+	defer->timer.handler = defer_timer;
+	pthread_mutex_init(&defer->mutex, NULL);
+	
+	if ((defer->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) goto die;
+	if ((defer->loop = loop_get(httpd)) == NULL) goto die;
+	if (loop_add(defer->loop, &defer->timer, EPOLLIN) != HTE_NONE) goto die;
+	
+	httpd->defer = defer;
+	
+done:
+	pthread_mutex_unlock(&defer_startMutex);
+	return defer;
+die:
+	if (defer->timer.fd != -1) close(defer->timer.fd);
+	pthread_mutex_destroy(&defer->mutex);
+	mem_free(defer);
+	defer = NULL;
+	goto done;
+}
+
+/* ########################################################################## */
+
+int defer_handOff(struct session_info *session) {
+	struct httpd_deferred *d = session->deferred;
+	struct defer_info *defer = d->defer;
+	
+	pthread_mutex_lock(&defer->mutex);
+	
+	if (d->completeWanted) {
+		/* it was answered before we got here, so we may as well send it */
+		pthread_mutex_unlock(&defer->mutex);
+		session->deferred = NULL;
+		mem_free(d);
+		http_respond(session, 1);
+		return 0;
+	}
+	
+	d->handedOff = 1;
+	if (d->state == DEFER_CALLBACK) {
+		d->state = DEFER_PENDING;
+		if (d->deadline) defer_link(defer, d);
+	}
+	
+	pthread_mutex_unlock(&defer->mutex);
+	
+	return 1;
+}
+
+int defer_abandon(struct session_info *session) {
+	struct httpd_deferred *d = session->deferred;
+	struct defer_info *defer = d->defer;
+	
+	pthread_mutex_lock(&defer->mutex);
+	session->deferred = NULL;
+	if (d->completeWanted) {
+		/* httpd_complete() has been and gone, nobody else has the handle */
+		pthread_mutex_unlock(&defer->mutex);
+		mem_free(d);
+		return 0;
+	}
+	if (d->state == DEFER_RESUMED) {
+		/* the resumer may be filling in the response as we speak, so it's left for httpd_complete() to close */
+		d->handedOff = 1;
+		d->abandoned = 1;
+		pthread_mutex_unlock(&defer->mutex);
+		return 1;
+	}
+	defer_unlink(defer, d);
+	d->state = DEFER_EXPIRED;
+	d->session = NULL;
+	pthread_mutex_unlock(&defer->mutex);
+	
+	return 0;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_defer(struct session_info *session, int timeout, struct httpd_deferred **handle) {
+	struct httpd_deferred *d;
+	struct defer_info *defer;
+	
+	if (!session || !handle || timeout < 0) return HTE_INVALPARAM;
+	if (session->h2 || session->ws || session->sse || session->deferred) return HTE_INVALPARAM;
+	
+	if ((defer = defer_get(session->httpd)) == NULL) return HTE_THREAD;
+	
+	if ((d = mem_malloc(HTTPD_MEM_SESSION, sizeof(*d))) == NULL) return HTE_NOMEM;
+	memset(d, 0, sizeof(*d));
+	d->defer = defer;
+	d->session = session;
+	d->state = DEFER_CALLBACK;
+	if (timeout > 0) d->deadline = mono_ns() + (unsigned long long)timeout * 1000000ULL;
+	
+	session->deferred = d;
+	*handle = d;
+	
+	return HTE_NONE;
+}
+
+EXPORT struct session_info *httpd_resume(struct httpd_deferred *d) {
+	struct defer_info *defer;
+	struct session_info *session;
+	
+	if (!d) return NULL;
+	defer = d->defer;
+	
+	pthread_mutex_lock(&defer->mutex);
+	if (d->state == DEFER_EXPIRED) {
+		pthread_mutex_unlock(&defer->mutex);
+		mem_free(d);
+		return NULL;
+	}
+	defer_unlink(defer, d);
+	d->state = DEFER_RESUMED;
+	session = d->session;
+	pthread_mutex_unlock(&defer->mutex);
+	
+	return session;
+}
+
+EXPORT hte httpd_complete(struct httpd_deferred *d) {
+	struct defer_info *defer;
+	struct session_info *session;
+	int abandoned;
+	hte ret;
+	
+	if (!d) return HTE_INVALPARAM;
+	defer = d->defer;
+	
+	pthread_mutex_lock(&defer->mutex);
+	if (d->state == DEFER_EXPIRED) {
+		pthread_mutex_unlock(&defer->mutex);
+		mem_free(d);
+		return HTE_INVALPARAM;
+	}
+	if (d->state != DEFER_RESUMED) {
+		pthread_mutex_unlock(&defer->mutex);
+		return HTE_INVALPARAM;
+	}
+	if (!d->handedOff) {
+		/* the callback is still on its way out, its thread sends the response */
+		d->completeWanted = 1;
+		pthread_mutex_unlock(&defer->mutex);
+		return HTE_NONE;
+	}
+	session = d->session;
+	abandoned = d->abandoned;
+	pthread_mutex_unlock(&defer->mutex);
+	
+	session->deferred = NULL;
+	mem_free(d);
+	
+	/* the client has had its answer already, the callback failed */
+	if (abandoned) {
+		session_close(session);
+		return HTE_RESPOND;
+	}
+	
+	ret = http_respond(session, 1) != HTE_NONE ? HTE_RESPOND : HTE_NONE;
+	session_close(session);
+	
+	return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef DEFER_H
+#define DEFER_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* deferred responses - httpd_defer() marks the session, and once the callback has returned
+   defer_handOff() lets the thread go while the connection waits for httpd_complete()
+   deadlines are kept in order on one timerfd per httpd, on the loop */
+
+#include "loop.h"
+
+struct session_info;
+
+enum defer_state {
+	DEFER_CALLBACK = 0, /* the callback hasn't returned yet */
+	DEFER_PENDING,      /* waiting, with nobody looking after the session */
+	DEFER_RESUMED,      /* httpd_resume() has handed the session out */
+	DEFER_EXPIRED,      /* the deadline passed (or the callback failed), the session is gone */
+};
+
+struct httpd_deferred {
+	struct defer_info *defer;
+	struct session_info *session;
+	struct httpd_deferred *prev;
+	struct httpd_deferred *next;
+	unsigned long long deadline; /* CLOCK_MONOTONIC in ns, 0 for never */
+	enum defer_state state;
+	int linked;         /* on the deadline list */
+	int handedOff;      /* the callback's thread has let go of the session */
+	int completeWanted; /* httpd_complete() came before the callback's thread let go */
+	int abandoned;      /* the callback failed after it was resumed, httpd_complete() only closes it */
+};
+
+struct defer_info {
+	struct loop_watch timer; /* must be first */
+	struct loop_info *loop;
+	pthread_mutex_t mutex; /* the list, and the state of every handle */
+	struct httpd_deferred *head;
+	struct httpd_deferred *tail;
+};
+
+/* returns 1 if the session now belongs to the handle, or 0 if it was completed while the
+   callback was still running (the response has been sent, the session is the caller's to close) */
+int defer_handOff(struct session_info *session);
+/* for a session that is being closed without the response it was deferred for - returns 1 if it
+   has been resumed, and must be left for httpd_complete() to close */
+int defer_abandon(struct session_info *session);
+
+#endif /* DEFER_H */
@@ -0,0 +1,214 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "etag.h"
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+#define ROTL(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t etag_read64(const unsigned char *p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+static inline uint32_t etag_read32(const unsigned char *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t etag_round(uint64_t acc, uint64_t in) {
+	acc += in * P2;
+	acc = ROTL(acc, 31);
+	return acc * P1;
+}
+static inline uint64_t etag_merge(uint64_t acc, uint64_t v) {
+	acc ^= etag_round(0, v);
+	return acc * P1 + P4;
+}
+
+/* XXH64, with a seed of 0 - four lanes of 8 bytes at a time */
+static uint64_t etag_hash(const unsigned char *p, size_t len) {
+	const unsigned char *end = p + len;
+	uint64_t h;
+	
+	if (len >= 32) {
+		uint64_t v1 = P1 + P2, v2 = P2, v3 = 0, v4 = -P1;
+		
+		do {
+			v1 = etag_round(v1, etag_read64(p));
+			v2 = etag_round(v2, etag_read64(p + 8));
+			v3 = etag_round(v3, etag_read64(p + 16));
+			v4 = etag_round(v4, etag_read64(p + 24));
+			p += 32;
+		} while (p + 32 <= end);
+		
+		h = ROTL(v1, 1) + ROTL(v2, 7) + ROTL(v3, 12) + ROTL(v4, 18);
+		h = etag_merge(h, v1);
+		h = etag_merge(h, v2);
+		h = etag_merge(h, v3);
+		h = etag_merge(h, v4);
+	} else {
+		h = P5;
+	}
+	h += len;
+	
+	for (; p + 8 <= end; p += 8) {
+		h ^= etag_round(0, etag_read64(p));
+		h = ROTL(h, 27) * P1 + P4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)etag_read32(p) * P1;
+		h = ROTL(h, 23) * P2 + P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * P5;
+		h = ROTL(h, 11) * P1;
+	}
+	
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	
+	return h;
+}
+
+/* a shared body's hash is kept with it, it can't change */
+static uint64_t etag_body(struct httpd_body *body) {
+	uint64_t h;
+	
+	if (body->hashed) return body->hash;
+	h = etag_hash(body->data, body->len);
+	body->hash = h;
+	__sync_synchronize();
+	body->hashed = 1;
+	
+	return h;
+}
+
+/* the buffer's hash, mixed with that of each shared body and where it is */
+static uint64_t etag_response(struct http_response *rsp) {
+	uint64_t h;
+	int i;
+	
+	h = etag_hash(rsp->buf ? rsp->buf->data : (unsigned char *)"", rsp->buf ? rsp->buf->len : 0);
+	for (i = 0; i < rsp->bodyc; i++) {
+		h = etag_merge(h, etag_body(rsp->bodies[i]));
+		h = etag_merge(h, rsp->bodyAt[i]);
+	}
+	
+	return h;
+}
+
+/* the opaque part of a tag, without its W/ and quotes - for a weak comparison */
+static void etag_opaque(char *tag, size_t len, char **opaque, size_t *opaqueLen) {
+	if (len >= 2 && tag[0] == 'W' && tag[1] == '/') {
+		tag += 2;
+		len -= 2;
+	}
+	if (len >= 2 && tag[0] == '"' && tag[len - 1] == '"') {
+		tag++;
+		len -= 2;
+	}
+	*opaque = tag;
+	*opaqueLen = len;
+}
+
+static int etag_matches(char *inm, char *etag) {
+	char *want, *p, *e;
+	size_t wantLen, len;
+	
+	etag_opaque(etag, strlen(etag), &want, &wantLen);
+	
+	for (p = inm; *p; p = e) {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+		if (!*p) break;
+		
+		/* a quoted tag may hold a comma */
+		e = p;
+		if (e[0] == 'W' && e[1] == '/') e += 2;
+		if (*e == '"') {
+			for (e++; *e && *e != '"'; e++);
+			if (*e) e++;
+		}
+		for (; *e && *e != ',' && *e != ' ' && *e != '\t'; e++);
+		
+		if (e - p == 1 && *p == '*') return 1;
+		etag_opaque(p, e - p, &p, &len);
+		if (len == wantLen && !memcmp(p, want, len)) return 1;
+	}
+	
+	return 0;
+}
+
+hte etag_prepare(struct session_info *session) {
+	struct http_response *rsp = session->xfer.response;
+	char *method = (char *)session->xfer.request->method;
+	char *etag = NULL, *inm;
+	char tag[24];
+	int i;
+	
+	if (!session->httpd->etags || session->ws || session->sse) return HTE_NONE;
+	if (rsp->httpCode != 200 || !method || (strcmp(method, "GET") && strcmp(method, "HEAD"))) return HTE_NONE;
+	
+	for (i = 0; i < rsp->data.headerc; i++) {
+		char *name = (char *)rsp->data.headers[i].name;
+		if (!name || !rsp->data.headers[i].value) continue;
+		
+		/* it can't be known what an encoded body was, and the handler's own tag stands */
+		if (!strcasecmp(name, "Content-Encoding")) return HTE_NONE;
+		if (!strcasecmp(name, "ETag")) etag = (char *)rsp->data.headers[i].value;
+	}
+	
+	if (!etag) {
+		snprintf(tag, sizeof(tag), "W/\"%016llx\"", (unsigned long long)etag_response(rsp));
+		if (httpd_addHeader(session, "ETag", "%s", tag) != HTE_NONE) return HTE_NOMEM;
+		etag = tag;
+	}
+	
+	if ((inm = httpd_getHeader(session, "If-None-Match")) == NULL || !etag_matches(inm, etag)) return HTE_NONE;
+	
+	rsp->httpCode = 304;
+	rsp->httpReason = NULL;
+	if (rsp->buf) {
+		buf_free(rsp->buf);
+		rsp->buf = NULL;
+	}
+	body_drop(rsp);
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,33 @@
+#ifndef ETAG_H
+#define ETAG_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* automatic validators - a buffered 200 to a GET or HEAD is hashed (XXH64) into a weak ETag, weak
+   because the same body may go out compressed or not, and an If-None-Match that matches it (or an
+   ETag the handler set) turns the response into a 304 without its body
+   a shared body's hash is worked out once and kept with it, then mixed in with the buffer's */
+
+struct session_info;
+
+/* called from http_prepare() before the body is compressed */
+hte etag_prepare(struct session_info *session);
+
+#endif /* ETAG_H */
@@ -0,0 +1,91 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "expect.h"
+
+static const char expect_100[] =
+	"HTTP/1.1 100 Continue\r\n"
+	"\r\n";
+
+int expect_check(struct session_info *session, int *cont) {
+	struct httpd_info *httpd = session->httpd;
+	struct http_request *req = session->xfer.request;
+	httpd_headHook hook;
+	void *ctx;
+	char *expect;
+	long base;
+	int code;
+	
+	*cont = 0;
+	
+	/* the parse holds everything as indexes until it's done, the buffer may yet move */
+	base = (long)req->buf->data;
+	http_rebase(req, base);
+	
+	code = 0;
+	if ((expect = httpd_getHeader(session, "Expect")) != NULL) {
+		if (strcasecmp(expect, "100-continue")) code = 417;
+		else *cont = 1;
+	}
+	if (!code && (hook = (httpd_headHook)hook_get(&httpd->headHook, &ctx)) != NULL) {
+		if ((code = hook(ctx, session)) != 0 && (code < 400 || code > 599)) code = 500;
+	}
+	
+	http_rebase(req, -base);
+	
+	return code;
+}
+
+hte expect_head(struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	int code, cont;
+	
+	/* the parse harnesses have no server */
+	if (!session->httpd || req->data.contentLength == 0) return HTE_NONE;
+	
+	if ((code = expect_check(session, &cont)) != 0) {
+		req->refused = code;
+		return HTE_PARSE;
+	}
+	
+	/* an HTTP/1.0 client doesn't wait for it, and there's no point once the body's coming */
+	if (!cont || strcmp((char *)&req->buf->data[(long)req->httpVersion], "HTTP/1.1") || req->state != STATE_START_CONTENT) return HTE_NONE;
+	
+	return session_answer(session, expect_100, sizeof(expect_100) - 1);
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setHeadHook(struct httpd_info *httpd, httpd_headHook hook, void *ctx) {
+	if (!httpd) return HTE_INVALPARAM;
+	
+	hook_set(&httpd->headHook, (hook_fn)hook, ctx);
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,35 @@
+#ifndef EXPECT_H
+#define EXPECT_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* a request's head, before its body - the head hook, and "Expect"
+   a refusal is left in the request's 'refused' for limit_answer(), as the limits' are */
+
+struct session_info;
+
+/* the "Expect" header and the head hook, for either protocol - the status to refuse with or 0,
+   and whether the client is waiting on a 100 Continue */
+int expect_check(struct session_info *session, int *cont);
+
+/* called by http_readMore() once the head is in, for a request with a body */
+hte expect_head(struct session_info *session);
+
+#endif /* EXPECT_H */
@@ -0,0 +1,118 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* libFuzzer entry point for the HPACK decoder
+   the input is a run of header blocks, each after a byte that gives its length, decoded with one
+   table as a connection's would be - the first byte shrinks the table to start with (16-4096 bytes),
+   as a size update would. every field that comes out goes back through the encoder, and must
+   decode to the same thing again */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "httpd.h"
+#include "buf.h"
+#include "hpack.h"
+
+struct field {
+	unsigned char *name, *value;
+	size_t nameLen, valueLen;
+	int seen;
+};
+
+static hte check(void *ctx, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	struct field *f = ctx;
+	size_t i;
+
+	if (nameLen != f->nameLen || valueLen != f->valueLen) abort();
+	for (i = 0; i < nameLen; i++) if (name[i] != tolower(f->name[i])) abort();
+	if (memcmp(value, f->value, valueLen)) abort();
+	f->seen++;
+
+	return HTE_NONE;
+}
+
+static hte emit(void *ctx, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	struct hpack_table table;
+	struct buf *block = NULL;
+	struct field f;
+	char *n, *v;
+
+	/* the encoder takes strings */
+	if (memchr(name, '\0', nameLen) || memchr(value, '\0', valueLen)) return HTE_NONE;
+	if ((n = malloc(nameLen + valueLen + 2)) == NULL) return HTE_NONE;
+	v = &n[nameLen + 1];
+	memcpy(n, name, nameLen);
+	n[nameLen] = '\0';
+	memcpy(v, value, valueLen);
+	v[valueLen] = '\0';
+
+	if (hpack_encodeField(&block, n, v) == 0) {
+		f.name = name;
+		f.nameLen = nameLen;
+		f.value = value;
+		f.valueLen = valueLen;
+		f.seen = 0;
+		hpack_tableInit(&table);
+		if (hpack_decode(&table, block->data, block->next, check, &f) != HTE_NONE || f.seen != 1) abort();
+		hpack_tableFree(&table);
+	}
+
+	if (block) buf_free(block);
+	free(n);
+
+	return HTE_NONE;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	struct hpack_table table;
+	unsigned char *block;
+	size_t len;
+
+	if (size < 2) return 0;
+	hpack_tableInit(&table);
+	table.maxSize = ((size_t)data[0] + 1) * 16;
+	data++;
+	size--;
+
+	while (size > 0) {
+		len = data[0];
+		data++;
+		size--;
+		if (len > size) len = size;
+
+		/* a block of its own, so that reading past it is caught */
+		if ((block = malloc(len ? len : 1)) == NULL) break;
+		memcpy(block, data, len);
+		if (hpack_decode(&table, block, len, emit, NULL) != HTE_NONE) {
+			free(block);
+			break;
+		}
+		free(block);
+		data += len;
+		size -= len;
+	}
+
+	hpack_tableFree(&table);
+
+	return 0;
+}
@@ -0,0 +1,84 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* libFuzzer entry point for http_parse()
+   the first byte of the input picks the slice size (1-256), and the rest is
+   revealed to the parser a slice at a time, the same way http_read() does.
+   link it with standalone.c to get a main() that just replays files */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "httpd.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "mem.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	struct session_info session;
+	struct http_request req;
+	volatile size_t sink = 0;
+	size_t step, len;
+	int i;
+
+	if (size < 2) return 0;
+	step = (size_t)data[0] + 1;
+	data++;
+	len = size - 1;
+
+	memset(&session, 0, sizeof(session));
+	memset(&req, 0, sizeof(req));
+	session.xfer.request = &req;
+	if ((req.buf = buf_alloc(NULL, len)) == NULL) return 0;
+	memcpy(req.buf->data, data, len);
+
+	req.state = STATE_START;
+	for (req.buf->next = 0; req.buf->next < len; ) {
+		req.buf->next += step;
+		if (req.buf->next > len) req.buf->next = len;
+		if (http_parse(&session) != HTE_NONE) break;
+		if (req.state == STATE_ERROR || req.state == STATE_COMPLETE) break;
+	}
+
+	if (req.state == STATE_COMPLETE) {
+		http_parse_fixup(&session);
+
+		/* walk everything that a callback could look at */
+		sink += strlen((char *)req.method);
+		sink += strlen((char *)req.uri);
+		sink += strlen((char *)req.httpVersion);
+		for (i = 0; i < req.data.headerc; i++) {
+			sink += strlen((char *)req.data.headers[i].name);
+			sink += strlen((char *)req.data.headers[i].value);
+		}
+		if (req.data.content) {
+			size_t j;
+			for (j = 0; j < req.data.contentReceived; j++) sink += req.data.content[j];
+		}
+	}
+
+	buf_free(req.buf);
+	mem_free(req.data.headers);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* libFuzzer entry point for the multipart/form-data parser
+   the input is the body of an upload to a server with httpd_setMultipart() on, after a head that
+   names its boundary ("XyZ") - the first byte picks the slice size (1-256), and the body is read a
+   slice at a time, through the same calls http_readMore() makes, so delimiters and part heads get
+   split across reads. fields over 32 bytes go to memfds, as a big upload's would */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "httpd.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "mem.h"
+#include "expect.h"
+#include "multipart.h"
+
+static struct httpd_info httpd;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	struct session_info session;
+	struct http_request req;
+	struct httpd_part *parts;
+	volatile size_t sink = 0;
+	char head[160];
+	size_t step, len, headLen, pos, k;
+	int i, partc;
+
+	if (size < 2) return 0;
+	step = (size_t)data[0] + 1;
+	data++;
+	len = size - 1;
+
+	if (!httpd.multipart && httpd_setMultipart(&httpd, 1, 32, NULL) != HTE_NONE) return 0;
+
+	headLen = snprintf(head, sizeof(head),
+		"POST /upload HTTP/1.1\r\n"
+		"Content-Type: multipart/form-data; boundary=XyZ\r\n"
+		"Content-Length: %zu\r\n"
+		"\r\n", len);
+
+	memset(&session, 0, sizeof(session));
+	memset(&req, 0, sizeof(req));
+	session.fd = -1;
+	session.httpd = &httpd;
+	session.xfer.request = &req;
+	if ((req.buf = buf_alloc(NULL, headLen + len + 1)) == NULL) return 0;
+	memcpy(req.buf->data, head, headLen);
+
+	/* the head arrives in one go, it's the body that's being fuzzed */
+	req.state = STATE_START;
+	req.buf->next = headLen;
+	for (pos = 0; ; pos += k) {
+		if (http_parse(&session) != HTE_NONE) break;
+		if (req.state == STATE_ERROR) break;
+
+		if (!req.headSeen && req.state >= STATE_START_CONTENT) {
+			req.headSeen = 1;
+			if (multipart_start(&session) != HTE_NONE) break;
+			if (expect_head(&session) != HTE_NONE) break;
+		}
+		if (req.multipart && multipart_take(&session) != HTE_NONE) break;
+		if (req.state == STATE_COMPLETE || pos >= len) break;
+
+		k = len - pos < step ? len - pos : step;
+		memcpy(&req.buf->data[req.buf->next], &data[pos], k);
+		req.buf->next += k;
+	}
+
+	/* walk everything that a callback could look at */
+	if (req.state == STATE_COMPLETE && !req.refused) {
+		partc = httpd_getParts(&session, &parts);
+		for (i = 0; i < partc; i++) {
+			sink += strlen(parts[i].name);
+			if (parts[i].filename) sink += strlen(parts[i].filename);
+			if (parts[i].contentType) sink += strlen(parts[i].contentType);
+			if (parts[i].data) {
+				for (k = 0; k < parts[i].len; k++) sink += (unsigned char)parts[i].data[k];
+			} else {
+				char b[256];
+				ssize_t l;
+				while ((l = read(parts[i].fd, b, sizeof(b))) > 0) sink += l;
+			}
+		}
+	}
+
+	if (req.multipart) multipart_free(req.multipart);
+	buf_free(req.buf);
+	mem_free(req.data.headers);
+
+	return 0;
+}
@@ -0,0 +1,86 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* libFuzzer entry point for the query string and form parameters
+   the input is taken as a request's URI, split as the parser does, and its query indexed - then as
+   an application/x-www-form-urlencoded body. every parameter is asked for by its own (decoded) name,
+   which decodes them all into the space the index came with. the first byte has every so many of
+   the names changed a little before they're asked for, so that names that don't match are too */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "httpd.h"
+#include "http.h"
+#include "query.h"
+#include "mem.h"
+
+static volatile size_t sink;
+
+static void query_all(struct query *q, int mangle) {
+	char name[256];
+	size_t n;
+	int i;
+
+	for (i = 0; i < q->paramc; i++) {
+		if (q->params[i].nameLen >= sizeof(name)) continue;
+		n = http_unescape((unsigned char *)name, q->params[i].name, q->params[i].nameLen, HTTP_UNESCAPE_PLUS);
+		name[n] = '\0';
+		if (mangle && n > 0 && i % mangle == 0) name[n / 2] ^= 1;
+
+		/* the same one twice, the second from the decoded copy */
+		sink += (size_t)query_get(q, name);
+		sink += (size_t)query_get(q, name);
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	struct query *q;
+	unsigned char *p;
+	size_t len, at;
+	int mangle;
+
+	if (size < 2) return 0;
+	mangle = data[0] % 8;
+	data++;
+	len = size - 1;
+
+	/* the parser gives the URI a nul, it has none of its own to stop at */
+	if ((p = malloc(len + 1)) == NULL) return 0;
+	memcpy(p, data, len);
+	p[len] = '\0';
+	if ((at = http_uri_split(p)) != 0 && (q = query_index(&p[at], strlen((char *)&p[at]))) != NULL) {
+		query_all(q, mangle);
+		query_free(q);
+	}
+	free(p);
+
+	/* a body has no nul, and may have anything in it */
+	if ((p = malloc(len)) == NULL) return 0;
+	memcpy(p, data, len);
+	if ((q = query_index(p, len)) != NULL) {
+		query_all(q, mangle);
+		query_free(q);
+	}
+	free(p);
+
+	return 0;
+}
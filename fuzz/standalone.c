@@ -0,0 +1,60 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* a main() for the fuzz targets that just replays files, for when there's no libFuzzer (gcc)
+   every target takes the first byte of its input as a knob (a slice size, a table size...), so the
+   file is the rest of the input, and each is replayed with a handful of settings of it */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char *argv[]) {
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		unsigned char *data;
+		FILE *f;
+		long l;
+
+		if ((f = fopen(argv[i], "rb")) == NULL) {
+			perror(argv[i]);
+			continue;
+		}
+		fseek(f, 0, SEEK_END);
+		l = ftell(f);
+		fseek(f, 0, SEEK_SET);
+
+		if (l > 0 && (data = malloc(l + 1)) != NULL) {
+			if (fread(&data[1], 1, l, f) == (size_t)l) {
+				int s;
+				for (s = 0; s < 256; s += 17) {
+					data[0] = s;
+					LLVMFuzzerTestOneInput(data, l + 1);
+				}
+			}
+			free(data);
+		}
+		fclose(f);
+	}
+
+	return 0;
+}
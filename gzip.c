@@ -0,0 +1,407 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "gzip.h"
+#include "mem.h"
+
+static pthread_mutex_t gzip_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef HTTPD_ZLIB
+
+#include <zlib.h>
+
+struct gzip_stream {
+	z_stream z;
+	struct gzip_stream *next; /* on the spares */
+	enum gzip_format format;
+	int level;
+};
+
+/* not "text/" as a whole, an event stream mustn't be held back */
+static char *gzip_defaults[] = {
+	"text/html", "text/plain", "text/css", "text/csv", "text/xml", "text/javascript",
+	"application/json", "application/javascript", "application/xml", "image/svg+xml",
+	NULL
+};
+
+static __thread struct gzip_stream *gzip_mine[GZIP_FORMATS];
+static pthread_key_t gzip_key;
+static pthread_once_t gzip_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t gzip_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct gzip_stream *gzip_spares[GZIP_FORMATS];
+static int gzip_kept;
+
+static voidpf gzip_zalloc(voidpf opaque, uInt items, uInt size) {
+	return mem_malloc(HTTPD_MEM_OTHER, (size_t)items * size);
+}
+static void gzip_zfree(voidpf opaque, voidpf p) {
+	mem_free(p);
+}
+
+static void gzip_spare(struct gzip_stream *s) {
+	pthread_mutex_lock(&gzip_mutex);
+	if (gzip_kept < GZIP_KEEP) {
+		s->next = gzip_spares[s->format];
+		gzip_spares[s->format] = s;
+		gzip_kept++;
+		s = NULL;
+	}
+	pthread_mutex_unlock(&gzip_mutex);
+	
+	if (!s) return;
+	deflateEnd(&s->z);
+	mem_free(s);
+}
+
+/* the thread's own go back to the spares as it exits */
+static void gzip_threadExit(void *arg) {
+	int i;
+	
+	for (i = 0; i < GZIP_FORMATS; i++) {
+		if (!gzip_mine[i]) continue;
+		gzip_spare(gzip_mine[i]);
+		gzip_mine[i] = NULL;
+	}
+}
+
+static void gzip_keyInit(void) {
+	pthread_key_create(&gzip_key, gzip_threadExit);
+}
+
+static struct gzip_stream *gzip_get(enum gzip_format format, int level) {
+	struct gzip_stream *s;
+	
+	pthread_once(&gzip_once, gzip_keyInit);
+	
+	if ((s = gzip_mine[format]) != NULL) {
+		gzip_mine[format] = NULL;
+	} else {
+		pthread_mutex_lock(&gzip_mutex);
+		if ((s = gzip_spares[format]) != NULL) {
+			gzip_spares[format] = s->next;
+			gzip_kept--;
+		}
+		pthread_mutex_unlock(&gzip_mutex);
+	}
+	
+	if (s) {
+		if (s->level != level && deflateParams(&s->z, level, Z_DEFAULT_STRATEGY) == Z_OK) s->level = level;
+		return s;
+	}
+	
+	if ((s = mem_malloc(HTTPD_MEM_OTHER, sizeof(*s))) == NULL) return NULL;
+	memset(s, 0, sizeof(*s));
+	s->z.zalloc = gzip_zalloc;
+	s->z.zfree = gzip_zfree;
+	s->format = format;
+	s->level = level;
+	
+	/* 16 more window bits asks for the gzip wrapper, without them it's zlib's ("deflate") */
+	if (deflateInit2(&s->z, level, Z_DEFLATED, format == GZIP_GZIP ? 15 + 16 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		mem_free(s);
+		return NULL;
+	}
+	
+	return s;
+}
+
+static void gzip_put(struct gzip_stream *s) {
+	deflateReset(&s->z);
+	
+	if (gzip_mine[s->format]) {
+		gzip_spare(s);
+		return;
+	}
+	gzip_mine[s->format] = s;
+	pthread_setspecific(gzip_key, (void *)1);
+}
+
+/* compresses 'len' bytes into '*out', which ends up with 'next' set to what came out */
+static hte gzip_run(struct gzip_stream *s, unsigned char *in, size_t len, int flush, struct buf **out) {
+	size_t cap, done;
+	void *p;
+	
+	cap = deflateBound(&s->z, len) + 16;
+	if (*out && (*out)->len > cap) cap = (*out)->len;
+	if ((p = buf_alloc(*out, cap)) == NULL) return HTE_NOMEM;
+	*out = p;
+	
+	s->z.next_in = in;
+	s->z.avail_in = len;
+	done = 0;
+	for (;;) {
+		s->z.next_out = &(*out)->data[done];
+		s->z.avail_out = cap - done;
+		if (deflate(&s->z, flush) == Z_STREAM_ERROR) return HTE_UNKNOWN;
+		done = cap - s->z.avail_out;
+		
+		/* with room left over, everything that could come out has */
+		if (s->z.avail_out != 0) break;
+		cap *= 2;
+		if ((p = buf_alloc(*out, cap)) == NULL) return HTE_NOMEM;
+		*out = p;
+	}
+	(*out)->next = done;
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+static int gzip_typeMatches(struct gzip_info *gzip, char *type) {
+	char **types = gzip->typec ? gzip->types : gzip_defaults;
+	int i;
+	
+	for (i = 0; types[i] && (!gzip->typec || i < gzip->typec); i++) {
+		if (!strncasecmp(type, types[i], strlen(types[i]))) return 1;
+	}
+	
+	return 0;
+}
+
+/* whether the response could be compressed, whatever the client will take */
+static int gzip_compressible(struct gzip_info *gzip, struct session_info *session) {
+	struct http_response *rsp = session->xfer.response;
+	char *method = (char *)session->xfer.request->method;
+	char *type = NULL;
+	int i;
+	
+	if (method && !strcmp(method, "HEAD")) return 0;
+	if (rsp->bodyc > 0) return 0; /* shared bodies go out as they are */
+	if (rsp->direct) return 0;
+	if (rsp->httpCode < 200 || rsp->httpCode == 204 || rsp->httpCode == 206 || rsp->httpCode == 304) return 0;
+	
+	for (i = 0; i < rsp->data.headerc; i++) {
+		char *name = (char *)rsp->data.headers[i].name;
+		if (!name || !rsp->data.headers[i].value) continue;
+		
+		/* the handler knows best, and a length it set would be wrong */
+		if (!strcasecmp(name, "Content-Encoding") || !strcasecmp(name, "Content-Length")) return 0;
+		if (!strcasecmp(name, "Content-Type")) type = (char *)rsp->data.headers[i].value;
+	}
+	
+	return type && gzip_typeMatches(gzip, type);
+}
+
+/* GZIP_FORMATS if the client will take neither - a coding it names has its own q, "*" is only for those it doesn't */
+static enum gzip_format gzip_accepted(struct session_info *session) {
+	double gz = -1, deflate = -1, any = -1, q;
+	char *ae, *p, *e;
+	size_t n;
+	
+	if ((ae = httpd_getHeader(session, "Accept-Encoding")) == NULL) return GZIP_FORMATS;
+	
+	for (p = ae; *p; p = e) {
+		while (*p == ' ' || *p == '\t' || *p == ',') p++;
+		if (!*p) break;
+		for (e = p; *e && *e != ',' && *e != ';' && *e != ' ' && *e != '\t'; e++);
+		n = e - p;
+		
+		q = 1;
+		for (; *e && *e != ','; e++) {
+			if ((e[0] == 'q' || e[0] == 'Q') && e[1] == '=') q = strtod(&e[2], NULL);
+		}
+		
+		if ((n == 4 && !strncasecmp(p, "gzip", 4)) || (n == 6 && !strncasecmp(p, "x-gzip", 6))) {
+			if (q > gz) gz = q;
+		} else if (n == 7 && !strncasecmp(p, "deflate", 7)) {
+			deflate = q;
+		} else if (n == 1 && *p == '*') {
+			any = q;
+		}
+	}
+	if (gz < 0) gz = any;
+	if (deflate < 0) deflate = any;
+	
+	if (gz > 0 && gz >= deflate) return GZIP_GZIP;
+	if (deflate > 0) return GZIP_DEFLATE;
+	return GZIP_FORMATS;
+}
+
+hte gzip_prepare(struct session_info *session, int streamed) {
+	struct gzip_info *gzip = session->httpd->gzip;
+	struct http_response *rsp = session->xfer.response;
+	enum gzip_format format;
+	struct gzip_stream *s;
+	struct buf *out = NULL;
+	size_t len;
+	void *p;
+	
+	if (!gzip || !gzip->level || session->ws || session->sse) return HTE_NONE;
+	if (!gzip_compressible(gzip, session)) return HTE_NONE;
+	len = rsp->buf ? rsp->buf->len : 0;
+	if (!streamed && len < (size_t)gzip->minBytes) return HTE_NONE;
+	
+	/* from here it depends on what's asked for, whatever this one asked */
+	if (httpd_addHeader(session, "Vary", "Accept-Encoding") != HTE_NONE) return HTE_NOMEM;
+	if ((format = gzip_accepted(session)) == GZIP_FORMATS) return HTE_NONE;
+	
+	/* it can go out as it is if there's no compressor to be had */
+	if ((s = gzip_get(format, gzip->level)) == NULL) return HTE_NONE;
+	if (gzip_run(s, rsp->buf ? rsp->buf->data : NULL, len, streamed ? Z_SYNC_FLUSH : Z_FINISH, &out) != HTE_NONE) goto plain;
+	
+	/* a body that doesn't get any smaller isn't worth the client's trouble */
+	if (!streamed && out->next >= len) goto plain;
+	if ((p = buf_alloc(out, out->next)) == NULL) goto plain;
+	out = p;
+	
+	if (httpd_addHeader(session, "Content-Encoding", format == GZIP_GZIP ? "gzip" : "deflate") != HTE_NONE) goto plain;
+	
+	__sync_fetch_and_add(&gzip->responses, 1);
+	__sync_fetch_and_add(&gzip->bytesIn, len);
+	__sync_fetch_and_add(&gzip->bytesOut, out->len);
+	
+	if (rsp->buf) buf_free(rsp->buf);
+	rsp->buf = out;
+	
+	if (streamed) {
+		rsp->gzip = s;
+	} else {
+		gzip_put(s);
+	}
+	
+	return HTE_NONE;
+plain:
+	if (out) buf_free(out);
+	gzip_put(s);
+	return HTE_NONE;
+}
+
+hte gzip_flush(struct session_info *session, int last) {
+	struct gzip_info *gzip = session->httpd->gzip;
+	struct http_response *rsp = session->xfer.response;
+	struct gzip_stream *s = rsp->gzip;
+	struct buf *out = NULL;
+	size_t len;
+	hte ret;
+	
+	len = rsp->buf ? rsp->buf->next : 0;
+	if ((ret = gzip_run(s, rsp->buf ? rsp->buf->data : NULL, len, last ? Z_FINISH : Z_SYNC_FLUSH, &out)) == HTE_NONE) {
+		__sync_fetch_and_add(&gzip->bytesIn, len);
+		__sync_fetch_and_add(&gzip->bytesOut, out->next);
+		if (out->next > 0) ret = session_send(session, out->data, out->next);
+	}
+	if (rsp->buf) rsp->buf->next = 0;
+	if (out) buf_free(out);
+	
+	if (last) gzip_release(rsp);
+	
+	return ret;
+}
+
+void gzip_release(struct http_response *rsp) {
+	if (!rsp->gzip) return;
+	gzip_put(rsp->gzip);
+	rsp->gzip = NULL;
+}
+
+#else /* HTTPD_ZLIB */
+
+hte gzip_prepare(struct session_info *session, int streamed) {
+	return HTE_NONE;
+}
+hte gzip_flush(struct session_info *session, int last) {
+	return HTE_NONE;
+}
+void gzip_release(struct http_response *rsp) {
+}
+
+#endif /* HTTPD_ZLIB */
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setCompression(struct httpd_info *httpd, int level, int minBytes) {
+	struct gzip_info *gzip;
+	hte ret = HTE_NONE;
+	
+	if (!httpd || level < 0 || level > 9 || minBytes < 0) return HTE_INVALPARAM;
+#ifndef HTTPD_ZLIB
+	if (level > 0) return HTE_ZLIB;
+#endif
+	
+	pthread_mutex_lock(&gzip_startMutex);
+	
+	if ((gzip = httpd->gzip) == NULL) {
+		if (level == 0) goto done;
+		if ((gzip = mem_malloc(HTTPD_MEM_SERVER, sizeof(*gzip))) == NULL) { ret = HTE_NOMEM; goto done; }
+		memset(gzip, 0, sizeof(*gzip));
+		gzip->level = level;
+		gzip->minBytes = minBytes;
+		
+		__sync_synchronize();
+		httpd->gzip = gzip;
+		goto done;
+	}
+	
+	gzip->minBytes = minBytes;
+	gzip->level = level;
+	
+done:
+	pthread_mutex_unlock(&gzip_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_addCompressionType(struct httpd_info *httpd, char *type) {
+	struct gzip_info *gzip;
+	hte ret = HTE_NONE;
+	char *p;
+	
+	if (!httpd || !type || !*type) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&gzip_startMutex);
+	
+	if ((gzip = httpd->gzip) == NULL || gzip->typec >= GZIP_TYPES) { ret = HTE_INVALPARAM; goto done; }
+	if ((p = mem_malloc(HTTPD_MEM_SERVER, strlen(type) + 1)) == NULL) { ret = HTE_NOMEM; goto done; }
+	strcpy(p, type);
+	
+	gzip->types[gzip->typec] = p;
+	__sync_synchronize();
+	gzip->typec++;
+	
+done:
+	pthread_mutex_unlock(&gzip_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_getCompressionStats(struct httpd_info *httpd, struct httpd_compressionStats *stats) {
+	struct gzip_info *gzip;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((gzip = httpd->gzip) == NULL) return HTE_NONE;
+	
+	stats->responses = gzip->responses;
+	stats->bytesIn = gzip->bytesIn;
+	stats->bytesOut = gzip->bytesOut;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,62 @@
+#ifndef GZIP_H
+#define GZIP_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* response compression, only built with OPTIONS=HTTPD_ZLIB (zlib)
+   a buffered body is compressed in one go as the head is prepared, a streamed one (httpd_flush())
+   at each flush with the stream kept on the response until the last
+   compressors are reset rather than set up again - each thread keeps one of each format, with a
+   shared list of spares behind them that a thread's go back to as it exits, so even a thread per
+   connection gets one that's already set up, and a streamed response takes its thread's for
+   itself until it's done (a coroutine may give the thread to another part way through) */
+
+struct session_info;
+struct http_response;
+
+#define GZIP_TYPES 16 /* content types it may be asked to compress */
+#define GZIP_KEEP  64 /* most spare compressors kept */
+
+enum gzip_format {
+	GZIP_GZIP = 0,
+	GZIP_DEFLATE,
+	GZIP_FORMATS,
+};
+
+struct gzip_info {
+	int level; /* 0 while it's off */
+	int minBytes;
+	char *types[GZIP_TYPES]; /* prefixes of the Content-Type, the defaults if there are none */
+	int typec;
+	
+	unsigned long long responses;
+	unsigned long long bytesIn;
+	unsigned long long bytesOut;
+};
+
+/* called from http_prepare() before the head is built - the body is compressed in place and the
+   head's fields added if it should be, 'streamed' for the first flush of a response */
+hte gzip_prepare(struct session_info *session, int streamed);
+/* for a flushed response with a stream, compresses and sends what's been buffered since - 'last' ends it */
+hte gzip_flush(struct session_info *session, int last);
+/* gives back a streamed response's compressor */
+void gzip_release(struct http_response *rsp);
+
+#endif /* GZIP_H */
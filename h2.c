@@ -0,0 +1,1162 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "hpack.h"
+#include "h2.h"
+#include "trace.h"
+#include "capture.h"
+#include "mem.h"
+#include "expect.h"
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+#define H2_FRAME_HEADER 9
+#define H2_MAX_FRAME    16384      /* SETTINGS_MAX_FRAME_SIZE, we leave it at the default */
+#define H2_WINDOW       65535      /* the default initial window */
+#define H2_WINDOW_MAX   0x7FFFFFFF
+
+enum h2_frameType {
+	H2_DATA          = 0x0,
+	H2_HEADERS       = 0x1,
+	H2_PRIORITY      = 0x2,
+	H2_RST_STREAM    = 0x3,
+	H2_SETTINGS      = 0x4,
+	H2_PUSH_PROMISE  = 0x5,
+	H2_PING          = 0x6,
+	H2_GOAWAY        = 0x7,
+	H2_WINDOW_UPDATE = 0x8,
+	H2_CONTINUATION  = 0x9,
+};
+
+#define H2_FLAG_END_STREAM  0x01
+#define H2_FLAG_ACK         0x01
+#define H2_FLAG_END_HEADERS 0x04
+#define H2_FLAG_PADDED      0x08
+#define H2_FLAG_PRIORITY    0x20
+
+enum h2_error {
+	H2_NO_ERROR            = 0x0,
+	H2_PROTOCOL_ERROR      = 0x1,
+	H2_INTERNAL_ERROR      = 0x2,
+	H2_FLOW_CONTROL_ERROR  = 0x3,
+	H2_STREAM_CLOSED       = 0x5,
+	H2_FRAME_SIZE_ERROR    = 0x6,
+	H2_REFUSED_STREAM      = 0x7,
+	H2_COMPRESSION_ERROR   = 0x9,
+};
+
+enum h2_setting {
+	H2_SETTINGS_HEADER_TABLE_SIZE      = 0x1,
+	H2_SETTINGS_ENABLE_PUSH            = 0x2,
+	H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+	H2_SETTINGS_INITIAL_WINDOW_SIZE    = 0x4,
+	H2_SETTINGS_MAX_FRAME_SIZE         = 0x5,
+};
+
+struct h2_conn {
+	int fd;
+	struct session_info *session; /* the connection's own session, owned by session_handleConnection() */
+	
+	pthread_mutex_t mutex; /* everything below, and the stream list */
+	pthread_cond_t cond;   /* window updates, resets, streams finishing */
+	pthread_mutex_t writeMutex; /* frames go out whole */
+	
+	int dead;
+	unsigned int lastStreamId;
+	int streamc;
+	int active; /* streams that have been handed to a thread */
+	struct h2_stream *streams;
+	
+	long sendWindow;
+	long peerInitialWindow;
+	unsigned int peerMaxFrame;
+	
+	/* only touched by the reader */
+	long recvWindow; /* what the client may still send before we open it again */
+	struct hpack_table decoder;
+	unsigned char *rx;
+	size_t rxPos;
+	size_t rxLen;
+	size_t rxSize;
+	
+	unsigned char *block; /* a header block waiting for CONTINUATION */
+	size_t blockLen;
+	unsigned int blockStream;
+	int blockEndStream;
+};
+
+struct h2_stream {
+	struct h2_stream *next;
+	struct h2_conn *conn;
+	unsigned int id;
+	struct session_info *session;
+	
+	long sendWindow;
+	long recvWindow; /* only touched by the reader */
+	
+	int gotMethod;
+	int gotPath;
+	int malformed;
+	int refused;     /* the status a limit answers it with, as req->refused */
+	int endStream;   /* the request is complete */
+	int running;
+	int reset;
+	int headersSent;
+	int ended;       /* we've sent END_STREAM */
+};
+
+/* ########################################################################## */
+
+static hte h2_sendAll(int fd, unsigned char *data, size_t len, int flags) {
+	ssize_t l;
+	while (len > 0) {
+		if ((l = send(fd, data, len, MSG_NOSIGNAL | flags)) <= 0) return HTE_WRITE;
+		data += l;
+		len -= l;
+	}
+	return HTE_NONE;
+}
+
+/* the caller must hold writeMutex */
+static hte h2_writeFrame(struct h2_conn *conn, int type, int flags, unsigned int id, unsigned char *payload, size_t len) {
+	unsigned char h[H2_FRAME_HEADER];
+	hte ret;
+	
+	h[0] = (len >> 16) & 0xFF;
+	h[1] = (len >>  8) & 0xFF;
+	h[2] = (len      ) & 0xFF;
+	h[3] = type;
+	h[4] = flags;
+	h[5] = (id >> 24) & 0x7F;
+	h[6] = (id >> 16) & 0xFF;
+	h[7] = (id >>  8) & 0xFF;
+	h[8] = (id      ) & 0xFF;
+	
+	if ((ret = h2_sendAll(conn->fd, h, sizeof(h), len > 0 ? MSG_MORE : 0)) != HTE_NONE) return ret;
+	if (len > 0) return h2_sendAll(conn->fd, payload, len, 0);
+	return HTE_NONE;
+}
+
+static hte h2_sendFrame(struct h2_conn *conn, int type, int flags, unsigned int id, unsigned char *payload, size_t len) {
+	hte ret;
+	pthread_mutex_lock(&conn->writeMutex);
+	ret = h2_writeFrame(conn, type, flags, id, payload, len);
+	pthread_mutex_unlock(&conn->writeMutex);
+	return ret;
+}
+
+static inline void h2_put32(unsigned char *p, uint32_t v) {
+	p[0] = (v >> 24) & 0xFF;
+	p[1] = (v >> 16) & 0xFF;
+	p[2] = (v >>  8) & 0xFF;
+	p[3] = (v      ) & 0xFF;
+}
+static inline uint32_t h2_get32(unsigned char *p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static hte h2_sendRst(struct h2_conn *conn, unsigned int id, enum h2_error code) {
+	unsigned char p[4];
+	h2_put32(p, code);
+	return h2_sendFrame(conn, H2_RST_STREAM, 0, id, p, sizeof(p));
+}
+static hte h2_sendGoaway(struct h2_conn *conn, enum h2_error code) {
+	unsigned char p[8];
+	h2_put32(&p[0], conn->lastStreamId);
+	h2_put32(&p[4], code);
+	return h2_sendFrame(conn, H2_GOAWAY, 0, 0, p, sizeof(p));
+}
+static hte h2_sendWindowUpdate(struct h2_conn *conn, unsigned int id, size_t increment) {
+	unsigned char p[4];
+	h2_put32(p, increment);
+	return h2_sendFrame(conn, H2_WINDOW_UPDATE, 0, id, p, sizeof(p));
+}
+
+/* ########################################################################## */
+
+/* the caller must hold conn->mutex */
+static struct h2_stream *h2_streamFind(struct h2_conn *conn, unsigned int id) {
+	struct h2_stream *stream;
+	for (stream = conn->streams; stream; stream = stream->next) {
+		if (stream->id == id) break;
+	}
+	return stream;
+}
+static void h2_streamUnlink(struct h2_conn *conn, struct h2_stream *stream) {
+	struct h2_stream **s;
+	for (s = &conn->streams; *s; s = &(*s)->next) {
+		if (*s != stream) continue;
+		*s = stream->next;
+		conn->streamc--;
+		break;
+	}
+}
+
+static void h2_streamFree(struct h2_stream *stream) {
+	if (stream->session) {
+		session_xferFree(stream->session);
+		mem_free(stream->session);
+	}
+	mem_free(stream);
+}
+
+static struct h2_stream *h2_streamNew(struct h2_conn *conn, unsigned int id, struct session_info *session) {
+	struct h2_stream *stream;
+	
+	if ((stream = mem_malloc(HTTPD_MEM_SESSION, sizeof(*stream))) == NULL) return NULL;
+	memset(stream, 0, sizeof(*stream));
+	stream->conn = conn;
+	stream->id = id;
+	stream->recvWindow = H2_WINDOW;
+	
+	if (!session) {
+		if ((session = mem_malloc(HTTPD_MEM_SESSION, sizeof(*session))) == NULL) goto die;
+		memset(session, 0, sizeof(*session));
+		session->fd = conn->fd;
+		session->addrinfo = conn->session->addrinfo;
+		session->addrlen = conn->session->addrlen;
+		session->httpd = conn->session->httpd;
+		stream->session = session;
+		if (session_xferAlloc(session) != HTE_NONE) goto die;
+	}
+	stream->session = session;
+	session->h2 = stream;
+	
+	pthread_mutex_lock(&conn->mutex);
+	stream->sendWindow = conn->peerInitialWindow;
+	stream->next = conn->streams;
+	conn->streams = stream;
+	conn->streamc++;
+	pthread_mutex_unlock(&conn->mutex);
+	
+	return stream;
+die:
+	h2_streamFree(stream);
+	return NULL;
+}
+
+/* for the reader, with a stream that hasn't been handed to a thread */
+static void h2_streamDrop(struct h2_conn *conn, struct h2_stream *stream) {
+	pthread_mutex_lock(&conn->mutex);
+	h2_streamUnlink(conn, stream);
+	pthread_mutex_unlock(&conn->mutex);
+	h2_streamFree(stream);
+}
+
+/* answers a stream a limit refused with just its status, as limit_answer() does, and drops it
+   a client that's still sending is told to stop, the answer is all it's getting */
+static void h2_streamRefuse(struct h2_conn *conn, struct h2_stream *stream, int endStream) {
+	struct buf *block = NULL;
+	
+	if (hpack_encodeStatus(&block, stream->refused) == 0) {
+		h2_sendFrame(conn, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream->id, block->data, block->next);
+		if (!endStream) h2_sendRst(conn, stream->id, H2_NO_ERROR);
+	} else {
+		h2_sendRst(conn, stream->id, H2_REFUSED_STREAM);
+	}
+	if (block) buf_free(block);
+	
+	h2_streamDrop(conn, stream);
+}
+
+/* the head hook and "Expect", as expect_head() runs them for HTTP/1 before any of the body is taken
+   a refusal answers the stream and drops it */
+static void h2_streamHead(struct h2_conn *conn, struct h2_stream *stream) {
+	struct buf *block = NULL;
+	int cont;
+	
+	if ((stream->refused = expect_check(stream->session, &cont)) != 0) {
+		h2_streamRefuse(conn, stream, 0);
+		return;
+	}
+	
+	/* the interim response is a HEADERS of its own, the stream's thread isn't running to race it */
+	if (cont && hpack_encodeStatus(&block, 100) == 0) h2_sendFrame(conn, H2_HEADERS, H2_FLAG_END_HEADERS, stream->id, block->data, block->next);
+	if (block) buf_free(block);
+}
+
+/* ########################################################################## */
+
+/* like the HTTP/1 parser, the request is built up in req->buf and held as indexes until http_parse_fixup()
+   and what it grows by is charged to the memory budget in the same way, a refusal leaves the stream a 503 */
+static long h2_append(struct h2_stream *stream, const void *data, size_t len, int nul) {
+	struct session_info *session = stream->session;
+	struct http_request *req = session->xfer.request;
+	size_t idx, need;
+	
+	idx = req->buf ? req->buf->next : 0;
+	need = idx + len + 1;
+	
+	if (!req->buf || need > req->buf->len) {
+		struct buf *p;
+		size_t size = req->buf ? req->buf->len * 2 : 256;
+		while (size < need) size *= 2;
+		if (!mem_charge(&session->memCharged, size - (req->buf ? req->buf->len : 0))) {
+			stream->refused = 503;
+			return -1;
+		}
+		if ((p = buf_alloc(req->buf, size)) == NULL) return -1;
+		req->buf = p;
+	}
+	
+	memcpy(&req->buf->data[idx], data, len);
+	req->buf->data[idx + len] = '\0';
+	req->buf->next += len + (nul ? 1 : 0);
+	
+	return idx;
+}
+
+/* the same limits as http_parse() - the status is left on the stream, and the decoder carries on */
+static void h2_limitHeader(struct h2_stream *stream, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	struct httpd_limits *limits = &stream->session->httpd->limits;
+	struct http_request *req = stream->session->xfer.request;
+	
+	if (limits->headers && req->data.headerc > limits->headers) stream->refused = 431;
+	if (limits->headerBytes && req->buf->next > (size_t)limits->headerBytes) stream->refused = 431;
+	
+	if (nameLen == 5 && !memcmp(name, ":path", 5)) {
+		if (limits->requestLine && valueLen > (size_t)limits->requestLine) stream->refused = 414;
+	} else if (nameLen == 14 && !strncasecmp((char *)name, "content-length", 14)) {
+		unsigned long long l = 0;
+		size_t i;
+		
+		for (i = 0; i < valueLen && value[i] >= '0' && value[i] <= '9' && l <= INT_MAX; i++) l = (l * 10) + (value[i] - '0');
+		if (l > INT_MAX || (limits->body && l > (unsigned long long)limits->body)) stream->refused = 413;
+	}
+}
+
+static hte h2_emitHeader(void *ctx, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	struct h2_stream *stream = ctx;
+	struct http_request *req = stream->session->xfer.request;
+	long n, v;
+	hte ret = HTE_NONE;
+	
+	/* a refused stream is answered once the block has been through the decoder */
+	if (stream->refused) return HTE_NONE;
+	
+	if ((v = h2_append(stream, value, valueLen, 1)) == -1) goto fail;
+	
+	if (nameLen > 0 && name[0] == ':') {
+#define PSEUDO(s) (nameLen == sizeof(s) - 1 && !memcmp(name, s, nameLen))
+		if (PSEUDO(":method")) {
+			req->method = (void*)v;
+			stream->gotMethod = 1;
+		} else if (PSEUDO(":path")) {
+			req->uri = (void*)v;
+			stream->gotPath = 1;
+		} else if (PSEUDO(":authority")) {
+			/* users will look for Host */
+			if ((n = h2_append(stream, "Host", 4, 1)) == -1) goto fail;
+			ret = add_header(&req->data, (void*)n, (void*)v);
+		} else if (!PSEUDO(":scheme")) {
+			/* carry on, the decoder has to see the whole block */
+			stream->malformed = 1;
+		}
+#undef PSEUDO
+	} else {
+		if ((n = h2_append(stream, name, nameLen, 1)) == -1) goto fail;
+		ret = add_header(&req->data, (void*)n, (void*)v);
+	}
+	
+	h2_limitHeader(stream, name, nameLen, value, valueLen);
+	return ret;
+fail:
+	return stream->refused ? HTE_NONE : HTE_NOMEM;
+}
+
+/* trailers, and the headers of streams we've refused, still have to go through the decoder */
+static hte h2_discardHeader(void *ctx, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	return HTE_NONE;
+}
+
+static void *h2_streamThread(void *_stream);
+
+/* the request is complete, hand it over */
+static hte h2_streamStart(struct h2_conn *conn, struct h2_stream *stream) {
+	struct session_info *session = stream->session;
+	struct http_request *req = session->xfer.request;
+	pthread_t tid;
+	hte ret;
+	
+	stream->endStream = 1;
+	
+	/* a request that arrived with "Upgrade: h2c" has been through all of this already */
+	if (req->state != STATE_COMPLETE) {
+		req->data.contentLength = req->data.contentReceived;
+		req->state = STATE_COMPLETE;
+		TRACE(read_complete, HTTPD_TRACE_READ_COMPLETE, session);
+		
+		if ((ret = http_parse_fixup(session)) != HTE_NONE) return ret;
+		TRACE(parse_complete, HTTPD_TRACE_PARSE_COMPLETE, session);
+	}
+	
+	pthread_mutex_lock(&conn->mutex);
+	stream->running = 1;
+	conn->active++;
+	pthread_mutex_unlock(&conn->mutex);
+	
+	if (pthread_create(&tid, NULL, h2_streamThread, stream) != 0) {
+		pthread_mutex_lock(&conn->mutex);
+		stream->running = 0;
+		conn->active--;
+		pthread_mutex_unlock(&conn->mutex);
+		return HTE_THREAD;
+	}
+	
+	return HTE_NONE;
+}
+
+static void h2_streamError(struct h2_stream *stream) {
+	struct h2_conn *conn = stream->conn;
+	
+	if (stream->reset || stream->ended) return;
+	
+	if (!stream->headersSent) {
+		unsigned char status = 0x80 | 14; /* :status 500, from the static table */
+		stream->headersSent = 1;
+		stream->ended = 1;
+		h2_sendFrame(conn, H2_HEADERS, H2_FLAG_END_HEADERS | H2_FLAG_END_STREAM, stream->id, &status, 1);
+		return;
+	}
+	
+	stream->ended = 1;
+	h2_sendRst(conn, stream->id, H2_INTERNAL_ERROR);
+}
+
+static void *h2_streamThread(void *_stream) {
+	struct h2_stream *stream = _stream;
+	struct h2_conn *conn = stream->conn;
+	hte ret;
+	
+	pthread_detach(pthread_self());
+	
+	if ((ret = session_dispatch(stream->session)) != HTE_NONE) {
+		fprintf(stderr, "%s:%d %s(): an error occured on stream %u (%d)\n", __FILE__, __LINE__, __FUNCTION__, stream->id, ret);
+		h2_streamError(stream);
+	}
+	
+	pthread_mutex_lock(&conn->mutex);
+	h2_streamUnlink(conn, stream);
+	conn->active--;
+	pthread_cond_broadcast(&conn->cond);
+	pthread_mutex_unlock(&conn->mutex);
+	
+	/* conn may be gone from here on */
+	h2_streamFree(stream);
+	
+	return NULL;
+}
+
+/* ########################################################################## */
+
+/* sends DATA frames as the windows allow */
+static hte h2_sendData(struct h2_stream *stream, unsigned char *data, size_t len, int end) {
+	struct h2_conn *conn = stream->conn;
+	hte ret;
+	
+	while (len > 0 || end) {
+		size_t n;
+		int last;
+		
+		pthread_mutex_lock(&conn->mutex);
+		while (len > 0 && !conn->dead && !stream->reset &&
+		       (conn->sendWindow <= 0 || stream->sendWindow <= 0)) {
+			pthread_cond_wait(&conn->cond, &conn->mutex);
+		}
+		if (conn->dead || stream->reset) {
+			ret = conn->dead ? HTE_WRITE : HTE_NONE;
+			pthread_mutex_unlock(&conn->mutex);
+			return ret;
+		}
+		n = len;
+		if (n > (size_t)conn->sendWindow)   n = conn->sendWindow;
+		if (n > (size_t)stream->sendWindow) n = stream->sendWindow;
+		if (n > conn->peerMaxFrame)         n = conn->peerMaxFrame;
+		conn->sendWindow -= n;
+		stream->sendWindow -= n;
+		pthread_mutex_unlock(&conn->mutex);
+		
+		last = end && n == len;
+		if ((ret = h2_sendFrame(conn, H2_DATA, last ? H2_FLAG_END_STREAM : 0, stream->id, data, n)) != HTE_NONE) return ret;
+		if (last) stream->ended = 1;
+		
+		data += n;
+		len -= n;
+		if (last) break;
+	}
+	
+	return HTE_NONE;
+}
+
+/* connection specific headers are not allowed in HTTP/2 */
+static int h2_connectionHeader(const char *name) {
+	return !strcasecmp(name, "Connection") || !strcasecmp(name, "Keep-Alive") ||
+	       !strcasecmp(name, "Transfer-Encoding") || !strcasecmp(name, "Upgrade") ||
+	       !strcasecmp(name, "Proxy-Connection");
+}
+
+static hte h2_sendHeaders(struct h2_stream *stream, int contentLength, int end) {
+	struct h2_conn *conn = stream->conn;
+	struct http_response *rsp = stream->session->xfer.response;
+	struct buf *block = NULL;
+	unsigned int maxFrame;
+	size_t pos, n;
+	hte ret = HTE_RESPOND;
+	int i, type, flags;
+	int gotContentLength = 0;
+	
+	if (hpack_encodeStatus(&block, rsp->httpCode) != 0) goto die;
+	
+	for (i = 0; i < rsp->data.headerc; i++) {
+		char *name = (char*)rsp->data.headers[i].name;
+		char *value = (char*)rsp->data.headers[i].value;
+		char *copy = NULL;
+		int r = 0;
+		
+		if (name == NULL) continue;
+		if (value == NULL) {
+			/* a whole "Name: value" line, split in a copy of it */
+			char *c;
+			if (strchr(name, ':') == NULL) continue;
+			if ((copy = mem_malloc(HTTPD_MEM_SESSION, strlen(name) + 1)) == NULL) goto die;
+			strcpy(copy, name);
+			c = strchr(copy, ':');
+			*c++ = '\0';
+			while (*c == ' ') c++;
+			name = copy;
+			value = c;
+		}
+		
+		if (!h2_connectionHeader(name)) {
+			if (!strcasecmp(name, "Content-Length")) gotContentLength = 1;
+			r = hpack_encodeField(&block, name, value);
+		}
+		if (copy) mem_free(copy);
+		if (r != 0) goto die;
+	}
+	if (!gotContentLength && contentLength >= 0) {
+		char l[24];
+		snprintf(l, sizeof(l), "%d", contentLength);
+		if (hpack_encodeField(&block, "content-length", l) != 0) goto die;
+	}
+	
+	pthread_mutex_lock(&conn->mutex);
+	maxFrame = conn->peerMaxFrame;
+	pthread_mutex_unlock(&conn->mutex);
+	
+	/* HEADERS then CONTINUATION, nothing else may go between them */
+	stream->headersSent = 1;
+	pthread_mutex_lock(&conn->writeMutex);
+	type = H2_HEADERS;
+	for (pos = 0; pos < block->next; pos += n) {
+		n = block->next - pos;
+		if (n > maxFrame) n = maxFrame;
+		
+		flags = 0;
+		if (type == H2_HEADERS && end) flags |= H2_FLAG_END_STREAM;
+		if (pos + n == block->next) flags |= H2_FLAG_END_HEADERS;
+		
+		if ((ret = h2_writeFrame(conn, type, flags, stream->id, &block->data[pos], n)) != HTE_NONE) break;
+		type = H2_CONTINUATION;
+	}
+	pthread_mutex_unlock(&conn->writeMutex);
+	if (end) stream->ended = 1;
+	
+die:
+	if (block) buf_free(block);
+	return ret;
+}
+
+hte h2_respond(struct session_info *session, int generate_content_length) {
+	struct h2_stream *stream = session->h2;
+	struct http_response *rsp = session->xfer.response;
+	size_t len;
+	hte ret;
+	
+	if (stream->reset || stream->ended) return HTE_NONE;
+	
+	len = rsp->buf ? rsp->buf->next : 0;
+	
+	if (!stream->headersSent) {
+		if ((ret = h2_sendHeaders(stream, generate_content_length ? (int)len : -1, len == 0)) != HTE_NONE) return ret;
+		if (len == 0) return HTE_NONE;
+	}
+	
+	return h2_sendData(stream, rsp->buf ? rsp->buf->data : NULL, len, 1);
+}
+
+/* unlike HTTP/1, the data carries on being buffered - it's sent as DATA frames at each flush */
+hte h2_flush(struct session_info *session) {
+	struct h2_stream *stream = session->h2;
+	struct http_response *rsp = session->xfer.response;
+	hte ret;
+	
+	if (stream->reset || stream->ended) return HTE_NONE;
+	
+	if (!stream->headersSent) {
+		if ((ret = h2_sendHeaders(stream, -1, 0)) != HTE_NONE) return ret;
+	}
+	if (!rsp->buf || rsp->buf->next == 0) return HTE_NONE;
+	
+	ret = h2_sendData(stream, rsp->buf->data, rsp->buf->next, 0);
+	rsp->buf->next = 0;
+	
+	return ret;
+}
+
+/* ########################################################################## */
+
+static enum h2_error h2_applySettings(struct h2_conn *conn, unsigned char *p, size_t len) {
+	enum h2_error err = H2_NO_ERROR;
+	
+	if (len % 6 != 0) return H2_FRAME_SIZE_ERROR;
+	
+	pthread_mutex_lock(&conn->mutex);
+	for (; len > 0; p += 6, len -= 6) {
+		unsigned int id = (p[0] << 8) | p[1];
+		uint32_t value = h2_get32(&p[2]);
+		
+		switch (id) {
+			case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+				struct h2_stream *stream;
+				long delta;
+				if (value > H2_WINDOW_MAX) { err = H2_FLOW_CONTROL_ERROR; goto done; }
+				delta = (long)value - conn->peerInitialWindow;
+				conn->peerInitialWindow = value;
+				for (stream = conn->streams; stream; stream = stream->next) stream->sendWindow += delta;
+				break;
+			}
+			case H2_SETTINGS_MAX_FRAME_SIZE:
+				if (value < 16384 || value > 16777215) { err = H2_PROTOCOL_ERROR; goto done; }
+				conn->peerMaxFrame = value;
+				break;
+			case H2_SETTINGS_ENABLE_PUSH:
+				if (value > 1) { err = H2_PROTOCOL_ERROR; goto done; }
+				break;
+			/* we never use the dynamic table when encoding, and don't open streams */
+			default:
+				break;
+		}
+	}
+done:
+	pthread_cond_broadcast(&conn->cond);
+	pthread_mutex_unlock(&conn->mutex);
+	return err;
+}
+
+/* HTTP2-Settings is base64url, without padding */
+static int h2_base64url(char *in, unsigned char *out, size_t outSize) {
+	uint32_t acc = 0;
+	int bits = 0;
+	size_t o = 0;
+	
+	for (; *in; in++) {
+		int v;
+		if      (*in >= 'A' && *in <= 'Z') v = *in - 'A';
+		else if (*in >= 'a' && *in <= 'z') v = *in - 'a' + 26;
+		else if (*in >= '0' && *in <= '9') v = *in - '0' + 52;
+		else if (*in == '-' || *in == '+') v = 62;
+		else if (*in == '_' || *in == '/') v = 63;
+		else if (*in == '=') break;
+		else return -1;
+		
+		acc = (acc << 6) | v;
+		bits += 6;
+		if (bits >= 8) {
+			bits -= 8;
+			if (o >= outSize) return -1;
+			out[o++] = (acc >> bits) & 0xFF;
+		}
+	}
+	
+	return o;
+}
+
+/* ########################################################################## */
+
+/* makes sure there are at least 'want' unread bytes in conn->rx */
+static hte h2_fill(struct h2_conn *conn, size_t want) {
+	ssize_t l;
+	
+	while (conn->rxLen - conn->rxPos < want) {
+		if (conn->rxPos > 0) {
+			memmove(conn->rx, &conn->rx[conn->rxPos], conn->rxLen - conn->rxPos);
+			conn->rxLen -= conn->rxPos;
+			conn->rxPos = 0;
+		}
+		if (conn->rxSize < want) {
+			void *p;
+			if ((p = mem_realloc(HTTPD_MEM_SESSION, conn->rx, want)) == NULL) return HTE_NOMEM;
+			conn->rx = p;
+			conn->rxSize = want;
+		}
+		
+		if ((l = recv(conn->fd, &conn->rx[conn->rxLen], conn->rxSize - conn->rxLen, 0)) <= 0) return HTE_READ;
+		capture_data(conn->session, &conn->rx[conn->rxLen], l);
+		conn->rxLen += l;
+	}
+	
+	return HTE_NONE;
+}
+
+/* strips padding and priority from DATA / HEADERS payloads */
+static enum h2_error h2_payload(int flags, int priority, unsigned char **p, size_t *len) {
+	size_t pad = 0;
+	
+	if (flags & H2_FLAG_PADDED) {
+		if (*len < 1) return H2_FRAME_SIZE_ERROR;
+		pad = (*p)[0];
+		(*p)++;
+		(*len)--;
+	}
+	if (priority && (flags & H2_FLAG_PRIORITY)) {
+		if (*len < 5) return H2_FRAME_SIZE_ERROR;
+		*p += 5;
+		*len -= 5;
+	}
+	if (pad > *len) return H2_PROTOCOL_ERROR;
+	*len -= pad;
+	
+	return H2_NO_ERROR;
+}
+
+static enum h2_error h2_headerBlock(struct h2_conn *conn, unsigned int id, unsigned char *block, size_t len, int endStream) {
+	struct h2_stream *stream;
+	struct http_request *req;
+	int closed = 0;
+	hte ret;
+	
+	/* once the stream is running its thread may free it at any point */
+	pthread_mutex_lock(&conn->mutex);
+	if ((stream = h2_streamFind(conn, id)) != NULL && stream->endStream) closed = 1;
+	pthread_mutex_unlock(&conn->mutex);
+	
+	if (closed) {
+		h2_sendRst(conn, id, H2_STREAM_CLOSED);
+		return H2_NO_ERROR;
+	}
+	if (stream) {
+		/* trailers */
+		if (!endStream) return H2_PROTOCOL_ERROR;
+		if (hpack_decode(&conn->decoder, block, len, h2_discardHeader, NULL) != HTE_NONE) return H2_COMPRESSION_ERROR;
+		if (h2_streamStart(conn, stream) != HTE_NONE) h2_sendRst(conn, id, H2_INTERNAL_ERROR);
+		return H2_NO_ERROR;
+	}
+	
+	/* a stream that's come and gone, or was skipped over, can't be opened now (RFC 9113 5.1.1) */
+	if (id <= conn->lastStreamId) return H2_PROTOCOL_ERROR;
+	conn->lastStreamId = id;
+	
+	if (conn->streamc >= H2_MAX_STREAMS || (stream = h2_streamNew(conn, id, NULL)) == NULL) {
+		/* the decoder has to see it regardless */
+		if (hpack_decode(&conn->decoder, block, len, h2_discardHeader, NULL) != HTE_NONE) return H2_COMPRESSION_ERROR;
+		h2_sendRst(conn, id, H2_REFUSED_STREAM);
+		return H2_NO_ERROR;
+	}
+	
+	/* index 0 must never be used for a header, so give it the version */
+	if (h2_append(stream, "HTTP/2.0", 8, 1) == -1) {
+		ret = HTE_NOMEM;
+	} else {
+		stream->session->xfer.request->httpVersion = 0;
+		ret = hpack_decode(&conn->decoder, block, len, h2_emitHeader, stream);
+	}
+	if (ret == HTE_NONE && stream->refused) {
+		h2_streamRefuse(conn, stream, endStream);
+		return H2_NO_ERROR;
+	}
+	if (ret != HTE_NONE || stream->malformed || !stream->gotMethod || !stream->gotPath) {
+		h2_streamDrop(conn, stream);
+		
+		/* a broken block leaves the decoder out of step with the client, that's the end of the connection */
+		if (ret == HTE_PARSE) return H2_COMPRESSION_ERROR;
+		h2_sendRst(conn, id, ret == HTE_NOMEM ? H2_INTERNAL_ERROR : H2_PROTOCOL_ERROR);
+		return H2_NO_ERROR;
+	}
+	
+	/* split as the HTTP/1 request line is, so the head hook sees the same URI */
+	req = stream->session->xfer.request;
+	req->queryAt = http_uri_split(&req->buf->data[(long)req->uri]);
+	
+	if (!endStream) h2_streamHead(conn, stream);
+	else if (h2_streamStart(conn, stream) != HTE_NONE) h2_sendRst(conn, id, H2_INTERNAL_ERROR);
+	
+	return H2_NO_ERROR;
+}
+
+static enum h2_error h2_frame(struct h2_conn *conn, int type, int flags, unsigned int id, unsigned char *p, size_t len) {
+	struct h2_stream *stream;
+	enum h2_error err;
+	
+	/* a header block must not be interrupted */
+	if (conn->block && (type != H2_CONTINUATION || id != conn->blockStream)) return H2_PROTOCOL_ERROR;
+	
+	switch (type) {
+		case H2_DATA: {
+			size_t frameLen = len;
+			long long body = conn->session->httpd->limits.body;
+			
+			/* limit or no, a body can't be more than INT_MAX, as the HTTP/1 parser has it */
+			if (body <= 0 || body > INT_MAX) body = INT_MAX;
+			
+			if (id == 0) return H2_PROTOCOL_ERROR;
+			if ((err = h2_payload(flags, 0, &p, &len)) != H2_NO_ERROR) return err;
+			
+			/* the whole frame counts against the windows, padding and all */
+			if ((long)frameLen > conn->recvWindow) return H2_FLOW_CONTROL_ERROR;
+			conn->recvWindow -= frameLen;
+			
+			pthread_mutex_lock(&conn->mutex);
+			if ((stream = h2_streamFind(conn, id)) != NULL && stream->endStream) stream = NULL;
+			pthread_mutex_unlock(&conn->mutex);
+			
+			if (!stream) {
+				if (id > conn->lastStreamId) return H2_PROTOCOL_ERROR;
+				h2_sendRst(conn, id, H2_STREAM_CLOSED);
+			} else if (stream->session->xfer.request->data.contentReceived + len > (unsigned long long)body) {
+				/* before the window, so it's a 413 rather than a reset */
+				stream->refused = 413;
+				h2_streamRefuse(conn, stream, flags & H2_FLAG_END_STREAM);
+			} else if ((long)frameLen > stream->recvWindow) {
+				h2_sendRst(conn, id, H2_FLOW_CONTROL_ERROR);
+				h2_streamDrop(conn, stream);
+			} else {
+				struct http_request *req = stream->session->xfer.request;
+				long idx, room;
+				
+				stream->recvWindow -= frameLen;
+				if (len > 0) {
+					if ((idx = h2_append(stream, p, len, 0)) == -1) {
+						if (stream->refused) {
+							h2_streamRefuse(conn, stream, flags & H2_FLAG_END_STREAM);
+						} else {
+							h2_sendRst(conn, id, H2_INTERNAL_ERROR);
+							h2_streamDrop(conn, stream);
+						}
+						goto taken;
+					}
+					if (req->data.content == NULL) req->data.content = (void*)idx;
+					req->data.contentReceived += len;
+				}
+				
+				/* the request has taken it, so the client may send more - in halves, not a frame at a time,
+				   and never more than the body limit has room for (and a little padding) */
+				room = H2_WINDOW;
+				if (body - (long long)req->data.contentReceived + 256 < room) room = body - req->data.contentReceived + 256;
+				
+				if (flags & H2_FLAG_END_STREAM) {
+					if (h2_streamStart(conn, stream) != HTE_NONE) h2_sendRst(conn, id, H2_INTERNAL_ERROR);
+				} else if (stream->recvWindow <= room / 2) {
+					h2_sendWindowUpdate(conn, id, room - stream->recvWindow);
+					stream->recvWindow = room;
+				}
+			}
+			
+taken:
+			/* the frame's off the socket, kept or dropped, so the connection may carry more */
+			if (conn->recvWindow <= H2_WINDOW / 2) {
+				h2_sendWindowUpdate(conn, 0, H2_WINDOW - conn->recvWindow);
+				conn->recvWindow = H2_WINDOW;
+			}
+			return H2_NO_ERROR;
+		}
+			
+		case H2_HEADERS:
+			if (id == 0 || (id & 1) == 0) return H2_PROTOCOL_ERROR;
+			if ((err = h2_payload(flags, 1, &p, &len)) != H2_NO_ERROR) return err;
+			
+			if (flags & H2_FLAG_END_HEADERS) return h2_headerBlock(conn, id, p, len, flags & H2_FLAG_END_STREAM);
+			
+			if ((conn->block = mem_malloc(HTTPD_MEM_SESSION, len + 1)) == NULL) return H2_INTERNAL_ERROR;
+			memcpy(conn->block, p, len);
+			conn->blockLen = len;
+			conn->blockStream = id;
+			conn->blockEndStream = flags & H2_FLAG_END_STREAM;
+			return H2_NO_ERROR;
+			
+		case H2_CONTINUATION: {
+			void *b;
+			
+			if (!conn->block) return H2_PROTOCOL_ERROR;
+			if (conn->blockLen + len > H2_MAX_HEADER_BLOCK) return H2_PROTOCOL_ERROR;
+			if ((b = mem_realloc(HTTPD_MEM_SESSION, conn->block, conn->blockLen + len + 1)) == NULL) return H2_INTERNAL_ERROR;
+			conn->block = b;
+			memcpy(&conn->block[conn->blockLen], p, len);
+			conn->blockLen += len;
+			
+			if (!(flags & H2_FLAG_END_HEADERS)) return H2_NO_ERROR;
+			
+			err = h2_headerBlock(conn, conn->blockStream, conn->block, conn->blockLen, conn->blockEndStream);
+			mem_free(conn->block);
+			conn->block = NULL;
+			return err;
+		}
+			
+		case H2_PRIORITY:
+			if (id == 0) return H2_PROTOCOL_ERROR;
+			if (len != 5) return H2_FRAME_SIZE_ERROR;
+			return H2_NO_ERROR;
+			
+		case H2_RST_STREAM:
+			if (id == 0) return H2_PROTOCOL_ERROR;
+			if (len != 4) return H2_FRAME_SIZE_ERROR;
+			
+			pthread_mutex_lock(&conn->mutex);
+			if ((stream = h2_streamFind(conn, id)) != NULL) {
+				stream->reset = 1;
+				if (!stream->running) {
+					h2_streamUnlink(conn, stream);
+				} else {
+					stream = NULL;
+				}
+				pthread_cond_broadcast(&conn->cond);
+			}
+			pthread_mutex_unlock(&conn->mutex);
+			if (stream) h2_streamFree(stream);
+			return H2_NO_ERROR;
+			
+		case H2_SETTINGS:
+			if (id != 0) return H2_PROTOCOL_ERROR;
+			if (flags & H2_FLAG_ACK) {
+				if (len != 0) return H2_FRAME_SIZE_ERROR;
+				return H2_NO_ERROR;
+			}
+			if ((err = h2_applySettings(conn, p, len)) != H2_NO_ERROR) return err;
+			h2_sendFrame(conn, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+			return H2_NO_ERROR;
+			
+		case H2_PUSH_PROMISE:
+			/* clients can't push */
+			return H2_PROTOCOL_ERROR;
+			
+		case H2_PING:
+			if (id != 0) return H2_PROTOCOL_ERROR;
+			if (len != 8) return H2_FRAME_SIZE_ERROR;
+			if (!(flags & H2_FLAG_ACK)) h2_sendFrame(conn, H2_PING, H2_FLAG_ACK, 0, p, 8);
+			return H2_NO_ERROR;
+			
+		case H2_GOAWAY:
+			/* the client will close when it's ready, streams in flight carry on until then */
+			if (id != 0) return H2_PROTOCOL_ERROR;
+			return H2_NO_ERROR;
+			
+		case H2_WINDOW_UPDATE: {
+			uint32_t inc;
+			
+			if (len != 4) return H2_FRAME_SIZE_ERROR;
+			inc = h2_get32(p) & 0x7FFFFFFF;
+			
+			pthread_mutex_lock(&conn->mutex);
+			if (id == 0) {
+				if (inc == 0 || conn->sendWindow + inc > H2_WINDOW_MAX) {
+					pthread_mutex_unlock(&conn->mutex);
+					return inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR;
+				}
+				conn->sendWindow += inc;
+			} else if ((stream = h2_streamFind(conn, id)) != NULL) {
+				if (inc == 0 || stream->sendWindow + inc > H2_WINDOW_MAX) {
+					stream->reset = 1;
+					pthread_mutex_unlock(&conn->mutex);
+					h2_sendRst(conn, id, inc == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+					pthread_mutex_lock(&conn->mutex);
+				} else {
+					stream->sendWindow += inc;
+				}
+			}
+			pthread_cond_broadcast(&conn->cond);
+			pthread_mutex_unlock(&conn->mutex);
+			return H2_NO_ERROR;
+		}
+			
+		default:
+			/* unknown frame types must be ignored */
+			return H2_NO_ERROR;
+	}
+}
+
+/* ########################################################################## */
+
+int h2_detect(struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	char *upgrade;
+	
+	if (!strcmp((char*)req->method, "PRI") && !strcmp((char*)req->uri, "*") &&
+	    !strcmp((char*)req->httpVersion, "HTTP/2.0")) return H2_PRIOR_KNOWLEDGE;
+	
+	if ((upgrade = httpd_getHeader(session, "Upgrade")) == NULL) return 0;
+	if (httpd_getHeader(session, "HTTP2-Settings") == NULL) return 0;
+	
+	/* Upgrade is a comma separated list */
+	while (*upgrade) {
+		size_t l;
+		while (*upgrade == ' ' || *upgrade == ',') upgrade++;
+		l = strcspn(upgrade, " ,");
+		if (l == 3 && !strncasecmp(upgrade, "h2c", 3)) return H2_UPGRADE;
+		upgrade += l;
+	}
+	
+	return 0;
+}
+
+hte h2_serve(struct session_info *session, int how) {
+	struct http_request *req = session->xfer.request;
+	struct h2_conn *conn;
+	struct h2_stream *stream;
+	char *preface;
+	size_t len;
+	int gotSettings = 0;
+	hte ret = HTE_NONE;
+	enum h2_error err = H2_NO_ERROR;
+	
+	if ((conn = mem_malloc(HTTPD_MEM_SESSION, sizeof(*conn))) == NULL) return HTE_NOMEM;
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = session->fd;
+	conn->session = session;
+	pthread_mutex_init(&conn->mutex, NULL);
+	pthread_cond_init(&conn->cond, NULL);
+	pthread_mutex_init(&conn->writeMutex, NULL);
+	conn->sendWindow = H2_WINDOW;
+	conn->recvWindow = H2_WINDOW;
+	conn->peerInitialWindow = H2_WINDOW;
+	conn->peerMaxFrame = H2_MAX_FRAME;
+	hpack_tableInit(&conn->decoder);
+	
+	/* anything the HTTP/1 parser read past the end of the request is ours */
+	len = req->buf->next - req->parsePos;
+	conn->rxSize = H2_FRAME_HEADER + H2_MAX_FRAME;
+	if (conn->rxSize < len) conn->rxSize = len;
+	if ((conn->rx = mem_malloc(HTTPD_MEM_SESSION, conn->rxSize)) == NULL) { ret = HTE_NOMEM; goto die; }
+	memcpy(conn->rx, &req->buf->data[req->parsePos], len);
+	conn->rxLen = len;
+	
+	if (how == H2_UPGRADE) {
+		unsigned char settings[256];
+		char rsp[] = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+		int l;
+		
+		if ((l = h2_base64url(httpd_getHeader(session, "HTTP2-Settings"), settings, sizeof(settings))) < 0 ||
+		    h2_applySettings(conn, settings, l) != H2_NO_ERROR) {
+			ret = HTE_PARSE;
+			goto die;
+		}
+		if ((ret = h2_sendAll(conn->fd, (unsigned char*)rsp, sizeof(rsp) - 1, 0)) != HTE_NONE) goto die;
+		
+		/* the request becomes stream 1, which is already half closed */
+		if ((stream = h2_streamNew(conn, 1, NULL)) == NULL) { ret = HTE_NOMEM; goto die; }
+		session_xferFree(stream->session);
+		stream->session->xfer.request = req;
+		stream->session->xfer.response = session->xfer.response;
+		session->xfer.request = NULL;
+		session->xfer.response = NULL;
+		if ((ret = session_xferAlloc(session)) != HTE_NONE) goto die;
+		req->httpVersion = (unsigned char*)"HTTP/2.0";
+		conn->lastStreamId = 1;
+		
+		preface = H2_PREFACE;
+	} else {
+		/* "PRI * HTTP/2.0\r\n\r\n" has been through the HTTP/1 parser */
+		preface = &H2_PREFACE[18];
+	}
+	
+	/* our SETTINGS must be the first thing we send */
+	{
+		unsigned char s[6];
+		s[0] = 0;
+		s[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+		h2_put32(&s[2], H2_MAX_STREAMS);
+		if ((ret = h2_sendFrame(conn, H2_SETTINGS, 0, 0, s, sizeof(s))) != HTE_NONE) goto die;
+	}
+	
+	if ((ret = h2_fill(conn, strlen(preface))) != HTE_NONE) goto die;
+	if (memcmp(&conn->rx[conn->rxPos], preface, strlen(preface))) { ret = HTE_PARSE; goto die; }
+	conn->rxPos += strlen(preface);
+	
+	if (how == H2_UPGRADE) {
+		pthread_mutex_lock(&conn->mutex);
+		stream = h2_streamFind(conn, 1);
+		pthread_mutex_unlock(&conn->mutex);
+		if (h2_streamStart(conn, stream) != HTE_NONE) h2_sendRst(conn, 1, H2_INTERNAL_ERROR);
+	}
+	
+	for (;;) {
+		unsigned char *h;
+		size_t frameLen;
+		if ((ret = h2_fill(conn, H2_FRAME_HEADER)) != HTE_NONE) break;
+		h = &conn->rx[conn->rxPos];
+		frameLen = (h[0] << 16) | (h[1] << 8) | h[2];
+		
+		if (frameLen > H2_MAX_FRAME) { err = H2_FRAME_SIZE_ERROR; break; }
+		if ((ret = h2_fill(conn, H2_FRAME_HEADER + frameLen)) != HTE_NONE) break;
+		h = &conn->rx[conn->rxPos];
+		
+		/* the client's preface ends with a SETTINGS frame */
+		if (!gotSettings && h[3] != H2_SETTINGS) { err = H2_PROTOCOL_ERROR; break; }
+		gotSettings = 1;
+		
+		err = h2_frame(conn, h[3], h[4], h2_get32(&h[5]) & 0x7FFFFFFF, &h[H2_FRAME_HEADER], frameLen);
+		if (err != H2_NO_ERROR) break;
+		
+		conn->rxPos += H2_FRAME_HEADER + frameLen;
+	}
+	
+	/* a client hanging up is the normal way for this to end */
+	if (ret == HTE_READ) ret = HTE_NONE;
+	if (err != H2_NO_ERROR) {
+		h2_sendGoaway(conn, err);
+		ret = HTE_PARSE;
+	}
+	
+die:
+	/* let any streams that are still running finish (or fail) before the connection goes */
+	pthread_mutex_lock(&conn->mutex);
+	conn->dead = 1;
+	pthread_cond_broadcast(&conn->cond);
+	while (conn->active > 0) pthread_cond_wait(&conn->cond, &conn->mutex);
+	pthread_mutex_unlock(&conn->mutex);
+	
+	while ((stream = conn->streams) != NULL) {
+		conn->streams = stream->next;
+		h2_streamFree(stream);
+	}
+	
+	hpack_tableFree(&conn->decoder);
+	if (conn->block) mem_free(conn->block);
+	if (conn->rx) mem_free(conn->rx);
+	pthread_mutex_destroy(&conn->writeMutex);
+	pthread_cond_destroy(&conn->cond);
+	pthread_mutex_destroy(&conn->mutex);
+	mem_free(conn);
+	
+	return ret;
+}
@@ -0,0 +1,45 @@
+#ifndef H2_H
+#define H2_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* cleartext HTTP/2 (RFC 7540) - either 'prior knowledge' (the request line was
+   "PRI * HTTP/2.0") or an HTTP/1.1 request carrying "Upgrade: h2c"
+   the session thread reads frames for the whole connection, each stream gets
+   its own session_info and is handed to session_dispatch() on a thread of its own */
+
+struct session_info;
+struct h2_stream;
+
+#define H2_PRIOR_KNOWLEDGE 1
+#define H2_UPGRADE         2
+
+#define H2_MAX_STREAMS     100    /* our SETTINGS_MAX_CONCURRENT_STREAMS */
+#define H2_MAX_HEADER_BLOCK 65536 /* the most we'll buffer waiting for END_HEADERS */
+
+/* returns H2_PRIOR_KNOWLEDGE or H2_UPGRADE if the request just read starts HTTP/2, otherwise 0 */
+int h2_detect(struct session_info *session);
+hte h2_serve(struct session_info *session, int how);
+
+/* reached through http_respond() and httpd_flush() for sessions that belong to a stream */
+hte h2_respond(struct session_info *session, int generate_content_length);
+hte h2_flush(struct session_info *session);
+
+#endif /* H2_H */
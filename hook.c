@@ -0,0 +1,62 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <sched.h>
+
+#include "hook.h"
+
+void hook_set(struct hook *hook, hook_fn fn, void *ctx) {
+	unsigned int seq;
+	
+	/* making it odd keeps other writers out as well as warning readers */
+	do {
+		seq = *(volatile unsigned int *)&hook->seq & ~1U;
+	} while (!__sync_bool_compare_and_swap(&hook->seq, seq, seq + 1));
+	__sync_synchronize();
+	
+	hook->fn = fn;
+	hook->ctx = ctx;
+	
+	__sync_synchronize();
+	hook->seq = seq + 2;
+}
+
+hook_fn hook_get(struct hook *hook, void **ctx) {
+	unsigned int seq;
+	hook_fn fn;
+	
+	/* the usual case, and if it's being set right now the request can just miss it */
+	if (*(hook_fn volatile *)&hook->fn == NULL) return NULL;
+	
+	for (;;) {
+		/* a writer that's been preempted half way would otherwise have us spin for the rest of our slice */
+		if ((seq = *(volatile unsigned int *)&hook->seq) & 1) {
+			sched_yield();
+			continue;
+		}
+		__sync_synchronize();
+		
+		fn = *(hook_fn volatile *)&hook->fn;
+		*ctx = *(void * volatile *)&hook->ctx;
+		
+		__sync_synchronize();
+		if (*(volatile unsigned int *)&hook->seq == seq) return fn;
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef HOOK_H
+#define HOOK_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* a callback and the ctx it's handed, which must always be seen together - they're written under a
+   sequence count (odd while a write is under way), and a reader that sees it change goes again
+   nothing is allocated, so a hook can be changed as often as you like while requests are using it */
+
+typedef void (*hook_fn)(void);
+
+struct hook {
+	unsigned int seq;
+	hook_fn fn;
+	void *ctx;
+};
+
+void hook_set(struct hook *hook, hook_fn fn, void *ctx);
+/* NULL if there isn't one */
+hook_fn hook_get(struct hook *hook, void **ctx);
+
+#endif /* HOOK_H */
@@ -0,0 +1,461 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "internal.h"
+#include "buf.h"
+#include "mem.h"
+#include "hpack.h"
+
+struct hpack_static {
+	const char *name;
+	const char *value;
+};
+
+/* RFC 7541 Appendix A - index 1 is [0] */
+static const struct hpack_static hpack_staticTable[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+/* RFC 7541 Appendix B, code lengths only - the code is canonical, so the codes
+   themselves are rebuilt from these in hpack_init(), [256] is EOS */
+static const unsigned char hpack_huffmanLen[257] = {
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	 6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+	 5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+	13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+	 7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+	15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+	 6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30,
+};
+
+#define HPACK_STATIC_COUNT (sizeof(hpack_staticTable) / sizeof(*hpack_staticTable))
+
+static unsigned int huffFirst[31];   /* the first code of each length */
+static unsigned int huffCount[31];   /* how many codes there are of each length */
+static unsigned int huffOffset[31];  /* where each length starts in huffSymbols[] */
+static unsigned short huffSymbols[257];
+
+static INIT void hpack_init(void) {
+	unsigned int code = 0;
+	int len, sym, n = 0;
+	
+	for (len = 1; len <= 30; len++) {
+		huffFirst[len] = code;
+		huffOffset[len] = n;
+		huffCount[len] = 0;
+		for (sym = 0; sym < 257; sym++) {
+			if (hpack_huffmanLen[sym] != len) continue;
+			huffSymbols[n++] = sym;
+			huffCount[len]++;
+		}
+		code = (code + huffCount[len]) << 1;
+	}
+}
+
+/* ########################################################################## */
+
+/* 'dst' must have room for len * 8 / 5 bytes */
+static int huff_decode(unsigned char *src, size_t len, unsigned char *dst, size_t *outLen) {
+	uint64_t bits = 0;
+	size_t i = 0, o = 0;
+	int nbits = 0;
+	
+	for (;;) {
+		unsigned int code;
+		int l, found;
+		
+		while (nbits <= 56 && i < len) {
+			bits = (bits << 8) | src[i++];
+			nbits += 8;
+		}
+		if (nbits == 0) break;
+		
+		found = 0;
+		for (l = 5; l <= 30 && l <= nbits; l++) {
+			code = (bits >> (nbits - l)) & ((1u << l) - 1);
+			if (code - huffFirst[l] >= huffCount[l]) continue;
+			
+			code = huffSymbols[huffOffset[l] + code - huffFirst[l]];
+			if (code == 256) return -1; /* EOS mustn't appear in a string */
+			dst[o++] = code;
+			nbits -= l;
+			found = 1;
+			break;
+		}
+		if (found) continue;
+		
+		/* whatever is left must be padding - fewer than 8 bits, all ones (the start of EOS) */
+		if (i < len || nbits > 7) return -1;
+		if ((bits & ((1u << nbits) - 1)) != (1u << nbits) - 1) return -1;
+		break;
+	}
+	
+	*outLen = o;
+	return 0;
+}
+
+static int hpack_int(unsigned char **p, unsigned char *end, int prefix, size_t *out) {
+	size_t max, v;
+	unsigned char b;
+	int m = 0;
+	
+	if (*p >= end) return -1;
+	max = (1u << prefix) - 1;
+	v = **p & max;
+	(*p)++;
+	
+	if (v == max) {
+		do {
+			if (*p >= end || m > 28) return -1;
+			b = *(*p)++;
+			v += (size_t)(b & 0x7F) << m;
+			m += 7;
+		} while (b & 0x80);
+	}
+	
+	*out = v;
+	return 0;
+}
+
+/* huffman coded strings are decoded into 'scratch' (and *scratchPos moved along), others are left where they are */
+static int hpack_string(unsigned char **p, unsigned char *end, unsigned char *scratch, size_t *scratchPos, unsigned char **str, size_t *len) {
+	size_t l;
+	int huff;
+	
+	if (*p >= end) return -1;
+	huff = **p & 0x80;
+	if (hpack_int(p, end, 7, &l) != 0) return -1;
+	if (l > (size_t)(end - *p)) return -1;
+	
+	if (!huff) {
+		*str = *p;
+		*len = l;
+	} else {
+		*str = &scratch[*scratchPos];
+		if (huff_decode(*p, l, *str, len) != 0) return -1;
+		*scratchPos += *len;
+	}
+	*p += l;
+	
+	return 0;
+}
+
+/* ########################################################################## */
+
+void hpack_tableInit(struct hpack_table *table) {
+	memset(table, 0, sizeof(*table));
+	table->maxSize = HPACK_TABLE_SIZE;
+}
+
+void hpack_tableFree(struct hpack_table *table) {
+	int i;
+	for (i = 0; i < table->count; i++) {
+		mem_free(table->entries[(table->start + i) % table->capacity].name);
+	}
+	if (table->entries) mem_free(table->entries);
+	memset(table, 0, sizeof(*table));
+}
+
+static void hpack_evict(struct hpack_table *table, size_t maxSize) {
+	while (table->count > 0 && table->size > maxSize) {
+		struct hpack_entry *e = &table->entries[(table->start + table->count - 1) % table->capacity];
+		table->size -= e->nameLen + e->valueLen + 32;
+		mem_free(e->name);
+		table->count--;
+	}
+}
+
+static hte hpack_insert(struct hpack_table *table, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen) {
+	size_t size = nameLen + valueLen + 32;
+	struct hpack_entry *e;
+	unsigned char *p;
+	
+	/* copy first, the name may well belong to an entry that's about to be evicted */
+	if ((p = mem_malloc(HTTPD_MEM_HTTP, nameLen + valueLen + 2)) == NULL) return HTE_NOMEM;
+	memcpy(p, name, nameLen);
+	p[nameLen] = '\0';
+	memcpy(&p[nameLen + 1], value, valueLen);
+	p[nameLen + 1 + valueLen] = '\0';
+	
+	if (size > table->maxSize) {
+		/* too big to ever fit - this empties the table */
+		hpack_evict(table, 0);
+		mem_free(p);
+		return HTE_NONE;
+	}
+	hpack_evict(table, table->maxSize - size);
+	
+	if (table->count == table->capacity) {
+		struct hpack_entry *n;
+		int i, cap = table->capacity ? table->capacity * 2 : 16;
+		
+		if ((n = mem_malloc(HTTPD_MEM_HTTP, sizeof(*n) * cap)) == NULL) {
+			mem_free(p);
+			return HTE_NOMEM;
+		}
+		for (i = 0; i < table->count; i++) n[i] = table->entries[(table->start + i) % table->capacity];
+		if (table->entries) mem_free(table->entries);
+		table->entries = n;
+		table->capacity = cap;
+		table->start = 0;
+	}
+	
+	table->start = (table->start + table->capacity - 1) % table->capacity;
+	e = &table->entries[table->start];
+	e->name = p;
+	e->nameLen = nameLen;
+	e->value = &p[nameLen + 1];
+	e->valueLen = valueLen;
+	table->count++;
+	table->size += size;
+	
+	return HTE_NONE;
+}
+
+static int hpack_lookup(struct hpack_table *table, size_t index, unsigned char **name, size_t *nameLen, unsigned char **value, size_t *valueLen) {
+	struct hpack_entry *e;
+	
+	if (index == 0) return -1;
+	if (index <= HPACK_STATIC_COUNT) {
+		*name = (unsigned char *)hpack_staticTable[index - 1].name;
+		*nameLen = strlen(hpack_staticTable[index - 1].name);
+		*value = (unsigned char *)hpack_staticTable[index - 1].value;
+		*valueLen = strlen(hpack_staticTable[index - 1].value);
+		return 0;
+	}
+	
+	index -= HPACK_STATIC_COUNT + 1;
+	if (index >= (size_t)table->count) return -1;
+	
+	e = &table->entries[(table->start + index) % table->capacity];
+	*name = e->name;
+	*nameLen = e->nameLen;
+	*value = e->value;
+	*valueLen = e->valueLen;
+	return 0;
+}
+
+hte hpack_decode(struct hpack_table *table, unsigned char *data, size_t len, hpack_emit emit, void *ctx) {
+	unsigned char *p, *end, *scratch;
+	hte ret = HTE_NONE;
+	
+	/* huffman decoding never grows a string more than 8/5 */
+	if ((scratch = mem_malloc(HTTPD_MEM_HTTP, len * 2 + 16)) == NULL) return HTE_NOMEM;
+	
+	p = data;
+	end = data + len;
+	
+	while (p < end) {
+		unsigned char *name, *value;
+		size_t nameLen, valueLen, index, scratchPos = 0;
+		int incremental = 0;
+		
+		if (*p & 0x80) {
+			/* indexed header field */
+			if (hpack_int(&p, end, 7, &index) != 0) goto parse_error;
+			if (hpack_lookup(table, index, &name, &nameLen, &value, &valueLen) != 0) goto parse_error;
+			
+		} else if ((*p & 0xE0) == 0x20) {
+			/* dynamic table size update */
+			if (hpack_int(&p, end, 5, &index) != 0) goto parse_error;
+			if (index > HPACK_TABLE_SIZE) goto parse_error;
+			table->maxSize = index;
+			hpack_evict(table, index);
+			continue;
+			
+		} else {
+			/* literal - with incremental indexing (01), without (0000) or never indexed (0001) */
+			int prefix = 4;
+			if ((*p & 0xC0) == 0x40) {
+				incremental = 1;
+				prefix = 6;
+			}
+			
+			if (hpack_int(&p, end, prefix, &index) != 0) goto parse_error;
+			if (index != 0) {
+				unsigned char *v;
+				size_t vl;
+				if (hpack_lookup(table, index, &name, &nameLen, &v, &vl) != 0) goto parse_error;
+			} else {
+				if (hpack_string(&p, end, scratch, &scratchPos, &name, &nameLen) != 0) goto parse_error;
+			}
+			if (hpack_string(&p, end, scratch, &scratchPos, &value, &valueLen) != 0) goto parse_error;
+		}
+		
+		if ((ret = emit(ctx, name, nameLen, value, valueLen)) != HTE_NONE) goto die;
+		if (incremental && (ret = hpack_insert(table, name, nameLen, value, valueLen)) != HTE_NONE) goto die;
+	}
+	
+	mem_free(scratch);
+	return HTE_NONE;
+parse_error:
+	ret = HTE_PARSE;
+die:
+	mem_free(scratch);
+	return ret;
+}
+
+/* ########################################################################## */
+
+static int hpack_putInt(struct buf **buf, unsigned char flags, int prefix, size_t v) {
+	unsigned char b[12];
+	size_t max = (1u << prefix) - 1;
+	int n = 0;
+	
+	if (v < max) {
+		b[n++] = flags | v;
+	} else {
+		b[n++] = flags | max;
+		v -= max;
+		while (v >= 0x80) {
+			b[n++] = (v & 0x7F) | 0x80;
+			v >>= 7;
+		}
+		b[n++] = v;
+	}
+	
+	return nbufcatf(buf, (char *)b, n) == n ? 0 : -1;
+}
+
+int hpack_encodeField(struct buf **buf, char *name, char *value) {
+	char lname[256];
+	size_t nameLen, valueLen, i;
+	
+	nameLen = strlen(name);
+	valueLen = strlen(value);
+	if (nameLen >= sizeof(lname)) return -1;
+	
+	/* HTTP/2 insists on lower case names */
+	for (i = 0; i < nameLen; i++) lname[i] = tolower((unsigned char)name[i]);
+	lname[i] = '\0';
+	
+	for (i = 0; i < HPACK_STATIC_COUNT; i++) {
+		if (!strcmp(hpack_staticTable[i].name, lname)) break;
+	}
+	
+	if (i < HPACK_STATIC_COUNT) {
+		if (hpack_putInt(buf, 0x00, 4, i + 1) != 0) return -1;
+	} else {
+		if (hpack_putInt(buf, 0x00, 4, 0) != 0) return -1;
+		if (hpack_putInt(buf, 0x00, 7, nameLen) != 0) return -1;
+		if (nbufcatf(buf, lname, nameLen) != (int)nameLen) return -1;
+	}
+	if (hpack_putInt(buf, 0x00, 7, valueLen) != 0) return -1;
+	if (valueLen > 0 && nbufcatf(buf, value, valueLen) != (int)valueLen) return -1;
+	
+	return 0;
+}
+
+int hpack_encodeStatus(struct buf **buf, int code) {
+	char status[4];
+	int index;
+	
+	switch (code) {
+		case 200: index = 8;  break;
+		case 204: index = 9;  break;
+		case 206: index = 10; break;
+		case 304: index = 11; break;
+		case 400: index = 12; break;
+		case 404: index = 13; break;
+		case 500: index = 14; break;
+		default:  index = 0;  break;
+	}
+	if (index != 0) return hpack_putInt(buf, 0x80, 7, index);
+	
+	if (code < 100 || code > 999) code = 500;
+	snprintf(status, sizeof(status), "%d", code);
+	if (hpack_putInt(buf, 0x00, 4, 8) != 0) return -1;
+	if (hpack_putInt(buf, 0x00, 7, 3) != 0) return -1;
+	return nbufcatf(buf, status, 3) == 3 ? 0 : -1;
+}
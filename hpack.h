@@ -0,0 +1,60 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* HPACK (RFC 7541) header compression for HTTP/2
+   the decoder keeps a dynamic table per connection, the encoder doesn't use
+   one at all (or Huffman coding) so it has no state - responses are small */
+
+#include <stddef.h>
+
+#define HPACK_TABLE_SIZE 4096 /* our SETTINGS_HEADER_TABLE_SIZE, the default */
+
+struct hpack_entry {
+	unsigned char *name; /* name and value share one allocation */
+	unsigned char *value;
+	size_t nameLen;
+	size_t valueLen;
+};
+
+struct hpack_table {
+	struct hpack_entry *entries; /* a ring, [start] is the newest */
+	int capacity;
+	int start;
+	int count;
+	size_t size; /* as RFC 7541 counts it: name + value + 32 per entry */
+	size_t maxSize;
+};
+
+/* called for every header field in a block, the strings are only valid during the call */
+typedef hte (*hpack_emit)(void *ctx, unsigned char *name, size_t nameLen, unsigned char *value, size_t valueLen);
+
+void hpack_tableInit(struct hpack_table *table);
+void hpack_tableFree(struct hpack_table *table);
+
+/* returns HTE_PARSE on a compression error, which is fatal for the connection */
+hte hpack_decode(struct hpack_table *table, unsigned char *data, size_t len, hpack_emit emit, void *ctx);
+
+/* appends a 'literal without indexing' field to 'buf', the name is lower-cased on the way */
+int hpack_encodeField(struct buf **buf, char *name, char *value);
+int hpack_encodeStatus(struct buf **buf, int code);
+
+#endif /* HPACK_H */
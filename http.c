@@ -19,16 +19,30 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 
 #include "internal.h"
+#include "interface.h"
 #include "http.h"
 #include "session.h"
 #include "buf.h"
+#include "h2.h"
+#include "trace.h"
+#include "capture.h"
+#include "etag.h"
+#include "expect.h"
+#include "multipart.h"
+#include "gzip.h"
+#include "mem.h"
 
 #define HTTP_BLOCK_SIZE 128
 
-void inline http_getField(unsigned char *start, unsigned char **end, unsigned char *endOfData, unsigned char delimiter) {
+static inline void http_getField(unsigned char *start, unsigned char **end, unsigned char *endOfData, unsigned char delimiter) {
 	while (*start != delimiter && start < endOfData) start++;
 	if (*start == delimiter) {
 		*start = '\0';
@@ -37,7 +51,7 @@ void inline http_getField(unsigned char *start, unsigned char **end, unsigned ch
 		*end = NULL;
 	}
 }
-void inline http_trimField(unsigned char **start, unsigned char **end) {
+static inline void http_trimField(unsigned char **start, unsigned char **end) {
 	if (start) while (**start == ' ' && *start < *end) (*start)++;
 	if (end)   while (**end == ' '   && *end > *start) (*end)--;
 }
@@ -45,7 +59,7 @@ void inline http_trimField(unsigned char **start, unsigned char **end) {
 hte add_header(struct http_data *data, unsigned char *field_name, unsigned char *field_value) {
 	void *p;
 	
-	if ((p = realloc(data->headers, sizeof(*data->headers) * (data->headerc + 1))) == NULL) return HTE_NOMEM;
+	if ((p = mem_realloc(HTTPD_MEM_HTTP, data->headers, sizeof(*data->headers) * (data->headerc + 1))) == NULL) return HTE_NOMEM;
 	data->headers = p;
 	
 	data->headers[data->headerc].name = field_name;
@@ -67,90 +81,158 @@ unsigned char asc2bin(unsigned char c) {
 	return 0xFF;
 }
 
-EXPORT void http_uri_decode(unsigned char *uri) {
-	int i, o;
-	unsigned char t;
-	o = 0;
-	for (i = 0; uri[i+o] != '\0'; i++) {
-		if (uri[i+o] != '%') {
-			if (o > 0) uri[i] = uri[i+o];
-			continue;
-		}
-		if (uri[i+o+1] == '\0' || uri[i+o+2] == '\0') break;
-		if ((t = asc2bin(uri[i+o+1])) == 0xFF) continue;
-		uri[i]  = (t << 4) & 0xF0;
-		if ((t = asc2bin(uri[i+o+2])) == 0xFF) continue;
-		uri[i] |= (t     ) & 0x0F;
-		o += 2;
+/* the next '%' (or '+') - memchr() when it's only '%', otherwise a word at a time */
+static inline size_t http_nextEscape(const unsigned char *s, size_t len, int plus) {
+	const unsigned char *p;
+	uint64_t w, a, b;
+	size_t i;
+	
+	if (!plus) return (p = memchr(s, '%', len)) != NULL ? (size_t)(p - s) : len;
+	
+#define ZEROBYTE(x) (((x) - 0x0101010101010101ULL) & ~(x) & 0x8080808080808080ULL)
+	for (i = 0; i + 8 <= len; i += 8) {
+		memcpy(&w, &s[i], 8);
+		a = w ^ 0x2525252525252525ULL;
+		b = w ^ 0x2B2B2B2B2B2B2B2BULL;
+		if (ZEROBYTE(a) | ZEROBYTE(b)) break;
+	}
+#undef ZEROBYTE
+	for (; i < len; i++) {
+		if (s[i] == '%' || s[i] == '+') break;
 	}
-	uri[i] = '\0';
+	return i;
 }
-EXPORT void http_uri_decode2(unsigned char *uri) {
-	int i, o;
-	unsigned char t, p;
-	o = 0;
-	for (i = 0; uri[i+o] != '\0'; i++) {
-		if (uri[i+o] != '%') {
-			if (o > 0) uri[i] = uri[i+o];
+
+/* decodes 'len' bytes of 'src' into 'dst' (which may be 'src'), moving whatever's between the escapes a run
+   at a time - a broken escape goes through as it is, and the decoded length is returned */
+size_t http_unescape(unsigned char *dst, const unsigned char *src, size_t len, int flags) {
+	size_t i, o, n;
+	unsigned char h, l;
+	
+	for (i = o = 0; i < len; ) {
+		n = http_nextEscape(&src[i], len - i, flags & HTTP_UNESCAPE_PLUS);
+		if (n > 0) {
+			if (&dst[o] != &src[i]) memmove(&dst[o], &src[i], n);
+			o += n;
+			i += n;
+			if (i >= len) break;
+		}
+		if (src[i] == '+') {
+			dst[o++] = ' ';
+			i++;
 			continue;
 		}
-		if (uri[i+o+1] == '\0' || uri[i+o+2] == '\0') break;
-		if ((t = asc2bin(uri[i+o+1])) == 0xFF) continue;
-		p  = (t << 4) & 0xF0;
-		if ((t = asc2bin(uri[i+o+2])) == 0xFF) continue;
-		p |= (t     ) & 0x0F;
-		if (p == 0x2F) { /* skip '/' */
-			int q;
-			for (q = 0; q <= o; q++) uri[i+q] = uri[i+o+q];
-			i += 2;
+		if (len - i < 3 || (h = asc2bin(src[i + 1])) == 0xFF || (l = asc2bin(src[i + 2])) == 0xFF ||
+		    ((flags & HTTP_UNESCAPE_SLASH) && ((h << 4) | l) == 0x2F)) {
+			dst[o++] = src[i++];
 			continue;
 		}
-		uri[i] = p;
-		o += 2;
+		dst[o++] = (h << 4) | l;
+		i += 3;
 	}
-	uri[i] = '\0';
+	
+	return o;
+}
+
+/* decodes the path, and leaves the query as it came (for the parameter index) - the query's offset in
+   'uri' is returned, 0 if there's no query */
+size_t http_uri_split(unsigned char *uri) {
+	unsigned char *q;
+	size_t len, n;
+	
+	len = strlen((char *)uri);
+	if ((q = memchr(uri, '?', len)) == NULL) {
+		uri[http_unescape(uri, uri, len, HTTP_UNESCAPE_SLASH)] = '\0';
+		return 0;
+	}
+	n = http_unescape(uri, uri, q - uri, HTTP_UNESCAPE_SLASH);
+	memmove(&uri[n], q, len - (q - uri) + 1);
+	
+	return n + 1;
+}
+
+EXPORT void http_uri_decode(unsigned char *uri) {
+	uri[http_unescape(uri, uri, strlen((char *)uri), 0)] = '\0';
+}
+EXPORT void http_uri_decode2(unsigned char *uri) {
+	uri[http_unescape(uri, uri, strlen((char *)uri), HTTP_UNESCAPE_SLASH)] = '\0';
 }
 
 /* ########################################################################## */
 
 /* BE AWARE! during the parse, until http_parse_fixup() is called, all pointers are held as indexes */
 hte http_read(struct session_info *session) {
-	hte ret = HTE_NONE;
+	hte ret;
+	
+	if (!session || !session->xfer.request) return HTE_INVALPARAM;
+	
+	session->xfer.request->state = STATE_START;
+	
+	while (session->xfer.request->state != STATE_COMPLETE) {
+		if ((ret = http_readMore(session, 0)) != HTE_NONE) return ret;
+	}
+	
+	return http_readDone(session);
+}
+
+hte http_readMore(struct session_info *session, int flags) {
 	struct http_request *req;
+	size_t need;
 	ssize_t rxLen;
+	hte ret;
 	void *p;
 	
 	if (!session || !session->xfer.request) return HTE_INVALPARAM;
 	req = session->xfer.request;
 	
-	req->state = STATE_START;
-	
-	while (req->state != STATE_COMPLETE) {
-		if (req->buf == NULL) {
-			if ((req->buf = buf_alloc(NULL, HTTP_BLOCK_SIZE)) == NULL) return HTE_NOMEM;
-		} else {
-			if ((p = buf_alloc(req->buf, req->buf->next + HTTP_BLOCK_SIZE)) == NULL) {
-				buf_free(req->buf);
-				return HTE_NOMEM;
-			}
-			req->buf = p;
+	/* there's always room for a block more, and what the buffer grows by is charged to the connection
+	   (the budget may have none to spare) - a streamed body leaves the buffer where it was */
+	need = (req->buf ? req->buf->next : 0) + HTTP_BLOCK_SIZE;
+	if (req->buf == NULL || req->buf->len < need) {
+		if (!mem_charge(&session->memCharged, need - (req->buf ? req->buf->len : 0))) {
+			req->refused = 503;
+			return HTE_NOMEM;
 		}
-		
-		if ((rxLen = recv(session->fd, &(req->buf->data[req->buf->next]), HTTP_BLOCK_SIZE, 0)) == -1) {
-			ret = HTE_READ;
-			goto die;
-		}
-		
-		if (rxLen == 0) break;
-		req->buf->next += rxLen;
-		
-		if ((ret = http_parse(session)) != HTE_NONE) goto die;
-		
-		if (req->state == STATE_ERROR) { ret = HTE_PARSE; goto die; }
+		if ((p = buf_alloc(req->buf, need)) == NULL) return HTE_NOMEM;
+		req->buf = p;
+	}
+	
+	/* errno is left for the caller to find EAGAIN */
+	if ((rxLen = session_recv(session, &(req->buf->data[req->buf->next]), HTTP_BLOCK_SIZE, flags)) == -1) return HTE_READ;
+	
+	/* the connection closed before the request was complete */
+	if (rxLen == 0) return HTE_PARSE;
+	capture_data(session, &(req->buf->data[req->buf->next]), rxLen);
+	req->buf->next += rxLen;
+	
+	if ((ret = http_parse(session)) != HTE_NONE) return ret;
+	
+	if (req->state == STATE_ERROR) return HTE_PARSE;
+	timeout_progress(session);
+	
+	/* the head's in, and may yet be refused before any more of the body is read */
+	if (!req->headSeen && req->state >= STATE_START_CONTENT) {
+		req->headSeen = 1;
+		if ((ret = multipart_start(session)) != HTE_NONE) return ret;
+		if ((ret = expect_head(session)) != HTE_NONE) return ret;
 	}
+	if (req->multipart && (ret = multipart_take(session)) != HTE_NONE) return ret;
+	
+	return HTE_NONE;
+}
+
+hte http_readDone(struct session_info *session) {
+	struct http_request *req;
+	hte ret;
+	void *p;
+	
+	if (!session || !session->xfer.request) return HTE_INVALPARAM;
+	req = session->xfer.request;
 	
 	if (req->state != STATE_COMPLETE) { ret = HTE_PARSE; goto die; }
 	
+	TRACE(read_complete, HTTPD_TRACE_READ_COMPLETE, session);
+	
 	if ((p = buf_alloc(req->buf, req->buf->next)) != NULL) {
 		req->buf = p;
 	} else {
@@ -159,6 +241,8 @@ hte http_read(struct session_info *session) {
 	
 	if ((ret = http_parse_fixup(session)) != HTE_NONE) goto die;
 	
+	TRACE(parse_complete, HTTPD_TRACE_PARSE_COMPLETE, session);
+	
 	return HTE_NONE;
 die:
 	return ret;
@@ -171,17 +255,21 @@ EXPORT hte http_parse(struct session_info *session) {
 	unsigned char *sof1, *eof1; /* {start|end} of field 1 */
 	unsigned char *sof2, *eof2; /* {start|end} of field 2 */
 	unsigned char *sod,  *eod;  /* {start|end} of data */
+	struct httpd_limits *limits;
 	
 	if (!session || !session->xfer.request) return HTE_INVALPARAM;
 	req = session->xfer.request;
+	/* the parse harnesses have no server */
+	limits = session->httpd ? &session->httpd->limits : NULL;
 	
 #define INDEXOF(a) (void*)((a) - sod)
+#define REFUSE(code) do { req->refused = (code); ret = HTE_PARSE; goto die; } while (0)
 	sod = req->buf->data;
 	eod = &(req->buf->data[req->buf->next - 1]);
 	
 	ret = HTE_NONE;
 	
-	while (req->parsePos < req->buf->next - 1 && req->state != STATE_COMPLETE) {
+	while (req->parsePos < req->buf->next && req->state != STATE_COMPLETE) {
 		sol = &(req->buf->data[req->parsePos]);
 		
 		if (req->state == STATE_START ||
@@ -208,6 +296,7 @@ EXPORT hte http_parse(struct session_info *session) {
 		
 		switch (req->state) {
 			case STATE_START:
+				if (limits && limits->requestLine && eol - sol > limits->requestLine) REFUSE(414);
 				sof1 = sol;
 				
 				/* get the method */
@@ -219,7 +308,7 @@ EXPORT hte http_parse(struct session_info *session) {
 				/* get the uri */
 				http_getField(sof1, &eof1, eod, ' ');
 				if (eof1 == NULL) { ret = HTE_PARSE; goto die; };
-				http_uri_decode2(sof1);
+				req->queryAt = http_uri_split(sof1);
 				req->uri = INDEXOF(sof1);
 				sof1 = eof1 + 2;
 				
@@ -233,6 +322,8 @@ EXPORT hte http_parse(struct session_info *session) {
 				
 			case STATE_PARSING_HEADERS:
 				if (sol == eol) {
+					if (limits && limits->headerBytes && req->parsePos > (size_t)limits->headerBytes) REFUSE(431);
+					if (limits && limits->body && req->data.contentLength > (unsigned long long)limits->body) REFUSE(413);
 					if (req->data.contentLength > 0) {
 						req->state = STATE_START_CONTENT;
 					} else {
@@ -241,6 +332,7 @@ EXPORT hte http_parse(struct session_info *session) {
 					break;
 				}
 
+				if (limits && limits->headers && req->data.headerc >= limits->headers) REFUSE(431);
 				sof1 = sol;
 				
 				/* get the name */
@@ -252,33 +344,40 @@ EXPORT hte http_parse(struct session_info *session) {
 				http_trimField(&sof1, &eof1); eof1[1] = '\0';
 				http_trimField(&sof2, &eof2); eof2[1] = '\0';
 				
-				add_header(&req->data, INDEXOF(sof1), INDEXOF(sof2));
+				if ((ret = add_header(&req->data, INDEXOF(sof1), INDEXOF(sof2))) != HTE_NONE) goto die;
 				
 				if (!strcasecmp((char*)sof1,"Content-Length")) {
-					int i;
-					if (sscanf((char*)sof2, "%d", &i) == 1) {
-						req->data.contentLength = i;
-					}
+					unsigned long long i;
+					char *end;
+					
+					/* the callback is given the length as an int */
+					if (*sof2 < '0' || *sof2 > '9') REFUSE(400);
+					errno = 0;
+					i = strtoull((char*)sof2, &end, 10);
+					if (*end != '\0') REFUSE(400);
+					if (errno == ERANGE || i > INT_MAX) REFUSE(413);
+					req->data.contentLength = i;
 				}
 				
 				break;
 				
 			case STATE_START_CONTENT:
 				req->state = STATE_PARSING_CONTENT;
-			case STATE_PARSING_CONTENT:
-				if (!req->data.content) {
-					req->data.content = INDEXOF(sol);
-					req->data.contentReceived = eod - sol + 1;
-					req->parsePos = eod - req->buf->data;
-				} else {
-					req->data.contentReceived += eod - sol;
-					req->parsePos = eod - req->buf->data;
-				}
+				req->data.content = INDEXOF(sol);
+				req->data.contentReceived = 0;
+			case STATE_PARSING_CONTENT: {
+				size_t l;
+				
+				/* parsePos is the first byte we haven't seen, never take more than the body (pipelining) */
+				l = eod - sol + 1;
+				if (l > req->data.contentLength - req->data.contentReceived) l = req->data.contentLength - req->data.contentReceived;
+				req->data.contentReceived += l;
+				req->parsePos += l;
 				
-				if (req->data.contentReceived > req->data.contentLength) req->data.contentReceived = req->data.contentLength;
 				if (req->data.contentReceived == req->data.contentLength) req->state = STATE_COMPLETE;
 				
 				break;
+			}
 				
 			case STATE_COMPLETE:
 				break;
@@ -297,6 +396,13 @@ EXPORT hte http_parse(struct session_info *session) {
 		    req->state == STATE_PARSING_CONTENT ||
 		    req->state == STATE_COMPLETE) break;
 	}
+	
+	/* a line still waiting for its end counts too, or it could grow forever */
+	if (limits && (req->state == STATE_START || req->state == STATE_PARSING_HEADERS)) {
+		if (req->state == STATE_START && limits->requestLine && req->buf->next - req->parsePos > (size_t)limits->requestLine) REFUSE(414);
+		if (limits->headerBytes && req->buf->next > (size_t)limits->headerBytes) REFUSE(431);
+	}
+#undef REFUSE
 #undef INDEXOF
 	
 	return HTE_NONE;
@@ -306,12 +412,20 @@ die:
 }
 EXPORT hte http_parse_fixup(struct session_info *session) {
 	struct http_request *req;
-	int i;
 	
 	if (!session || !session->xfer.request) return HTE_INVALPARAM;
 	req = session->xfer.request;
 	
-#define FIXUP(a) a += (long)req->buf->data
+	http_rebase(req, (long)req->buf->data);
+
+	return HTE_NONE;
+}
+
+/* moves the parse's pointers by 'by' - from indexes to pointers into the buffer, or back again */
+void http_rebase(struct http_request *req, long by) {
+	int i;
+	
+#define FIXUP(a) a += by
 	FIXUP(req->method);
 	FIXUP(req->uri);
 	FIXUP(req->httpVersion);
@@ -323,11 +437,94 @@ EXPORT hte http_parse_fixup(struct session_info *session) {
 	}
 	if (req->data.content != NULL) FIXUP(req->data.content);
 #undef FIXUP
+}
 
+hte http_respond(struct session_info *session, int generate_content_length) {
+	struct http_response *rsp;
+	hte ret;
+	
+	ret = HTE_NONE;
+	
+	if (!session || !session->xfer.response) return HTE_INVALPARAM;
+	if (session->h2) return h2_respond(session, generate_content_length);
+	rsp = session->xfer.response;
+	if (rsp->flushed) {
+		/* a compressed stream was buffered too, and only the dispatcher's call (the last) wants a length */
+		if (rsp->gzip) return gzip_flush(session, generate_content_length);
+		
+		/* the head has gone, and usually the writes have too (straight to the fd)
+		   unless the connection is userspace TLS, then they were buffered for us to send now */
+		if (rsp->buf && rsp->buf->fd == 0 && rsp->buf->next > 0) {
+			ret = session_send(session, rsp->buf->data, rsp->buf->next);
+			rsp->buf->next = 0;
+		}
+		return ret;
+	}
+	
+	if ((ret = http_prepare(session, generate_content_length)) != HTE_NONE) return ret;
+	
+	/* the head, the buffer and any shared bodies go together */
+	{
+		struct iovec iov[HTTP_IOV];
+		int iovc;
+		
+		if ((iovc = body_iov(rsp, iov, 1)) > 0) if ((ret = session_sendv(session, iov, iovc)) != HTE_NONE) return ret;
+	}
+	
 	return HTE_NONE;
 }
 
-hte http_respond(struct session_info *session, int generate_content_length) {
+/* the reason phrase that goes with a status code */
+char *http_reason(int code) {
+	switch (code) {
+		case 100: return "Continue";
+		case 101: return "Switching Protocols";
+		case 200: return "OK";
+		case 201: return "Created";
+		case 202: return "Accepted";
+		case 203: return "Non-Authoritative Information";
+		case 204: return "No Content";
+		case 205: return "Reset Content";
+		case 206: return "Partial Content";
+		case 300: return "Multiple Choices";
+		case 301: return "Moved Permanently";
+		case 302: return "Found";
+		case 303: return "See Other";
+		case 304: return "Not Modified";
+		case 305: return "Use Proxy";
+		case 307: return "Temporary Redirect";
+		case 400: return "Bad Request";
+		case 401: return "Unauthorized";
+		case 402: return "Payment Required";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 405: return "Method Not Allowed";
+		case 406: return "Not Acceptable";
+		case 407: return "Proxy Authentication Required";
+		case 408: return "Request Time-out";
+		case 409: return "Conflict";
+		case 410: return "Gone";
+		case 411: return "Length Required";
+		case 412: return "Precondition Failed";
+		case 413: return "Request Entity Too Large";
+		case 414: return "Request-URI Too Large";
+		case 415: return "Unsupported Media Type";
+		case 416: return "Requested range not satisfiable";
+		case 417: return "Expectation Failed";
+		case 429: return "Too Many Requests";
+		case 431: return "Request Header Fields Too Large";
+		case 500: return "Internal Server Error";
+		case 501: return "Not Implemented";
+		case 502: return "Bad Gateway";
+		case 503: return "Service Unavailable";
+		case 504: return "Gateway Time-out";
+		case 505: return "HTTP Version not supported";
+		default:  return "Unknown";
+	}
+}
+
+/* builds the head in rsp->headBuf, ready to go ahead of rsp->buf */
+hte http_prepare(struct session_info *session, int generate_content_length) {
 	hte ret;
 	int l, i;
 	int gotContentLength = 0;
@@ -339,56 +536,14 @@ hte http_respond(struct session_info *session, int generate_content_length) {
 	
 	if (!session || !session->xfer.response) return HTE_INVALPARAM;
 	rsp = session->xfer.response;
-	if (rsp->buf != NULL && rsp->buf->fd != 0) return HTE_NONE;
-	
-	reason = (char*)rsp->httpReason;
-	if (!reason) {
-		/* if we don't have a reason string, look it up */
-		switch (rsp->httpCode) {
-			case 100: reason = "Continue";                        break;
-			case 101: reason = "Switching Protocols";             break;
-			case 200: reason = "OK";                              break;
-			case 201: reason = "Created";                         break;
-			case 202: reason = "Accepted";                        break;
-			case 203: reason = "Non-Authoritative Information";   break;
-			case 204: reason = "No Content";                      break;
-			case 205: reason = "Reset Content";                   break;
-			case 206: reason = "Partial Content";                 break;
-			case 300: reason = "Multiple Choices";                break;
-			case 301: reason = "Moved Permanently";               break;
-			case 302: reason = "Found";                           break;
-			case 303: reason = "See Other";                       break;
-			case 304: reason = "Not Modified";                    break;
-			case 305: reason = "Use Proxy";                       break;
-			case 307: reason = "Temporary Redirect";              break;
-			case 400: reason = "Bad Request";                     break;
-			case 401: reason = "Unauthorized";                    break;
-			case 402: reason = "Payment Required";                break;
-			case 403: reason = "Forbidden";                       break;
-			case 404: reason = "Not Found";                       break;
-			case 405: reason = "Method Not Allowed";              break;
-			case 406: reason = "Not Acceptable";                  break;
-			case 407: reason = "Proxy Authentication Required";   break;
-			case 408: reason = "Request Time-out";                break;
-			case 409: reason = "Conflict";                        break;
-			case 410: reason = "Gone";                            break;
-			case 411: reason = "Length Required";                 break;
-			case 412: reason = "Precondition Failed";             break;
-			case 413: reason = "Request Entity Too Large";        break;
-			case 414: reason = "Request-URI Too Large";           break;
-			case 415: reason = "Unsupported Media Type";          break;
-			case 416: reason = "Requested range not satisfiable"; break;
-			case 417: reason = "Expectation Failed";              break;
-			case 500: reason = "Internal Server Error";           break;
-			case 501: reason = "Not Implemented";                 break;
-			case 502: reason = "Bad Gateway";                     break;
-			case 503: reason = "Service Unavailable";             break;
-			case 504: reason = "Gateway Time-out";                break;
-			case 505: reason = "HTTP Version not supported";      break;
-			default:  reason = "Unknown";                         break;
-		}
+	
+	if (session->httpd) {
+		if (generate_content_length && (ret = etag_prepare(session)) != HTE_NONE) return ret;
+		if ((ret = gzip_prepare(session, !generate_content_length)) != HTE_NONE) return ret;
 	}
 	
+	reason = rsp->httpReason ? (char *)rsp->httpReason : http_reason(rsp->httpCode);
+	
 	/* add the HTTP status line */
 	if ((l = bufcatf(&rsp->headBuf, "%s %d %s\r\n", rsp->httpVersion, rsp->httpCode, reason)) <= 0) { ret = HTE_RESPOND; goto die; }
 	
@@ -402,20 +557,14 @@ hte http_respond(struct session_info *session, int generate_content_length) {
 			if ((l = bufcatf(&rsp->headBuf, "%s: %s\r\n", rsp->data.headers[i].name, rsp->data.headers[i].value)) <= 0) { ret = HTE_RESPOND; goto die; }
 		}
 	}
-	if (gotContentLength == 0 && generate_content_length != 0) {
-		if (rsp->buf) {
-			if ((l = bufcatf(&rsp->headBuf, "Content-Length: %d\r\n", rsp->buf->len)) <= 0) { ret = HTE_RESPOND; goto die; }
-		} else {
-			if ((l = bufcatf(&rsp->headBuf, "Content-Length: 0\r\n")) <= 0) { ret = HTE_RESPOND; goto die; }
-		}
+	/* a 304 has no body, and its length would be that of the one it stands in for */
+	if (gotContentLength == 0 && generate_content_length != 0 && rsp->httpCode != 304) {
+		if ((l = bufcatf(&rsp->headBuf, "Content-Length: %zu\r\n", body_length(rsp))) <= 0) { ret = HTE_RESPOND; goto die; }
 	}
 	
 	/* add the blank line */
 	if ((l = bufcatf(&rsp->headBuf, "\r\n")) <= 0) { ret = HTE_RESPOND; goto die; }
 	
-	if (rsp->headBuf) if ((ret = buf_send(session->fd, rsp->headBuf)) != HTE_NONE) goto die;
-	if (rsp->buf)     if ((ret = buf_send(session->fd, rsp->buf))     != HTE_NONE) goto die;
-	
 	return HTE_NONE;
 die:
 	return ret;
@@ -20,6 +20,8 @@
 	along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "body.h"
+
 struct session_info;
 
 enum http_state {
@@ -50,9 +52,15 @@ struct http_request {
 	struct buf *buf;
 	size_t parsePos;
 	enum http_state state;
+	int refused; /* the status a limit answers it with, 0 if none did */
+	int headSeen; /* expect_head() has been through it */
+	struct multipart *multipart; /* the body's parts, rather than the body */
+	struct query *query; /* the parameters, indexed when they're first asked for */
+	struct query *form;
 	
 	unsigned char *method;
 	unsigned char *uri;
+	size_t queryAt; /* where the query starts in uri, 0 if it hasn't got one */
 	unsigned char *httpVersion;
 	
 	struct http_data data;
@@ -61,6 +69,13 @@ struct http_request {
 struct http_response {
 	struct buf *headBuf;
 	struct buf *buf;
+	int flushed; /* the head has been sent by httpd_flush() */
+	struct gzip_stream *gzip; /* compressing what's flushed */
+	int direct; /* the body goes out around buf (the proxy), so it can't be compressed */
+	
+	struct httpd_body *bodies[HTTP_BODIES]; /* each goes out ahead of buf's data from bodyAt[] on */
+	size_t bodyAt[HTTP_BODIES];
+	int bodyc;
 	
 	unsigned char *httpVersion;
 	int httpCode;
@@ -69,7 +84,21 @@ struct http_response {
 	struct http_data data;
 };
 
+hte add_header(struct http_data *data, unsigned char *field_name, unsigned char *field_value);
+
 hte http_read(struct session_info *session);
+/* http_read() in pieces, for a loop that can't wait - one recv() with 'flags' and a parse each time */
+hte http_readMore(struct session_info *session, int flags);
+hte http_readDone(struct session_info *session); /* once the request is STATE_COMPLETE */
 hte http_respond(struct session_info *session, int generate_content_length);
+hte http_prepare(struct session_info *session, int generate_content_length);
+char *http_reason(int code);
+
+#define HTTP_UNESCAPE_SLASH 0x01 /* leave "%2F" alone */
+#define HTTP_UNESCAPE_PLUS  0x02 /* '+' is a space, as in a form */
+unsigned char asc2bin(unsigned char c); /* 0xFF if it isn't hex */
+size_t http_unescape(unsigned char *dst, const unsigned char *src, size_t len, int flags);
+size_t http_uri_split(unsigned char *uri);
+void http_rebase(struct http_request *req, long by);
 
 #endif /* HTTP_H */
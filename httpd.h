@@ -25,6 +25,9 @@ extern "C" {
 #endif
 
 #include <stdarg.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 enum httpd_err {
 	HTE_NONE = 0,
@@ -41,6 +44,8 @@ enum httpd_err {
 	HTE_PARSE = -11,
 	HTE_RESPOND = -12,
 	HTE_CALLBACK = -13,
+	HTE_TLS = -14,
+	HTE_ZLIB = -15, /* built without OPTIONS=HTTPD_ZLIB */
 };
 typedef enum httpd_err hte;
 
@@ -51,11 +56,44 @@ typedef int (*httpd_callback)(int rxid, struct session_info *session, char *cont
 
 hte httpd_startServer(struct httpd_info **httpd, int listenPort, httpd_callback callback);
 
+/* as httpd_startServer(), but every connection is TLS - the library must be built with OPTIONS=HTTPD_TLS
+   'certFile' (a PEM chain) and 'keyFile' are loaded before this returns
+   sessions can be resumed (tickets, or the server side cache), and where the kernel supports it the
+   connection is moved into kernel TLS once the handshake is done
+   WebSockets and event streams need kernel TLS, without it httpd_wsAccept() and httpd_sseSubscribe() return HTE_TLS */
+hte httpd_startTLSServer(struct httpd_info **httpd, int listenPort, httpd_callback callback, char *certFile, char *keyFile);
+
+struct httpd_tlsStats {
+	unsigned long long handshakes;
+	unsigned long long failures;
+	unsigned long long resumed;
+	unsigned long long ktlsSend; /* connections that the kernel encrypts for */
+	unsigned long long ktlsRecv; /* ... and decrypts for */
+};
+hte httpd_getTLSStats(struct httpd_info *httpd, struct httpd_tlsStats *stats);
+
+/* accept cleartext HTTP/2 - 'prior knowledge' or an "Upgrade: h2c" - off by default
+   every stream is passed to the callback on its own thread, just as a connection is */
+hte httpd_setH2c(struct httpd_info *httpd, int enable);
+
+/* ETags for dynamic responses - off by default
+   a buffered 200 to a GET or HEAD without one gets a weak ETag hashed from its body, and is sent as
+   a 304 without the body if the request's If-None-Match matches it (or the handler's own ETag) */
+hte httpd_setETags(struct httpd_info *httpd, int enable);
+
 char *httpd_getMethod(struct session_info *session);
 char *httpd_getURI(struct session_info *session);
 char *httpd_getHttpVersion(struct session_info *session);
 char *httpd_getHeader(struct session_info *session, char *field_name);
 
+/* the query as it came, after the '?' - NULL if there isn't one
+   the path in httpd_getURI() is decoded, but the query is left alone, so "%26" and '&' can be told apart */
+char *httpd_getQuery(struct session_info *session);
+/* a parameter of the query, or of an application/x-www-form-urlencoded body - decoded, NULL if it isn't
+   there, "" if it hasn't a value, and gone once the request is (the first is returned if it's repeated) */
+char *httpd_getQueryParam(struct session_info *session, char *name);
+char *httpd_getFormParam(struct session_info *session, char *name);
+
 /* if you don't give a 'reason' string, it will be looked up
    if you DO give a 'reason' string, it should NOT need to be free()'d */
 hte httpd_setHttpCode(struct session_info *session, int code, char *reason);
@@ -66,12 +104,400 @@ hte httpd_respond(struct session_info *session, char *format, ...);
 hte httpd_vrespond(struct session_info *session, char *format, va_list ap);
 hte httpd_nrespond(struct session_info *session, char *data, int len);
 
+/* shared bodies - immutable data that's sent to any number of clients at once without being copied
+   httpd_respondBody() puts it in the response where httpd_nrespond() would copy it, holding a
+   reference until it's been sent, and 'release' is called once the last reference has gone
+   the creator holds the first, and lets go of it with httpd_bodyRelease()
+   HTTP/2 streams and compressed streams still get a copy, and the response isn't compressed */
+struct httpd_body;
+typedef void (*httpd_bodyFree)(void *ctx, void *data, size_t len);
+
+struct httpd_body *httpd_bodyCreate(void *data, size_t len, httpd_bodyFree release, void *ctx);
+struct httpd_body *httpd_bodyHold(struct httpd_body *body);
+void httpd_bodyRelease(struct httpd_body *body);
+hte httpd_respondBody(struct session_info *session, struct httpd_body *body);
+
 /* calling this function allows you to respond with a large amount of data
    this function will send any buffered headers to the client, and any existing buffered data
 	 after calling this function, data will not be buffered, it will be sent directly to the client */
 hte httpd_flush(struct session_info *session);
 
 
+/* WebSockets (RFC 6455)
+   call httpd_wsAccept() from the callback for a request carrying "Upgrade: websocket", the
+   handshake is sent once the callback returns, and the connection moves onto an event loop
+   that all WebSockets share - none of them keep a thread
+   'callback' runs on that loop, so it must not block: message data points straight into the
+   receive buffer and is only good until it returns
+   httpd_wsSend() may be called from any thread, but 'ws' is gone once HTTPD_WS_CLOSE has been seen,
+   unless it's held - a thread that's handed it should hold it, and sends to it once it's closed fail
+   with HTE_WRITE until it's released */
+struct httpd_ws;
+
+enum httpd_wsOpcode {
+	HTTPD_WS_TEXT   = 0x1,
+	HTTPD_WS_BINARY = 0x2,
+	HTTPD_WS_PING   = 0x9, /* pongs are sent automatically */
+};
+enum httpd_wsEvent {
+	HTTPD_WS_OPEN = 0,
+	HTTPD_WS_MESSAGE, /* 'opcode' is HTTPD_WS_TEXT or HTTPD_WS_BINARY */
+	HTTPD_WS_CLOSE,   /* 'opcode' is the close code, 1006 if the peer just went away */
+};
+typedef void (*httpd_wsCallback)(void *ctx, struct httpd_ws *ws, enum httpd_wsEvent event, int opcode, unsigned char *data, size_t len);
+
+/* returns HTE_INVALPARAM if the request isn't a valid handshake */
+hte httpd_wsAccept(struct session_info *session, httpd_wsCallback callback, void *ctx);
+hte httpd_wsSend(struct httpd_ws *ws, int opcode, void *data, size_t len);
+hte httpd_wsClose(struct httpd_ws *ws, int code);
+struct httpd_ws *httpd_wsHold(struct httpd_ws *ws);
+void httpd_wsRelease(struct httpd_ws *ws);
+
+
+/* Server-Sent Events
+   each event is formatted once into a shared buffer that every subscriber's queue points at
+   a subscriber more than 'queueLength' events behind is dropped, and one that has had nothing
+   for 'keepalive' seconds is sent a comment (0 for never) so that proxies don't give up on it
+   like WebSockets, subscribers live on the shared event loop and don't keep a thread
+   channels are never freed */
+struct httpd_sse;
+struct httpd_sseStats {
+	int subscribers;
+	unsigned long long published;
+	unsigned long long evicted;
+};
+
+hte httpd_sseCreate(struct httpd_info *httpd, struct httpd_sse **channel, int queueLength, int keepalive);
+/* call from the callback, the response becomes the event stream once it returns */
+hte httpd_sseSubscribe(struct session_info *session, struct httpd_sse *channel);
+/* 'event' and 'id' may be NULL, 'data' may run over several lines */
+hte httpd_ssePublish(struct httpd_sse *channel, char *event, char *id, char *data);
+hte httpd_sseGetStats(struct httpd_sse *channel, struct httpd_sseStats *stats);
+
+
+/* deferred responses
+   call httpd_defer() from the callback to hold the response back once it returns, the thread is
+   let go and the connection waits until httpd_resume() hands the session back (on any thread) to
+   be filled in, and httpd_complete() sends it - from that thread, and the connection is closed
+   if 'timeout' milliseconds (0 for never) pass first, a 504 is sent and httpd_resume() returns NULL
+   every handle must go to httpd_resume() once, and then to httpd_complete() if that gave a session
+   the callback must return 0 after deferring, and HTTP/2 streams can't be deferred - if it fails
+   anyway once the session has been resumed, httpd_complete() only closes it, and returns HTE_RESPOND */
+struct httpd_deferred;
+
+hte httpd_defer(struct session_info *session, int timeout, struct httpd_deferred **handle);
+struct session_info *httpd_resume(struct httpd_deferred *handle);
+hte httpd_complete(struct httpd_deferred *handle);
+
+
+/* thread pools
+   by default every connection has a thread of its own, once this is called new connections are
+   read and sent on 'ioThreads' event loops without blocking, and the callbacks run on a pool of
+   'handlerThreads' - each with its own queue, stealing from the others when it runs out
+   callbacks can still do anything they could before (flush, upgrade, defer, proxy) on the handler
+   HTTP/2 connections keep a thread each, and TLS servers can't use the pools (HTE_TLS)
+   this can only be done once */
+struct httpd_poolStats {
+	int ioThreads;
+	int handlerThreads;
+	int queued;      /* requests waiting for a handler */
+	int queuedPeak;
+	unsigned long long dispatched;
+	unsigned long long steals;  /* requests a handler took from another's queue */
+	int coroutines;  /* callbacks started and not yet finished, see httpd_setCoroutines() */
+	int stacks;      /* coroutine stacks, in use or kept for the next callback */
+};
+
+hte httpd_setThreadPools(struct httpd_info *httpd, int ioThreads, int handlerThreads);
+hte httpd_getPoolStats(struct httpd_info *httpd, struct httpd_poolStats *stats);
+
+/* coroutines
+   the I/O loops of the thread pools without the handler threads - each callback runs on a small
+   stack of its own on the loop that read its request, and gives the loop back whenever it waits
+   in one of the calls below, so it can be written as if it had a thread to itself
+   flushing and the reverse proxy wait like this too, but anything else that blocks (read(),
+   sleep(), a lock held for long) holds up every connection on that loop
+   'stackSize' is 0 for 64KiB, and there's no room to spare on it for large locals or deep recursion
+   this can only be done once, and not as well as httpd_setThreadPools() */
+hte httpd_setCoroutines(struct httpd_info *httpd, int ioThreads, size_t stackSize);
+
+/* from a coroutine these give the loop back while they wait, on any other thread they block
+   'timeoutMs' of 0 waits for ever, and a timeout fails with errno set to ETIMEDOUT
+   httpd_send() sends everything, or fails */
+ssize_t httpd_recv(int fd, void *buf, size_t len, int timeoutMs);
+ssize_t httpd_send(int fd, const void *buf, size_t len, int timeoutMs);
+int httpd_connect(int fd, const struct sockaddr *addr, socklen_t addrlen, int timeoutMs);
+void httpd_sleep(int ms);
+
+/* priority classes, for the thread pools' queues
+   each request is put in a class as soon as it's been read - by the classifier if there is one and
+   it returns a class, or else by the longest matching URI prefix, or else it's NORMAL
+   handlers take from the classes in proportion to their weights (8, 4 and 1 to begin with), and a
+   class given a target delay sheds load - once every request taken from it for 100ms has waited
+   longer than 'targetMs', those that have are answered with a 503 until one comes through in time
+   the classifier runs on an I/O loop, so it mustn't block
+   these do nothing until httpd_setThreadPools() has been called, and nothing with coroutines */
+enum httpd_priority {
+	HTTPD_PRIORITY_HIGH = 0,
+	HTTPD_PRIORITY_NORMAL,
+	HTTPD_PRIORITY_LOW,
+	HTTPD_PRIORITIES,
+};
+typedef int (*httpd_classifier)(void *ctx, struct session_info *session);
+
+struct httpd_priorityStats {
+	int queued;
+	int overloaded;
+	unsigned long long dispatched;
+	unsigned long long shed; /* answered with a 503 */
+};
+
+/* 'weight' is at least 1, and a 'targetMs' of 0 never sheds */
+hte httpd_setPriority(struct httpd_info *httpd, enum httpd_priority priority, int weight, int targetMs);
+hte httpd_addPriorityPrefix(struct httpd_info *httpd, char *prefix, enum httpd_priority priority);
+/* pass a NULL classifier to remove it, it returns -1 to leave it to the prefixes */
+hte httpd_setClassifier(struct httpd_info *httpd, httpd_classifier classifier, void *ctx);
+hte httpd_getPriorityStats(struct httpd_info *httpd, enum httpd_priority priority, struct httpd_priorityStats *stats);
+
+
+/* per-client rate limiting
+   each client address has a bucket of 'burst' tokens that refills at 'perSecond', and every
+   connection or request (or both, see 'where') takes one - with none left it's answered with a 429
+   addresses are counted together by their first 'v4Prefix' or 'v6Prefix' bits (32 and 128 for each
+   on its own), the table is a fixed size, and a client it can't find room for isn't limited
+   calling this again changes the limits, and a 'where' of 0 turns it off */
+enum httpd_rateWhere {
+	HTTPD_RATE_ACCEPT = 1,  /* as the connection is accepted, with nothing read and no thread started */
+	HTTPD_RATE_REQUEST = 2, /* once the request is parsed, before the callback (each HTTP/2 stream counts) */
+};
+struct httpd_rateStats {
+	unsigned long long limited;   /* connections and requests refused */
+	unsigned long long evictions; /* buckets handed to another address */
+	unsigned long long untracked; /* let through for want of room */
+};
+
+hte httpd_setRateLimit(struct httpd_info *httpd, int perSecond, int burst, int v4Prefix, int v6Prefix, int where);
+hte httpd_getRateStats(struct httpd_info *httpd, struct httpd_rateStats *stats);
+
+
+/* connection timeouts, in ms with 0 for none
+   a connection that's too slow with its request is answered with a 408, one that's too slow to
+   take its response is closed - the callback itself is never timed, but its time counts towards
+   'totalMs' (accept to the last byte of the response) once the response is being sent
+   each connection carries one request, so 'idleMs' is the wait for its first byte (and for a TLS
+   handshake), HTTP/2 connections are only timed until they've been recognised
+   calling this again changes the timeouts for connections accepted after it */
+struct httpd_timeouts {
+	int idleMs;
+	int headerMs; /* from the first byte to the end of the header */
+	int bodyMs;   /* from the end of the header to the end of the body */
+	int writeMs;  /* sending the response */
+	int totalMs;
+};
+struct httpd_timeoutStats {
+	unsigned long long idle;
+	unsigned long long header;
+	unsigned long long body;
+	unsigned long long write;
+	unsigned long long total;
+};
+
+hte httpd_setTimeouts(struct httpd_info *httpd, struct httpd_timeouts *timeouts);
+hte httpd_getTimeoutStats(struct httpd_info *httpd, struct httpd_timeoutStats *stats);
+
+
+/* how big a request may be, with 0 for no limit
+   anything bigger is answered as soon as it's seen, without waiting for the rest of it - a request
+   line that's too long gets a 414, too many or too much header a 431, and too big a body a 413
+   (whatever the limit, the body can't be more than INT_MAX as the callback gets its length as an int)
+   a server starts with 8KiB, 100 fields, 64KiB and no limit on the body, and calling this changes
+   them for requests read after it */
+struct httpd_limits {
+	int requestLine; /* bytes, without the line ending */
+	int headers;     /* header fields */
+	int headerBytes; /* bytes of the request line and header fields together */
+	long long body;  /* bytes */
+};
+
+hte httpd_setLimits(struct httpd_info *httpd, struct httpd_limits *limits);
+hte httpd_getLimits(struct httpd_info *httpd, struct httpd_limits *limits);
+
+/* before the body - once the head of a request with a body is in, and before any more is read
+   the hook sees the method, URI and headers (not the body) and returns 0 to let it through, or the
+   status to refuse it with (401, 403, 413...) - the refusal is just the status, and the connection
+   is closed as the limits' are
+   an "Expect: 100-continue" it lets through gets its 100 Continue then, hook or not, and any other
+   expectation a 417
+   HTTP/2 streams go through it too, a refusal answering and resetting just the stream
+   it's called on whichever thread is reading the request, the thread pools' I/O loops included,
+   so it mustn't wait on anything - pass a NULL hook to remove it */
+typedef int (*httpd_headHook)(void *ctx, struct session_info *session);
+hte httpd_setHeadHook(struct httpd_info *httpd, httpd_headHook hook, void *ctx);
+
+/* multipart/form-data uploads, parsed as they're read - off by default
+   the body isn't kept, so the callback is given no content (NULL, 0) and finds the parts here
+   a part with a filename goes straight to a file as it comes in, as does a field that's bigger than
+   'memBytes' - the rest are kept in memory (with a nul after them)
+   the files are memfds, or unlinked files in 'dir' if one's given, read from the start and closed
+   with the request - dup() the fd to keep one
+   more than 64 parts gets a 413, and a part's head must fit in 16KiB
+   HTTP/2 requests aren't parsed, the callback has the whole body as ever */
+struct httpd_part {
+	char *name;
+	char *filename;    /* NULL for a field */
+	char *contentType; /* NULL if it didn't say */
+	
+	size_t len;
+	char *data; /* the part if it's in memory */
+	int fd;     /* or the file it's in, -1 if it isn't */
+};
+
+hte httpd_setMultipart(struct httpd_info *httpd, int enable, size_t memBytes, char *dir);
+/* the number of parts, 0 if the request wasn't multipart - they're gone once the request is */
+int httpd_getParts(struct session_info *session, struct httpd_part **parts);
+struct httpd_part *httpd_getPart(struct session_info *session, char *name);
+
+
+/* response cache
+   responses to GET and HEAD are kept whole, as they went out, if the handler says they may be with
+   a Cache-Control max-age (or s-maxage), and are sent in place of running the callback until it's
+   up - a stale-while-revalidate lets the next request after that go to the callback for a fresh copy
+   while the rest are sent the stale one, and no-store, no-cache, private or a Set-Cookie keep a
+   response out (and drop the one that was kept for it)
+   it's keyed on the method, URI and version, along with any headers added with httpd_addCacheVary()
+   (add them before the cache is used, and a response that varies on any other isn't kept)
+   requests with an Authorization and HTTP/2 streams don't use it
+   'bytes' is the most the entries can take up between them, 0 turns it off and empties it */
+struct httpd_cacheStats {
+	unsigned long long hits;
+	unsigned long long staleHits; /* sent while another request revalidated them */
+	unsigned long long misses;
+	unsigned long long stores;
+	unsigned long long evictions;
+	unsigned long long coalesced; /* sent another request's response, see httpd_setCoalescing() */
+	unsigned long long fallbacks; /* gave up waiting for one, or it couldn't be shared */
+	unsigned long long entries;
+	unsigned long long bytes;
+};
+
+hte httpd_setCache(struct httpd_info *httpd, size_t bytes);
+hte httpd_addCacheVary(struct httpd_info *httpd, char *header);
+/* request coalescing - with the same key as the cache (and whether or not it's on), a request that
+   arrives while the callback is running for another waits up to 'timeoutMs' for that one's response
+   and is sent it too, if it's one that could be shared (see above, but without needing a max-age)
+   otherwise it runs the callback itself - waiting holds the thread, or gives the loop back in a
+   coroutine, and 0 turns it off */
+hte httpd_setCoalescing(struct httpd_info *httpd, int timeoutMs);
+hte httpd_getCacheStats(struct httpd_info *httpd, struct httpd_cacheStats *stats);
+
+
+/* response compression - the library must be built with OPTIONS=HTTPD_ZLIB, or it returns HTE_ZLIB
+   gzip (or deflate) at 'level' (1-9, 0 turns it off) for bodies of at least 'minBytes' whose
+   Content-Type starts with one of the types (text/html, text/plain, text/css, application/json and
+   the like until one's added) and the client accepts it, adding Content-Encoding and Vary
+   flushed responses are compressed as they're sent, and a response that already has a
+   Content-Encoding or Content-Length is left alone
+   a compressed response only goes in the cache if "Accept-Encoding" is one of its vary headers */
+struct httpd_compressionStats {
+	unsigned long long responses;
+	unsigned long long bytesIn;
+	unsigned long long bytesOut;
+};
+
+hte httpd_setCompression(struct httpd_info *httpd, int level, int minBytes);
+hte httpd_addCompressionType(struct httpd_info *httpd, char *type);
+hte httpd_getCompressionStats(struct httpd_info *httpd, struct httpd_compressionStats *stats);
+
+
+/* reverse proxy
+   call httpd_proxyForward() from the callback to pass the request on to whichever upstream has the
+   fewest requests in flight, and stream its response back - the callback's thread waits for it
+   upstreams are "host:port" or "unix:/path/to/socket", up to 'poolSize' idle keep-alive connections
+   are kept for each, and 'timeout' seconds (0 for none) limits each read or write to an upstream
+   proxies are never freed */
+struct httpd_proxy;
+struct httpd_proxyStats {
+	unsigned long long requests;
+	unsigned long long connects;
+	unsigned long long reused;   /* requests sent over a pooled connection */
+	unsigned long long failures; /* requests answered with a 502 */
+	unsigned long long spliced;  /* body bytes that went from socket to socket without being copied */
+};
+
+hte httpd_proxyCreate(struct httpd_proxy **proxy, int poolSize, int timeout);
+hte httpd_proxyAddUpstream(struct httpd_proxy *proxy, char *address);
+/* if no upstream gives a response a 502 is sent in its place, once the upstream's response has
+   started an error means that it was cut short, and the connection should be dropped
+   a multipart upload that httpd_setMultipart() has parsed has no body left to forward, so it gets a 500 */
+hte httpd_proxyForward(struct session_info *session, struct httpd_proxy *proxy);
+hte httpd_proxyGetStats(struct httpd_proxy *proxy, struct httpd_proxyStats *stats);
+
+
+/* request lifecycle tracing
+   the same events are available as USDT probes (provider 'libhttpd') when built with <sys/sdt.h>
+   the hook is called on the thread handling the session, so keep it short! */
+enum httpd_trace_event {
+	HTTPD_TRACE_ACCEPT = 0,
+	HTTPD_TRACE_READ_COMPLETE,
+	HTTPD_TRACE_PARSE_COMPLETE,
+	HTTPD_TRACE_CALLBACK_START,
+	HTTPD_TRACE_CALLBACK_END,
+	HTTPD_TRACE_SEND_COMPLETE,
+};
+typedef void (*httpd_traceHook)(void *ctx, struct session_info *session, enum httpd_trace_event event, struct timespec *ts);
+
+/* pass a NULL hook to remove it */
+hte httpd_setTraceHook(struct httpd_info *httpd, httpd_traceHook hook, void *ctx);
+
+
+/* records the raw bytes and timing of every request received to 'path', for replay with tools/replay
+   starting a capture while one is running switches to the new file */
+hte httpd_startCapture(struct httpd_info *httpd, char *path);
+hte httpd_stopCapture(struct httpd_info *httpd);
+
+
+/* every allocation the library makes goes through these
+   httpd_setAllocator() must be called before anything else, otherwise it will refuse */
+typedef void *(*httpd_malloc)(void *ctx, size_t size);
+typedef void *(*httpd_realloc)(void *ctx, void *ptr, size_t size);
+typedef void (*httpd_free)(void *ctx, void *ptr);
+
+hte httpd_setAllocator(httpd_malloc malloc_fn, httpd_realloc realloc_fn, httpd_free free_fn, void *ctx);
+
+enum httpd_memSubsys {
+	HTTPD_MEM_BUF = 0,
+	HTTPD_MEM_HTTP,
+	HTTPD_MEM_INTERFACE,
+	HTTPD_MEM_SERVER,
+	HTTPD_MEM_SESSION,
+	HTTPD_MEM_OTHER,
+	HTTPD_MEM_COUNT /* ask httpd_getMemStats() for this to get the total */
+};
+struct httpd_memStats {
+	unsigned long long mallocs;
+	unsigned long long reallocs;
+	unsigned long long frees;
+	unsigned long long bytes; /* total ever asked for (growth only, for reallocs) */
+	long long inUse;
+	long long peak;
+};
+
+hte httpd_getMemStats(enum httpd_memSubsys subsys, struct httpd_memStats *stats);
+
+/* the memory every connection's request may take between them, with 0 (the default) for no limit
+   a connection that would take the total past it is answered with a 503 and closed - the requests'
+   buffers are all that's counted, and are charged to their connections until they close */
+struct httpd_memBudget {
+	long long limit;
+	long long inUse;
+	long long peak;
+	unsigned long long refused; /* connections turned away for want of it */
+};
+
+hte httpd_setMemBudget(long long bytes);
+hte httpd_getMemBudget(struct httpd_memBudget *budget);
+
+
 /* buffer functions that are available outside! */
 struct buf *buf_alloc(struct buf *_buf, size_t size);
 void buf_free(struct buf *buf);
@@ -87,7 +513,7 @@ hte http_parse_fixup(struct session_info *session);
 
 void http_uri_decode(unsigned char *uri); /* decodes all escape sequences (%20) */
 void http_uri_decode2(unsigned char *uri); /* decodes all escape sequences, apart from %2F - '/' to maintain filenames
-                                              this is automatically called on request strings */
+                                              a request's path is decoded this way, but its query is left as it came */
 
 #ifdef __cplusplus
 } /* extern "C" */
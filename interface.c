@@ -28,21 +28,28 @@
 #include "http.h"
 #include "session.h"
 #include "buf.h"
+#include "h2.h"
+#include "tls.h"
+#include "limit.h"
+#include "mem.h"
 
-EXPORT hte httpd_startServer(struct httpd_info **_httpd, int listenPort, httpd_callback callback) {
+static hte httpd_start(struct httpd_info **_httpd, int listenPort, httpd_callback callback, char *certFile, char *keyFile) {
 	struct httpd_info *httpd;
 	hte ret;
 	
 	if (!callback || !_httpd) return HTE_INVALPARAM;
 	
-	if ((httpd = malloc(sizeof(*httpd))) == NULL) return HTE_NOMEM;
+	if ((httpd = mem_malloc(HTTPD_MEM_INTERFACE, sizeof(*httpd))) == NULL) return HTE_NOMEM;
 	memset(httpd, 0, sizeof(*httpd));
 	
 	httpd->listenPort = listenPort;
 	httpd->callback = callback;
+	httpd->tlsCert = certFile;
+	httpd->tlsKey = keyFile;
+	limit_defaults(&httpd->limits);
 	
 	if ((ret = srv_listenStart(httpd)) != HTE_NONE) {
-		free(httpd);
+		mem_free(httpd);
 		return ret;
 	}
 	
@@ -51,6 +58,31 @@ EXPORT hte httpd_startServer(struct httpd_info **_httpd, int listenPort, httpd_c
 	return HTE_NONE;
 }
 
+EXPORT hte httpd_startServer(struct httpd_info **_httpd, int listenPort, httpd_callback callback) {
+	return httpd_start(_httpd, listenPort, callback, NULL, NULL);
+}
+
+EXPORT hte httpd_startTLSServer(struct httpd_info **_httpd, int listenPort, httpd_callback callback, char *certFile, char *keyFile) {
+	if (!certFile || !keyFile) return HTE_INVALPARAM;
+	return httpd_start(_httpd, listenPort, callback, certFile, keyFile);
+}
+
+EXPORT hte httpd_setH2c(struct httpd_info *httpd, int enable) {
+	if (!httpd) return HTE_INVALPARAM;
+	
+	httpd->h2c = !!enable;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_setETags(struct httpd_info *httpd, int enable) {
+	if (!httpd) return HTE_INVALPARAM;
+	
+	httpd->etags = !!enable;
+	
+	return HTE_NONE;
+}
+
 EXPORT char *httpd_getMethod(struct session_info *session) {
 	if (!session) return NULL;
 	return (char *)session->xfer.request->method;
@@ -107,14 +139,14 @@ EXPORT hte httpd_addHeader(struct session_info *session, char *field_name, char
 				char *p;
 				int len2;
 				
-				if ((p = malloc(sizeof(char) * (len + 1))) == NULL) return HTE_NOMEM;
+				if ((p = mem_malloc(HTTPD_MEM_INTERFACE, sizeof(char) * (len + 1))) == NULL) return HTE_NOMEM;
 				
 				va_start(ap, field_value_format);
 				len2 = vsnprintf(p, len + 1, field_value_format, ap);
 				va_end(ap);
 				
 				if (len != len2) {
-					free(p);
+					mem_free(p);
 					return HTE_UNKNOWN;
 				}
 				
@@ -125,8 +157,8 @@ EXPORT hte httpd_addHeader(struct session_info *session, char *field_name, char
 	}
 
 	data = &session->xfer.response->data;
-	if ((p = realloc(data->headers, sizeof(*data->headers) * (data->headerc + 1))) == NULL) {
-		if (field_value != NULL && field_valueFree) free(field_value);
+	if ((p = mem_realloc(HTTPD_MEM_INTERFACE, data->headers, sizeof(*data->headers) * (data->headerc + 1))) == NULL) {
+		if (field_value != NULL && field_valueFree) mem_free(field_value);
 		return HTE_NOMEM;
 	}
 	data->headers = p;
@@ -194,14 +226,22 @@ EXPORT hte httpd_flush(struct session_info *session) {
 	void *p;
 	
 	if (!session) return HTE_INVALPARAM;
+	if (session->h2) return h2_flush(session);
 	
 	ret = HTE_NONE;
 	if (http_respond(session, 0) != HTE_NONE) ret = HTE_RESPOND;
+	body_drop(session->xfer.response);
 	
 	if ((p = buf_alloc(session->xfer.response->buf, 1)) == NULL) return HTE_NOMEM;
 	session->xfer.response->buf = p;
 	session->xfer.response->buf->pos = 0;
 	session->xfer.response->buf->next = 0;
+	session->xfer.response->flushed = 1;
+	
+	/* userspace TLS can't be written to the fd, so keep buffering and send at each flush
+	   as does a compressed response, that's compressed at each flush */
+	if (session->tls && !session->tls->ktlsSend) return ret;
+	if (session->xfer.response->gzip) return ret;
 	session->xfer.response->buf->fd = session->fd;
 	
 	return ret;
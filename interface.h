@@ -20,11 +20,33 @@
 	along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "hook.h"
+
 struct httpd_info {
 	int listenPort;
 	struct srv_listenInfo *listen;
 	int rxid;
 	httpd_callback callback;
+	int h2c;
+	int etags;
+	
+	struct hook traceHook;
+	struct hook headHook;
+	
+	struct capture_info *capture;
+	struct loop_info *loop;
+	struct defer_info *defer;
+	struct pool_info *pool;
+	struct rate_info *rate;
+	struct timeout_info *timeouts;
+	struct httpd_limits limits;
+	struct cache_info *cache;
+	struct gzip_info *gzip;
+	struct multipart_info *multipart;
+	
+	char *tlsCert;
+	char *tlsKey;
+	struct tls_server *tls;
 };
 
 #endif /* INTERFACE_H */
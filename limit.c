@@ -0,0 +1,109 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "limit.h"
+
+static const char limit_400[] =
+	"HTTP/1.1 400 Bad Request\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+static const char limit_413[] =
+	"HTTP/1.1 413 Request Entity Too Large\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+static const char limit_414[] =
+	"HTTP/1.1 414 Request-URI Too Large\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+static const char limit_431[] =
+	"HTTP/1.1 431 Request Header Fields Too Large\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+static const char limit_503[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Content-Length: 0\r\n"
+	"Retry-After: 1\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+void limit_defaults(struct httpd_limits *limits) {
+	limits->requestLine = LIMIT_REQUEST_LINE;
+	limits->headers = LIMIT_HEADERS;
+	limits->headerBytes = LIMIT_HEADER_BYTES;
+	limits->body = LIMIT_BODY;
+}
+
+int limit_answer(struct session_info *session) {
+	const char *answer;
+	char other[128];
+	size_t len;
+	int code;
+	
+	if (!session->xfer.request) return 0;
+	
+	switch ((code = session->xfer.request->refused)) {
+		case 400: answer = limit_400; len = sizeof(limit_400) - 1; break;
+		case 413: answer = limit_413; len = sizeof(limit_413) - 1; break;
+		case 414: answer = limit_414; len = sizeof(limit_414) - 1; break;
+		case 431: answer = limit_431; len = sizeof(limit_431) - 1; break;
+		case 503: answer = limit_503; len = sizeof(limit_503) - 1; break;
+		default:
+			/* the head hook may refuse with anything */
+			if (code < 400 || code > 599) return 0;
+			len = snprintf(other, sizeof(other), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", code, http_reason(code));
+			answer = other;
+			break;
+	}
+	
+	session_answer(session, answer, len);
+	
+	return 1;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setLimits(struct httpd_info *httpd, struct httpd_limits *limits) {
+	if (!httpd || !limits) return HTE_INVALPARAM;
+	if (limits->requestLine < 0 || limits->headers < 0 || limits->headerBytes < 0 || limits->body < 0) return HTE_INVALPARAM;
+	
+	/* a request being parsed may see a mix of the old and new, which is no worse than either */
+	httpd->limits = *limits;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_getLimits(struct httpd_info *httpd, struct httpd_limits *limits) {
+	if (!httpd || !limits) return HTE_INVALPARAM;
+	
+	*limits = httpd->limits;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,38 @@
+#ifndef LIMIT_H
+#define LIMIT_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* request size limits - the parser checks them as the request comes in, and leaves the status
+   that should refuse it on the request for limit_answer() */
+
+struct session_info;
+struct httpd_limits;
+
+#define LIMIT_REQUEST_LINE 8192
+#define LIMIT_HEADERS 100
+#define LIMIT_HEADER_BYTES 65536
+#define LIMIT_BODY 0
+
+void limit_defaults(struct httpd_limits *limits);
+/* for a request a limit (or the memory budget, or the head hook) refused - the client is told why before it's closed */
+int limit_answer(struct session_info *session);
+
+#endif /* LIMIT_H */
@@ -0,0 +1,119 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "loop.h"
+#include "mem.h"
+
+#define LOOP_EVENTS 64
+
+static pthread_mutex_t loop_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *loop_thread(void *_loop) {
+	struct loop_info *loop = _loop;
+	struct epoll_event ev[LOOP_EVENTS];
+	int i, n;
+	
+	pthread_detach(pthread_self());
+	
+	for (;;) {
+		if ((n = epoll_wait(loop->epfd, ev, LOOP_EVENTS, -1)) == -1) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		
+		/* a handler may only ever free its own watch, so the rest of ev[] stays good */
+		for (i = 0; i < n; i++) {
+			struct loop_watch *watch = ev[i].data.ptr;
+			watch->handler(watch, ev[i].events);
+		}
+	}
+	
+	fprintf(stderr, "%s:%d %s(): epoll_wait() returned an error...\n\tepoll_wait(): %d: '%s'\n",
+	        __FILE__, __LINE__, __FUNCTION__, errno, strerror(errno));
+	
+	return NULL;
+}
+
+struct loop_info *loop_new(void) {
+	struct loop_info *loop;
+	
+	if ((loop = mem_malloc(HTTPD_MEM_SERVER, sizeof(*loop))) == NULL) return NULL;
+	memset(loop, 0, sizeof(*loop));
+	
+	if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) goto die;
+	if (pthread_create(&loop->tid, NULL, loop_thread, loop) != 0) goto die;
+	
+	return loop;
+die:
+	if (loop->epfd != -1) close(loop->epfd);
+	mem_free(loop);
+	return NULL;
+}
+
+struct loop_info *loop_get(struct httpd_info *httpd) {
+	struct loop_info *loop;
+	
+	pthread_mutex_lock(&loop_startMutex);
+	
+	if ((loop = httpd->loop) == NULL) {
+		if ((loop = loop_new()) != NULL) httpd->loop = loop;
+	}
+	
+	pthread_mutex_unlock(&loop_startMutex);
+	
+	return loop;
+}
+
+hte loop_add(struct loop_info *loop, struct loop_watch *watch, uint32_t events) {
+	struct epoll_event ev;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = watch;
+	
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, watch->fd, &ev) != 0) return HTE_SOCK;
+	
+	return HTE_NONE;
+}
+
+hte loop_mod(struct loop_info *loop, struct loop_watch *watch, uint32_t events) {
+	struct epoll_event ev;
+	
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = watch;
+	
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_MOD, watch->fd, &ev) != 0) return HTE_SOCK;
+	
+	return HTE_NONE;
+}
+
+void loop_del(struct loop_info *loop, struct loop_watch *watch) {
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, watch->fd, NULL);
+}
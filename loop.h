@@ -0,0 +1,53 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* an epoll loop on a thread of its own, for connections that live longer than
+   a request and shouldn't each tie up a thread (WebSockets, event streams)
+   handlers run on the loop thread and must never block */
+
+#include <stdint.h>
+#include <pthread.h>
+
+struct loop_watch;
+typedef void (*loop_handler)(struct loop_watch *watch, uint32_t events);
+
+/* embed this in whatever is being watched */
+struct loop_watch {
+	int fd;
+	loop_handler handler;
+};
+
+struct loop_info {
+	int epfd;
+	pthread_t tid;
+};
+
+/* the loop is started the first time it's asked for, and runs for as long as the process */
+struct loop_info *loop_get(struct httpd_info *httpd);
+/* ... or one that isn't shared, the thread pools' I/O loops */
+struct loop_info *loop_new(void);
+
+hte loop_add(struct loop_info *loop, struct loop_watch *watch, uint32_t events);
+hte loop_mod(struct loop_info *loop, struct loop_watch *watch, uint32_t events);
+void loop_del(struct loop_info *loop, struct loop_watch *watch);
+
+#endif /* LOOP_H */
@@ -0,0 +1,192 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "mem.h"
+
+/* 16 bytes keeps the user's pointer aligned as well as malloc()'s was */
+struct mem_header {
+	size_t size;
+	unsigned int subsys;
+	unsigned int magic;
+} __attribute__((aligned(16)));
+
+#define MEM_MAGIC 0x4D454D21 /* "MEM!" */
+
+static void *libc_malloc(void *ctx, size_t size)             { return malloc(size); }
+static void *libc_realloc(void *ctx, void *ptr, size_t size) { return realloc(ptr, size); }
+static void  libc_free(void *ctx, void *ptr)                 { free(ptr); }
+
+static struct {
+	httpd_malloc malloc;
+	httpd_realloc realloc;
+	httpd_free free;
+	void *ctx;
+	int used;
+} allocator = { libc_malloc, libc_realloc, libc_free, NULL, 0 };
+
+/* the extra slot at [HTTPD_MEM_COUNT] is the total */
+static struct httpd_memStats stats[HTTPD_MEM_COUNT + 1];
+
+static struct httpd_memBudget budget;
+
+/* ########################################################################## */
+
+static void mem_count1(struct httpd_memStats *s, unsigned long long *call, long long delta) {
+	long long inUse, peak;
+	
+	__sync_fetch_and_add(call, 1);
+	inUse = __sync_add_and_fetch(&s->inUse, delta);
+	if (delta > 0) __sync_fetch_and_add(&s->bytes, delta);
+	
+	/* the peak doesn't need to be perfect, just never too low */
+	while ((peak = s->peak) < inUse) {
+		if (__sync_bool_compare_and_swap(&s->peak, peak, inUse)) break;
+	}
+}
+#define mem_count(subsys, call, delta) \
+	do { \
+		mem_count1(&stats[(subsys)], &stats[(subsys)].call, (delta)); \
+		mem_count1(&stats[HTTPD_MEM_COUNT], &stats[HTTPD_MEM_COUNT].call, (delta)); \
+	} while (0)
+
+void *mem_malloc(enum httpd_memSubsys subsys, size_t size) {
+	struct mem_header *h;
+	
+	if ((unsigned)subsys >= HTTPD_MEM_COUNT) subsys = HTTPD_MEM_OTHER;
+	allocator.used = 1;
+	
+	if ((h = allocator.malloc(allocator.ctx, sizeof(*h) + size)) == NULL) return NULL;
+	h->size = size;
+	h->subsys = subsys;
+	h->magic = MEM_MAGIC;
+	
+	mem_count(subsys, mallocs, size);
+	
+	return &h[1];
+}
+
+void *mem_realloc(enum httpd_memSubsys subsys, void *ptr, size_t size) {
+	struct mem_header *h;
+	size_t oldSize;
+	
+	if (!ptr) return mem_malloc(subsys, size);
+	
+	h = &((struct mem_header *)ptr)[-1];
+	if (h->magic != MEM_MAGIC) {
+		fprintf(stderr, "%s:%d %s(): %p wasn't allocated by libhttpd!\n", __FILE__, __LINE__, __FUNCTION__, ptr);
+		abort();
+	}
+	subsys = h->subsys;
+	oldSize = h->size;
+	
+	if ((h = allocator.realloc(allocator.ctx, h, sizeof(*h) + size)) == NULL) return NULL;
+	h->size = size;
+	
+	mem_count(subsys, reallocs, (long long)size - (long long)oldSize);
+	
+	return &h[1];
+}
+
+void mem_free(void *ptr) {
+	struct mem_header *h;
+	
+	if (!ptr) return;
+	
+	h = &((struct mem_header *)ptr)[-1];
+	if (h->magic != MEM_MAGIC) {
+		fprintf(stderr, "%s:%d %s(): %p wasn't allocated by libhttpd!\n", __FILE__, __LINE__, __FUNCTION__, ptr);
+		abort();
+	}
+	h->magic = 0;
+	
+	mem_count(h->subsys, frees, -(long long)h->size);
+	
+	allocator.free(allocator.ctx, h);
+}
+
+int mem_charge(long long *account, size_t size) {
+	long long inUse, peak;
+	
+	inUse = __sync_add_and_fetch(&budget.inUse, (long long)size);
+	if (budget.limit && inUse > budget.limit) {
+		__sync_fetch_and_sub(&budget.inUse, (long long)size);
+		__sync_fetch_and_add(&budget.refused, 1);
+		return 0;
+	}
+	*account += size;
+	
+	while ((peak = budget.peak) < inUse) {
+		if (__sync_bool_compare_and_swap(&budget.peak, peak, inUse)) break;
+	}
+	
+	return 1;
+}
+
+void mem_uncharge(long long *account) {
+	if (*account == 0) return;
+	__sync_fetch_and_sub(&budget.inUse, *account);
+	*account = 0;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setAllocator(httpd_malloc malloc_fn, httpd_realloc realloc_fn, httpd_free free_fn, void *ctx) {
+	if (!malloc_fn || !realloc_fn || !free_fn) return HTE_INVALPARAM;
+	
+	/* blocks can't move between allocators */
+	if (allocator.used) return HTE_INVALPARAM;
+	
+	allocator.malloc = malloc_fn;
+	allocator.realloc = realloc_fn;
+	allocator.free = free_fn;
+	allocator.ctx = ctx;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_getMemStats(enum httpd_memSubsys subsys, struct httpd_memStats *out) {
+	if (!out) return HTE_INVALPARAM;
+	if ((unsigned)subsys > HTTPD_MEM_COUNT) return HTE_INVALPARAM;
+	
+	memcpy(out, &stats[subsys], sizeof(*out));
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_setMemBudget(long long bytes) {
+	if (bytes < 0) return HTE_INVALPARAM;
+	
+	/* lowering it below what's in use only stops new charges */
+	budget.limit = bytes;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_getMemBudget(struct httpd_memBudget *out) {
+	if (!out) return HTE_INVALPARAM;
+	
+	memcpy(out, &budget, sizeof(*out));
+	
+	return HTE_NONE;
+}
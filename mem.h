@@ -0,0 +1,38 @@
+#ifndef MEM_H
+#define MEM_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* every allocation the library makes goes through here
+   each block carries a small header recording its size and owner, so that
+   mem_realloc() and mem_free() can keep the per-subsystem counters right */
+
+#include <stddef.h>
+
+void *mem_malloc(enum httpd_memSubsys subsys, size_t size);
+void *mem_realloc(enum httpd_memSubsys subsys, void *ptr, size_t size);
+void mem_free(void *ptr);
+
+/* the memory budget - charges are held in an 'account' until it's uncharged in one go,
+   and a charge that would go over the budget is refused (returning 0) */
+int mem_charge(long long *account, size_t size);
+void mem_uncharge(long long *account);
+
+#endif /* MEM_H */
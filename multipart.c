@@ -0,0 +1,462 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE /* memfd_create(), O_TMPFILE */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "multipart.h"
+#include "mem.h"
+
+static pthread_mutex_t multipart_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static char *multipart_strndup(const char *s, size_t len) {
+	char *p;
+	
+	if ((p = mem_malloc(HTTPD_MEM_HTTP, len + 1)) == NULL) return NULL;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	
+	return p;
+}
+
+/* the value of 'key' in a header's parameters ("; key=value" or "; key="value""), NULL if it's not there */
+static char *multipart_param(char *params, char *key, size_t *len) {
+	size_t keyLen = strlen(key);
+	char *p, *v;
+	
+	for (p = params; p && *p; p = strchr(p, ';')) {
+		if (*p == ';') p++;
+		while (*p == ' ' || *p == '\t') p++;
+		if (strncasecmp(p, key, keyLen) || p[keyLen] != '=') continue;
+		
+		v = &p[keyLen + 1];
+		if (*v == '"') {
+			char *e;
+			v++;
+			if ((e = strchr(v, '"')) == NULL) return NULL;
+			*len = e - v;
+			return v;
+		}
+		*len = strcspn(v, "; \t");
+		return v;
+	}
+	
+	return NULL;
+}
+
+/* ########################################################################## */
+
+static int multipart_file(struct multipart *mp) {
+	const char *dir = mp->dir ? mp->dir : "/tmp";
+	char path[4096];
+	int fd;
+	
+	/* memory the kernel holds, which a thread's stack or the heap doesn't have to */
+	if (!mp->dir && (fd = memfd_create("httpd-part", MFD_CLOEXEC)) != -1) return fd;
+	
+	/* or a file that was never in the directory, or was only for a moment */
+	if ((fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) != -1) return fd;
+	if (snprintf(path, sizeof(path), "%s/httpd-part-XXXXXX", dir) >= (int)sizeof(path)) return -1;
+	if ((fd = mkostemp(path, O_CLOEXEC)) == -1) return -1;
+	unlink(path);
+	
+	return fd;
+}
+
+static int multipart_writeAll(int fd, unsigned char *data, size_t len) {
+	ssize_t l;
+	
+	while (len > 0) {
+		if ((l = write(fd, data, len)) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		data += l;
+		len -= l;
+	}
+	
+	return 0;
+}
+
+/* returns 0, or the status to refuse the request with */
+static int multipart_write(struct multipart *mp, unsigned char *data, size_t len) {
+	struct httpd_part *part = &mp->parts[mp->partc - 1];
+	void *p;
+	
+	/* a field that's grown too big for memory goes where a file would */
+	if (part->fd == -1 && part->len + len > mp->memBytes) {
+		if ((part->fd = multipart_file(mp)) == -1) return 500;
+		if (part->data) {
+			if (multipart_writeAll(part->fd, (unsigned char *)part->data, part->len)) return 500;
+			mem_free(part->data);
+			part->data = NULL;
+		}
+	}
+	
+	if (part->fd != -1) {
+		if (multipart_writeAll(part->fd, data, len)) return 500;
+		part->len += len;
+		return 0;
+	}
+	
+	if (part->len + len + 1 > mp->cap) {
+		size_t cap = mp->cap ? mp->cap : 256;
+		while (cap < part->len + len + 1) cap *= 2;
+		if ((p = mem_realloc(HTTPD_MEM_HTTP, part->data, cap)) == NULL) return 503;
+		part->data = p;
+		mp->cap = cap;
+	}
+	memcpy(&part->data[part->len], data, len);
+	part->len += len;
+	part->data[part->len] = '\0';
+	
+	return 0;
+}
+
+static int multipart_begin(struct multipart *mp) {
+	struct httpd_part *part;
+	
+	if (mp->partc >= MULTIPART_PARTS) return 413;
+	part = &mp->parts[mp->partc++];
+	memset(part, 0, sizeof(*part));
+	part->fd = -1;
+	mp->cap = 0;
+	
+	return 0;
+}
+
+/* the part's head is in - a file goes straight to one */
+static int multipart_open(struct multipart *mp) {
+	struct httpd_part *part = &mp->parts[mp->partc - 1];
+	
+	if (!part->name) return 400;
+	if (part->filename && (part->fd = multipart_file(mp)) == -1) return 500;
+	
+	return 0;
+}
+
+static int multipart_end(struct multipart *mp) {
+	struct httpd_part *part = &mp->parts[mp->partc - 1];
+	
+	if (part->fd != -1) {
+		if (lseek(part->fd, 0, SEEK_SET) == -1) return 500;
+		return 0;
+	}
+	/* an empty field is still a string */
+	if (!part->data && (part->data = multipart_strndup("", 0)) == NULL) return 503;
+	
+	return 0;
+}
+
+static int multipart_header(struct multipart *mp, char *line) {
+	struct httpd_part *part = &mp->parts[mp->partc - 1];
+	char *v, *p;
+	size_t len;
+	
+	if ((v = strchr(line, ':')) == NULL) return 400;
+	*v++ = '\0';
+	while (*v == ' ' || *v == '\t') v++;
+	
+	if (!strcasecmp(line, "Content-Disposition")) {
+		if (strncasecmp(v, "form-data", 9)) return 400;
+		if (part->name) return 400;
+		if ((p = multipart_param(v, "name", &len)) == NULL) return 400;
+		if ((part->name = multipart_strndup(p, len)) == NULL) return 503;
+		if ((p = multipart_param(v, "filename", &len)) != NULL) {
+			if ((part->filename = multipart_strndup(p, len)) == NULL) return 503;
+		}
+	} else if (!strcasecmp(line, "Content-Type")) {
+		if (part->contentType) return 400;
+		if ((part->contentType = multipart_strndup(v, strlen(v))) == NULL) return 503;
+	}
+	
+	return 0;
+}
+
+/* the delimiter, where one might start at the end of what's here, or 'end' */
+static unsigned char *multipart_find(struct multipart *mp, unsigned char *p, unsigned char *end) {
+	size_t n;
+	
+	while ((p = memchr(p, '\r', end - p)) != NULL) {
+		n = end - p;
+		if (n >= mp->delimLen) {
+			if (!memcmp(p, mp->delim, mp->delimLen)) return p;
+		} else {
+			if (!memcmp(p, mp->delim, n)) return p;
+		}
+		p++;
+	}
+	
+	return end;
+}
+
+/* goes as far through the window as it can, and keeps what it couldn't for the next time */
+static int multipart_run(struct multipart *mp) {
+	unsigned char *end = &mp->w[mp->wlen], *p = mp->w, *d, *e;
+	int code;
+	
+	for (;;) {
+		switch (mp->state) {
+			case MULTIPART_PREAMBLE:
+			case MULTIPART_DATA:
+				d = multipart_find(mp, p, end);
+				if (mp->state == MULTIPART_DATA && d > p && (code = multipart_write(mp, p, d - p)) != 0) return code;
+				p = d;
+				
+				/* and the two bytes after it, "--" for the last or the line's end */
+				if ((size_t)(end - p) < mp->delimLen + 2) goto more;
+				e = p + mp->delimLen;
+				if (e[0] == '-' && e[1] == '-') {
+					if (mp->state == MULTIPART_DATA && (code = multipart_end(mp)) != 0) return code;
+					mp->state = MULTIPART_DONE;
+					p = end;
+					goto more;
+				}
+				while (e < end && (*e == ' ' || *e == '\t')) e++;
+				if (end - e < 2) goto more;
+				if (e[0] != '\r' || e[1] != '\n') return 400;
+				
+				if (mp->state == MULTIPART_DATA && (code = multipart_end(mp)) != 0) return code;
+				if ((code = multipart_begin(mp)) != 0) return code;
+				mp->state = MULTIPART_HEAD;
+				p = e + 2;
+				break;
+				
+			case MULTIPART_HEAD:
+				if ((e = memchr(p, '\n', end - p)) == NULL) {
+					/* a head that won't fit in the window */
+					if (p == mp->w && mp->wlen == sizeof(mp->w)) return 431;
+					goto more;
+				}
+				d = e;
+				if (d > p && d[-1] == '\r') d--;
+				*d = '\0';
+				
+				if (d == p) {
+					if ((code = multipart_open(mp)) != 0) return code;
+					mp->state = MULTIPART_DATA;
+				} else if ((code = multipart_header(mp, (char *)p)) != 0) {
+					return code;
+				}
+				p = e + 1;
+				break;
+				
+			case MULTIPART_DONE:
+				/* the epilogue is of no interest */
+				p = end;
+				goto more;
+		}
+	}
+	
+more:
+	mp->wlen = end - p;
+	if (mp->wlen > 0 && p != mp->w) memmove(mp->w, p, mp->wlen);
+	
+	return 0;
+}
+
+static int multipart_feed(struct multipart *mp, unsigned char *data, size_t len) {
+	size_t n;
+	int code;
+	
+	while (len > 0) {
+		n = sizeof(mp->w) - mp->wlen;
+		if (n > len) n = len;
+		memcpy(&mp->w[mp->wlen], data, n);
+		mp->wlen += n;
+		data += n;
+		len -= n;
+		
+		if ((code = multipart_run(mp)) != 0) return code;
+	}
+	
+	return 0;
+}
+
+/* ########################################################################## */
+
+hte multipart_start(struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	struct multipart_info *info;
+	struct multipart *mp;
+	char *type, *boundary;
+	size_t len;
+	long base;
+	hte ret;
+	
+	if (!session->httpd || (info = session->httpd->multipart) == NULL || !info->enabled || req->data.contentLength == 0) return HTE_NONE;
+	
+	/* as expect_head(), the parse is still in indexes */
+	base = (long)req->buf->data;
+	http_rebase(req, base);
+	
+	ret = HTE_NONE;
+	if ((type = httpd_getHeader(session, "Content-Type")) == NULL || strncasecmp(type, "multipart/form-data", 19)) goto done;
+	
+	if ((boundary = multipart_param(type, "boundary", &len)) == NULL || len == 0 || len > MULTIPART_BOUNDARY) {
+		req->refused = 400;
+		ret = HTE_PARSE;
+		goto done;
+	}
+	
+	if ((mp = mem_malloc(HTTPD_MEM_HTTP, sizeof(*mp))) == NULL) {
+		req->refused = 503;
+		ret = HTE_NOMEM;
+		goto done;
+	}
+	mp->state = MULTIPART_PREAMBLE;
+	memcpy(mp->delim, "\r\n--", 4);
+	memcpy(&mp->delim[4], boundary, len);
+	mp->delimLen = 4 + len;
+	mp->memBytes = info->memBytes;
+	mp->dir = info->dir;
+	mp->partc = 0;
+	mp->cap = 0;
+	
+	/* the first delimiter comes without a line before it */
+	memcpy(mp->w, "\r\n", 2);
+	mp->wlen = 2;
+	
+	req->multipart = mp;
+	
+done:
+	http_rebase(req, -base);
+	return ret;
+}
+
+hte multipart_take(struct session_info *session) {
+	struct http_request *req = session->xfer.request;
+	struct multipart *mp = req->multipart;
+	size_t start;
+	int code;
+	
+	if (req->state != STATE_PARSING_CONTENT && req->state != STATE_COMPLETE) return HTE_NONE;
+	
+	/* the body's still an index, and whatever follows it (there's a connection per request) goes too */
+	start = (size_t)req->data.content;
+	if (req->parsePos > start && (code = multipart_feed(mp, &req->buf->data[start], req->parsePos - start)) != 0) goto refuse;
+	req->buf->next = req->parsePos = start;
+	
+	if (req->state != STATE_COMPLETE) return HTE_NONE;
+	
+	/* the callback has the parts instead */
+	if (mp->state != MULTIPART_DONE) {
+		code = 400;
+		goto refuse;
+	}
+	req->data.content = NULL;
+	req->data.contentLength = 0;
+	
+	return HTE_NONE;
+refuse:
+	req->refused = code;
+	return HTE_PARSE;
+}
+
+void multipart_free(struct multipart *mp) {
+	int i;
+	
+	for (i = 0; i < mp->partc; i++) {
+		struct httpd_part *part = &mp->parts[i];
+		if (part->name) mem_free(part->name);
+		if (part->filename) mem_free(part->filename);
+		if (part->contentType) mem_free(part->contentType);
+		if (part->data) mem_free(part->data);
+		if (part->fd != -1) close(part->fd);
+	}
+	mem_free(mp);
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setMultipart(struct httpd_info *httpd, int enable, size_t memBytes, char *dir) {
+	struct multipart_info *info;
+	char *p = NULL;
+	hte ret = HTE_NONE;
+	
+	if (!httpd) return HTE_INVALPARAM;
+	if (dir && (p = multipart_strndup(dir, strlen(dir))) == NULL) return HTE_NOMEM;
+	
+	pthread_mutex_lock(&multipart_startMutex);
+	
+	if ((info = httpd->multipart) == NULL) {
+		if (!enable) goto done;
+		if ((info = mem_malloc(HTTPD_MEM_SERVER, sizeof(*info))) == NULL) { ret = HTE_NOMEM; goto done; }
+		info->enabled = 1;
+		info->memBytes = memBytes;
+		info->dir = p;
+		p = NULL;
+		
+		__sync_synchronize();
+		httpd->multipart = info;
+		goto done;
+	}
+	
+	/* a request may still have the old directory, it's kept */
+	info->enabled = !!enable;
+	info->memBytes = memBytes;
+	if (p) {
+		info->dir = p;
+		p = NULL;
+	}
+	
+done:
+	pthread_mutex_unlock(&multipart_startMutex);
+	if (p) mem_free(p);
+	return ret;
+}
+
+EXPORT int httpd_getParts(struct session_info *session, struct httpd_part **parts) {
+	struct multipart *mp;
+	
+	if (!session || !parts) return 0;
+	if ((mp = session->xfer.request->multipart) == NULL) return 0;
+	
+	*parts = mp->parts;
+	return mp->partc;
+}
+
+EXPORT struct httpd_part *httpd_getPart(struct session_info *session, char *name) {
+	struct multipart *mp;
+	int i;
+	
+	if (!session || !name) return NULL;
+	if ((mp = session->xfer.request->multipart) == NULL) return NULL;
+	
+	for (i = 0; i < mp->partc; i++) {
+		if (!strcmp(mp->parts[i].name, name)) return &mp->parts[i];
+	}
+	
+	return NULL;
+}
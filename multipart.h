@@ -0,0 +1,69 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* multipart/form-data, parsed as it's read - each read's worth of the body goes through the parser
+   and is then dropped from the request's buffer, so an upload takes the same memory whatever its size
+   the body goes through a window, where the delimiter is found with memchr() on its first byte (a
+   '\r'), and what's left of the window that could still be the start of one waits for the next read */
+
+struct session_info;
+
+#define MULTIPART_PARTS    64    /* more than this is refused with a 413 */
+#define MULTIPART_WINDOW   16384 /* which a part's head must fit in */
+#define MULTIPART_BOUNDARY 70
+
+struct multipart_info {
+	int enabled;
+	size_t memBytes;
+	char *dir; /* NULL for memfds */
+};
+
+enum multipart_state {
+	MULTIPART_PREAMBLE = 0,
+	MULTIPART_HEAD,
+	MULTIPART_DATA,
+	MULTIPART_DONE,
+};
+
+struct multipart {
+	enum multipart_state state;
+	unsigned char delim[4 + MULTIPART_BOUNDARY]; /* "\r\n--" and the boundary */
+	size_t delimLen;
+	
+	size_t memBytes;
+	char *dir;
+	
+	struct httpd_part parts[MULTIPART_PARTS];
+	int partc;
+	size_t cap; /* of the last part's data */
+	
+	size_t wlen;
+	unsigned char w[MULTIPART_WINDOW];
+};
+
+/* called by http_readMore() - multipart_start() once the head is in, and multipart_take() after
+   each read, either may refuse the request */
+hte multipart_start(struct session_info *session);
+hte multipart_take(struct session_info *session);
+void multipart_free(struct multipart *mp);
+
+#endif /* MULTIPART_H */
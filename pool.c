@@ -0,0 +1,722 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "h2.h"
+#include "defer.h"
+#include "trace.h"
+#include "loop.h"
+#include "timeout.h"
+#include "pool.h"
+#include "limit.h"
+#include "mem.h"
+#include "mono.h"
+
+#define POOL_STEAL 32 /* most taken from another handler in one go */
+
+static void pool_close(struct pool_conn *conn) {
+	if (conn->watched) loop_del(conn->io->loop, &conn->watch);
+	conn->session->pool = NULL;
+	/* a callback that deferred and then failed, the handle must not be left with a closed session */
+	if (!conn->session->deferred || !defer_abandon(conn->session)) session_close(conn->session);
+	mem_free(conn);
+}
+
+/* the same last gasp that session_handleConnection() gives */
+static void pool_fail(struct pool_conn *conn, hte ret) {
+	char err_buf[] = "HTTP/1.1 500 Internal Server Error\r\n";
+	
+	if (limit_answer(conn->session)) {
+		pool_close(conn);
+		return;
+	}
+	
+	fprintf(stderr, "%s:%d %s(): an error occured (%d)\n", __FILE__, __LINE__, __FUNCTION__, ret);
+	send(conn->session->fd, err_buf, sizeof(err_buf), MSG_NOSIGNAL | MSG_DONTWAIT);
+	pool_close(conn);
+}
+
+/* on the I/O loop, which has the connection whenever it's being timed */
+static void pool_expire(struct session_info *session) {
+	timeout_answer(session);
+	pool_close(session->pool);
+}
+
+/* ########################################################################## */
+
+/* the handler's mutex must be held */
+static int pool_dequePush(struct pool_handler *h, struct pool_conn *conn) {
+	struct pool_deque *d = &h->deques[conn->priority];
+	
+	if (d->count == d->size) {
+		struct pool_conn **p;
+		int i;
+		
+		if ((p = mem_malloc(HTTPD_MEM_SERVER, sizeof(*p) * d->size * 2)) == NULL) return -1;
+		for (i = 0; i < d->count; i++) p[i] = d->items[(d->head + i) % d->size];
+		mem_free(d->items);
+		d->items = p;
+		d->head = 0;
+		d->size *= 2;
+	}
+	d->items[(d->head + d->count) % d->size] = conn;
+	d->count++;
+	h->count++;
+	
+	return 0;
+}
+
+/* the handler's mutex must be held, each class with something waiting gets its weight in
+   credit and the richest pays for the turn, so that they're interleaved rather than bunched */
+static struct pool_conn *pool_dequePop(struct pool_handler *h) {
+	struct pool_info *pool = h->pool;
+	struct pool_conn *conn;
+	struct pool_deque *d;
+	int c, best = -1, total = 0;
+	
+	for (c = 0; c < HTTPD_PRIORITIES; c++) {
+		if (h->deques[c].count == 0) continue;
+		h->credit[c] += pool->classes[c].weight;
+		total += pool->classes[c].weight;
+		if (best == -1 || h->credit[c] > h->credit[best]) best = c;
+	}
+	if (best == -1) return NULL;
+	h->credit[best] -= total;
+	
+	d = &h->deques[best];
+	conn = d->items[d->head];
+	d->head = (d->head + 1) % d->size;
+	d->count--;
+	h->count--;
+	
+	return conn;
+}
+
+static void pool_queue(struct pool_info *pool, struct pool_conn *conn) {
+	struct pool_handler *h;
+	int q, peak, r;
+	
+	h = &pool->handlers[__sync_fetch_and_add(&pool->nextHandler, 1) % pool->handlerc];
+	conn->queuedAt = mono_ns();
+	
+	pthread_mutex_lock(&h->mutex);
+	r = pool_dequePush(h, conn);
+	pthread_mutex_unlock(&h->mutex);
+	if (r != 0) {
+		pool_fail(conn, HTE_NOMEM);
+		return;
+	}
+	
+	__sync_fetch_and_add(&pool->dispatched, 1);
+	__sync_fetch_and_add(&pool->classes[conn->priority].queued, 1);
+	
+	/* as mem_charge()'s, a plain store could put back a lower peak another thread just passed */
+	q = __sync_add_and_fetch(&pool->queued, 1);
+	while ((peak = pool->queuedPeak) < q) {
+		if (__sync_bool_compare_and_swap(&pool->queuedPeak, peak, q)) break;
+	}
+	
+	/* the atomics on both sides order this against a handler going to sleep */
+	if (*(volatile int *)&pool->idle > 0) {
+		pthread_mutex_lock(&pool->idleMutex);
+		pthread_cond_signal(&pool->idleCond);
+		pthread_mutex_unlock(&pool->idleMutex);
+	}
+}
+
+static struct pool_conn *pool_take(struct pool_handler *self) {
+	struct pool_info *pool = self->pool;
+	struct pool_conn *stolen[POOL_STEAL];
+	struct pool_conn *conn = NULL;
+	struct pool_deque *d;
+	int i, n, v, c;
+	
+	pthread_mutex_lock(&self->mutex);
+	conn = pool_dequePop(self);
+	pthread_mutex_unlock(&self->mutex);
+	if (conn) goto done;
+	
+	/* nothing of our own, so take half of someone else's most important class from the back, where the newest are */
+	for (v = 1; v < pool->handlerc; v++) {
+		struct pool_handler *victim = &pool->handlers[((self - pool->handlers) + v) % pool->handlerc];
+		
+		if (*(volatile int *)&victim->count == 0) continue;
+		
+		n = 0;
+		pthread_mutex_lock(&victim->mutex);
+		for (c = 0; c < HTTPD_PRIORITIES; c++) {
+			d = &victim->deques[c];
+			if (d->count == 0) continue;
+			n = (d->count + 1) / 2;
+			if (n > POOL_STEAL) n = POOL_STEAL;
+			for (i = 0; i < n; i++) {
+				d->count--;
+				stolen[i] = d->items[(d->head + d->count) % d->size];
+			}
+			victim->count -= n;
+			break;
+		}
+		pthread_mutex_unlock(&victim->mutex);
+		
+		if (n == 0) continue;
+		__sync_fetch_and_add(&self->steals, n);
+		
+		/* run the oldest of them now, and keep the rest */
+		conn = stolen[n - 1];
+		if (n > 1) {
+			pthread_mutex_lock(&self->mutex);
+			for (i = n - 2; i >= 0; i--) {
+				if (pool_dequePush(self, stolen[i]) != 0) break;
+			}
+			pthread_mutex_unlock(&self->mutex);
+			/* they were taken out of a deque with room, so this can only fail if the memory's gone */
+			for (; i >= 0; i--) {
+				__sync_fetch_and_sub(&pool->queued, 1);
+				__sync_fetch_and_sub(&pool->classes[stolen[i]->priority].queued, 1);
+				pool_fail(stolen[i], HTE_NOMEM);
+			}
+		}
+		goto done;
+	}
+	
+	return NULL;
+done:
+	__sync_fetch_and_sub(&pool->queued, 1);
+	__sync_fetch_and_sub(&pool->classes[conn->priority].queued, 1);
+	return conn;
+}
+
+/* controlled delay - a class is overloaded once everything taken from it for an interval has
+   waited longer than its target, and then what has is turned away until something hasn't */
+static int pool_shouldShed(struct pool_info *pool, struct pool_conn *conn) {
+	struct pool_class *class = &pool->classes[conn->priority];
+	unsigned long long now, waited;
+	int shed = 0;
+	
+	if (class->target == 0) return 0;
+	
+	now = mono_ns();
+	waited = now - conn->queuedAt;
+	
+	pthread_mutex_lock(&class->mutex);
+	if (waited <= class->target) {
+		class->firstAbove = 0;
+		class->overloaded = 0;
+	} else if (class->overloaded) {
+		shed = 1;
+	} else if (class->firstAbove == 0) {
+		class->firstAbove = now;
+	} else if (now - class->firstAbove >= POOL_INTERVAL * 1000000ULL) {
+		class->overloaded = 1;
+		shed = 1;
+	}
+	pthread_mutex_unlock(&class->mutex);
+	
+	return shed;
+}
+
+/* for a connection shed while it waited for a handler */
+static const char pool_503[] =
+	"HTTP/1.1 503 Service Unavailable\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 20\r\n"
+	"Retry-After: 1\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Service Unavailable\n";
+
+static void pool_shed(struct pool_info *pool, struct pool_conn *conn) {
+	__sync_fetch_and_add(&pool->classes[conn->priority].shed, 1);
+	session_answer(conn->session, pool_503, sizeof(pool_503) - 1);
+	pool_close(conn);
+}
+
+/* ########################################################################## */
+
+static void *pool_h2(void *_conn) {
+	struct pool_conn *conn = _conn;
+	hte ret;
+	
+	pthread_detach(pthread_self());
+	
+	/* an HTTP/2 connection multiplexes streams that each want a thread, so it lives as it always has */
+	if ((ret = h2_serve(conn->session, conn->h2)) != HTE_NONE) {
+		fprintf(stderr, "%s:%d %s(): an error occured on an HTTP/2 connection (%d)\n", __FILE__, __LINE__, __FUNCTION__, ret);
+	}
+	pool_close(conn);
+	
+	return NULL;
+}
+
+/* the I/O loop's mutex is not held, the connection is the loop's alone */
+static void pool_send(struct pool_conn *conn) {
+	struct http_response *rsp = conn->session->xfer.response;
+	struct iovec iov[HTTP_IOV];
+	struct msghdr msg;
+	size_t skip;
+	ssize_t l;
+	int i, c;
+	
+	timeout_phase(conn->session, TIMEOUT_WRITE);
+	
+	for (;;) {
+		/* the head, then the buffer with any shared bodies, less what's been sent */
+		c = body_iov(rsp, iov, 1);
+		skip = conn->sent;
+		for (i = 0; i < c && iov[i].iov_len <= skip; i++) skip -= iov[i].iov_len;
+		if (i == c) break;
+		iov[i].iov_base = (unsigned char *)iov[i].iov_base + skip;
+		iov[i].iov_len -= skip;
+		
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov[i];
+		msg.msg_iovlen = c - i;
+		
+		if ((l = sendmsg(conn->session->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) goto done;
+			if (!conn->watched) {
+				if (loop_add(conn->io->loop, &conn->watch, EPOLLOUT) != HTE_NONE) goto done;
+				conn->watched = 1;
+			}
+			return;
+		}
+		conn->sent += l;
+	}
+	
+	TRACE(send_complete, HTTPD_TRACE_SEND_COMPLETE, conn->session);
+done:
+	pool_close(conn);
+}
+
+static void pool_co(void *conn);
+
+static int pool_classify(struct pool_info *pool, struct session_info *session) {
+	httpd_classifier classifier;
+	struct pool_prefix *p, *best = NULL;
+	void *ctx;
+	char *uri;
+	int c;
+	
+	classifier = (httpd_classifier)hook_get(&pool->classifier, &ctx);
+	if (classifier && (c = classifier(ctx, session)) >= 0 && c < HTTPD_PRIORITIES) return c;
+	
+	if ((uri = (char *)session->xfer.request->uri) == NULL) return HTTPD_PRIORITY_NORMAL;
+	for (p = pool->prefixes; p; p = p->next) {
+		if (best && p->len <= best->len) continue;
+		if (!strncmp(uri, p->prefix, p->len)) best = p;
+	}
+	
+	return best ? best->priority : HTTPD_PRIORITY_NORMAL;
+}
+
+static void pool_read(struct pool_conn *conn) {
+	struct session_info *session = conn->session;
+	struct httpd_info *httpd = session->httpd;
+	hte ret;
+	
+	while (session->xfer.request->state != STATE_COMPLETE) {
+		if ((ret = http_readMore(session, MSG_DONTWAIT)) != HTE_NONE) {
+			if (ret == HTE_READ && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+			goto die;
+		}
+	}
+	
+	/* the handler has the socket until the response comes back, and isn't timed */
+	loop_del(conn->io->loop, &conn->watch);
+	conn->watched = 0;
+	timeout_stop(session);
+	
+	if ((ret = http_readDone(session)) != HTE_NONE) goto die;
+	
+	if (httpd->h2c && (conn->h2 = h2_detect(session)) != 0) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, pool_h2, conn) != 0) { ret = HTE_THREAD; goto die; }
+		return;
+	}
+	
+	conn->priority = pool_classify(httpd->pool, session);
+	
+	if (httpd->pool->handlerc == 0) {
+		if ((ret = co_start(&conn->io->co, pool_co, conn)) != HTE_NONE) goto die;
+		return;
+	}
+	
+	pool_queue(httpd->pool, conn);
+	return;
+die:
+	pool_fail(conn, ret);
+}
+
+static void pool_event(struct loop_watch *watch, uint32_t events) {
+	struct pool_conn *conn = (struct pool_conn *)watch;
+	
+	if (conn->sending) {
+		pool_send(conn);
+	} else {
+		pool_read(conn);
+	}
+}
+
+/* responses back from the handlers */
+static void pool_wake(struct loop_watch *watch, uint32_t events) {
+	struct pool_io *io = (struct pool_io *)watch;
+	struct pool_conn *conn, *next, *incoming;
+	uint64_t n;
+	
+	if (read(io->wake.fd, &n, sizeof(n)) != sizeof(n)) return;
+	
+	pthread_mutex_lock(&io->mutex);
+	conn = io->ready;
+	io->ready = NULL;
+	incoming = io->incoming;
+	io->incoming = NULL;
+	pthread_mutex_unlock(&io->mutex);
+	
+	for (; conn; conn = next) {
+		next = conn->next;
+		pool_send(conn);
+	}
+	
+	for (conn = incoming; conn; conn = next) {
+		next = conn->next;
+		timeout_start(conn->session, &io->wheel, pool_expire);
+		if (loop_add(io->loop, &conn->watch, EPOLLIN) != HTE_NONE) {
+			pool_close(conn);
+			continue;
+		}
+		conn->watched = 1;
+	}
+}
+
+/* ########################################################################## */
+
+static void pool_run(struct pool_conn *conn) {
+	struct session_info *session = conn->session;
+	struct pool_io *io = conn->io;
+	uint64_t one = 1;
+	hte ret;
+	
+	if ((ret = session_dispatch(session)) != HTE_NONE) {
+		pool_fail(conn, ret);
+		return;
+	}
+	
+	if (session->deferred) {
+		session->pool = NULL;
+		if (defer_handOff(session)) {
+			mem_free(conn);
+			return;
+		}
+		pool_close(conn);
+		return;
+	}
+	
+	/* upgrades have taken the socket, and a flushed response has been sent already */
+	if (session->fd == -1 || session->xfer.response->flushed) {
+		pool_close(conn);
+		return;
+	}
+	
+	conn->sending = 1;
+	conn->sent = 0;
+	
+	/* a coroutine is on the I/O loop already */
+	if (co_active()) {
+		pool_send(conn);
+		return;
+	}
+	
+	pthread_mutex_lock(&io->mutex);
+	conn->next = io->ready;
+	io->ready = conn;
+	pthread_mutex_unlock(&io->mutex);
+	
+	if (write(io->wake.fd, &one, sizeof(one)) != sizeof(one)) {
+		fprintf(stderr, "%s:%d %s(): couldn't wake the I/O loop\n", __FILE__, __LINE__, __FUNCTION__);
+	}
+}
+
+static void pool_co(void *conn) {
+	pool_run(conn);
+}
+
+static void *pool_handlerThread(void *_h) {
+	struct pool_handler *h = _h;
+	struct pool_info *pool = h->pool;
+	struct pool_conn *conn;
+	
+	pthread_detach(pthread_self());
+	
+	for (;;) {
+		if ((conn = pool_take(h)) != NULL) {
+			if (pool_shouldShed(pool, conn)) {
+				pool_shed(pool, conn);
+				continue;
+			}
+			__sync_fetch_and_add(&pool->classes[conn->priority].dispatched, 1);
+			pool_run(conn);
+			continue;
+		}
+		
+		pthread_mutex_lock(&pool->idleMutex);
+		__sync_fetch_and_add(&pool->idle, 1);
+		while (*(volatile int *)&pool->queued == 0) pthread_cond_wait(&pool->idleCond, &pool->idleMutex);
+		__sync_fetch_and_sub(&pool->idle, 1);
+		pthread_mutex_unlock(&pool->idleMutex);
+	}
+	
+	return NULL;
+}
+
+void pool_accept(struct pool_info *pool, struct session_info *session) {
+	struct pool_conn *conn;
+	
+	if ((conn = mem_malloc(HTTPD_MEM_SESSION, sizeof(*conn))) == NULL) goto die;
+	memset(conn, 0, sizeof(*conn));
+	conn->io = &pool->io[__sync_fetch_and_add(&pool->nextIo, 1) % pool->ioc];
+	conn->session = session;
+	conn->watch.fd = session->fd;
+	conn->watch.handler = pool_event;
+	session->pool = conn;
+	
+	if (session_xferAlloc(session) != HTE_NONE) goto die;
+	
+	if (session->httpd->timeouts) {
+		/* the timer can't be started from here, it could go off before the loop has the connection */
+		uint64_t one = 1;
+		
+		pthread_mutex_lock(&conn->io->mutex);
+		conn->next = conn->io->incoming;
+		conn->io->incoming = conn;
+		pthread_mutex_unlock(&conn->io->mutex);
+		
+		if (write(conn->io->wake.fd, &one, sizeof(one)) != sizeof(one)) {
+			fprintf(stderr, "%s:%d %s(): couldn't wake the I/O loop\n", __FILE__, __LINE__, __FUNCTION__);
+		}
+		return;
+	}
+	
+	/* the I/O thread may be done with it before loop_add() returns */
+	conn->watched = 1;
+	if (loop_add(conn->io->loop, &conn->watch, EPOLLIN) != HTE_NONE) goto die;
+	
+	return;
+die:
+	session->pool = NULL;
+	session_close(session);
+	if (conn) mem_free(conn);
+}
+
+/* ########################################################################## */
+
+/* no handler threads means the callbacks are coroutines on the I/O loops */
+static hte pool_start(struct httpd_info *httpd, int ioThreads, int handlerThreads, size_t stackSize) {
+	struct pool_info *pool;
+	int i, c;
+	
+	if (httpd->pool) return HTE_INVALPARAM;
+	/* handshakes block, TLS stays on a thread per connection */
+	if (httpd->tls) return HTE_TLS;
+	
+	if ((pool = mem_malloc(HTTPD_MEM_SERVER, sizeof(*pool))) == NULL) return HTE_NOMEM;
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->idleMutex, NULL);
+	pthread_cond_init(&pool->idleCond, NULL);
+	pool->ioc = ioThreads;
+	pool->handlerc = handlerThreads;
+	
+	if ((pool->io = mem_malloc(HTTPD_MEM_SERVER, sizeof(*pool->io) * ioThreads)) == NULL) goto nomem;
+	memset(pool->io, 0, sizeof(*pool->io) * ioThreads);
+	if (handlerThreads > 0) {
+		if ((pool->handlers = mem_malloc(HTTPD_MEM_SERVER, sizeof(*pool->handlers) * handlerThreads)) == NULL) goto nomem;
+		memset(pool->handlers, 0, sizeof(*pool->handlers) * handlerThreads);
+	}
+	
+	for (i = 0; i < handlerThreads; i++) {
+		struct pool_handler *h = &pool->handlers[i];
+		h->pool = pool;
+		pthread_mutex_init(&h->mutex, NULL);
+		for (c = 0; c < HTTPD_PRIORITIES; c++) {
+			struct pool_deque *d = &h->deques[c];
+			d->size = POOL_DEQUE;
+			if ((d->items = mem_malloc(HTTPD_MEM_SERVER, sizeof(*d->items) * d->size)) == NULL) goto nomem;
+		}
+	}
+	for (c = 0; c < HTTPD_PRIORITIES; c++) {
+		pthread_mutex_init(&pool->classes[c].mutex, NULL);
+		pool->classes[c].weight = c == HTTPD_PRIORITY_HIGH ? 8 : c == HTTPD_PRIORITY_NORMAL ? 4 : 1;
+	}
+	for (i = 0; i < ioThreads; i++) {
+		struct pool_io *io = &pool->io[i];
+		io->pool = pool;
+		io->wake.handler = pool_wake;
+		pthread_mutex_init(&io->mutex, NULL);
+		if ((io->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) goto nomem;
+	}
+	
+	/* threads can't be taken back, anything started before a failure is left running idle */
+	for (i = 0; i < ioThreads; i++) {
+		struct pool_io *io = &pool->io[i];
+		if ((io->loop = loop_new()) == NULL) return HTE_THREAD;
+		co_cacheInit(&io->co, io->loop, stackSize);
+		if (wheel_init(&io->wheel, io->loop) != HTE_NONE) return HTE_THREAD;
+		if (loop_add(io->loop, &io->wake, EPOLLIN) != HTE_NONE) return HTE_THREAD;
+	}
+	for (i = 0; i < handlerThreads; i++) {
+		if (pthread_create(&pool->handlers[i].tid, NULL, pool_handlerThread, &pool->handlers[i]) != 0) return HTE_THREAD;
+	}
+	
+	/* the listener picks this up with the next connection */
+	__sync_synchronize();
+	httpd->pool = pool;
+	
+	return HTE_NONE;
+nomem:
+	if (pool->io) {
+		for (i = 0; i < ioThreads; i++) {
+			if (pool->io[i].wake.fd > 0) close(pool->io[i].wake.fd);
+		}
+		mem_free(pool->io);
+	}
+	if (pool->handlers) {
+		for (i = 0; i < handlerThreads; i++) {
+			for (c = 0; c < HTTPD_PRIORITIES; c++) {
+				if (pool->handlers[i].deques[c].items) mem_free(pool->handlers[i].deques[c].items);
+			}
+		}
+		mem_free(pool->handlers);
+	}
+	mem_free(pool);
+	return HTE_NOMEM;
+}
+
+EXPORT hte httpd_setThreadPools(struct httpd_info *httpd, int ioThreads, int handlerThreads) {
+	if (!httpd || ioThreads < 1 || handlerThreads < 1) return HTE_INVALPARAM;
+	return pool_start(httpd, ioThreads, handlerThreads, 0);
+}
+
+EXPORT hte httpd_setCoroutines(struct httpd_info *httpd, int ioThreads, size_t stackSize) {
+	if (!httpd || ioThreads < 1) return HTE_INVALPARAM;
+	if (stackSize == 0) stackSize = CO_STACK;
+	return pool_start(httpd, ioThreads, 0, stackSize);
+}
+
+EXPORT hte httpd_getPoolStats(struct httpd_info *httpd, struct httpd_poolStats *stats) {
+	struct pool_info *pool;
+	int i;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((pool = httpd->pool) == NULL) return HTE_NONE;
+	
+	stats->ioThreads = pool->ioc;
+	stats->handlerThreads = pool->handlerc;
+	stats->queued = pool->queued;
+	stats->queuedPeak = pool->queuedPeak;
+	stats->dispatched = pool->dispatched;
+	for (i = 0; i < pool->handlerc; i++) stats->steals += pool->handlers[i].steals;
+	/* only the loops' own threads write these */
+	for (i = 0; i < pool->ioc; i++) {
+		stats->coroutines += *(volatile int *)&pool->io[i].co.live;
+		stats->stacks += *(volatile int *)&pool->io[i].co.stacks;
+	}
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setPriority(struct httpd_info *httpd, enum httpd_priority priority, int weight, int targetMs) {
+	struct pool_class *class;
+	
+	if (!httpd || !httpd->pool || priority < 0 || priority >= HTTPD_PRIORITIES || weight < 1 || targetMs < 0) return HTE_INVALPARAM;
+	class = &httpd->pool->classes[priority];
+	
+	pthread_mutex_lock(&class->mutex);
+	class->weight = weight;
+	class->target = (unsigned long long)targetMs * 1000000ULL;
+	class->firstAbove = 0;
+	class->overloaded = 0;
+	pthread_mutex_unlock(&class->mutex);
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_addPriorityPrefix(struct httpd_info *httpd, char *prefix, enum httpd_priority priority) {
+	struct pool_prefix *p;
+	size_t len;
+	
+	if (!httpd || !httpd->pool || !prefix || priority < 0 || priority >= HTTPD_PRIORITIES) return HTE_INVALPARAM;
+	
+	len = strlen(prefix);
+	if ((p = mem_malloc(HTTPD_MEM_SERVER, sizeof(*p) + len)) == NULL) return HTE_NOMEM;
+	memcpy(p->prefix, prefix, len + 1);
+	p->len = len;
+	p->priority = priority;
+	
+	/* the I/O loops may be reading the list, which only ever grows at the front */
+	do {
+		p->next = httpd->pool->prefixes;
+	} while (!__sync_bool_compare_and_swap(&httpd->pool->prefixes, p->next, p));
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_setClassifier(struct httpd_info *httpd, httpd_classifier classifier, void *ctx) {
+	if (!httpd || !httpd->pool) return HTE_INVALPARAM;
+	
+	hook_set(&httpd->pool->classifier, (hook_fn)classifier, ctx);
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_getPriorityStats(struct httpd_info *httpd, enum httpd_priority priority, struct httpd_priorityStats *stats) {
+	struct pool_class *class;
+	
+	if (!httpd || !stats || priority < 0 || priority >= HTTPD_PRIORITIES) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if (!httpd->pool) return HTE_NONE;
+	class = &httpd->pool->classes[priority];
+	
+	stats->queued = class->queued;
+	stats->overloaded = class->overloaded;
+	stats->dispatched = class->dispatched;
+	stats->shed = class->shed;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,130 @@
+#ifndef POOL_H
+#define POOL_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* thread pools - the listener hands each connection to one of the I/O loops, which reads and
+   parses the request without blocking, then queues it on a handler's deque for the callback
+   (a handler that runs dry steals from the others) and the response is handed back to the
+   I/O loop to be sent
+   the socket itself stays blocking, so everything a callback can do with its session still
+   works on a handler thread - only the plain responses go back to the loop
+   with coroutines there are no handlers, the callbacks run on the I/O loops themselves
+   each handler has a deque per priority class, taken from in proportion to the classes' weights,
+   and a class with a target delay sheds what's waited too long with a 503 once it's overloaded */
+
+#include "loop.h"
+#include "co.h"
+#include "wheel.h"
+#include "hook.h"
+
+struct session_info;
+
+#define POOL_DEQUE    256 /* each handler's deques start this big, and grow */
+#define POOL_INTERVAL 100 /* ms a class's requests must all have waited too long for, before it sheds */
+
+struct pool_conn {
+	struct loop_watch watch; /* must be first */
+	struct pool_io *io;
+	struct session_info *session;
+	struct pool_conn *next; /* on the I/O loop's list of responses to send */
+	int h2;
+	int priority;
+	unsigned long long queuedAt; /* CLOCK_MONOTONIC in ns */
+	int sending;
+	int watched; /* the socket is on the I/O loop */
+	size_t sent;
+};
+
+struct pool_io {
+	struct loop_watch wake; /* must be first, an eventfd the handlers poke */
+	struct pool_info *pool;
+	struct loop_info *loop;
+	pthread_mutex_t mutex;
+	struct pool_conn *ready;    /* responses waiting to be sent */
+	struct pool_conn *incoming; /* connections to be timed from the start, so the loop must take them on itself */
+	struct co_cache co;         /* the callbacks' stacks, when there are no handlers */
+	struct wheel_info wheel;    /* the timeouts of the connections it has */
+};
+
+struct pool_deque {
+	struct pool_conn **items;
+	int size;
+	int head;
+	int count;
+};
+
+struct pool_handler {
+	struct pool_info *pool;
+	pthread_t tid;
+	
+	pthread_mutex_t mutex; /* the deques - the owner takes from the front, thieves from the back */
+	struct pool_deque deques[HTTPD_PRIORITIES];
+	int count;                     /* across them */
+	int credit[HTTPD_PRIORITIES]; /* for the weighted round robin between them */
+	
+	unsigned long long steals;
+};
+
+/* requests are put in a class by the classifier, or else by the longest prefix of the URI */
+struct pool_prefix {
+	struct pool_prefix *next;
+	enum httpd_priority priority;
+	size_t len;
+	char prefix[1];
+};
+
+struct pool_class {
+	int weight;
+	unsigned long long target; /* ns a request may wait, 0 never sheds */
+	
+	pthread_mutex_t mutex;         /* the controller */
+	unsigned long long firstAbove; /* when it first waited too long, 0 if the last one didn't */
+	int overloaded;                /* every request has for an interval, so the late are shed */
+	
+	int queued;
+	unsigned long long dispatched;
+	unsigned long long shed;
+};
+
+struct pool_info {
+	int ioc;
+	struct pool_io *io;
+	int handlerc; /* 0 when the callbacks are coroutines */
+	struct pool_handler *handlers;
+	unsigned int nextIo;
+	unsigned int nextHandler;
+	
+	pthread_mutex_t idleMutex;
+	pthread_cond_t idleCond;
+	int idle;   /* handlers asleep */
+	int queued; /* across every deque */
+	int queuedPeak;
+	unsigned long long dispatched;
+	
+	struct pool_class classes[HTTPD_PRIORITIES];
+	struct pool_prefix *prefixes;
+	struct hook classifier;
+};
+
+/* the connection belongs to the pool from here */
+void pool_accept(struct pool_info *pool, struct session_info *session);
+
+#endif /* POOL_H */
@@ -0,0 +1,732 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define _GNU_SOURCE /* splice(), pipe2(), memmem(), strcasestr() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "internal.h"
+#include "session.h"
+#include "http.h"
+#include "buf.h"
+#include "tls.h"
+#include "proxy.h"
+#include "co.h"
+#include "mem.h"
+#include "mono.h"
+
+struct proxy_head {
+	int code;
+	int keepAlive;
+	int chunked;
+	int haveLength;
+	unsigned long long length;
+};
+
+/* these describe the connection they arrive on, not the request, so they aren't passed along */
+static const char *proxy_hopByHop[] = {
+	"Connection",
+	"Keep-Alive",
+	"Proxy-Connection",
+	"Proxy-Authenticate",
+	"Proxy-Authorization",
+	"TE",
+	"Trailer",
+	"Transfer-Encoding",
+	"Upgrade",
+	NULL
+};
+
+static int proxy_isHopByHop(const char *name) {
+	int i;
+	
+	for (i = 0; proxy_hopByHop[i]; i++) {
+		if (!strcasecmp(name, proxy_hopByHop[i])) return 1;
+	}
+	
+	return 0;
+}
+
+/* ########################################################################## */
+
+static void proxy_connFree(struct proxy_conn *conn) {
+	close(conn->fd);
+	if (conn->pipe[0] != -1) {
+		close(conn->pipe[0]);
+		close(conn->pipe[1]);
+	}
+	mem_free(conn);
+}
+
+static struct proxy_conn *proxy_connect(struct httpd_proxy *proxy, struct proxy_upstream *up) {
+	struct proxy_conn *conn;
+	
+	if ((conn = mem_malloc(HTTPD_MEM_OTHER, sizeof(*conn))) == NULL) return NULL;
+	conn->next = NULL;
+	conn->pipe[0] = conn->pipe[1] = -1;
+	conn->pos = conn->end = 0;
+	conn->timeoutMs = proxy->timeout * 1000;
+	
+	if ((conn->fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+		mem_free(conn);
+		return NULL;
+	}
+	
+	if (proxy->timeout > 0) {
+		/* for splice(), everything else waits in co_*() with the same timeout */
+		struct timeval tv;
+		tv.tv_sec = proxy->timeout;
+		tv.tv_usec = 0;
+		setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+	if (up->addr.ss_family != AF_UNIX) {
+		int one = 1;
+		setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	
+	if (co_connect(conn->fd, (struct sockaddr *)&up->addr, up->addrlen, conn->timeoutMs) != 0) {
+		proxy_connFree(conn);
+		return NULL;
+	}
+	__sync_fetch_and_add(&proxy->connects, 1);
+	
+	return conn;
+}
+
+/* the upstream with the fewest requests in flight, preferring those that haven't just failed */
+static struct proxy_upstream *proxy_pick(struct httpd_proxy *proxy) {
+	struct proxy_upstream *up, *best;
+	time_t now;
+	int i;
+	
+	now = (time_t)(mono_ms() / 1000);
+	best = NULL;
+	
+	pthread_mutex_lock(&proxy->mutex);
+	
+	up = (proxy->last && proxy->last->next) ? proxy->last->next : proxy->upstreams;
+	for (i = 0; i < proxy->upstreamc; i++) {
+		int upDown = up->downUntil > now;
+		int bestDown = best && best->downUntil > now;
+		
+		if (!best || (bestDown && !upDown) || (bestDown == upDown && up->active < best->active)) best = up;
+		
+		up = up->next ? up->next : proxy->upstreams;
+	}
+	if (best) {
+		best->active++;
+		proxy->last = best;
+	}
+	
+	pthread_mutex_unlock(&proxy->mutex);
+	
+	return best;
+}
+
+/* a connection from the pool, if there's one the upstream hasn't closed while it sat there */
+static struct proxy_conn *proxy_idle(struct httpd_proxy *proxy, struct proxy_upstream *up) {
+	struct proxy_conn *conn;
+	unsigned char c;
+	
+	for (;;) {
+		pthread_mutex_lock(&proxy->mutex);
+		if ((conn = up->idle) != NULL) {
+			up->idle = conn->next;
+			up->idlec--;
+		}
+		pthread_mutex_unlock(&proxy->mutex);
+		
+		if (conn == NULL) return NULL;
+		
+		/* an idle connection should have nothing to read, EOF or stray data means it's finished with */
+		if (recv(conn->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+		proxy_connFree(conn);
+	}
+	__sync_fetch_and_add(&proxy->reused, 1);
+	
+	return conn;
+}
+
+/* 'keep' returns the connection to the pool (if there's room), 'down' rests the upstream for a while */
+static void proxy_release(struct httpd_proxy *proxy, struct proxy_upstream *up, struct proxy_conn *conn, int keep, int down) {
+	pthread_mutex_lock(&proxy->mutex);
+	up->active--;
+	if (down) up->downUntil = (time_t)(mono_ms() / 1000) + PROXY_RETRY;
+	if (conn && keep && up->idlec < proxy->poolSize) {
+		conn->pos = conn->end = 0;
+		conn->next = up->idle;
+		up->idle = conn;
+		up->idlec++;
+		conn = NULL;
+	}
+	pthread_mutex_unlock(&proxy->mutex);
+	
+	if (conn) proxy_connFree(conn);
+}
+
+/* ########################################################################## */
+
+/* the path was decoded by the parser, so it has to be put back the way it can travel
+   (http_uri_decode2() leaves "%2F" alone, so that's let through as it is) - the query never was */
+static hte proxy_catURI(struct buf **head, unsigned char *uri, size_t queryAt) {
+	static const char hex[] = "0123456789ABCDEF";
+	char e[3];
+	size_t s, n, end;
+	
+	end = queryAt ? queryAt - 1 : strlen((char *)uri);
+	
+	for (s = 0; s < end; s++) {
+		for (n = 0; s + n < end; n++) {
+			unsigned char c = uri[s + n];
+			if (c <= 0x20 || c >= 0x7F || c == '"' || c == '#' || c == '<' || c == '>' || c == '?') break;
+			if (c == '%' && !(uri[s + n + 1] == '2' && (uri[s + n + 2] == 'F' || uri[s + n + 2] == 'f'))) break;
+		}
+		if (n > 0 && nbufcatf(head, (char *)&uri[s], n) != n) return HTE_NOMEM;
+		s += n;
+		if (s >= end) break;
+		
+		e[0] = '%';
+		e[1] = hex[uri[s] >> 4];
+		e[2] = hex[uri[s] & 0x0F];
+		if (nbufcatf(head, e, 3) != 3) return HTE_NOMEM;
+	}
+	
+	/* the '?' and the query, as they came */
+	if (queryAt) {
+		n = strlen((char *)&uri[end]);
+		if (nbufcatf(head, (char *)&uri[end], n) != n) return HTE_NOMEM;
+	}
+	
+	return HTE_NONE;
+}
+
+static hte proxy_buildRequest(struct session_info *session, struct proxy_upstream *up, struct buf **head) {
+	struct http_request *req = session->xfer.request;
+	char addr[INET6_ADDRSTRLEN];
+	char *xff = NULL;
+	int gotHost = 0;
+	int gotLength = 0;
+	int i;
+	
+	if (bufcatf(head, "%s ", req->method) <= 0) return HTE_NOMEM;
+	if (proxy_catURI(head, req->uri, req->queryAt) != HTE_NONE) return HTE_NOMEM;
+	if (bufcatf(head, " HTTP/1.1\r\n") <= 0) return HTE_NOMEM;
+	
+	for (i = 0; i < req->data.headerc; i++) {
+		char *name = (char *)req->data.headers[i].name;
+		char *value = (char *)req->data.headers[i].value;
+		
+		if (!name || !value) continue;
+		if (proxy_isHopByHop(name)) continue;
+		/* the body has already been read, it's sent with a length of our own */
+		if (!strcasecmp(name, "Content-Length")) { gotLength = 1; continue; }
+		if (!strcasecmp(name, "Expect")) continue;
+		if (!strcasecmp(name, "X-Forwarded-For")) { xff = value; continue; }
+		if (!strcasecmp(name, "Host")) gotHost = 1;
+		
+		if (bufcatf(head, "%s: %s\r\n", name, value) <= 0) return HTE_NOMEM;
+	}
+	
+	if (!gotHost) {
+		if (bufcatf(head, "Host: %s\r\n", up->host) <= 0) return HTE_NOMEM;
+	}
+	if (session->addrinfo.ss_family == AF_INET6) {
+		if (inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&session->addrinfo)->sin6_addr, addr, sizeof(addr)) == NULL) strcpy(addr, "unknown");
+	} else {
+		if (inet_ntop(AF_INET, &((struct sockaddr_in *)&session->addrinfo)->sin_addr, addr, sizeof(addr)) == NULL) strcpy(addr, "unknown");
+	}
+	if (bufcatf(head, "X-Forwarded-For: %s%s%s\r\n", xff ? xff : "", xff ? ", " : "", addr) <= 0) return HTE_NOMEM;
+	if (gotLength || req->data.contentLength > 0) {
+		if (bufcatf(head, "Content-Length: %zu\r\n", req->data.contentLength) <= 0) return HTE_NOMEM;
+	}
+	if (bufcatf(head, "\r\n") <= 0) return HTE_NOMEM;
+	
+	return HTE_NONE;
+}
+
+static hte proxy_sendRequest(struct proxy_conn *conn, struct buf *head, unsigned char *body, size_t bodyLen) {
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t l;
+	
+	iov[0].iov_base = head->data;
+	iov[0].iov_len = head->next;
+	iov[1].iov_base = body;
+	iov[1].iov_len = bodyLen;
+	
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = (body && bodyLen > 0) ? 2 : 1;
+	
+	while (msg.msg_iovlen > 0) {
+		if ((l = co_sendmsg(conn->fd, &msg, MSG_NOSIGNAL, conn->timeoutMs)) == -1) {
+			if (errno == EINTR) continue;
+			return HTE_WRITE;
+		}
+		while (l > 0) {
+			if ((size_t)l >= msg.msg_iov->iov_len) {
+				l -= msg.msg_iov->iov_len;
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			} else {
+				msg.msg_iov->iov_base = (unsigned char *)msg.msg_iov->iov_base + l;
+				msg.msg_iov->iov_len -= l;
+				l = 0;
+			}
+		}
+	}
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+/* one more read from the upstream, after making room at the end of the buffer */
+static hte proxy_fill(struct proxy_conn *conn) {
+	ssize_t l;
+	
+	if (conn->pos > 0) {
+		memmove(conn->buf, &conn->buf[conn->pos], conn->end - conn->pos);
+		conn->end -= conn->pos;
+		conn->pos = 0;
+	}
+	if (conn->end == sizeof(conn->buf)) return HTE_PARSE;
+	
+	while ((l = co_recv(conn->fd, &conn->buf[conn->end], sizeof(conn->buf) - conn->end, 0, conn->timeoutMs)) == -1) {
+		if (errno != EINTR) return HTE_READ;
+	}
+	if (l == 0) return HTE_READ;
+	conn->end += l;
+	
+	return HTE_NONE;
+}
+
+/* waits for a whole head at conn->pos, 'headLen' includes the blank line */
+static hte proxy_readHead(struct proxy_conn *conn, size_t *headLen) {
+	unsigned char *e;
+	hte ret;
+	
+	for (;;) {
+		if ((e = memmem(&conn->buf[conn->pos], conn->end - conn->pos, "\r\n\r\n", 4)) != NULL) {
+			*headLen = e + 4 - &conn->buf[conn->pos];
+			return HTE_NONE;
+		}
+		if ((ret = proxy_fill(conn)) != HTE_NONE) return ret;
+	}
+}
+
+static hte proxy_readLine(struct proxy_conn *conn, char **line) {
+	unsigned char *e;
+	hte ret;
+	
+	for (;;) {
+		if ((e = memchr(&conn->buf[conn->pos], '\n', conn->end - conn->pos)) != NULL) {
+			*line = (char *)&conn->buf[conn->pos];
+			*e = '\0';
+			if ((char *)e > *line && e[-1] == '\r') e[-1] = '\0';
+			conn->pos = e + 1 - conn->buf;
+			return HTE_NONE;
+		}
+		if ((ret = proxy_fill(conn)) != HTE_NONE) return ret;
+	}
+}
+
+/* the value is copied into the same allocation as the name, so that session_xferFree() frees both */
+static hte proxy_addHeader(struct http_data *data, char *name, char *value) {
+	size_t nl = strlen(name);
+	size_t vl = strlen(value);
+	char *p;
+	void *q;
+	
+	if ((p = mem_malloc(HTTPD_MEM_INTERFACE, vl + nl + 2)) == NULL) return HTE_NOMEM;
+	memcpy(p, value, vl + 1);
+	memcpy(&p[vl + 1], name, nl + 1);
+	
+	if ((q = mem_realloc(HTTPD_MEM_INTERFACE, data->headers, sizeof(*data->headers) * (data->headerc + 1))) == NULL) {
+		mem_free(p);
+		return HTE_NOMEM;
+	}
+	data->headers = q;
+	
+	data->headers[data->headerc].name = (unsigned char *)&p[vl + 1];
+	data->headers[data->headerc].value = (unsigned char *)p;
+	data->headers[data->headerc].valueFree = 1;
+	data->headerc++;
+	
+	return HTE_NONE;
+}
+
+/* takes the response's headers back to how they were before proxy_parseHead() */
+static void proxy_dropHeaders(struct http_data *data, int headerc) {
+	while (data->headerc > headerc) {
+		data->headerc--;
+		mem_free(data->headers[data->headerc].value);
+	}
+}
+
+/* 'h' is a whole head from proxy_readHead(), the headers are added to the response for all but 1xx */
+static hte proxy_parseHead(struct session_info *session, char *h, struct proxy_head *ph) {
+	char *line, *next, *value, *e;
+	int minor;
+	hte ret;
+	
+	memset(ph, 0, sizeof(*ph));
+	
+	/* the blank line at the end means every strstr() below stops inside the head */
+	if ((next = strstr(h, "\r\n")) == NULL) return HTE_PARSE;
+	*next = '\0';
+	if (sscanf(h, "HTTP/1.%d %3d", &minor, &ph->code) != 2) return HTE_PARSE;
+	if (ph->code < 100 || ph->code > 999) return HTE_PARSE;
+	ph->keepAlive = minor >= 1;
+	
+	for (line = next + 2; *line != '\r'; line = next + 2) {
+		if ((next = strstr(line, "\r\n")) == NULL) return HTE_PARSE;
+		*next = '\0';
+		
+		if ((value = strchr(line, ':')) == NULL) return HTE_PARSE;
+		*(value++) = '\0';
+		while (*value == ' ' || *value == '\t') value++;
+		for (e = next; e > value && (e[-1] == ' ' || e[-1] == '\t'); e--);
+		*e = '\0';
+		
+		if (!strcasecmp(line, "Content-Length")) {
+			if (sscanf(value, "%llu", &ph->length) != 1) return HTE_PARSE;
+			ph->haveLength = 1;
+		} else if (!strcasecmp(line, "Transfer-Encoding")) {
+			/* anything else (chunked or not) runs until the upstream closes */
+			ph->chunked = strcasestr(value, "chunked") != NULL;
+			ph->haveLength = -1;
+		} else if (!strcasecmp(line, "Connection")) {
+			if (strcasestr(value, "close")) ph->keepAlive = 0;
+			else if (strcasestr(value, "keep-alive")) ph->keepAlive = 1;
+		}
+		
+		if (ph->code < 200 || proxy_isHopByHop(line)) continue;
+		if ((ret = proxy_addHeader(&session->xfer.response->data, line, value)) != HTE_NONE) return ret;
+	}
+	if (ph->haveLength == -1) ph->haveLength = 0;
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+static hte proxy_emit(struct session_info *session, int direct, unsigned char *data, size_t len) {
+	hte ret;
+	
+	if (direct) return session_send(session, data, len);
+	
+	/* HTTP/2 or userspace TLS, everything goes through the response */
+	if ((ret = httpd_nrespond(session, (char *)data, len)) != HTE_NONE) return ret;
+	return httpd_flush(session);
+}
+
+static hte proxy_splice(struct httpd_proxy *proxy, struct proxy_conn *conn, int out, unsigned long long len, int toEOF) {
+	ssize_t n, m;
+	size_t want;
+	
+	while (toEOF || len > 0) {
+		want = PROXY_PIPE_SIZE;
+		if (!toEOF && want > len) want = len;
+		
+		if ((n = splice(conn->fd, NULL, conn->pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE)) == -1) {
+			if (errno == EINTR) continue;
+			return HTE_READ;
+		}
+		if (n == 0) return toEOF ? HTE_NONE : HTE_READ;
+		if (!toEOF) len -= n;
+		
+		while (n > 0) {
+			if ((m = splice(conn->pipe[0], NULL, out, NULL, n, SPLICE_F_MOVE | ((toEOF || len > 0) ? SPLICE_F_MORE : 0))) == -1) {
+				if (errno == EINTR) continue;
+				return HTE_WRITE;
+			}
+			n -= m;
+			__sync_fetch_and_add(&proxy->spliced, m);
+		}
+	}
+	
+	return HTE_NONE;
+}
+
+/* 'len' bytes of body (or all of it, to EOF) from the upstream to the client */
+static hte proxy_copy(struct httpd_proxy *proxy, struct proxy_conn *conn, struct session_info *session, int direct, unsigned long long len, int toEOF) {
+	size_t n;
+	hte ret;
+	
+	while (toEOF || len > 0) {
+		if (conn->pos == conn->end) {
+			conn->pos = conn->end = 0;
+			
+			/* nothing is buffered, so the rest can go from socket to socket without coming up here */
+			if (direct && !co_active() && (conn->pipe[0] != -1 || pipe2(conn->pipe, O_CLOEXEC) == 0)) {
+				return proxy_splice(proxy, conn, session->fd, len, toEOF);
+			}
+			
+			if ((ret = proxy_fill(conn)) != HTE_NONE) return (toEOF && ret == HTE_READ) ? HTE_NONE : ret;
+		}
+		
+		n = conn->end - conn->pos;
+		if (!toEOF && n > len) n = len;
+		if ((ret = proxy_emit(session, direct, &conn->buf[conn->pos], n)) != HTE_NONE) return ret;
+		conn->pos += n;
+		if (!toEOF) len -= n;
+	}
+	
+	return HTE_NONE;
+}
+
+static hte proxy_chunked(struct httpd_proxy *proxy, struct proxy_conn *conn, struct session_info *session, int direct) {
+	unsigned long long size;
+	char *line, *e;
+	hte ret;
+	
+	for (;;) {
+		if ((ret = proxy_readLine(conn, &line)) != HTE_NONE) return ret;
+		size = strtoull(line, &e, 16);
+		if (e == line) return HTE_PARSE;
+		if (size == 0) break;
+		
+		if ((ret = proxy_copy(proxy, conn, session, direct, size, 0)) != HTE_NONE) return ret;
+		
+		if ((ret = proxy_readLine(conn, &line)) != HTE_NONE) return ret;
+		if (line[0] != '\0') return HTE_PARSE;
+	}
+	
+	/* trailers are dropped, the client's response isn't chunked */
+	do {
+		if ((ret = proxy_readLine(conn, &line)) != HTE_NONE) return ret;
+	} while (line[0] != '\0');
+	
+	return HTE_NONE;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_proxyCreate(struct httpd_proxy **_proxy, int poolSize, int timeout) {
+	struct httpd_proxy *proxy;
+	
+	if (!_proxy || poolSize < 0 || timeout < 0) return HTE_INVALPARAM;
+	
+	if ((proxy = mem_malloc(HTTPD_MEM_OTHER, sizeof(*proxy))) == NULL) return HTE_NOMEM;
+	memset(proxy, 0, sizeof(*proxy));
+	proxy->poolSize = poolSize;
+	proxy->timeout = timeout;
+	pthread_mutex_init(&proxy->mutex, NULL);
+	
+	*_proxy = proxy;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_proxyAddUpstream(struct httpd_proxy *proxy, char *address) {
+	struct proxy_upstream *up, **p;
+	
+	if (!proxy || !address) return HTE_INVALPARAM;
+	
+	if ((up = mem_malloc(HTTPD_MEM_OTHER, sizeof(*up) + strlen(address))) == NULL) return HTE_NOMEM;
+	memset(up, 0, sizeof(*up));
+	
+	if (!strncmp(address, "unix:", 5)) {
+		struct sockaddr_un *un = (struct sockaddr_un *)&up->addr;
+		
+		if (address[5] == '\0' || strlen(&address[5]) >= sizeof(un->sun_path)) goto inval;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, &address[5]);
+		up->addrlen = sizeof(*un);
+		strcpy(up->host, "localhost");
+	} else {
+		struct addrinfo hints, *ai;
+		char *host, *port;
+		size_t l;
+		
+		/* "host:port", or "[v6]:port" */
+		if ((port = strrchr(address, ':')) == NULL || port[1] == '\0') goto inval;
+		strcpy(up->host, address);
+		host = up->host;
+		host[port - address] = '\0';
+		port++;
+		if (host[0] == '[' && (l = strlen(host)) > 2 && host[l - 1] == ']') {
+			host[l - 1] = '\0';
+			host++;
+		}
+		
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host, port, &hints, &ai) != 0) {
+			mem_free(up);
+			return HTE_SOCK;
+		}
+		memcpy(&up->addr, ai->ai_addr, ai->ai_addrlen);
+		up->addrlen = ai->ai_addrlen;
+		freeaddrinfo(ai);
+		
+		strcpy(up->host, address);
+	}
+	
+	pthread_mutex_lock(&proxy->mutex);
+	for (p = &proxy->upstreams; *p; p = &(*p)->next);
+	*p = up;
+	proxy->upstreamc++;
+	pthread_mutex_unlock(&proxy->mutex);
+	
+	return HTE_NONE;
+inval:
+	mem_free(up);
+	return HTE_INVALPARAM;
+}
+
+EXPORT hte httpd_proxyForward(struct session_info *session, struct httpd_proxy *proxy) {
+	struct http_response *rsp;
+	struct proxy_upstream *up;
+	struct proxy_conn *conn;
+	struct proxy_head ph;
+	struct buf *head = NULL;
+	size_t headLen;
+	int tries, reused, direct, headerc;
+	hte ret;
+	
+	if (!session || !proxy || !session->xfer.request || !session->xfer.response) return HTE_INVALPARAM;
+	rsp = session->xfer.response;
+	if (rsp->flushed) return HTE_INVALPARAM;
+	
+	/* httpd_setMultipart() has taken the body apart as it came in, there's none left to pass on */
+	if (session->xfer.request->multipart) {
+		httpd_setHttpCode(session, 500, NULL);
+		return httpd_respond(session, "Internal Server Error\n");
+	}
+	
+	__sync_fetch_and_add(&proxy->requests, 1);
+	
+	for (tries = 0; ; tries++) {
+		/* each stale pooled connection, and each upstream that can't be reached, costs another go */
+		if (tries > proxy->poolSize + proxy->upstreamc) goto badGateway;
+		if ((up = proxy_pick(proxy)) == NULL) goto badGateway;
+		
+		reused = 1;
+		if ((conn = proxy_idle(proxy, up)) == NULL) {
+			reused = 0;
+			if ((conn = proxy_connect(proxy, up)) == NULL) {
+				proxy_release(proxy, up, NULL, 0, 1);
+				continue;
+			}
+		}
+		
+		if (head) head->next = 0;
+		if ((ret = proxy_buildRequest(session, up, &head)) != HTE_NONE) goto die;
+		
+		if (proxy_sendRequest(conn, head, session->xfer.request->data.content, session->xfer.request->data.contentLength) == HTE_NONE &&
+		    proxy_readHead(conn, &headLen) == HTE_NONE) break;
+		
+		/* the upstream may have closed a pooled connection just as we took it, and it's
+		   seen nothing of the request if nothing came back, so it's safe to go again */
+		reused = reused && conn->end == 0;
+		proxy_release(proxy, up, conn, 0, 0);
+		if (!reused) goto badGateway;
+	}
+	buf_free(head);
+	head = NULL;
+	
+	for (;;) {
+		headerc = rsp->data.headerc;
+		if (proxy_parseHead(session, (char *)&conn->buf[conn->pos], &ph) != HTE_NONE) {
+			proxy_dropHeaders(&rsp->data, headerc);
+			goto failed;
+		}
+		conn->pos += headLen;
+		if (ph.code >= 200) break;
+		
+		/* 1xx are passed over, and nothing was asked to switch protocols */
+		if (ph.code == 101) goto failed;
+		if (proxy_readHead(conn, &headLen) != HTE_NONE) goto failed;
+	}
+	
+	httpd_setHttpCode(session, ph.code, NULL);
+	
+	/* the body is sent (or spliced) as the upstream sent it, so it mustn't be announced as compressed */
+	rsp->direct = 1;
+	
+	/* splice() can't be asked not to raise SIGPIPE, and this thread is only serving this client */
+	if ((direct = !session->h2 && (!session->tls || session->tls->ktlsSend)) != 0) {
+		sigset_t set;
+		sigemptyset(&set);
+		sigaddset(&set, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &set, NULL);
+	}
+	
+	/* the head goes now, and the body straight after it */
+	if ((ret = httpd_flush(session)) != HTE_NONE) goto die;
+	
+	if (!strcmp((char *)session->xfer.request->method, "HEAD") || ph.code == 204 || ph.code == 304) {
+		ret = HTE_NONE;
+	} else if (ph.chunked) {
+		ret = proxy_chunked(proxy, conn, session, direct);
+	} else if (ph.haveLength) {
+		ret = proxy_copy(proxy, conn, session, direct, ph.length, 0);
+	} else {
+		ph.keepAlive = 0;
+		ret = proxy_copy(proxy, conn, session, direct, 0, 1);
+	}
+	
+	/* anything left over would be taken as the start of the next response */
+	proxy_release(proxy, up, conn, ret == HTE_NONE && ph.keepAlive && conn->pos == conn->end, 0);
+	
+	return ret;
+failed:
+	proxy_release(proxy, up, conn, 0, 0);
+badGateway:
+	if (head) buf_free(head);
+	__sync_fetch_and_add(&proxy->failures, 1);
+	httpd_setHttpCode(session, 502, NULL);
+	return httpd_respond(session, "Bad Gateway\n");
+die:
+	if (head) buf_free(head);
+	proxy_release(proxy, up, conn, 0, 0);
+	return ret;
+}
+
+EXPORT hte httpd_proxyGetStats(struct httpd_proxy *proxy, struct httpd_proxyStats *stats) {
+	if (!proxy || !stats) return HTE_INVALPARAM;
+	
+	stats->requests = proxy->requests;
+	stats->connects = proxy->connects;
+	stats->reused = proxy->reused;
+	stats->failures = proxy->failures;
+	stats->spliced = proxy->spliced;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,76 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* reverse proxy - httpd_proxyForward() sends the request to the upstream with the fewest
+   requests in flight, over a keep-alive connection from that upstream's pool if there is
+   one, and the response body is spliced straight from the upstream's socket to the client's
+   whenever the client's socket can be written to directly
+   from a coroutine the upstream is waited for with co_*(), and the body is copied rather than
+   spliced, since splice() would block the loop */
+
+#include <sys/socket.h>
+
+#define PROXY_BUF_SIZE  16384 /* the upstream's head must fit in this */
+#define PROXY_PIPE_SIZE 65536 /* most that's spliced in one go */
+#define PROXY_RETRY     1     /* seconds an upstream is passed over for after a failed connect */
+
+struct proxy_conn {
+	struct proxy_conn *next;
+	int fd;
+	int timeoutMs;
+	int pipe[2]; /* for splice(), made the first time it's needed */
+	
+	/* read from the upstream, but not used yet */
+	size_t pos;
+	size_t end;
+	unsigned char buf[PROXY_BUF_SIZE];
+};
+
+struct proxy_upstream {
+	struct proxy_upstream *next;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	
+	int active;      /* requests in flight */
+	time_t downUntil;
+	struct proxy_conn *idle;
+	int idlec;
+	
+	char host[1];    /* sent as Host: if the client didn't send one */
+};
+
+struct httpd_proxy {
+	pthread_mutex_t mutex; /* the upstream list, and everything in it */
+	int poolSize;
+	int timeout;
+	struct proxy_upstream *upstreams;
+	struct proxy_upstream *last; /* the search starts after this, so equally loaded upstreams take turns */
+	int upstreamc;
+	
+	unsigned long long requests;
+	unsigned long long connects;
+	unsigned long long reused;
+	unsigned long long failures;
+	unsigned long long spliced;
+};
+
+#endif /* PROXY_H */
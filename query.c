@@ -0,0 +1,155 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "http.h"
+#include "query.h"
+#include "mem.h"
+
+/* compares a name in the buffer with the one that was asked for, decoding as it goes */
+static int query_match(const unsigned char *s, size_t len, const char *name) {
+	unsigned char c, h, l;
+	size_t i;
+	
+	for (i = 0; i < len; i++, name++) {
+		c = s[i];
+		if (c == '+') {
+			c = ' ';
+		} else if (c == '%' && len - i >= 3 && (h = asc2bin(s[i + 1])) != 0xFF && (l = asc2bin(s[i + 2])) != 0xFF) {
+			c = (h << 4) | l;
+			i += 2;
+		}
+		if (*name == '\0' || c != (unsigned char)*name) return 0;
+	}
+	
+	return *name == '\0';
+}
+
+struct query *query_index(unsigned char *s, size_t len) {
+	struct query *q;
+	struct query_param *p;
+	unsigned char *e, *amp, *eq;
+	int n;
+	
+	/* there can't be more parameters than there are '&'s, and one */
+	for (n = 1, e = s; (amp = memchr(e, '&', len - (e - s))) != NULL; e = amp + 1) n++;
+	
+	if ((q = mem_malloc(HTTPD_MEM_HTTP, sizeof(*q) + (sizeof(*q->params) * n) + len + n)) == NULL) return NULL;
+	q->paramc = 0;
+	q->params = (void *)&q[1];
+	q->spare = (char *)&q->params[n];
+	q->spareUsed = 0;
+	
+	for (e = s; e < s + len; e = amp + 1) {
+		if ((amp = memchr(e, '&', len - (e - s))) == NULL) amp = s + len;
+		if (amp == e) continue; /* "a&&b" */
+		
+		p = &q->params[q->paramc++];
+		p->name = e;
+		p->decoded = NULL;
+		if ((eq = memchr(e, '=', amp - e)) == NULL) {
+			p->nameLen = amp - e;
+			p->value = NULL;
+			p->valueLen = 0;
+		} else {
+			p->nameLen = eq - e;
+			p->value = eq + 1;
+			p->valueLen = amp - p->value;
+		}
+	}
+	
+	return q;
+}
+
+/* the first parameter called 'name', decoded the first time it's asked for */
+char *query_get(struct query *q, char *name) {
+	struct query_param *p;
+	int i;
+	
+	for (i = 0; i < q->paramc; i++) {
+		p = &q->params[i];
+		if (!query_match(p->name, p->nameLen, name)) continue;
+		
+		if (p->decoded) return p->decoded;
+		p->decoded = &q->spare[q->spareUsed];
+		if (p->value) q->spareUsed += http_unescape((unsigned char *)p->decoded, p->value, p->valueLen, HTTP_UNESCAPE_PLUS);
+		q->spare[q->spareUsed++] = '\0';
+		
+		return p->decoded;
+	}
+	
+	return NULL;
+}
+
+void query_free(struct query *q) {
+	mem_free(q);
+}
+
+/* ########################################################################## */
+
+EXPORT char *httpd_getQuery(struct session_info *session) {
+	struct http_request *req;
+	
+	if (!session) return NULL;
+	req = session->xfer.request;
+	if (!req->queryAt) return NULL;
+	
+	return (char *)&req->uri[req->queryAt];
+}
+
+EXPORT char *httpd_getQueryParam(struct session_info *session, char *name) {
+	struct http_request *req;
+	unsigned char *s;
+	
+	if (!session || !name) return NULL;
+	req = session->xfer.request;
+	if (!req->queryAt) return NULL;
+	
+	if (!req->query) {
+		s = &req->uri[req->queryAt];
+		if ((req->query = query_index(s, strlen((char *)s))) == NULL) return NULL;
+	}
+	
+	return query_get(req->query, name);
+}
+
+EXPORT char *httpd_getFormParam(struct session_info *session, char *name) {
+	struct http_request *req;
+	char *type;
+	
+	if (!session || !name) return NULL;
+	req = session->xfer.request;
+	
+	if (!req->form) {
+		/* a multipart body has gone by now, its fields are in httpd_getPart() */
+		if (!req->data.content || req->data.contentLength == 0) return NULL;
+		if ((type = httpd_getHeader(session, "Content-Type")) == NULL || strncasecmp(type, "application/x-www-form-urlencoded", 33)) return NULL;
+		if ((req->form = query_index(req->data.content, req->data.contentLength)) == NULL) return NULL;
+	}
+	
+	return query_get(req->form, name);
+}
@@ -0,0 +1,47 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* the parameters of a query string, or of an application/x-www-form-urlencoded body - indexed the first time
+   one's asked for, as slices of the request's buffer, and a value is only decoded once it's asked for
+   (into space that comes with the index, which is as big as what it indexes, so nothing is allocated after) */
+
+struct query_param {
+	unsigned char *name;
+	size_t nameLen;
+	unsigned char *value; /* NULL for "?a", as opposed to "?a=" */
+	size_t valueLen;
+	char *decoded;
+};
+
+struct query {
+	int paramc;
+	struct query_param *params;
+	
+	char *spare; /* what the decoded values are carved from */
+	size_t spareUsed;
+};
+
+struct query *query_index(unsigned char *s, size_t len);
+char *query_get(struct query *q, char *name);
+void query_free(struct query *q);
+
+#endif /* QUERY_H */
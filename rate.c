@@ -0,0 +1,246 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "rate.h"
+#include "mem.h"
+#include "mono.h"
+
+/* for a connection turned away before anything is read */
+static const char rate_429[] =
+	"HTTP/1.1 429 Too Many Requests\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 18\r\n"
+	"Retry-After: 1\r\n"
+	"Connection: close\r\n"
+	"\r\n"
+	"Too Many Requests\n";
+
+static uint32_t rate_now(void) {
+	/* it wraps every 49 days, which only matters to a bucket that's been left that long, and it's full by then */
+	uint32_t now = (uint32_t)mono_ms();
+	
+	return now ? now : 1;
+}
+
+static uint64_t rate_mix(uint64_t k) {
+	/* MurmurHash3's finaliser */
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+/* 0 for an address that can't be limited */
+static uint64_t rate_key(struct rate_info *rate, struct session_info *session) {
+	struct sockaddr *sa = (struct sockaddr *)&session->addrinfo;
+	unsigned char a[16];
+	uint64_t h, w[2];
+	int bits, i;
+	
+	memset(a, 0, sizeof(a));
+	if (sa->sa_family == AF_INET) {
+		memcpy(a, &((struct sockaddr_in *)sa)->sin_addr, 4);
+		bits = rate->v4Prefix;
+		h = 4;
+	} else if (sa->sa_family == AF_INET6 && session->addrlen >= sizeof(struct sockaddr_in6)) {
+		struct in6_addr *in6 = &((struct sockaddr_in6 *)sa)->sin6_addr;
+		if (IN6_IS_ADDR_V4MAPPED(in6)) {
+			memcpy(a, &in6->s6_addr[12], 4);
+			bits = rate->v4Prefix;
+			h = 4;
+		} else {
+			memcpy(a, in6->s6_addr, 16);
+			bits = rate->v6Prefix;
+			h = 6;
+		}
+	} else {
+		return 0;
+	}
+	
+	/* only the prefix counts */
+	for (i = 0; i < 16; i++) {
+		if (bits >= 8) {
+			bits -= 8;
+			continue;
+		}
+		a[i] &= (unsigned char)(0xff00 >> bits);
+		bits = 0;
+	}
+	
+	memcpy(w, a, sizeof(w));
+	h = rate_mix(h ^ w[0]);
+	h = rate_mix(h ^ w[1]);
+	
+	return h ? h : 1;
+}
+
+/* 'now' is read before the probe, so another thread may already have stamped the bucket later -
+   a stamp up to a minute ahead is no time at all, rather than 49 days of it */
+static uint32_t rate_elapsed(uint32_t stamp, uint32_t now) {
+	return (uint32_t)(stamp - now) < 60000 ? 0 : now - stamp;
+}
+
+static uint32_t rate_tokens(struct rate_info *rate, uint64_t state, uint32_t now) {
+	uint64_t tokens;
+	
+	if (state == 0) return rate->burst;
+	
+	tokens = (uint32_t)state + (uint64_t)rate_elapsed((uint32_t)(state >> 32), now) * rate->perSecond;
+	return tokens > rate->burst ? rate->burst : (uint32_t)tokens;
+}
+
+static int rate_take(struct rate_info *rate, struct rate_slot *slot, uint32_t now) {
+	uint64_t old, new;
+	uint32_t tokens, stamp;
+	
+	do {
+		old = *(volatile uint64_t *)&slot->state;
+		if ((tokens = rate_tokens(rate, old, now)) < 1000) return 0;
+		
+		/* the stamp only ever moves forward */
+		stamp = (uint32_t)(old >> 32);
+		if (old == 0 || rate_elapsed(stamp, now) > 0) stamp = now;
+		new = ((uint64_t)stamp << 32) | (tokens - 1000);
+	} while (!__sync_bool_compare_and_swap(&slot->state, old, new));
+	
+	return 1;
+}
+
+int rate_allow(struct rate_info *rate, struct session_info *session) {
+	struct rate_slot *slot, *spent = NULL;
+	uint64_t key, k;
+	uint32_t now;
+	int i;
+	
+	if ((key = rate_key(rate, session)) == 0) return 1;
+	now = rate_now();
+	
+	for (i = 0; i < RATE_PROBES; i++) {
+		slot = &rate->slots[(key + i) & (RATE_SLOTS - 1)];
+		
+		if ((k = *(volatile uint64_t *)&slot->key) == key) goto take;
+		if (k == 0) {
+			/* someone else may have just taken it, for this address too */
+			if (__sync_bool_compare_and_swap(&slot->key, 0, key) || slot->key == key) goto take;
+			continue;
+		}
+		if (!spent && rate_tokens(rate, *(volatile uint64_t *)&slot->state, now) == rate->burst) spent = slot;
+	}
+	
+	/* a bucket that's filled up again can go to this address, a request still being counted
+	   against the old one might land in the new one, but only ever as one token */
+	if (spent && (k = spent->key) != key && __sync_bool_compare_and_swap(&spent->key, k, key)) {
+		spent->state = 0;
+		__sync_fetch_and_add(&rate->evictions, 1);
+		slot = spent;
+		goto take;
+	}
+	
+	/* nowhere to count it, so it goes uncounted rather than refused */
+	__sync_fetch_and_add(&rate->untracked, 1);
+	return 1;
+take:
+	if (rate_take(rate, slot, now)) return 1;
+	__sync_fetch_and_add(&rate->limited, 1);
+	return 0;
+}
+
+hte rate_refuse(struct session_info *session) {
+	hte ret;
+	
+	httpd_setHttpCode(session, 429, NULL);
+	if ((ret = httpd_addHeader(session, "Retry-After", "1")) != HTE_NONE) return ret;
+	return httpd_respond(session, "Too Many Requests\n");
+}
+
+void rate_refuseConnection(struct session_info *session) {
+	/* nothing is spoken on a TLS listener until the handshake, so it's only closed */
+	if (!session->httpd->tls) send(session->fd, rate_429, sizeof(rate_429) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+	shutdown(session->fd, SHUT_RDWR);
+	close(session->fd);
+	session->fd = -1;
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setRateLimit(struct httpd_info *httpd, int perSecond, int burst, int v4Prefix, int v6Prefix, int where) {
+	struct rate_info *rate;
+	
+	if (!httpd || perSecond < 1 || burst < 1 || burst > 4000000) return HTE_INVALPARAM;
+	if (v4Prefix < 0 || v4Prefix > 32 || v6Prefix < 0 || v6Prefix > 128) return HTE_INVALPARAM;
+	if ((where & ~(HTTPD_RATE_ACCEPT | HTTPD_RATE_REQUEST)) != 0) return HTE_INVALPARAM;
+	
+	if ((rate = httpd->rate) != NULL) {
+		/* the buckets are kept, and fill or drain to the new limits as they're next used */
+		rate->perSecond = perSecond;
+		rate->burst = burst * 1000;
+		rate->v4Prefix = v4Prefix;
+		rate->v6Prefix = v6Prefix;
+		rate->where = where;
+		return HTE_NONE;
+	}
+	
+	if ((rate = mem_malloc(HTTPD_MEM_SERVER, sizeof(*rate))) == NULL) return HTE_NOMEM;
+	memset(rate, 0, sizeof(*rate));
+	if ((rate->slots = mem_malloc(HTTPD_MEM_SERVER, sizeof(*rate->slots) * RATE_SLOTS)) == NULL) {
+		mem_free(rate);
+		return HTE_NOMEM;
+	}
+	memset(rate->slots, 0, sizeof(*rate->slots) * RATE_SLOTS);
+	rate->perSecond = perSecond;
+	rate->burst = burst * 1000;
+	rate->v4Prefix = v4Prefix;
+	rate->v6Prefix = v6Prefix;
+	rate->where = where;
+	
+	__sync_synchronize();
+	httpd->rate = rate;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_getRateStats(struct httpd_info *httpd, struct httpd_rateStats *stats) {
+	struct rate_info *rate;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((rate = httpd->rate) == NULL) return HTE_NONE;
+	
+	stats->limited = rate->limited;
+	stats->evictions = rate->evictions;
+	stats->untracked = rate->untracked;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,61 @@
+#ifndef RATE_H
+#define RATE_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* per-client rate limiting - a token bucket for each client address (or prefix of one), in a
+   fixed table that's open-addressed and lock-free: a bucket is a single word holding its tokens
+   and when it was last touched, refilled lazily and taken from with a CAS
+   slots are never emptied, a bucket that would be full again is as good as a new one, so it's
+   handed to the next address that wants a slot near it */
+
+#include <stdint.h>
+
+struct session_info;
+
+#define RATE_SLOTS  65536 /* must be a power of two */
+#define RATE_PROBES 8     /* slots looked at before giving up, and letting the client through */
+
+struct rate_slot {
+	uint64_t key;   /* a hash of the address, 0 while the slot has never been used */
+	uint64_t state; /* ms the tokens were last counted at << 32 | thousandths of a token, 0 for full */
+};
+
+struct rate_info {
+	struct rate_slot *slots;
+	int perSecond;
+	unsigned int burst; /* in thousandths */
+	int v4Prefix;
+	int v6Prefix;
+	int where;
+	
+	unsigned long long limited;
+	unsigned long long evictions;
+	unsigned long long untracked;
+};
+
+/* 0 if the session's client has run out of tokens */
+int rate_allow(struct rate_info *rate, struct session_info *session);
+/* answers a request that wasn't allowed in place of the callback */
+hte rate_refuse(struct session_info *session);
+/* for a connection that wasn't allowed, before anything has been read */
+void rate_refuseConnection(struct session_info *session);
+
+#endif /* RATE_H */
@@ -129,6 +129,9 @@ struct page {
 	size_t contentLength;
 	char *mimeType;
 	
+	/* static content is shared between every response, rather than copied into each */
+	struct httpd_body *body;
+	
 } pageList[] = {
 	{ "/",            page_index },
 	{ "/post",        page_post  },
@@ -158,9 +161,7 @@ int client_callback(int rxid, struct session_info *session, char *content, int c
 		/* otherwise use static content */
 		} else if (pageList[i].content != NULL && pageList[i].contentLength > 0) {
 			if (pageList[i].mimeType != NULL) httpd_addHeader(session, "Content-Type", "%s", pageList[i].mimeType);
-			httpd_addHeader(session, "Content-Length", "%d", pageList[i].contentLength);
-			httpd_flush(session);
-			httpd_nrespond(session, pageList[i].content, pageList[i].contentLength);
+			httpd_respondBody(session, pageList[i].body);
 			
 		/* otherwise it's not implemented! (501 - uri is registerd, but has no content) */
 		} else {
@@ -180,6 +181,12 @@ int client_callback(int rxid, struct session_info *session, char *content, int c
 int main(int argc, char *argv[]) {
 	struct httpd_info *httpd;
 	hte ret;
+	int i;
+	
+	for (i = 0; i < sizeof(pageList) / sizeof(*pageList); i++) {
+		if (pageList[i].content == NULL) continue;
+		pageList[i].body = httpd_bodyCreate(pageList[i].content, pageList[i].contentLength, NULL, NULL);
+	}
 
 	if ((ret = httpd_startServer(&httpd, 8080, client_callback)) != HTE_NONE) {
 		printf("httpd_startServer() returned %d\n", ret);
@@ -33,6 +33,11 @@
 #include "interface.h"
 #include "server.h"
 #include "session.h"
+#include "trace.h"
+#include "tls.h"
+#include "pool.h"
+#include "rate.h"
+#include "mem.h"
 
 int srv_listenStart(struct httpd_info *httpd) {
 	hte ret = HTE_NONE;
@@ -43,9 +48,14 @@ int srv_listenStart(struct httpd_info *httpd) {
 	
 	if (httpd->listenPort < 1 || httpd->listenPort > 65535) return HTE_INVALPARAM;
 	
+	/* load the certificate before there's anyone to hand it to */
+	if (httpd->tlsCert && !httpd->tls) {
+		if ((ret = tls_serverStart(httpd)) != HTE_NONE) return ret;
+	}
+	
 	/* get some memory */
 	if (!httpd->listen) {
-		if ((httpd->listen = malloc(sizeof(*httpd->listen))) == NULL) { ret = HTE_NOMEM; goto die; }
+		if ((httpd->listen = mem_malloc(HTTPD_MEM_SERVER, sizeof(*httpd->listen))) == NULL) { ret = HTE_NOMEM; goto die; }
 		httpd->listen->fd = -1;
 	}
 	
@@ -77,7 +87,7 @@ die:
 			close(listen->fd);
 		}
 		
-		free(httpd->listen);
+		mem_free(listen);
 	}
 	return ret;
 }
@@ -92,7 +102,7 @@ void *srv_listenThread(void *_httpd) {
 	
 	for (;;) {
 		if (!session) {
-			if ((session = malloc(sizeof(*session))) == NULL) { ret = HTE_NOMEM; break; }
+			if ((session = mem_malloc(HTTPD_MEM_SESSION, sizeof(*session))) == NULL) { ret = HTE_NOMEM; break; }
 			memset(session, 0, sizeof(*session));
 			session->httpd = httpd;
 		}
@@ -116,6 +126,19 @@ void *srv_listenThread(void *_httpd) {
 			break;
 		}
 		
+		if (httpd->rate && (httpd->rate->where & HTTPD_RATE_ACCEPT) && !rate_allow(httpd->rate, session)) {
+			rate_refuseConnection(session);
+			continue;
+		}
+		
+		TRACE(accept, HTTPD_TRACE_ACCEPT, session);
+		
+		if (httpd->pool) {
+			pool_accept(httpd->pool, session);
+			session = NULL;
+			continue;
+		}
+		
 		if (pthread_create(&session->tid, NULL, session_handleConnection, (void*)session) != 0) {
 			fprintf(stderr, "%s:%d %s(): pthread_create() returned an error...\n\tpthread_create(): %d: '%s'\n",
 			        __FILE__, __LINE__, __FUNCTION__, errno, strerror(errno));
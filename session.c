@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <pthread.h>
 
 #include "internal.h"
@@ -28,62 +29,114 @@
 #include "interface.h"
 #include "http.h"
 #include "buf.h"
+#include "h2.h"
+#include "ws.h"
+#include "sse.h"
+#include "tls.h"
+#include "defer.h"
+#include "co.h"
+#include "rate.h"
+#include "trace.h"
+#include "capture.h"
+#include "limit.h"
+#include "cache.h"
+#include "gzip.h"
+#include "multipart.h"
+#include "query.h"
+#include "mem.h"
 
-void *session_handleConnection(void *_session) {
-	char err_buf[] = "HTTP/1.1 500 Internal Server Error\r\n";
-	struct session_info *session = _session;
-	struct httpd_info *httpd;
-	hte ret = HTE_NONE;
+/* 'flags' are lost on userspace TLS */
+ssize_t session_recv(struct session_info *session, void *buf, size_t len, int flags) {
+	if (session->tls && !session->tls->ktlsRecv) return tls_recv(session, buf, len);
+	return recv(session->fd, buf, len, flags);
+}
+
+hte session_send(struct session_info *session, void *data, size_t len) {
+	unsigned char *p = data;
+	ssize_t l;
 	
-	pthread_detach(pthread_self());
+	while (len > 0) {
+		if (session->tls && !session->tls->ktlsSend) {
+			l = tls_send(session, p, len);
+		} else {
+			/* a coroutine gives the loop back while the socket is full */
+			l = co_send(session->fd, p, len, MSG_NOSIGNAL, 0);
+		}
+		if (l <= 0) return HTE_WRITE;
+		p += l;
+		len -= l;
+	}
 	
-	if (!session || !session->httpd) return (void*)-1;
-	httpd = session->httpd;
+	return HTE_NONE;
+}
+
+/* as session_send(), for pieces that are gathered into each write - 'iov' is used up as it goes */
+hte session_sendv(struct session_info *session, struct iovec *iov, int iovc) {
+	struct msghdr msg;
+	ssize_t l;
+	
+	/* records are built from one piece at a time anyway */
+	if (session->tls && !session->tls->ktlsSend) {
+		for (; iovc > 0; iov++, iovc--) {
+			if (session_send(session, iov->iov_base, iov->iov_len) != HTE_NONE) return HTE_WRITE;
+		}
+		return HTE_NONE;
+	}
+	
+	while (iovc > 0) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovc;
+		if ((l = co_sendmsg(session->fd, &msg, MSG_NOSIGNAL, 0)) <= 0) return HTE_WRITE;
+		
+		for (; iovc > 0 && (size_t)l >= iov->iov_len; iov++, iovc--) l -= iov->iov_len;
+		if (iovc > 0) {
+			iov->iov_base = (unsigned char *)iov->iov_base + l;
+			iov->iov_len -= l;
+		}
+	}
+	
+	return HTE_NONE;
+}
+
+/* a short canned answer (a refusal, a timeout, a 100 Continue) - the thread pools' sockets must not
+   block the loop, so it goes without waiting, and being small it fits in the socket's buffer */
+hte session_answer(struct session_info *session, const void *data, size_t len) {
+	if (session->tls) return session_send(session, (void *)data, len);
+	if (send(session->fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len) return HTE_WRITE;
 	
+	return HTE_NONE;
+}
+
+hte session_xferAlloc(struct session_info *session) {
 	if (!session->xfer.request) {
-		if ((session->xfer.request = malloc(sizeof(*session->xfer.request))) == NULL) { ret = HTE_NOMEM; goto die; }
+		if ((session->xfer.request = mem_malloc(HTTPD_MEM_SESSION, sizeof(*session->xfer.request))) == NULL) return HTE_NOMEM;
 		memset(session->xfer.request, 0, sizeof(*session->xfer.request));
 	}
 	
 	if (!session->xfer.response) {
-		if ((session->xfer.response = malloc(sizeof(*session->xfer.response))) == NULL) { ret = HTE_NOMEM; goto die; }
+		if ((session->xfer.response = mem_malloc(HTTPD_MEM_SESSION, sizeof(*session->xfer.response))) == NULL) return HTE_NOMEM;
 		memset(session->xfer.response, 0, sizeof(*session->xfer.response));
 	}
 	
-	/* read request */
-	if (http_read(session) != 0) { ret = HTE_READ; goto die; }
-	
-	/* prepare asumptions about response */
-	session->xfer.response->httpVersion = session->xfer.request->httpVersion;
-	session->xfer.response->httpCode = 200;
-	session->xfer.response->httpReason = (unsigned char*)"Success";
-	
-	/* run the callback */
-	if (httpd->callback(httpd->rxid++, session, (char*)session->xfer.request->data.content, session->xfer.request->data.contentLength) != 0) { ret = HTE_CALLBACK; goto die; }
-	
-	/* send the response */
-	if (http_respond(session, 1) != 0) { ret = HTE_RESPOND; goto die; }
-	
-	goto done;
-die:
-	
-	/* some sort of 'an-error-occured' callback? check ret! */
-	fprintf(stderr, "%s:%d %s(): an error occured (%d)\n", __FILE__, __LINE__, __FUNCTION__, ret);
+	return HTE_NONE;
+}
 
-	send(session->fd, err_buf, sizeof(err_buf), MSG_NOSIGNAL);
-	
-done:
-	
-	shutdown(session->fd, SHUT_RDWR);
-	close(session->fd);
-	
+void session_xferFree(struct session_info *session) {
 	if (session->xfer.request) {
 		if (session->xfer.request->buf) buf_free(session->xfer.request->buf);
-		if (session->xfer.request->data.headers) free(session->xfer.request->data.headers);
-		free(session->xfer.request);
+		if (session->xfer.request->multipart) multipart_free(session->xfer.request->multipart);
+		if (session->xfer.request->query) query_free(session->xfer.request->query);
+		if (session->xfer.request->form) query_free(session->xfer.request->form);
+		mem_uncharge(&session->memCharged);
+		if (session->xfer.request->data.headers) mem_free(session->xfer.request->data.headers);
+		mem_free(session->xfer.request);
+		session->xfer.request = NULL;
 	}
 	if (session->xfer.response) {
 		
+		gzip_release(session->xfer.response);
+		body_drop(session->xfer.response);
 		if (session->xfer.response->headBuf) buf_free(session->xfer.response->headBuf);
 		if (session->xfer.response->buf) buf_free(session->xfer.response->buf);
 		
@@ -97,13 +150,137 @@ done:
 				header = &htdata->headers[i];
 				if (header->value == NULL) continue;
 				if (header->valueFree == 0) continue;
-				free(header->value);
+				mem_free(header->value);
 			}
-			free(session->xfer.response->data.headers);
+			mem_free(session->xfer.response->data.headers);
+		}
+		mem_free(session->xfer.response);
+		session->xfer.response = NULL;
+	}
+}
+
+/* runs the callback for a request that has been read and parsed, and sends the response */
+hte session_dispatch(struct session_info *session) {
+	struct httpd_info *httpd = session->httpd;
+	int served, called = 0;
+	
+	/* prepare asumptions about response */
+	session->xfer.response->httpVersion = session->xfer.request->httpVersion;
+	session->xfer.response->httpCode = 200;
+	session->xfer.response->httpReason = (unsigned char*)"Success";
+	
+	if (httpd->rate && (httpd->rate->where & HTTPD_RATE_REQUEST) && !rate_allow(httpd->rate, session)) {
+		/* the callback never hears of it */
+		if (rate_refuse(session) != HTE_NONE) return HTE_RESPOND;
+	} else if (httpd->cache && (served = cache_serve(session)) != 0) {
+		/* nor does one the cache can answer, the pool's I/O loop is left a copy to send */
+		return served > 0 ? HTE_NONE : HTE_WRITE;
+	} else {
+		/* run the callback */
+		TRACE(callback_start, HTTPD_TRACE_CALLBACK_START, session);
+		if (httpd->callback(httpd->rxid++, session, (char*)session->xfer.request->data.content, session->xfer.request->data.contentLength) != 0) return HTE_CALLBACK;
+		TRACE(callback_end, HTTPD_TRACE_CALLBACK_END, session);
+		called = 1;
+	}
+	
+	/* send the response */
+	if (session->ws) {
+		/* the connection belongs to the WebSocket from here on */
+		if (ws_upgrade(session) != HTE_NONE) return HTE_RESPOND;
+	} else if (session->sse) {
+		/* as does an event stream */
+		if (sse_upgrade(session) != HTE_NONE) return HTE_RESPOND;
+	} else if (session->deferred) {
+		/* the response is sent by whoever completes it */
+		return HTE_NONE;
+	} else if (session->pool && !session->xfer.response->flushed) {
+		/* ... or by the I/O loop */
+		if (http_prepare(session, 1) != HTE_NONE) return HTE_RESPOND;
+		if (called && httpd->cache) cache_store(session);
+		return HTE_NONE;
+	} else {
+		timeout_phase(session, TIMEOUT_WRITE);
+		if (http_respond(session, 1) != 0) return HTE_RESPOND;
+		if (called && httpd->cache) cache_store(session);
+	}
+	TRACE(send_complete, HTTPD_TRACE_SEND_COMPLETE, session);
+	
+	return HTE_NONE;
+}
+
+void *session_handleConnection(void *_session) {
+	char err_buf[] = "HTTP/1.1 500 Internal Server Error\r\n";
+	struct session_info *session = _session;
+	struct httpd_info *httpd;
+	hte ret = HTE_NONE;
+	int h2;
+	
+	pthread_detach(pthread_self());
+	
+	if (!session || !session->httpd) return (void*)-1;
+	httpd = session->httpd;
+	
+	if ((ret = session_xferAlloc(session)) != HTE_NONE) goto die;
+	timeout_start(session, NULL, NULL);
+	
+	if (httpd->tls) {
+		/* nothing useful can be sent if this fails */
+		if ((ret = tls_accept(session)) != HTE_NONE) goto done;
+	}
+	
+	/* read request */
+	if (http_read(session) != 0) { ret = HTE_READ; goto die; }
+	timeout_stop(session);
+	
+	/* h2 over TLS is negotiated with ALPN, which we don't offer */
+	if (httpd->h2c && !session->tls && (h2 = h2_detect(session)) != 0) {
+		/* the rest of the connection is HTTP/2, and the streams are dispatched from in there */
+		if ((ret = h2_serve(session, h2)) != HTE_NONE) {
+			fprintf(stderr, "%s:%d %s(): an error occured on an HTTP/2 connection (%d)\n", __FILE__, __LINE__, __FUNCTION__, ret);
 		}
-		free(session->xfer.response);
+		goto done;
+	}
+	
+	if ((ret = session_dispatch(session)) != HTE_NONE) goto die;
+	
+	/* the connection waits for httpd_complete() without this thread */
+	if (session->deferred && defer_handOff(session)) return NULL;
+	
+	goto done;
+die:
+	
+	if (session->timeout.expired) {
+		timeout_answer(session);
+		goto done;
 	}
+	if (limit_answer(session)) goto done;
+	
+	/* some sort of 'an-error-occured' callback? check ret! */
+	fprintf(stderr, "%s:%d %s(): an error occured (%d)\n", __FILE__, __LINE__, __FUNCTION__, ret);
+
+	session_send(session, err_buf, sizeof(err_buf));
+	
+done:
+	
+	if (session->deferred && defer_abandon(session)) return NULL;
+	session_close(session);
 	
-	free(_session);
 	return NULL;
 }
+
+/* once nothing more is going to be sent on the connection */
+void session_close(struct session_info *session) {
+	timeout_stop(session);
+	if (session->flight) cache_land(session);
+	capture_close(session);
+	tls_close(session);
+	if (session->fd != -1) {
+		shutdown(session->fd, SHUT_RDWR);
+		close(session->fd);
+	}
+	
+	if (session->ws) ws_free(session->ws);
+	session_xferFree(session);
+	
+	mem_free(session);
+}
@@ -23,6 +23,8 @@
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
+#include "timeout.h"
+
 struct xfer_info {
 	struct http_request *request;
 	struct http_response *response;
@@ -30,14 +32,36 @@ struct xfer_info {
 
 struct session_info {
 	int fd;
-	struct sockaddr_in addrinfo;
+	struct sockaddr_storage addrinfo; /* the listener is IPv4, but an address may be either */
 	socklen_t addrlen;
 	pthread_t tid;
 	struct httpd_info *httpd;
+	unsigned int captureId;
+	unsigned int captureFile;
+	struct h2_stream *h2; /* set if this session is an HTTP/2 stream */
+	struct httpd_ws *ws;  /* set by httpd_wsAccept(), the response becomes the handshake */
+	struct httpd_sse *sse; /* set by httpd_sseSubscribe(), the response becomes the event stream */
+	struct tls_session *tls;
+	struct pool_conn *pool; /* set while a thread pool has the connection, the I/O loop sends the response */
+	struct httpd_deferred *deferred; /* set by httpd_defer(), the response is sent by httpd_complete() */
+	struct timeout_session timeout;
+	struct cache_flight *flight; /* set while requests with the same key wait for its response */
+	long long memCharged; /* the request's buffers, counted against the memory budget */
 
 	struct xfer_info xfer;
 };
 
 void *session_handleConnection(void *_session);
+void session_close(struct session_info *session);
+
+/* all reads and writes for the connection go through these, TLS or not */
+ssize_t session_recv(struct session_info *session, void *buf, size_t len, int flags);
+hte session_send(struct session_info *session, void *data, size_t len);
+hte session_sendv(struct session_info *session, struct iovec *iov, int iovc);
+hte session_answer(struct session_info *session, const void *data, size_t len);
+
+hte session_xferAlloc(struct session_info *session);
+void session_xferFree(struct session_info *session);
+hte session_dispatch(struct session_info *session);
 
 #endif /* SESSION_H */
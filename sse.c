@@ -0,0 +1,385 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "loop.h"
+#include "sse.h"
+#include "tls.h"
+#include "mem.h"
+
+static struct sse_event *sse_eventNew(size_t len) {
+	struct sse_event *ev;
+	
+	if ((ev = mem_malloc(HTTPD_MEM_OTHER, sizeof(*ev) + len)) == NULL) return NULL;
+	ev->refs = 1;
+	ev->len = len;
+	
+	return ev;
+}
+
+static void sse_eventRelease(struct sse_event *ev) {
+	if (__sync_sub_and_fetch(&ev->refs, 1) == 0) mem_free(ev);
+}
+
+/* ########################################################################## */
+
+/* the subscriber's mutex must be held
+   returns 0 once the queue is empty, 1 if the socket is full, -1 if the socket is broken */
+static int sse_flush(struct sse_sub *sub) {
+	int cap = sub->channel->queueLength;
+	
+	while (sub->count > 0) {
+		struct iovec iov[SSE_IOV];
+		struct msghdr msg;
+		ssize_t l;
+		int i;
+		
+		memset(&msg, 0, sizeof(msg));
+		for (i = 0; i < sub->count && i < SSE_IOV; i++) {
+			struct sse_event *ev = sub->queue[(sub->head + i) % cap];
+			size_t o = i == 0 ? sub->offset : 0;
+			iov[i].iov_base = &ev->data[o];
+			iov[i].iov_len = ev->len - o;
+		}
+		msg.msg_iov = iov;
+		msg.msg_iovlen = i;
+		
+		if ((l = sendmsg(sub->watch.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+			return -1;
+		}
+		
+		while (l > 0) {
+			struct sse_event *ev = sub->queue[sub->head];
+			size_t rem = ev->len - sub->offset;
+			
+			if ((size_t)l < rem) {
+				sub->offset += l;
+				break;
+			}
+			l -= rem;
+			sub->offset = 0;
+			sub->queue[sub->head] = NULL;
+			sub->head = (sub->head + 1) % cap;
+			sub->count--;
+			sse_eventRelease(ev);
+		}
+	}
+	
+	return 0;
+}
+
+/* the channel's mutex must be held */
+static void sse_enqueue(struct httpd_sse *channel, struct sse_sub *sub, struct sse_event *ev) {
+	int r;
+	
+	pthread_mutex_lock(&sub->mutex);
+	
+	if (sub->evicted) goto done;
+	
+	if (sub->count == channel->queueLength) {
+		/* a slow consumer - the loop notices the shutdown and cleans up */
+		sub->evicted = 1;
+		channel->evicted++;
+		shutdown(sub->watch.fd, SHUT_RDWR);
+		goto done;
+	}
+	
+	__sync_fetch_and_add(&ev->refs, 1);
+	sub->queue[(sub->head + sub->count) % channel->queueLength] = ev;
+	sub->count++;
+	sub->idle = 0;
+	
+	/* if the loop is already waiting to write, leave it to the loop */
+	if (sub->wantOut) goto done;
+	
+	if ((r = sse_flush(sub)) < 0) {
+		sub->evicted = 1;
+		shutdown(sub->watch.fd, SHUT_RDWR);
+	} else if (r > 0) {
+		sub->wantOut = 1;
+		loop_mod(channel->loop, &sub->watch, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+	}
+	
+done:
+	pthread_mutex_unlock(&sub->mutex);
+}
+
+static void sse_drop(struct sse_sub *sub) {
+	struct httpd_sse *channel = sub->channel;
+	struct sse_sub **s;
+	
+	pthread_mutex_lock(&channel->mutex);
+	for (s = &channel->subs; *s; s = &(*s)->next) {
+		if (*s != sub) continue;
+		*s = sub->next;
+		channel->subc--;
+		break;
+	}
+	pthread_mutex_unlock(&channel->mutex);
+	
+	/* nobody else can reach it now */
+	loop_del(channel->loop, &sub->watch);
+	close(sub->watch.fd);
+	
+	while (sub->count > 0) {
+		sse_eventRelease(sub->queue[sub->head]);
+		sub->head = (sub->head + 1) % channel->queueLength;
+		sub->count--;
+	}
+	pthread_mutex_destroy(&sub->mutex);
+	mem_free(sub->queue);
+	mem_free(sub);
+}
+
+static void sse_handler(struct loop_watch *watch, uint32_t events) {
+	struct sse_sub *sub = (struct sse_sub *)watch;
+	
+	if (events & EPOLLOUT) {
+		int r;
+		
+		pthread_mutex_lock(&sub->mutex);
+		if ((r = sse_flush(sub)) == 0) {
+			sub->wantOut = 0;
+			loop_mod(sub->channel->loop, &sub->watch, EPOLLIN | EPOLLRDHUP);
+		}
+		pthread_mutex_unlock(&sub->mutex);
+		
+		if (r < 0) goto die;
+	}
+	
+	if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+		unsigned char b[256];
+		ssize_t l;
+		
+		/* nothing is expected from the client, whatever it sends is dropped */
+		if ((l = recv(watch->fd, b, sizeof(b), MSG_DONTWAIT)) > 0) return;
+		if (l == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+		goto die;
+	}
+	
+	return;
+die:
+	sse_drop(sub);
+}
+
+static void sse_timer(struct loop_watch *watch, uint32_t events) {
+	struct httpd_sse *channel = (struct httpd_sse *)watch;
+	struct sse_event *ev;
+	struct sse_sub *sub;
+	uint64_t expirations;
+	
+	if (read(watch->fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+	
+	/* a comment line, which clients ignore - it's only here to keep proxies from giving up on the connection */
+	if ((ev = sse_eventNew(3)) == NULL) return;
+	memcpy(ev->data, ":\n\n", 3);
+	
+	pthread_mutex_lock(&channel->mutex);
+	for (sub = channel->subs; sub; sub = sub->next) {
+		if (sub->idle) sse_enqueue(channel, sub, ev);
+		sub->idle = 1;
+	}
+	pthread_mutex_unlock(&channel->mutex);
+	
+	sse_eventRelease(ev);
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_sseCreate(struct httpd_info *httpd, struct httpd_sse **_channel, int queueLength, int keepalive) {
+	struct httpd_sse *channel;
+	hte ret = HTE_NONE;
+	
+	if (!httpd || !_channel || queueLength < 1 || keepalive < 0) return HTE_INVALPARAM;
+	
+	if ((channel = mem_malloc(HTTPD_MEM_OTHER, sizeof(*channel))) == NULL) return HTE_NOMEM;
+	memset(channel, 0, sizeof(*channel));
+	channel->httpd = httpd;
+	channel->queueLength = queueLength;
+	channel->keepalive = keepalive;
+	channel->timer.fd = -1;
+	channel->timer.handler = sse_timer;
+	pthread_mutex_init(&channel->mutex, NULL);
+	
+	if ((channel->loop = loop_get(httpd)) == NULL) { ret = HTE_THREAD; goto die; }
+	
+	if (keepalive > 0) {
+		struct itimerspec its;
+		
+		if ((channel->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) { ret = HTE_UNKNOWN; goto die; }
+		memset(&its, 0, sizeof(its));
+		its.it_interval.tv_sec = keepalive;
+		its.it_value.tv_sec = keepalive;
+		if (timerfd_settime(channel->timer.fd, 0, &its, NULL) != 0) { ret = HTE_UNKNOWN; goto die; }
+		if ((ret = loop_add(channel->loop, &channel->timer, EPOLLIN)) != HTE_NONE) goto die;
+	}
+	
+	*_channel = channel;
+	
+	return HTE_NONE;
+die:
+	if (channel->timer.fd != -1) close(channel->timer.fd);
+	pthread_mutex_destroy(&channel->mutex);
+	mem_free(channel);
+	return ret;
+}
+
+EXPORT hte httpd_sseSubscribe(struct session_info *session, struct httpd_sse *channel) {
+	hte ret;
+	
+	if (!session || !channel) return HTE_INVALPARAM;
+	if (session->h2 || session->ws || session->sse) return HTE_INVALPARAM;
+	/* the loop writes to the fd directly, nothing it reads matters */
+	if (session->tls && !session->tls->ktlsSend) return HTE_TLS;
+	
+	if ((ret = httpd_addHeader(session, "Content-Type", "text/event-stream")) != HTE_NONE) return ret;
+	if ((ret = httpd_addHeader(session, "Cache-Control", "no-cache")) != HTE_NONE) return ret;
+	
+	session->sse = channel;
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_ssePublish(struct httpd_sse *channel, char *event, char *id, char *data) {
+	struct sse_event *ev;
+	struct sse_sub *sub;
+	size_t len;
+	unsigned char *p;
+	char *c;
+	
+	if (!channel || !data) return HTE_INVALPARAM;
+	if (id && strchr(id, '\n')) return HTE_INVALPARAM;
+	if (event && strchr(event, '\n')) return HTE_INVALPARAM;
+	
+	/* every line of data gets its own "data: " */
+	len = 0;
+	if (id)    len += strlen(id) + 5;
+	if (event) len += strlen(event) + 8;
+	len += strlen(data) + 7;
+	for (c = data; *c; c++) if (*c == '\n') len += 6;
+	len += 1;
+	
+	if ((ev = sse_eventNew(len)) == NULL) return HTE_NOMEM;
+	
+#define PUT(s, l) do { memcpy(p, (s), (l)); p += (l); } while (0)
+	p = ev->data;
+	if (id) {
+		PUT("id: ", 4);
+		PUT(id, strlen(id));
+		PUT("\n", 1);
+	}
+	if (event) {
+		PUT("event: ", 7);
+		PUT(event, strlen(event));
+		PUT("\n", 1);
+	}
+	PUT("data: ", 6);
+	for (c = data; *c; c++) {
+		*p++ = *c;
+		if (*c == '\n') PUT("data: ", 6);
+	}
+	PUT("\n\n", 2);
+#undef PUT
+	
+	pthread_mutex_lock(&channel->mutex);
+	channel->published++;
+	for (sub = channel->subs; sub; sub = sub->next) sse_enqueue(channel, sub, ev);
+	pthread_mutex_unlock(&channel->mutex);
+	
+	sse_eventRelease(ev);
+	
+	return HTE_NONE;
+}
+
+EXPORT hte httpd_sseGetStats(struct httpd_sse *channel, struct httpd_sseStats *stats) {
+	if (!channel || !stats) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&channel->mutex);
+	stats->subscribers = channel->subc;
+	stats->published = channel->published;
+	stats->evicted = channel->evicted;
+	pthread_mutex_unlock(&channel->mutex);
+	
+	return HTE_NONE;
+}
+
+hte sse_upgrade(struct session_info *session) {
+	struct httpd_sse *channel = session->sse;
+	struct sse_sub *sub;
+	int flags;
+	hte ret;
+	
+	session->sse = NULL;
+	
+	/* no Content-Length, the stream runs until the connection closes
+	   anything the callback wrote (a "retry:" perhaps) goes out ahead of the events */
+	if ((ret = http_respond(session, 0)) != HTE_NONE) return ret;
+	
+	if ((flags = fcntl(session->fd, F_GETFL)) == -1 || fcntl(session->fd, F_SETFL, flags | O_NONBLOCK) == -1) return HTE_SOCK;
+	
+	if ((sub = mem_malloc(HTTPD_MEM_OTHER, sizeof(*sub))) == NULL) return HTE_NOMEM;
+	memset(sub, 0, sizeof(*sub));
+	if ((sub->queue = mem_malloc(HTTPD_MEM_OTHER, sizeof(*sub->queue) * channel->queueLength)) == NULL) {
+		mem_free(sub);
+		return HTE_NOMEM;
+	}
+	sub->watch.fd = session->fd;
+	sub->watch.handler = sse_handler;
+	sub->channel = channel;
+	pthread_mutex_init(&sub->mutex, NULL);
+	
+	/* hold the channel while it's added, so the loop can't drop it before it's in the list */
+	pthread_mutex_lock(&channel->mutex);
+	if ((ret = loop_add(channel->loop, &sub->watch, EPOLLIN | EPOLLRDHUP)) == HTE_NONE) {
+		sub->next = channel->subs;
+		channel->subs = sub;
+		channel->subc++;
+	}
+	pthread_mutex_unlock(&channel->mutex);
+	
+	if (ret != HTE_NONE) {
+		pthread_mutex_destroy(&sub->mutex);
+		mem_free(sub->queue);
+		mem_free(sub);
+		return ret;
+	}
+	
+	/* the connection is the channel's now */
+	session->fd = -1;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,71 @@
+#ifndef SSE_H
+#define SSE_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Server-Sent Events - httpd_sseSubscribe() marks the session, then session_dispatch()
+   calls sse_upgrade() in place of http_respond() and the connection joins the channel
+   on the loop, where it stays until it goes away or is evicted */
+
+#include "loop.h"
+
+struct session_info;
+
+#define SSE_IOV 64 /* events per sendmsg() */
+
+/* formatted once per publish, and shared by every subscriber's queue */
+struct sse_event {
+	int refs;
+	size_t len;
+	unsigned char data[1];
+};
+
+struct sse_sub {
+	struct loop_watch watch; /* must be first */
+	struct httpd_sse *channel;
+	struct sse_sub *next;
+	
+	pthread_mutex_t mutex;
+	struct sse_event **queue; /* a ring of channel->queueLength */
+	int head;
+	int count;
+	size_t offset; /* how much of queue[head] has already gone */
+	int wantOut;   /* the socket is full, the loop is waiting for EPOLLOUT */
+	int idle;      /* nothing has been queued since the last keepalive */
+	int evicted;
+};
+
+struct httpd_sse {
+	struct loop_watch timer; /* must be first, keepalives */
+	struct httpd_info *httpd;
+	struct loop_info *loop;
+	int queueLength;
+	int keepalive;
+	
+	pthread_mutex_t mutex; /* the subscriber list, and the counters */
+	struct sse_sub *subs;
+	int subc;
+	unsigned long long published;
+	unsigned long long evicted;
+};
+
+hte sse_upgrade(struct session_info *session);
+
+#endif /* SSE_H */
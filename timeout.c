@@ -0,0 +1,220 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "loop.h"
+#include "wheel.h"
+#include "timeout.h"
+#include "mem.h"
+#include "mono.h"
+
+static const char timeout_408[] =
+	"HTTP/1.1 408 Request Timeout\r\n"
+	"Content-Length: 0\r\n"
+	"Connection: close\r\n"
+	"\r\n";
+
+static pthread_mutex_t timeout_startMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int timeout_limit(struct timeout_info *timeouts, enum timeout_kind kind) {
+	switch (kind) {
+		case TIMEOUT_IDLE:   return timeouts->limits.idleMs;
+		case TIMEOUT_HEADER: return timeouts->limits.headerMs;
+		case TIMEOUT_BODY:   return timeouts->limits.bodyMs;
+		case TIMEOUT_WRITE:  return timeouts->limits.writeMs;
+		case TIMEOUT_TOTAL:  return timeouts->limits.totalMs;
+		default:             return 0;
+	}
+}
+
+static int timeout_reading(enum timeout_kind phase) {
+	return phase == TIMEOUT_IDLE || phase == TIMEOUT_HEADER || phase == TIMEOUT_BODY;
+}
+
+static void timeout_fire(struct wheel_timer *timer) {
+	struct timeout_session *t = (struct timeout_session *)timer;
+	struct session_info *session = t->session;
+	
+	__sync_fetch_and_add(&session->httpd->timeouts->counts[t->kind], 1);
+	t->expired = 1;
+	
+	if (t->expire) {
+		t->expire(session);
+	} else {
+		/* the blocked recv() sees the end of the stream, and there's still a way out for the 408 */
+		shutdown(session->fd, timeout_reading(t->phase) ? SHUT_RD : SHUT_RDWR);
+	}
+}
+
+/* the phase's deadline or the request's, whichever comes first */
+static void timeout_arm(struct session_info *session) {
+	struct timeout_session *t = &session->timeout;
+	struct timeout_info *timeouts = session->httpd->timeouts;
+	unsigned long long now, left;
+	int ms;
+	
+	t->kind = t->phase;
+	ms = timeout_limit(timeouts, t->phase);
+	
+	if (t->totalDeadline) {
+		now = mono_ms();
+		left = t->totalDeadline > now ? t->totalDeadline - now : 0;
+		if (ms == 0 || left < (unsigned long long)ms) {
+			t->kind = TIMEOUT_TOTAL;
+			ms = left;
+		}
+	}
+	
+	if (ms == 0 && t->kind != TIMEOUT_TOTAL) {
+		wheel_del(t->wheel, &t->timer);
+		return;
+	}
+	wheel_add(t->wheel, &t->timer, ms);
+}
+
+void timeout_start(struct session_info *session, struct wheel_info *wheel, timeout_expire expire) {
+	struct timeout_session *t = &session->timeout;
+	struct timeout_info *timeouts;
+	
+	if ((timeouts = session->httpd->timeouts) == NULL) return;
+	
+	t->session = session;
+	t->wheel = wheel ? wheel : &timeouts->wheel;
+	t->expire = expire;
+	t->timer.handler = timeout_fire;
+	t->totalDeadline = timeouts->limits.totalMs > 0 ? mono_ms() + timeouts->limits.totalMs : 0;
+	t->expired = 0;
+	t->phase = TIMEOUT_IDLE;
+	
+	timeout_arm(session);
+}
+
+void timeout_phase(struct session_info *session, enum timeout_kind phase) {
+	struct timeout_session *t = &session->timeout;
+	
+	if (!t->wheel || (t->phase == phase && t->timer.linked)) return;
+	
+	t->phase = phase;
+	timeout_arm(session);
+}
+
+void timeout_progress(struct session_info *session) {
+	struct timeout_session *t = &session->timeout;
+	enum timeout_kind phase;
+	
+	if (!t->wheel) return;
+	
+	switch (session->xfer.request->state) {
+		case STATE_START:
+		case STATE_PARSING_HEADERS:
+			phase = TIMEOUT_HEADER;
+			break;
+		case STATE_START_CONTENT:
+		case STATE_PARSING_CONTENT:
+			phase = TIMEOUT_BODY;
+			break;
+		default:
+			return;
+	}
+	
+	/* the total's deadline doesn't move, so there's nothing to do until the phase changes */
+	if (t->phase != phase) timeout_phase(session, phase);
+}
+
+void timeout_stop(struct session_info *session) {
+	struct timeout_session *t = &session->timeout;
+	
+	if (!t->wheel) return;
+	
+	wheel_del(t->wheel, &t->timer);
+	t->phase = TIMEOUT_NONE;
+}
+
+void timeout_answer(struct session_info *session) {
+	struct timeout_session *t = &session->timeout;
+	
+	/* nothing was asked, so there's nothing to answer */
+	if (!t->expired || (t->phase != TIMEOUT_HEADER && t->phase != TIMEOUT_BODY)) return;
+	
+	session_answer(session, timeout_408, sizeof(timeout_408) - 1);
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_setTimeouts(struct httpd_info *httpd, struct httpd_timeouts *limits) {
+	struct timeout_info *timeouts;
+	struct loop_info *loop;
+	hte ret = HTE_NONE;
+	
+	if (!httpd || !limits) return HTE_INVALPARAM;
+	if (limits->idleMs < 0 || limits->headerMs < 0 || limits->bodyMs < 0 || limits->writeMs < 0 || limits->totalMs < 0) return HTE_INVALPARAM;
+	
+	pthread_mutex_lock(&timeout_startMutex);
+	
+	/* sessions already started keep the deadlines they had, new ones get these */
+	if ((timeouts = httpd->timeouts) != NULL) {
+		timeouts->limits = *limits;
+		goto done;
+	}
+	
+	if ((loop = loop_get(httpd)) == NULL) { ret = HTE_THREAD; goto done; }
+	if ((timeouts = mem_malloc(HTTPD_MEM_SERVER, sizeof(*timeouts))) == NULL) { ret = HTE_NOMEM; goto done; }
+	memset(timeouts, 0, sizeof(*timeouts));
+	timeouts->limits = *limits;
+	if ((ret = wheel_init(&timeouts->wheel, loop)) != HTE_NONE) {
+		mem_free(timeouts);
+		goto done;
+	}
+	
+	__sync_synchronize();
+	httpd->timeouts = timeouts;
+	
+done:
+	pthread_mutex_unlock(&timeout_startMutex);
+	return ret;
+}
+
+EXPORT hte httpd_getTimeoutStats(struct httpd_info *httpd, struct httpd_timeoutStats *stats) {
+	struct timeout_info *timeouts;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((timeouts = httpd->timeouts) == NULL) return HTE_NONE;
+	
+	stats->idle = timeouts->counts[TIMEOUT_IDLE];
+	stats->header = timeouts->counts[TIMEOUT_HEADER];
+	stats->body = timeouts->counts[TIMEOUT_BODY];
+	stats->write = timeouts->counts[TIMEOUT_WRITE];
+	stats->total = timeouts->counts[TIMEOUT_TOTAL];
+	
+	return HTE_NONE;
+}
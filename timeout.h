@@ -0,0 +1,71 @@
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* connection deadlines - each session being read or written has one timer on a wheel, for
+   whichever comes first of the current phase's deadline and the whole request's
+   on a thread of its own the session is woken from its blocking recv() or send() by shutting
+   the socket down, in the thread pools the I/O loop that owns it closes it there and then
+   nothing is timed while the callback has the session */
+
+#include "wheel.h"
+
+struct session_info;
+
+enum timeout_kind {
+	TIMEOUT_IDLE = 0, /* waiting for the first byte, connections only ever carry one request */
+	TIMEOUT_HEADER,
+	TIMEOUT_BODY,
+	TIMEOUT_WRITE,
+	TIMEOUT_TOTAL,
+	TIMEOUT_KINDS,
+	TIMEOUT_NONE = -1,
+};
+
+typedef void (*timeout_expire)(struct session_info *session);
+
+struct timeout_session {
+	struct wheel_timer timer; /* must be first */
+	struct session_info *session;
+	struct wheel_info *wheel; /* NULL if the session isn't timed */
+	timeout_expire expire;
+	unsigned long long totalDeadline; /* CLOCK_MONOTONIC in ms, 0 for none */
+	enum timeout_kind phase;
+	enum timeout_kind kind; /* what the timer is for, the phase or TOTAL */
+	int expired;
+};
+
+struct timeout_info {
+	struct httpd_timeouts limits;
+	struct wheel_info wheel; /* for sessions with threads of their own, on the shared loop */
+	unsigned long long counts[TIMEOUT_KINDS];
+};
+
+/* 'wheel' is NULL for the shared one, and 'expire' NULL to shut the socket down */
+void timeout_start(struct session_info *session, struct wheel_info *wheel, timeout_expire expire);
+void timeout_phase(struct session_info *session, enum timeout_kind phase);
+/* follows the request's parsing from idle through the header to the body */
+void timeout_progress(struct session_info *session);
+void timeout_stop(struct session_info *session);
+/* for a session that expired - a request that was too slow in coming gets a 408 */
+void timeout_answer(struct session_info *session);
+
+#endif /* TIMEOUT_H */
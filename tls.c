@@ -0,0 +1,191 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "tls.h"
+#include "mem.h"
+
+#ifdef HTTPD_TLS
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static void tls_logErrors(const char *func) {
+	unsigned long e;
+	char b[256];
+	
+	while ((e = ERR_get_error()) != 0) {
+		ERR_error_string_n(e, b, sizeof(b));
+		fprintf(stderr, "%s(): %s\n", func, b);
+	}
+}
+
+hte tls_serverStart(struct httpd_info *httpd) {
+	struct tls_server *tls;
+	SSL_CTX *ctx;
+	
+	if ((tls = mem_malloc(HTTPD_MEM_SERVER, sizeof(*tls))) == NULL) return HTE_NOMEM;
+	memset(tls, 0, sizeof(*tls));
+	
+	if ((ctx = SSL_CTX_new(TLS_server_method())) == NULL) goto die;
+	tls->ctx = ctx;
+	
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	
+	/* kTLS is only used if the kernel has the 'tls' ULP, and the cipher suits it */
+	SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+	
+	/* resumption: stateless tickets (OpenSSL rotates the keys), and a session cache for clients that don't do tickets */
+	SSL_CTX_set_session_id_context(ctx, (unsigned char *)"libhttpd", 8);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_num_tickets(ctx, 2);
+	
+	if (SSL_CTX_use_certificate_chain_file(ctx, httpd->tlsCert) != 1) goto die;
+	if (SSL_CTX_use_PrivateKey_file(ctx, httpd->tlsKey, SSL_FILETYPE_PEM) != 1) goto die;
+	if (SSL_CTX_check_private_key(ctx) != 1) goto die;
+	
+	httpd->tls = tls;
+	
+	return HTE_NONE;
+die:
+	tls_logErrors(__FUNCTION__);
+	if (tls->ctx) SSL_CTX_free(tls->ctx);
+	mem_free(tls);
+	return HTE_TLS;
+}
+
+hte tls_accept(struct session_info *session) {
+	struct tls_server *server = session->httpd->tls;
+	struct tls_session *tls;
+	sigset_t set;
+	SSL *ssl;
+	
+	/* OpenSSL (and kTLS) write() to the socket, we can't pass MSG_NOSIGNAL so a peer that goes away
+	   would kill the process - this thread only ever serves this connection, so block it here */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+	
+	if ((tls = mem_malloc(HTTPD_MEM_SESSION, sizeof(*tls))) == NULL) return HTE_NOMEM;
+	memset(tls, 0, sizeof(*tls));
+	session->tls = tls;
+	
+	if ((ssl = SSL_new(server->ctx)) == NULL) goto die;
+	tls->ssl = ssl;
+	if (SSL_set_fd(ssl, session->fd) != 1) goto die;
+	
+	if (SSL_accept(ssl) != 1) goto die;
+	
+	__sync_fetch_and_add(&server->handshakes, 1);
+	if (SSL_session_reused(ssl)) __sync_fetch_and_add(&server->resumed, 1);
+	
+	/* OpenSSL has already tried to hand the keys to the kernel, see how it went */
+	if (BIO_get_ktls_send(SSL_get_wbio(ssl))) {
+		tls->ktlsSend = 1;
+		__sync_fetch_and_add(&server->ktlsSend, 1);
+	}
+	if (BIO_get_ktls_recv(SSL_get_rbio(ssl))) {
+		tls->ktlsRecv = 1;
+		__sync_fetch_and_add(&server->ktlsRecv, 1);
+	}
+	
+	return HTE_NONE;
+die:
+	__sync_fetch_and_add(&server->failures, 1);
+	ERR_clear_error();
+	return HTE_TLS;
+}
+
+ssize_t tls_recv(struct session_info *session, void *buf, size_t len) {
+	int l;
+	
+	if ((l = SSL_read(session->tls->ssl, buf, len)) > 0) return l;
+	if (SSL_get_error(session->tls->ssl, l) == SSL_ERROR_ZERO_RETURN) return 0;
+	ERR_clear_error();
+	return -1;
+}
+
+ssize_t tls_send(struct session_info *session, void *data, size_t len) {
+	int l;
+	
+	if ((l = SSL_write(session->tls->ssl, data, len)) > 0) return l;
+	ERR_clear_error();
+	return -1;
+}
+
+void tls_close(struct session_info *session) {
+	struct tls_session *tls = session->tls;
+	
+	if (!tls) return;
+	session->tls = NULL;
+	
+	if (tls->ssl) {
+		/* if the fd has been handed on (a WebSocket) the kernel carries on with it, so just let go */
+		if (session->fd != -1 && SSL_is_init_finished((SSL *)tls->ssl)) SSL_shutdown(tls->ssl);
+		SSL_free(tls->ssl);
+	}
+	ERR_clear_error();
+	mem_free(tls);
+}
+
+#else /* HTTPD_TLS */
+
+hte tls_serverStart(struct httpd_info *httpd) {
+	return HTE_TLS;
+}
+hte tls_accept(struct session_info *session) {
+	return HTE_TLS;
+}
+ssize_t tls_recv(struct session_info *session, void *buf, size_t len) {
+	return -1;
+}
+ssize_t tls_send(struct session_info *session, void *data, size_t len) {
+	return -1;
+}
+void tls_close(struct session_info *session) {
+}
+
+#endif /* HTTPD_TLS */
+
+EXPORT hte httpd_getTLSStats(struct httpd_info *httpd, struct httpd_tlsStats *stats) {
+	struct tls_server *tls;
+	
+	if (!httpd || !stats) return HTE_INVALPARAM;
+	
+	memset(stats, 0, sizeof(*stats));
+	if ((tls = httpd->tls) == NULL) return HTE_NONE;
+	
+	stats->handshakes = tls->handshakes;
+	stats->failures = tls->failures;
+	stats->resumed = tls->resumed;
+	stats->ktlsSend = tls->ktlsSend;
+	stats->ktlsRecv = tls->ktlsRecv;
+	
+	return HTE_NONE;
+}
@@ -0,0 +1,56 @@
+#ifndef TLS_H
+#define TLS_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* TLS on the listener, only built with OPTIONS=HTTPD_TLS (OpenSSL)
+   after the handshake, OpenSSL is asked to move the connection into the kernel (kTLS)
+   each direction that makes it can use plain send() / recv() on the fd, so the buf
+   fd-divert, the WebSocket and the event stream paths work unchanged on top of it */
+
+#include <sys/types.h>
+
+struct session_info;
+struct httpd_info;
+
+struct tls_server {
+	void *ctx; /* SSL_CTX */
+	
+	/* counters for httpd_getTLSStats(), updated atomically */
+	unsigned long long handshakes;
+	unsigned long long failures;
+	unsigned long long resumed;
+	unsigned long long ktlsSend;
+	unsigned long long ktlsRecv;
+};
+
+struct tls_session {
+	void *ssl; /* SSL */
+	int ktlsSend; /* the kernel does the encryption, write to the fd directly */
+	int ktlsRecv; /* ... and the decryption */
+};
+
+hte tls_serverStart(struct httpd_info *httpd);
+hte tls_accept(struct session_info *session);
+ssize_t tls_recv(struct session_info *session, void *buf, size_t len);
+ssize_t tls_send(struct session_info *session, void *data, size_t len);
+void tls_close(struct session_info *session);
+
+#endif /* TLS_H */
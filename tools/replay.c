@@ -0,0 +1,602 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* replays a capture made with httpd_startCapture() against a server
+   each captured connection is re-driven on its own connection, at the original
+   pace (optionally scaled with -s) or as fast as possible (-m), with at most
+   -c connections in flight. latency is measured from the last byte of each
+   request being sent to the end of its response, and is reported per route
+   (method + path, without the query string) */
+
+#define _GNU_SOURCE /* strcasestr() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "capture.h" /* for CAP_MAGIC and the record types only */
+
+#define ROUTE_MAX 128
+#define HDR_MAX   16384
+
+struct chunk {
+	uint64_t t; /* microseconds since the start of the capture */
+	size_t off;
+	size_t len;
+};
+
+struct request {
+	size_t start;
+	size_t end;
+	int route;
+};
+
+struct conn {
+	unsigned char *data;
+	size_t len;
+	size_t size;
+
+	struct chunk *chunks;
+	int nchunks;
+
+	struct request *reqs;
+	int nreqs;
+
+	uint64_t tOpen;
+	int seen;
+};
+
+struct route {
+	char name[ROUTE_MAX];
+	uint32_t *us;
+	size_t count;
+	size_t size;
+	uint64_t errors;
+};
+
+static struct conn *conns;
+static int nconns;
+
+/* capture ids to conns, open addressed - the ids needn't be dense, or start anywhere near 1 */
+static struct {
+	uint64_t *ids;
+	int *index;
+	size_t size;
+} connMap;
+
+static struct route *routes;
+static int nroutes;
+static pthread_mutex_t routeMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	struct addrinfo *addr;
+	int maxSpeed;
+	double speed;
+	int concurrency;
+
+	uint64_t tFirst;
+	uint64_t start;
+
+	pthread_mutex_t mutex;
+	int next;
+
+	uint64_t late;
+	uint64_t retries;
+	uint64_t connErrors;
+} replay;
+
+/* ########################################################################## */
+
+static uint64_t now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* sleeps until 't' (capture time) comes around again, returns how late we are */
+static uint64_t wait_until(uint64_t t) {
+	uint64_t due, now;
+
+	if (replay.maxSpeed) return 0;
+
+	due = replay.start + (uint64_t)((t - replay.tFirst) / replay.speed);
+	now = now_us();
+	if (now >= due) return now - due;
+
+	usleep(due - now);
+	return 0;
+}
+
+static int get_varint(FILE *f, uint64_t *v) {
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		if ((c = fgetc(f)) == EOF || shift > 63) return -1;
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static int route_find(const char *name) {
+	int i;
+
+	for (i = 0; i < nroutes; i++) {
+		if (!strcmp(routes[i].name, name)) return i;
+	}
+	if ((routes = realloc(routes, sizeof(*routes) * (nroutes + 1))) == NULL) exit(1);
+	memset(&routes[nroutes], 0, sizeof(*routes));
+	snprintf(routes[nroutes].name, ROUTE_MAX, "%s", name);
+
+	return nroutes++;
+}
+
+static void route_add(int r, uint64_t us, int error) {
+	struct route *route;
+
+	pthread_mutex_lock(&routeMutex);
+	route = &routes[r];
+	if (error) {
+		route->errors++;
+	} else {
+		if (route->count == route->size) {
+			route->size = route->size ? route->size * 2 : 1024;
+			if ((route->us = realloc(route->us, route->size * sizeof(*route->us))) == NULL) exit(1);
+		}
+		route->us[route->count++] = us > UINT32_MAX ? UINT32_MAX : us;
+	}
+	pthread_mutex_unlock(&routeMutex);
+}
+
+/* ########################################################################## */
+
+/* finds the end of the headers, and returns the total length of the message (or 0 if it's incomplete)
+   for a request 'lengthless' is 0, for a response it's set if the body runs until the connection closes */
+static size_t message_length(const unsigned char *data, size_t len, int *lengthless) {
+	size_t i, eoh = 0, cl = 0;
+	int haveCl = 0;
+
+	for (i = 0; i + 1 < len; i++) {
+		if (data[i] != '\n') continue;
+		if (data[i + 1] == '\n') { eoh = i + 2; break; }
+		if (i + 2 < len && data[i + 1] == '\r' && data[i + 2] == '\n') { eoh = i + 3; break; }
+	}
+	if (eoh == 0) return 0;
+
+	for (i = 0; i < eoh; i++) {
+		if (data[i] != '\n' || eoh - i < 16) continue;
+		if (strncasecmp((const char *)&data[i + 1], "Content-Length:", 15)) continue;
+		cl = strtoul((const char *)&data[i + 16], NULL, 10);
+		haveCl = 1;
+		break;
+	}
+
+	if (lengthless) *lengthless = !haveCl;
+	return eoh + cl;
+}
+
+static void split_requests(struct conn *c) {
+	size_t pos, l;
+
+	for (pos = 0; pos < c->len; pos += l) {
+		char route[ROUTE_MAX];
+		size_t i, j;
+
+		if ((l = message_length(&c->data[pos], c->len - pos, NULL)) == 0 || pos + l > c->len) {
+			/* a partial request (e.g. the client gave up) - replay it anyway */
+			l = c->len - pos;
+		}
+
+		/* route is "METHOD /path" */
+		for (i = 0, j = 0; pos + i < c->len && j < ROUTE_MAX - 1; i++) {
+			unsigned char ch = c->data[pos + i];
+			if (ch == '\r' || ch == '\n' || ch == '?') break;
+			if (ch == ' ' && memchr(route, ' ', j)) break;
+			route[j++] = ch;
+		}
+		route[j] = '\0';
+
+		if ((c->reqs = realloc(c->reqs, sizeof(*c->reqs) * (c->nreqs + 1))) == NULL) exit(1);
+		c->reqs[c->nreqs].start = pos;
+		c->reqs[c->nreqs].end = pos + l;
+		c->reqs[c->nreqs].route = route_find(route);
+		c->nreqs++;
+	}
+}
+
+static uint64_t map_hash(uint64_t id) {
+	id ^= id >> 33;
+	id *= 0xff51afd7ed558ccdULL;
+	id ^= id >> 33;
+	return id;
+}
+
+/* finds (or adds) the conn for 'id' */
+static struct conn *conn_get(uint64_t id) {
+	size_t i;
+
+	/* kept at most half full */
+	if ((size_t)nconns * 2 >= connMap.size) {
+		uint64_t *ids = connMap.ids;
+		int *index = connMap.index;
+		size_t j, size = connMap.size;
+
+		connMap.size = size ? size * 2 : 1024;
+		if ((connMap.ids = calloc(connMap.size, sizeof(*connMap.ids))) == NULL) exit(1);
+		if ((connMap.index = malloc(connMap.size * sizeof(*connMap.index))) == NULL) exit(1);
+		for (j = 0; j < size; j++) {
+			if (ids[j] == 0) continue;
+			for (i = map_hash(ids[j]) & (connMap.size - 1); connMap.ids[i] != 0; i = (i + 1) & (connMap.size - 1));
+			connMap.ids[i] = ids[j];
+			connMap.index[i] = index[j];
+		}
+		free(ids);
+		free(index);
+	}
+
+	for (i = map_hash(id) & (connMap.size - 1); connMap.ids[i] != 0; i = (i + 1) & (connMap.size - 1)) {
+		if (connMap.ids[i] == id) return &conns[connMap.index[i]];
+	}
+
+	if ((conns = realloc(conns, sizeof(*conns) * (nconns + 1))) == NULL) exit(1);
+	memset(&conns[nconns], 0, sizeof(*conns));
+	connMap.ids[i] = id;
+	connMap.index[i] = nconns;
+
+	return &conns[nconns++];
+}
+
+static int load_capture(const char *path) {
+	unsigned char hdr[16];
+	const char *bad = NULL;
+	uint64_t t = 0;
+	long at = 0;
+	FILE *f;
+	int type, i;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		perror(path);
+		return -1;
+	}
+	if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, CAP_MAGIC, 8)) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	/* a capture that's still being written, or was cut short, ends part way through a record */
+	while ((type = fgetc(f)) != EOF) {
+		uint64_t id, dt, len;
+		struct conn *c;
+
+		at = ftell(f) - 1;
+
+		if (get_varint(f, &id) || get_varint(f, &dt)) {
+			bad = "a truncated record";
+			break;
+		}
+		t += dt;
+
+		if (id == 0 || (type != CAP_OPEN && type != CAP_DATA && type != CAP_CLOSE)) {
+			bad = "a record that makes no sense";
+			break;
+		}
+		c = conn_get(id);
+
+		if (type == CAP_OPEN) {
+			c->tOpen = t;
+			c->seen = 1;
+		} else if (type == CAP_DATA) {
+			if (get_varint(f, &len) || len > SIZE_MAX / 4) {
+				bad = "a truncated record";
+				break;
+			}
+			if (c->len + len > c->size) {
+				c->size = (c->len + len) * 2;
+				if ((c->data = realloc(c->data, c->size)) == NULL) exit(1);
+			}
+			if (fread(&c->data[c->len], 1, len, f) != len) {
+				bad = "a truncated record";
+				break;
+			}
+
+			if ((c->chunks = realloc(c->chunks, sizeof(*c->chunks) * (c->nchunks + 1))) == NULL) exit(1);
+			c->chunks[c->nchunks].t = t;
+			c->chunks[c->nchunks].off = c->len;
+			c->chunks[c->nchunks].len = len;
+			c->nchunks++;
+			c->len += len;
+		}
+		/* CAP_CLOSE - nothing to do, we finish once the data has been sent */
+	}
+	fclose(f);
+
+	/* what came before it is still worth replaying */
+	if (bad) fprintf(stderr, "%s: %s at byte %ld, the rest is ignored\n", path, bad, at);
+
+	for (i = 0; i < nconns; i++) {
+		if (!conns[i].seen || conns[i].len == 0) continue;
+		split_requests(&conns[i]);
+	}
+
+	return 0;
+}
+
+/* ########################################################################## */
+
+static int open_conn(void) {
+	int fd, i;
+
+	if ((fd = socket(replay.addr->ai_family, SOCK_STREAM, 0)) == -1) return -1;
+	if (connect(fd, replay.addr->ai_addr, replay.addr->ai_addrlen) != 0) {
+		close(fd);
+		return -1;
+	}
+	i = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i));
+
+	return fd;
+}
+
+/* sends [start,end) of the connection, chunk by chunk, at the original pace */
+static int send_range(int fd, struct conn *c, size_t start, size_t end, int paced) {
+	int i;
+
+	for (i = 0; i < c->nchunks; i++) {
+		struct chunk *ch = &c->chunks[i];
+		size_t a, b;
+
+		if (ch->off + ch->len <= start) continue;
+		if (ch->off >= end) break;
+
+		a = ch->off > start ? ch->off : start;
+		b = ch->off + ch->len < end ? ch->off + ch->len : end;
+
+		if (paced && wait_until(ch->t) > 10000) __sync_fetch_and_add(&replay.late, 1);
+
+		while (a < b) {
+			ssize_t l;
+			if ((l = send(fd, &c->data[a], b - a, MSG_NOSIGNAL)) <= 0) return -1;
+			a += l;
+		}
+	}
+
+	return 0;
+}
+
+/* reads a whole response, returns the status code, 0 if the connection closed first, or -1 on error
+   *closed is set if the connection can't be used again */
+static int read_response(int fd, int *closed) {
+	unsigned char buf[HDR_MAX];
+	size_t have = 0, total = 0;
+	int lengthless = 0, status = 0;
+	ssize_t l;
+
+	*closed = 0;
+	for (;;) {
+		if ((l = recv(fd, &buf[have], sizeof(buf) - have - 1, 0)) <= 0) {
+			*closed = 1;
+			if (total == 0 && have == 0) return 0;
+			if (lengthless && status) return status;
+			return -1;
+		}
+		have += l;
+		buf[have] = '\0';
+
+		if (total == 0) {
+			if ((total = message_length(buf, have, &lengthless)) == 0) {
+				if (have >= sizeof(buf) - 1) return -1;
+				continue;
+			}
+			if (sscanf((char *)buf, "HTTP/%*d.%*d %d", &status) != 1) return -1;
+			if (strcasestr((char *)buf, "\nConnection: close")) *closed = 1;
+		}
+		if (lengthless) {
+			have = 0;
+			continue;
+		}
+
+		if (have >= total) return status;
+
+		/* just discard the body as it arrives */
+		total -= have;
+		have = 0;
+	}
+}
+
+static void replay_conn(struct conn *c) {
+	int fd = -1, i;
+
+	if (!replay.maxSpeed && wait_until(c->tOpen) > 10000) __sync_fetch_and_add(&replay.late, 1);
+
+	for (i = 0; i < c->nreqs; i++) {
+		struct request *req = &c->reqs[i];
+		int attempt, status = 0, closed = 1;
+		uint64_t sent = 0;
+
+		/* the server may well close between requests, so have one more go on a new connection */
+		for (attempt = 0; attempt < 2; attempt++) {
+			if (fd == -1 && (fd = open_conn()) == -1) {
+				__sync_fetch_and_add(&replay.connErrors, 1);
+				break;
+			}
+			if (send_range(fd, c, req->start, req->end, attempt == 0 && !replay.maxSpeed) == 0) {
+				sent = now_us();
+				status = read_response(fd, &closed);
+			} else {
+				status = 0;
+				closed = 1;
+			}
+			if (closed) {
+				close(fd);
+				fd = -1;
+			}
+			if (status != 0) break;
+			__sync_fetch_and_add(&replay.retries, 1);
+		}
+
+		route_add(req->route, now_us() - sent, status < 200 || status > 399);
+	}
+
+	if (fd != -1) close(fd);
+}
+
+void *replay_thread(void *arg) {
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&replay.mutex);
+		i = replay.next++;
+		pthread_mutex_unlock(&replay.mutex);
+
+		if (i >= nconns) break;
+		if (!conns[i].seen || conns[i].nreqs == 0) continue;
+
+		replay_conn(&conns[i]);
+	}
+
+	return NULL;
+}
+
+/* ########################################################################## */
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static uint32_t percentile(struct route *r, double p) {
+	if (r->count == 0) return 0;
+	return r->us[(size_t)(p * (r->count - 1) + 0.5)];
+}
+
+static void usage(const char *argv0) {
+	fprintf(stderr, "usage: %s [-H host] [-p port] [-c concurrency] [-m | -s speed] [-o results.json] <capture file>\n", argv0);
+	fprintf(stderr, "  -m          as fast as possible, ignoring the captured timing\n");
+	fprintf(stderr, "  -s speed    scale the captured timing, 2.0 is twice as fast (default 1.0)\n");
+}
+
+int main(int argc, char *argv[]) {
+	struct addrinfo hints;
+	pthread_t *tids;
+	char *host = "127.0.0.1";
+	char *port = "8080";
+	char *outfile = NULL;
+	uint64_t elapsed;
+	FILE *out = NULL;
+	int i, opt, n;
+
+	replay.concurrency = 16;
+	replay.speed = 1.0;
+	pthread_mutex_init(&replay.mutex, NULL);
+
+	while ((opt = getopt(argc, argv, "H:p:c:ms:o:h")) != -1) {
+		switch (opt) {
+			case 'H': host = optarg;                      break;
+			case 'p': port = optarg;                      break;
+			case 'c': replay.concurrency = atoi(optarg);  break;
+			case 'm': replay.maxSpeed = 1;                break;
+			case 's': replay.speed = atof(optarg);        break;
+			case 'o': outfile = optarg;                   break;
+			default:  usage(argv[0]);                     return 1;
+		}
+	}
+	if (optind != argc - 1 || replay.concurrency < 1 || replay.speed <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if ((i = getaddrinfo(host, port, &hints, &replay.addr)) != 0) {
+		fprintf(stderr, "%s:%s: %s\n", host, port, gai_strerror(i));
+		return 1;
+	}
+
+	if (load_capture(argv[optind]) != 0) return 1;
+
+	for (i = 0, n = 0; i < nconns; i++) {
+		if (!conns[i].seen) continue;
+		if (n++ == 0 || conns[i].tOpen < replay.tFirst) replay.tFirst = conns[i].tOpen;
+	}
+	fprintf(stderr, "%d connections, %d routes\n", n, nroutes);
+
+	if ((tids = calloc(replay.concurrency, sizeof(*tids))) == NULL) return 1;
+	replay.start = now_us();
+	for (i = 0; i < replay.concurrency; i++) pthread_create(&tids[i], NULL, replay_thread, NULL);
+	for (i = 0; i < replay.concurrency; i++) pthread_join(tids[i], NULL);
+	elapsed = now_us() - replay.start;
+
+	fprintf(stderr, "replayed in %.3fs, %llu retries, %llu connect errors, %llu late starts (>10ms)\n",
+	        elapsed / 1e6, (unsigned long long)replay.retries, (unsigned long long)replay.connErrors,
+	        (unsigned long long)replay.late);
+	fprintf(stderr, "%-40s %8s %7s %9s %9s %9s %9s\n", "route", "count", "errors", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+
+	if (outfile) {
+		if ((out = fopen(outfile, "w")) == NULL) {
+			perror(outfile);
+			return 1;
+		}
+		fprintf(out, "{\n  \"seconds\": %.3f,\n  \"retries\": %llu,\n  \"late\": %llu,\n  \"routes\": [",
+		        elapsed / 1e6, (unsigned long long)replay.retries, (unsigned long long)replay.late);
+	}
+
+	for (i = 0; i < nroutes; i++) {
+		struct route *r = &routes[i];
+
+		qsort(r->us, r->count, sizeof(*r->us), cmp_u32);
+		fprintf(stderr, "%-40s %8zu %7llu %9u %9u %9u %9u\n", r->name, r->count, (unsigned long long)r->errors,
+		        percentile(r, 0.5), percentile(r, 0.9), percentile(r, 0.99), r->count ? r->us[r->count - 1] : 0);
+
+		if (!out) continue;
+		fprintf(out, "%s\n    {\"route\": \"", i ? "," : "");
+		{
+			char *p;
+			for (p = r->name; *p; p++) {
+				if (*p == '"' || *p == '\\') fputc('\\', out);
+				if ((unsigned char)*p < 0x20) continue;
+				fputc(*p, out);
+			}
+		}
+		fprintf(out, "\", \"count\": %zu, \"errors\": %llu, \"latency_us\": {\"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}}",
+		        r->count, (unsigned long long)r->errors, percentile(r, 0.5), percentile(r, 0.9), percentile(r, 0.99),
+		        r->count ? r->us[r->count - 1] : 0);
+	}
+
+	if (out) {
+		fprintf(out, "\n  ]\n}\n");
+		fclose(out);
+	}
+
+	freeaddrinfo(replay.addr);
+	return 0;
+}
@@ -0,0 +1,52 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "internal.h"
+#include "interface.h"
+#include "session.h"
+#include "trace.h"
+#include "mono.h"
+
+EXPORT hte httpd_setTraceHook(struct httpd_info *httpd, httpd_traceHook hook, void *ctx) {
+	if (!httpd) return HTE_INVALPARAM;
+	
+	hook_set(&httpd->traceHook, (hook_fn)hook, ctx);
+	
+	return HTE_NONE;
+}
+
+void trace_emit(struct session_info *session, enum httpd_trace_event event) {
+	httpd_traceHook hook;
+	unsigned long long now;
+	struct timespec ts;
+	void *ctx;
+	
+	if (!session || !session->httpd) return;
+	if ((hook = (httpd_traceHook)hook_get(&session->httpd->traceHook, &ctx)) == NULL) return;
+	
+	now = mono_ns();
+	ts.tv_sec = now / 1000000000ULL;
+	ts.tv_nsec = now % 1000000000ULL;
+	hook(ctx, session, event, &ts);
+}
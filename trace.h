@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* USDT probes are only built in if <sys/sdt.h> is around (systemtap-sdt-dev)
+   build with OPTIONS=HTTPD_NO_SDT to leave them out regardless */
+#if !defined(HTTPD_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HTTPD_HAVE_SDT
+#endif
+#endif
+
+#ifdef HTTPD_HAVE_SDT
+#define TRACE_PROBE(probe, session) DTRACE_PROBE2(libhttpd, probe, (session), (session)->fd)
+#else
+#define TRACE_PROBE(probe, session)
+#endif
+
+/* probe is the USDT name, event is the enum httpd_trace_event handed to the hook */
+#define TRACE(probe, event, session) \
+	do { \
+		TRACE_PROBE(probe, session); \
+		trace_emit((session), (event)); \
+	} while (0)
+
+void trace_emit(struct session_info *session, enum httpd_trace_event event);
+
+#endif /* TRACE_H */
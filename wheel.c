@@ -0,0 +1,189 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "internal.h"
+#include "loop.h"
+#include "wheel.h"
+#include "mono.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+static void wheel_unlink(struct wheel_info *wheel, struct wheel_timer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+	timer->linked = 0;
+	wheel->count--;
+}
+
+/* the mutex must be held, and nothing goes in before 'earliest' - the slot for 'now' has already
+   run when a timer's added, but is still to run when one's cascaded down into it */
+static void wheel_link(struct wheel_info *wheel, struct wheel_timer *timer, unsigned long long earliest) {
+	unsigned long long delta;
+	struct wheel_timer *head;
+	int level;
+	
+	if (timer->expires < earliest) timer->expires = earliest;
+	delta = timer->expires - wheel->now;
+	
+	/* the lowest level whose span covers it, and past the top it waits at the far end */
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < (1ULL << (WHEEL_BITS * (level + 1)))) break;
+	}
+	if (delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS))) {
+		timer->expires = wheel->now + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	}
+	
+	head = &wheel->slots[level][(timer->expires >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	timer->prev = head;
+	timer->next = head->next;
+	head->next->prev = timer;
+	head->next = timer;
+	timer->linked = 1;
+	wheel->count++;
+}
+
+/* a slot of an upper level is due once 'now' reaches the block it covers, and what's in it moves down */
+static void wheel_cascade(struct wheel_info *wheel, int level) {
+	struct wheel_timer *head = &wheel->slots[level][(wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK];
+	struct wheel_timer *timer;
+	
+	while ((timer = head->next) != head) {
+		wheel_unlink(wheel, timer);
+		wheel_link(wheel, timer, wheel->now);
+	}
+}
+
+static void wheel_arm(struct wheel_info *wheel, int on) {
+	struct itimerspec its;
+	
+	memset(&its, 0, sizeof(its));
+	if (on) {
+		its.it_value.tv_nsec = WHEEL_TICK * 1000000L;
+		its.it_interval.tv_nsec = WHEEL_TICK * 1000000L;
+	}
+	if (timerfd_settime(wheel->watch.fd, 0, &its, NULL) == 0) wheel->ticking = on;
+}
+
+static void wheel_event(struct loop_watch *watch, uint32_t events) {
+	struct wheel_info *wheel = (struct wheel_info *)watch;
+	struct wheel_timer *head, *timer;
+	unsigned long long target;
+	uint64_t n;
+	int level;
+	
+	if (read(wheel->watch.fd, &n, sizeof(n)) != sizeof(n)) return;
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	target = mono_ms() / WHEEL_TICK;
+	while (wheel->now < target) {
+		wheel->now++;
+		
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if ((wheel->now & ((1ULL << (WHEEL_BITS * level)) - 1)) != 0) break;
+			wheel_cascade(wheel, level);
+		}
+		
+		/* a handler may add and remove timers, so the slot is looked at afresh each time */
+		head = &wheel->slots[0][wheel->now & WHEEL_MASK];
+		while ((timer = head->next) != head) {
+			wheel_unlink(wheel, timer);
+			wheel->running = timer;
+			wheel->runner = pthread_self();
+			pthread_mutex_unlock(&wheel->mutex);
+			
+			timer->handler(timer);
+			
+			pthread_mutex_lock(&wheel->mutex);
+			wheel->running = NULL;
+		}
+	}
+	
+	if (wheel->count == 0 && wheel->ticking) wheel_arm(wheel, 0);
+	
+	pthread_mutex_unlock(&wheel->mutex);
+}
+
+/* ########################################################################## */
+
+hte wheel_init(struct wheel_info *wheel, struct loop_info *loop) {
+	int i, j;
+	
+	memset(wheel, 0, sizeof(*wheel));
+	wheel->loop = loop;
+	pthread_mutex_init(&wheel->mutex, NULL);
+	for (i = 0; i < WHEEL_LEVELS; i++) {
+		for (j = 0; j < WHEEL_SLOTS; j++) {
+			wheel->slots[i][j].prev = wheel->slots[i][j].next = &wheel->slots[i][j];
+		}
+	}
+	
+	if ((wheel->watch.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) == -1) return HTE_NOMEM;
+	wheel->watch.handler = wheel_event;
+	if (loop_add(loop, &wheel->watch, EPOLLIN) != HTE_NONE) {
+		close(wheel->watch.fd);
+		return HTE_THREAD;
+	}
+	
+	return HTE_NONE;
+}
+
+void wheel_add(struct wheel_info *wheel, struct wheel_timer *timer, unsigned int ms) {
+	unsigned long long now = mono_ms() / WHEEL_TICK;
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	if (timer->linked) wheel_unlink(wheel, timer);
+	/* nothing has been ticking, so there's nothing to catch up on */
+	if (!wheel->ticking) wheel->now = now;
+	
+	timer->expires = now + (ms + WHEEL_TICK - 1) / WHEEL_TICK;
+	wheel_link(wheel, timer, wheel->now + 1);
+	
+	if (!wheel->ticking) wheel_arm(wheel, 1);
+	
+	pthread_mutex_unlock(&wheel->mutex);
+}
+
+void wheel_del(struct wheel_info *wheel, struct wheel_timer *timer) {
+	pthread_mutex_lock(&wheel->mutex);
+	
+	if (timer->linked) wheel_unlink(wheel, timer);
+	while (wheel->running == timer && !pthread_equal(wheel->runner, pthread_self())) {
+		pthread_mutex_unlock(&wheel->mutex);
+		sched_yield();
+		pthread_mutex_lock(&wheel->mutex);
+	}
+	
+	pthread_mutex_unlock(&wheel->mutex);
+}
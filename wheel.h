@@ -0,0 +1,67 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* a hierarchical timer wheel - four levels of 64 slots, each slot a list, so adding and removing
+   a timer is O(1) and a tick only looks at one slot (and now and then moves a slot of the level
+   above down into the one below)
+   it's driven by a timerfd on a loop, which only ticks while there are timers, and the timers'
+   handlers are called on the loop thread without the wheel's mutex held */
+
+#include <pthread.h>
+
+#include "loop.h"
+
+#define WHEEL_TICK   10 /* ms */
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4  /* 64^4 ticks, a little over 46 hours */
+
+struct wheel_timer;
+typedef void (*wheel_handler)(struct wheel_timer *timer);
+
+struct wheel_timer {
+	struct wheel_timer *prev;
+	struct wheel_timer *next;
+	unsigned long long expires; /* in ticks */
+	wheel_handler handler;
+	int linked;
+};
+
+struct wheel_info {
+	struct loop_watch watch; /* must be first, the timerfd */
+	struct loop_info *loop;
+	pthread_mutex_t mutex;
+	unsigned long long now; /* the last tick run */
+	int count;
+	int ticking;
+	struct wheel_timer *running; /* whose handler is being called, and on which thread */
+	pthread_t runner;
+	struct wheel_timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; /* list heads */
+};
+
+hte wheel_init(struct wheel_info *wheel, struct loop_info *loop);
+/* the timer's handler must be set, and 'ms' from now is rounded up to the next tick */
+void wheel_add(struct wheel_info *wheel, struct wheel_timer *timer, unsigned int ms);
+/* once this returns the handler isn't running and won't be, unless it's called from the handler */
+void wheel_del(struct wheel_info *wheel, struct wheel_timer *timer);
+
+#endif /* WHEEL_H */
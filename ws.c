@@ -0,0 +1,647 @@
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "internal.h"
+#include "session.h"
+#include "interface.h"
+#include "http.h"
+#include "buf.h"
+#include "loop.h"
+#include "ws.h"
+#include "tls.h"
+#include "mem.h"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OP_CONTINUATION 0x0
+#define WS_OP_TEXT         0x1
+#define WS_OP_BINARY       0x2
+#define WS_OP_CLOSE        0x8
+#define WS_OP_PING         0x9
+#define WS_OP_PONG         0xA
+
+#define WS_RX_SIZE 4096
+
+struct httpd_ws {
+	struct loop_watch watch; /* must be first */
+	struct loop_info *loop;
+	
+	httpd_wsCallback callback;
+	void *ctx;
+	int refs; /* the loop's, and each httpd_wsHold() and httpd_wsSend() in progress */
+	
+	pthread_mutex_t writeMutex; /* everything in here that other threads may touch */
+	int registered;
+	int closed; /* the socket's gone, and its fd may already belong to someone else */
+	int closeSent;
+	unsigned char *tx; /* what the socket wouldn't take yet */
+	size_t txLen;
+	size_t txSize;
+	
+	/* only touched on the loop thread */
+	unsigned char *rx;
+	size_t rxPos;
+	size_t rxLen;
+	size_t rxSize;
+	int closeCode;
+	int draining; /* the close is done with, only what's left in tx has still to go */
+	
+	unsigned char *msg; /* a fragmented message being put back together */
+	size_t msgLen;
+	int msgOpcode;
+};
+
+/* ########################################################################## */
+
+static uint32_t sha1_rol(uint32_t v, int n) {
+	return (v << n) | (v >> (32 - n));
+}
+
+/* only ever used on a handful of bytes for the handshake */
+static void ws_sha1(unsigned char *data, size_t len, unsigned char out[20]) {
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	unsigned char block[64];
+	uint64_t bits = (uint64_t)len * 8;
+	size_t pos = 0;
+	int i, last = 0;
+	
+	while (!last) {
+		uint32_t w[80], a, b, c, d, e, f, k, t;
+		size_t n = pos >= len ? 0 : len - pos < 64 ? len - pos : 64;
+		
+		memset(block, 0, sizeof(block));
+		if (n > 0) memcpy(block, &data[pos], n);
+		if (n < 64) {
+			/* the 0x80 goes straight after the data, the length only if there's room for it */
+			if (pos <= len) block[n] = 0x80;
+			if (n < 56) {
+				for (i = 0; i < 8; i++) block[63 - i] = (bits >> (i * 8)) & 0xFF;
+				last = 1;
+			}
+		}
+		pos += 64;
+		
+		for (i = 0; i < 16; i++) w[i] = ((uint32_t)block[i * 4] << 24) | (block[i * 4 + 1] << 16) | (block[i * 4 + 2] << 8) | block[i * 4 + 3];
+		for (; i < 80; i++) w[i] = sha1_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (i = 0; i < 80; i++) {
+			if      (i < 20) { f = (b & c) | (~b & d);          k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+			t = sha1_rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = sha1_rol(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+	
+	for (i = 0; i < 20; i++) out[i] = (h[i / 4] >> (24 - (i % 4) * 8)) & 0xFF;
+}
+
+static void ws_base64(unsigned char *in, size_t len, char *out) {
+	static const char t[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+	
+	for (i = 0; i + 2 < len; i += 3) {
+		*out++ = t[in[i] >> 2];
+		*out++ = t[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+		*out++ = t[((in[i + 1] & 0x0F) << 2) | (in[i + 2] >> 6)];
+		*out++ = t[in[i + 2] & 0x3F];
+	}
+	if (i < len) {
+		*out++ = t[in[i] >> 2];
+		if (i + 1 < len) {
+			*out++ = t[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+			*out++ = t[(in[i + 1] & 0x0F) << 2];
+		} else {
+			*out++ = t[(in[i] & 0x03) << 4];
+			*out++ = '=';
+		}
+		*out++ = '=';
+	}
+	*out = '\0';
+}
+
+/* this is done to every byte a client sends, so do it a register at a time */
+static void ws_unmask(unsigned char *p, size_t len, unsigned char *key) {
+	unsigned char k[8];
+	uint64_t k64;
+	size_t i = 0;
+	
+	memcpy(&k[0], key, 4);
+	memcpy(&k[4], key, 4);
+	memcpy(&k64, k, 8);
+	
+#ifdef __SSE2__
+	{
+		__m128i k128 = _mm_set1_epi64x(k64);
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((__m128i*)&p[i]);
+			_mm_storeu_si128((__m128i*)&p[i], _mm_xor_si128(v, k128));
+		}
+	}
+#endif
+	for (; i + 8 <= len; i += 8) {
+		uint64_t v;
+		memcpy(&v, &p[i], 8);
+		v ^= k64;
+		memcpy(&p[i], &v, 8);
+	}
+	/* i is a multiple of 4 here, so the key lines up again */
+	for (; i < len; i++) p[i] ^= key[i & 3];
+}
+
+/* ########################################################################## */
+
+static hte ws_sendFrame(struct httpd_ws *ws, int opcode, unsigned char *data, size_t len) {
+	unsigned char h[10];
+	struct iovec iov[2];
+	struct msghdr msg;
+	size_t hl, sent = 0;
+	ssize_t l;
+	hte ret = HTE_NONE;
+	
+	h[0] = 0x80 | opcode;
+	if (len < 126) {
+		h[1] = len;
+		hl = 2;
+	} else if (len < 65536) {
+		h[1] = 126;
+		h[2] = (len >> 8) & 0xFF;
+		h[3] = (len     ) & 0xFF;
+		hl = 4;
+	} else {
+		int i;
+		h[1] = 127;
+		for (i = 0; i < 8; i++) h[9 - i] = ((uint64_t)len >> (i * 8)) & 0xFF;
+		hl = 10;
+	}
+	
+	pthread_mutex_lock(&ws->writeMutex);
+	
+	if (ws->closed || ws->closeSent) { ret = HTE_WRITE; goto done; }
+	if (opcode == WS_OP_CLOSE) ws->closeSent = 1;
+	
+	if (ws->txLen == 0) {
+		iov[0].iov_base = h;
+		iov[0].iov_len = hl;
+		iov[1].iov_base = data;
+		iov[1].iov_len = len;
+		
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = len > 0 ? 2 : 1;
+		
+		if ((l = sendmsg(ws->watch.fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) { ret = HTE_WRITE; goto done; }
+			l = 0;
+		}
+		sent = l;
+		if (sent == hl + len) goto done;
+		
+	} else if (opcode != WS_OP_CLOSE && ws->txLen + hl + len > WS_MAX_QUEUE) {
+		/* nothing has gone yet, so the stream is still intact - a close frame always gets in, it's
+		   small and the last there'll be */
+		ret = HTE_WRITE;
+		goto done;
+	}
+	
+	/* queue the rest for the loop */
+	if (ws->txLen + hl + len - sent > ws->txSize) {
+		void *p;
+		size_t size = ws->txSize ? ws->txSize : WS_RX_SIZE;
+		while (size < ws->txLen + hl + len - sent) size *= 2;
+		if ((p = mem_realloc(HTTPD_MEM_OTHER, ws->tx, size)) == NULL) { ret = HTE_NOMEM; goto done; }
+		ws->tx = p;
+		ws->txSize = size;
+	}
+	if (sent < hl) {
+		memcpy(&ws->tx[ws->txLen], &h[sent], hl - sent);
+		ws->txLen += hl - sent;
+		sent = hl;
+	}
+	memcpy(&ws->tx[ws->txLen], &data[sent - hl], len - (sent - hl));
+	ws->txLen += len - (sent - hl);
+	
+	if (ws->registered) loop_mod(ws->loop, &ws->watch, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+	
+done:
+	pthread_mutex_unlock(&ws->writeMutex);
+	return ret;
+}
+
+static hte ws_flush(struct httpd_ws *ws) {
+	ssize_t l;
+	hte ret = HTE_NONE;
+	
+	pthread_mutex_lock(&ws->writeMutex);
+	
+	while (!ws->closed && ws->txLen > 0) {
+		if ((l = send(ws->watch.fd, ws->tx, ws->txLen, MSG_NOSIGNAL | MSG_DONTWAIT)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) ret = HTE_WRITE;
+			break;
+		}
+		memmove(ws->tx, &ws->tx[l], ws->txLen - l);
+		ws->txLen -= l;
+	}
+	if (ws->txLen == 0) loop_mod(ws->loop, &ws->watch, EPOLLIN | EPOLLRDHUP);
+	
+	pthread_mutex_unlock(&ws->writeMutex);
+	return ret;
+}
+
+void ws_free(struct httpd_ws *ws) {
+	pthread_mutex_destroy(&ws->writeMutex);
+	if (ws->tx) mem_free(ws->tx);
+	if (ws->rx) mem_free(ws->rx);
+	if (ws->msg) mem_free(ws->msg);
+	mem_free(ws);
+}
+
+static void ws_release(struct httpd_ws *ws) {
+	if (__sync_sub_and_fetch(&ws->refs, 1) != 0) return;
+	ws_free(ws);
+}
+
+/* the end, for whatever reason - a sender that comes after finds it closed, rather than an fd
+   that may have been handed to another client, and the last of them frees it */
+static void ws_finish(struct httpd_ws *ws) {
+	int fd;
+	
+	if (ws->registered) loop_del(ws->loop, &ws->watch);
+	
+	pthread_mutex_lock(&ws->writeMutex);
+	fd = ws->watch.fd;
+	ws->watch.fd = -1;
+	ws->closed = 1;
+	pthread_mutex_unlock(&ws->writeMutex);
+	
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+	
+	ws->callback(ws->ctx, ws, HTTPD_WS_CLOSE, ws->closeCode, NULL, 0);
+	ws_release(ws);
+}
+
+/* the close handshake's over, but our close frame may still be stuck in tx behind whatever was
+   queued before it - stop reading and let it go first, the kernel gives up on a client that won't
+   take it after WS_LINGER and the loop hears about that as an error */
+static void ws_done(struct httpd_ws *ws) {
+	unsigned int ms = WS_LINGER;
+	hte ret = HTE_NONE;
+	
+	pthread_mutex_lock(&ws->writeMutex);
+	if (ws->txLen > 0) {
+		ws->draining = 1;
+		setsockopt(ws->watch.fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &ms, sizeof(ms));
+		if (ws->registered) ret = loop_mod(ws->loop, &ws->watch, EPOLLOUT);
+		else if ((ret = loop_add(ws->loop, &ws->watch, EPOLLOUT)) == HTE_NONE) ws->registered = 1;
+	}
+	pthread_mutex_unlock(&ws->writeMutex);
+	
+	if (!ws->draining || ret != HTE_NONE) ws_finish(ws);
+}
+
+/* a protocol error, tell the client why before we go */
+static int ws_fail(struct httpd_ws *ws, int code) {
+	unsigned char p[2];
+	p[0] = (code >> 8) & 0xFF;
+	p[1] = (code     ) & 0xFF;
+	ws_sendFrame(ws, WS_OP_CLOSE, p, sizeof(p));
+	ws->closeCode = code;
+	return -1;
+}
+
+/* handles every complete frame in rx, returns -1 when the connection is done with */
+static int ws_parse(struct httpd_ws *ws) {
+	for (;;) {
+		unsigned char *p = &ws->rx[ws->rxPos];
+		size_t avail = ws->rxLen - ws->rxPos;
+		size_t hl, len;
+		unsigned char *payload;
+		int fin, opcode;
+		
+		if (avail < 2) break;
+		fin = p[0] & 0x80;
+		opcode = p[0] & 0x0F;
+		len = p[1] & 0x7F;
+		hl = 2;
+		
+		if (p[0] & 0x70) return ws_fail(ws, 1002); /* no extensions were agreed */
+		if (!(p[1] & 0x80)) return ws_fail(ws, 1002); /* clients must mask */
+		
+		if (len == 126) {
+			if (avail < 4) break;
+			len = (p[2] << 8) | p[3];
+			hl = 4;
+		} else if (len == 127) {
+			uint64_t l = 0;
+			int i;
+			if (avail < 10) break;
+			for (i = 0; i < 8; i++) l = (l << 8) | p[2 + i];
+			if (l > WS_MAX_MESSAGE) return ws_fail(ws, 1009);
+			len = l;
+			hl = 10;
+		}
+		hl += 4;
+		
+		if ((opcode & 0x8) && (!fin || len > 125)) return ws_fail(ws, 1002);
+		if (len > WS_MAX_MESSAGE) return ws_fail(ws, 1009);
+		
+		if (avail < hl + len) {
+			/* make room for the rest of the frame */
+			if (ws->rxPos > 0) {
+				memmove(ws->rx, p, avail);
+				ws->rxLen = avail;
+				ws->rxPos = 0;
+			}
+			if (ws->rxSize < hl + len) {
+				void *n;
+				if ((n = mem_realloc(HTTPD_MEM_OTHER, ws->rx, hl + len)) == NULL) return ws_fail(ws, 1011);
+				ws->rx = n;
+				ws->rxSize = hl + len;
+			}
+			break;
+		}
+		
+		payload = &p[hl];
+		ws_unmask(payload, len, &p[hl - 4]);
+		ws->rxPos += hl + len;
+		
+		switch (opcode) {
+			case WS_OP_TEXT:
+			case WS_OP_BINARY:
+				if (ws->msgOpcode != 0) return ws_fail(ws, 1002);
+				if (fin) {
+					/* the usual case - straight out of the receive buffer */
+					ws->callback(ws->ctx, ws, HTTPD_WS_MESSAGE, opcode, payload, len);
+					break;
+				}
+				ws->msgOpcode = opcode;
+				ws->msgLen = 0;
+				/* fall through */
+			case WS_OP_CONTINUATION: {
+				void *n;
+				
+				if (ws->msgOpcode == 0) return ws_fail(ws, 1002);
+				if (ws->msgLen + len > WS_MAX_MESSAGE) return ws_fail(ws, 1009);
+				if ((n = mem_realloc(HTTPD_MEM_OTHER, ws->msg, ws->msgLen + len + 1)) == NULL) return ws_fail(ws, 1011);
+				ws->msg = n;
+				memcpy(&ws->msg[ws->msgLen], payload, len);
+				ws->msgLen += len;
+				
+				if (!fin) break;
+				ws->callback(ws->ctx, ws, HTTPD_WS_MESSAGE, ws->msgOpcode, ws->msg, ws->msgLen);
+				ws->msgOpcode = 0;
+				ws->msgLen = 0;
+				break;
+			}
+				
+			case WS_OP_CLOSE:
+				if (len == 1) return ws_fail(ws, 1002);
+				ws->closeCode = len >= 2 ? (payload[0] << 8) | payload[1] : 1005;
+				/* echo it back, unless this is the reply to ours */
+				ws_sendFrame(ws, WS_OP_CLOSE, payload, len >= 2 ? 2 : 0);
+				return -1;
+				
+			case WS_OP_PING:
+				ws_sendFrame(ws, WS_OP_PONG, payload, len);
+				break;
+				
+			case WS_OP_PONG:
+				break;
+				
+			default:
+				return ws_fail(ws, 1002);
+		}
+	}
+	
+	if (ws->rxPos > 0) {
+		memmove(ws->rx, &ws->rx[ws->rxPos], ws->rxLen - ws->rxPos);
+		ws->rxLen -= ws->rxPos;
+		ws->rxPos = 0;
+	}
+	
+	return 0;
+}
+
+static void ws_handler(struct loop_watch *watch, uint32_t events) {
+	struct httpd_ws *ws = (struct httpd_ws *)watch;
+	ssize_t l;
+	
+	if (ws->draining) {
+		/* nothing more is sent once the close is, so only the flush empties tx now */
+		if (!(events & EPOLLOUT) || ws_flush(ws) != HTE_NONE || ws->txLen == 0) ws_finish(ws);
+		return;
+	}
+	
+	if ((events & EPOLLOUT) && ws_flush(ws) != HTE_NONE) goto die;
+	if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+	
+	for (;;) {
+		if (ws->rxLen == ws->rxSize) {
+			void *n;
+			if ((n = mem_realloc(HTTPD_MEM_OTHER, ws->rx, ws->rxSize * 2)) == NULL) goto die;
+			ws->rx = n;
+			ws->rxSize *= 2;
+		}
+		
+		if ((l = recv(watch->fd, &ws->rx[ws->rxLen], ws->rxSize - ws->rxLen, MSG_DONTWAIT)) == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+			goto die;
+		}
+		if (l == 0) goto die;
+		ws->rxLen += l;
+		
+		if (ws_parse(ws) != 0) break;
+	}
+	
+	ws_done(ws);
+	return;
+die:
+	/* gone without a close frame */
+	if (ws->closeCode == 0) ws->closeCode = 1006;
+	ws_finish(ws);
+}
+
+/* ########################################################################## */
+
+EXPORT hte httpd_wsAccept(struct session_info *session, httpd_wsCallback callback, void *ctx) {
+	struct httpd_ws *ws;
+	unsigned char hash[20];
+	char buf[64], accept[32];
+	char *upgrade, *key, *version;
+	size_t l;
+	hte ret;
+	
+	if (!session || !callback) return HTE_INVALPARAM;
+	if (session->h2 || session->ws) return HTE_INVALPARAM;
+	/* the loop talks to the fd directly */
+	if (session->tls && (!session->tls->ktlsSend || !session->tls->ktlsRecv)) return HTE_TLS;
+	
+	/* is this actually a WebSocket handshake? */
+	if (strcmp(httpd_getMethod(session), "GET")) return HTE_INVALPARAM;
+	if ((upgrade = httpd_getHeader(session, "Upgrade")) == NULL || strcasecmp(upgrade, "websocket")) return HTE_INVALPARAM;
+	if ((version = httpd_getHeader(session, "Sec-WebSocket-Version")) == NULL || strcmp(version, "13")) return HTE_INVALPARAM;
+	if ((key = httpd_getHeader(session, "Sec-WebSocket-Key")) == NULL || (l = strlen(key)) != 24) return HTE_INVALPARAM;
+	
+	memcpy(buf, key, l);
+	memcpy(&buf[l], WS_GUID, sizeof(WS_GUID) - 1);
+	ws_sha1((unsigned char*)buf, l + sizeof(WS_GUID) - 1, hash);
+	ws_base64(hash, sizeof(hash), accept);
+	
+	if ((ws = mem_malloc(HTTPD_MEM_OTHER, sizeof(*ws))) == NULL) return HTE_NOMEM;
+	memset(ws, 0, sizeof(*ws));
+	ws->watch.fd = -1;
+	ws->watch.handler = ws_handler;
+	ws->callback = callback;
+	ws->ctx = ctx;
+	ws->refs = 1;
+	pthread_mutex_init(&ws->writeMutex, NULL);
+	
+	if ((ret = httpd_setHttpCode(session, 101, NULL)) != HTE_NONE) goto die;
+	if ((ret = httpd_addHeader(session, "Upgrade", "websocket")) != HTE_NONE) goto die;
+	if ((ret = httpd_addHeader(session, "Connection", "Upgrade")) != HTE_NONE) goto die;
+	if ((ret = httpd_addHeader(session, "Sec-WebSocket-Accept", "%s", accept)) != HTE_NONE) goto die;
+	
+	session->ws = ws;
+	
+	return HTE_NONE;
+die:
+	ws_free(ws);
+	return ret;
+}
+
+EXPORT struct httpd_ws *httpd_wsHold(struct httpd_ws *ws) {
+	if (!ws) return NULL;
+	__sync_fetch_and_add(&ws->refs, 1);
+	return ws;
+}
+
+EXPORT void httpd_wsRelease(struct httpd_ws *ws) {
+	if (!ws) return;
+	ws_release(ws);
+}
+
+EXPORT hte httpd_wsSend(struct httpd_ws *ws, int opcode, void *data, size_t len) {
+	hte ret;
+	
+	if (!ws) return HTE_INVALPARAM;
+	if (opcode != HTTPD_WS_TEXT && opcode != HTTPD_WS_BINARY && opcode != HTTPD_WS_PING) return HTE_INVALPARAM;
+	if (opcode == HTTPD_WS_PING && len > 125) return HTE_INVALPARAM;
+	if (!data && len > 0) return HTE_INVALPARAM;
+	
+	httpd_wsHold(ws);
+	ret = ws_sendFrame(ws, opcode, data, len);
+	ws_release(ws);
+	
+	return ret;
+}
+
+EXPORT hte httpd_wsClose(struct httpd_ws *ws, int code) {
+	unsigned char p[2];
+	hte ret;
+	
+	if (!ws) return HTE_INVALPARAM;
+	
+	p[0] = (code >> 8) & 0xFF;
+	p[1] = (code     ) & 0xFF;
+	
+	httpd_wsHold(ws);
+	ret = ws_sendFrame(ws, WS_OP_CLOSE, p, sizeof(p));
+	ws_release(ws);
+	
+	return ret;
+}
+
+hte ws_upgrade(struct session_info *session) {
+	struct httpd_ws *ws = session->ws;
+	struct http_request *req = session->xfer.request;
+	struct http_response *rsp = session->xfer.response;
+	size_t len;
+	int flags;
+	hte ret;
+	
+	session->ws = NULL;
+	
+	/* a 101 has no body */
+	if (rsp->buf) {
+		buf_free(rsp->buf);
+		rsp->buf = NULL;
+	}
+	body_drop(rsp);
+	if ((ret = http_respond(session, 0)) != HTE_NONE) goto die;
+	
+	if ((ws->loop = loop_get(session->httpd)) == NULL) { ret = HTE_THREAD; goto die; }
+	if ((flags = fcntl(session->fd, F_GETFL)) == -1 || fcntl(session->fd, F_SETFL, flags | O_NONBLOCK) == -1) { ret = HTE_SOCK; goto die; }
+	
+	/* anything that came in behind the handshake */
+	len = req->buf->next - req->parsePos;
+	ws->rxSize = len > WS_RX_SIZE ? len : WS_RX_SIZE;
+	if ((ws->rx = mem_malloc(HTTPD_MEM_OTHER, ws->rxSize)) == NULL) { ret = HTE_NOMEM; goto die; }
+	memcpy(ws->rx, &req->buf->data[req->parsePos], len);
+	ws->rxLen = len;
+	
+	/* the connection is ours now */
+	ws->watch.fd = session->fd;
+	session->fd = -1;
+	
+	ws->callback(ws->ctx, ws, HTTPD_WS_OPEN, 0, NULL, 0);
+	
+	if (ws->rxLen > 0 && ws_parse(ws) != 0) {
+		ws_done(ws);
+		return HTE_NONE;
+	}
+	
+	pthread_mutex_lock(&ws->writeMutex);
+	ws->registered = 1;
+	ret = loop_add(ws->loop, &ws->watch, EPOLLIN | EPOLLRDHUP | (ws->txLen > 0 ? EPOLLOUT : 0));
+	if (ret != HTE_NONE) ws->registered = 0;
+	pthread_mutex_unlock(&ws->writeMutex);
+	
+	if (ret != HTE_NONE) {
+		ws->closeCode = 1011;
+		ws_finish(ws);
+	}
+	
+	return HTE_NONE;
+die:
+	ws_free(ws);
+	return ret;
+}
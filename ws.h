@@ -0,0 +1,37 @@
+#ifndef WS_H
+#define WS_H
+
+/*
+	libhttpd - a C library to aid serving and responding to HTTP requests
+
+	Copyright (C) 2009 onwards  Attie Grande (attie@attie.co.uk)
+
+	This program is free software: you can redistribute it and/or modify it
+	under the terms of the GNU Lesser General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	See the
+	GNU Lesser General Public License for more details.
+
+	You should have received a copy of the GNU Lesser General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* WebSockets (RFC 6455) - httpd_wsAccept() checks the request and sets up the 101
+   response, session_dispatch() then calls ws_upgrade() in place of http_respond()
+   and the connection is handed over to the loop */
+
+struct session_info;
+struct httpd_ws;
+
+#define WS_MAX_MESSAGE (16 * 1024 * 1024) /* bigger than this is closed with 1009 */
+#define WS_MAX_QUEUE   (4 * 1024 * 1024)  /* httpd_wsSend() fails once this much is waiting for the socket */
+#define WS_LINGER      5000               /* ms a client that's closed gets to take the rest of what we queued */
+
+hte ws_upgrade(struct session_info *session);
+void ws_free(struct httpd_ws *ws); /* for one that was accepted, but never upgraded */
+
+#endif /* WS_H */